@@ -0,0 +1,80 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Microbenchmarks.  bench_bitcoin runs all of them, bench_bitcoin <name>
+// only those whose name contains <name>.  Results go to the console.
+//
+#include "../headers.h"
+
+typedef void (*BenchFunction)();
+
+struct CBenchEntry
+{
+    const char* pszName;
+    BenchFunction pfn;
+};
+
+static vector<CBenchEntry>& GetBenchmarks()
+{
+    static vector<CBenchEntry> vBenchmarks;
+    return vBenchmarks;
+}
+
+class CBenchRegister
+{
+public:
+    CBenchRegister(const char* pszName, BenchFunction pfn)
+    {
+        CBenchEntry entry = { pszName, pfn };
+        GetBenchmarks().push_back(entry);
+    }
+};
+
+#define BENCHMARK(name) \
+    static void name(); \
+    static CBenchRegister name##_register(#name, name); \
+    static void name()
+
+// Print one result line, per item cost in nanoseconds
+static void BenchReport(const string& strWhat, int64 nItems, int64 nMillis)
+{
+    printf("  %-40s %10"PRI64d" items %8"PRI64d"ms %10.1fns/item\n", strWhat.c_str(), nItems, nMillis,
+           nItems ? nMillis * 1000000.0 / nItems : 0.0);
+}
+
+// Random keys, the same ones every run
+static uint256 BenchHash(unsigned int n)
+{
+    return Hash(BEGIN(n), END(n));
+}
+
+#include "hashmap_bench.cpp"
+#include "scriptcheck_bench.cpp"
+#include "secp256k1_bench.cpp"
+#include "script_bench.cpp"
+#include "sighash_bench.cpp"
+#include "merkle_bench.cpp"
+#include "scanhash_bench.cpp"
+
+
+// Symbols from init.cpp, which isn't linked in
+void Shutdown(void* parg)
+{
+    exit(0);
+}
+
+int main(int argc, char* argv[])
+{
+    fPrintToConsole = true;
+    string strFilter = (argc > 1 ? argv[1] : "");
+    foreach(const CBenchEntry& entry, GetBenchmarks())
+    {
+        if (string(entry.pszName).find(strFilter) == string::npos)
+            continue;
+        printf("%s\n", entry.pszName);
+        entry.pfn();
+    }
+    return 0;
+}
@@ -0,0 +1,66 @@
+//
+// CHashMap against the std::map it replaced, at the sizes of the main
+// network's block index and a busy memory pool
+//
+
+template<typename M>
+static void BenchLookupInsert(const string& strName, unsigned int nSize)
+{
+    vector<uint256> vKeys, vMissing;
+    for (unsigned int i = 0; i < nSize; i++)
+    {
+        vKeys.push_back(BenchHash(i));
+        vMissing.push_back(BenchHash(nSize + i));
+    }
+
+    // Small maps are filled and emptied several times to get a measurable time
+    unsigned int nRounds = max(1U, 1000000 / nSize);
+    int64 nInsertMillis = 0;
+    int64 nEraseMillis = 0;
+    for (unsigned int nRound = 0; nRound < nRounds; nRound++)
+    {
+        M m;
+        int64 nStart = GetTimeMillis();
+        for (unsigned int i = 0; i < nSize; i++)
+            m.insert(make_pair(vKeys[i], i));
+        nInsertMillis += GetTimeMillis() - nStart;
+
+        if (nRound == nRounds - 1)
+        {
+            // Lookups in a different order than the inserts, half of them misses
+            unsigned int nLookups = 2000000;
+            unsigned int nFound = 0;
+            nStart = GetTimeMillis();
+            for (unsigned int i = 0; i < nLookups; i++)
+            {
+                unsigned int n = (i * 2654435761U) % nSize;
+                if (i & 1)
+                    nFound += (m.find(vKeys[n]) != m.end());
+                else
+                    nFound += (m.find(vMissing[n]) != m.end());
+            }
+            BenchReport(strName + " lookup", nLookups, GetTimeMillis() - nStart);
+            if (nFound != nLookups / 2)
+                printf("  lookup found %u of %u\n", nFound, nLookups / 2);
+        }
+
+        nStart = GetTimeMillis();
+        for (unsigned int i = 0; i < nSize; i++)
+            m.erase(vKeys[i]);
+        nEraseMillis += GetTimeMillis() - nStart;
+    }
+    BenchReport(strName + " insert", (int64)nSize * nRounds, nInsertMillis);
+    BenchReport(strName + " erase", (int64)nSize * nRounds, nEraseMillis);
+}
+
+BENCHMARK(hashmap_blockindex)
+{
+    BenchLookupInsert<map<uint256, unsigned int> >("std::map 250000", 250000);
+    BenchLookupInsert<CHashMap<uint256, unsigned int, CUint256Hasher> >("CHashMap 250000", 250000);
+}
+
+BENCHMARK(hashmap_mempool)
+{
+    BenchLookupInsert<map<uint256, unsigned int> >("std::map 20000", 20000);
+    BenchLookupInsert<CHashMap<uint256, unsigned int, CUint256Hasher> >("CHashMap 20000", 20000);
+}
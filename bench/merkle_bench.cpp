@@ -0,0 +1,73 @@
+//
+// Merkle trees hashed a pair at a time with Hash(), as BuildMerkleTree did
+// before SHA256D64, against SHA256D64 on each whole level
+//
+#ifdef FOURWAYSSE2
+
+static uint256 BenchMerkleScalar(vector<uint256>& vTree, unsigned int nLeaves)
+{
+    vTree.resize(nLeaves);
+    int j = 0;
+    for (int nSize = nLeaves; nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        for (int i = 0; i < nSize; i += 2)
+        {
+            int i2 = min(i+1, nSize-1);
+            vTree.push_back(Hash(BEGIN(vTree[j+i]),  END(vTree[j+i]),
+                                 BEGIN(vTree[j+i2]), END(vTree[j+i2])));
+        }
+        j += nSize;
+    }
+    return vTree.back();
+}
+
+static uint256 BenchMerkleSHA256D64(vector<uint256>& vTree, unsigned int nLeaves)
+{
+    vTree.resize(nLeaves);
+    int j = 0;
+    for (int nSize = nLeaves; nSize > 1; nSize = (nSize + 1) / 2)
+    {
+        int nPairs = nSize / 2;
+        vTree.resize(j + nSize + nPairs);
+        SHA256D64((unsigned char*)&vTree[j+nSize], (const unsigned char*)&vTree[j], nPairs);
+        if (nSize & 1)
+            vTree.push_back(Hash(BEGIN(vTree[j+nSize-1]), END(vTree[j+nSize-1]),
+                                 BEGIN(vTree[j+nSize-1]), END(vTree[j+nSize-1])));
+        j += nSize;
+    }
+    return vTree.back();
+}
+
+static void BenchMerkle(const string& strName, uint256 (*pfn)(vector<uint256>&, unsigned int), unsigned int nLeaves,
+                        const vector<uint256>& vLeaves, uint256& hashRootRet)
+{
+    vector<uint256> vTree;
+    vTree.reserve(nLeaves * 2 + 16);
+    unsigned int nTrees = max(1U, 2000000 / nLeaves);
+    int64 nStart = GetTimeMillis();
+    for (unsigned int i = 0; i < nTrees; i++)
+    {
+        vTree.assign(vLeaves.begin(), vLeaves.begin() + nLeaves);
+        hashRootRet = pfn(vTree, nLeaves);
+    }
+    BenchReport(strprintf("%s %u leaves", strName.c_str(), nLeaves), (int64)nLeaves * nTrees, GetTimeMillis() - nStart);
+}
+
+BENCHMARK(merkle_tree)
+{
+    unsigned int nLeafCounts[] = { 3, 100, 2000, 20000 };
+    vector<uint256> vLeaves;
+    for (unsigned int i = 0; i < 20000; i++)
+        vLeaves.push_back(BenchHash(i));
+
+    for (unsigned int n = 0; n < sizeof(nLeafCounts) / sizeof(nLeafCounts[0]); n++)
+    {
+        uint256 hashScalar, hashSHA256D64;
+        BenchMerkle("Hash()", BenchMerkleScalar, nLeafCounts[n], vLeaves, hashScalar);
+        BenchMerkle("SHA256D64", BenchMerkleSHA256D64, nLeafCounts[n], vLeaves, hashSHA256D64);
+        if (hashScalar != hashSHA256D64)
+            printf("  merkle roots differ\n");
+    }
+}
+
+#endif
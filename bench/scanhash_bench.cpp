@@ -0,0 +1,52 @@
+//
+// Every mining kernel this CPU can run over the same 2^21 nonces of the
+// genesis block header, in Mhash/s.  4way-ref is the original unpruned
+// SSE2 kernel the others replaced.
+//
+#ifdef FOURWAYSSE2
+
+static void BenchScanHash(const string& strName, ScanHashFunction pScanHash)
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.hashMerkleRoot = uint256("0x4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b");
+    block.nTime = 1231006505;
+    block.nBits = 0x1d00ffff;
+    block.nNonce = 0;
+
+    char pmidstatebuf[32+16]; char* pmidstate = alignup<16>(pmidstatebuf);
+    char pdatabuf[128+16];    char* pdata     = alignup<16>(pdatabuf);
+    char phash1buf[64+16];    char* phash1    = alignup<16>(phash1buf);
+    char phashbuf[32+16];     char* phash     = alignup<16>(phashbuf);
+    FormatHashBuffers(&block, pmidstate, pdata, phash1);
+
+    // The 16 bit kernels return often, carry on from the nonce they found
+    const unsigned int nRange = 1 << 21;
+    unsigned int& nNonce = *(unsigned int*)(pdata + 64 + 12);
+    nNonce = 0;
+    int64 nStart = GetTimeMillis();
+    while (nNonce < nRange)
+    {
+        unsigned int nHashesDone = 0;
+        pScanHash(pmidstate, pdata + 64, phash1, phash, nHashesDone);
+    }
+    int64 nMillis = GetTimeMillis() - nStart;
+    printf("  %-40s %10u nonces %8"PRI64d"ms %10.2fMhash/s\n", strName.c_str(), nNonce, nMillis,
+           nMillis ? nNonce / (nMillis * 1000.0) : 0.0);
+}
+
+BENCHMARK(scanhash_kernels)
+{
+    BenchScanHash("cryptopp", ScanHash_CryptoPP);
+    if (Detect128BitSSE2())
+    {
+        BenchScanHash("4way-ref", ScanHash_4WaySSE2Ref);
+        BenchScanHash("4way", ScanHash_4WaySSE2);
+    }
+    if (DetectAVX2())
+        BenchScanHash("avx2", ScanHash_8WayAVX2);
+    if (DetectSHANI())
+        BenchScanHash("shani", ScanHash_SHANI);
+}
+
+#endif
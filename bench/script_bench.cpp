@@ -0,0 +1,36 @@
+//
+// VerifyScript on a pay-to-pubkey-hash spend with its signature already in
+// the signature cache, and on a script of stack, hash and number opcodes
+//
+
+static void BenchVerifyScript(const string& strName, const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo)
+{
+    if (!VerifyScript(scriptSig, scriptPubKey, txTo, 0, 0))
+        printf("  %s failed\n", strName.c_str());
+    int nCount = 0;
+    int64 nStart = GetTimeMillis();
+    while (nCount < 100000 || GetTimeMillis() - nStart < 1000)
+    {
+        for (int i = 0; i < 1000; i++)
+            VerifyScript(scriptSig, scriptPubKey, txTo, 0, 0);
+        nCount += 1000;
+    }
+    BenchReport(strName, nCount, GetTimeMillis() - nStart);
+}
+
+BENCHMARK(script_verify)
+{
+    vector<CTransaction> vtxPrev, vtx;
+    BenchSignedTransactions(1, vtxPrev, vtx);
+    BenchVerifyScript("P2PKH, signature cached", vtx[0].vin[0].scriptSig, vtxPrev[0].vout[0].scriptPubKey, vtx[0]);
+
+    vector<unsigned char> vchData(33, 0x42);
+    CScript scriptSig;
+    scriptSig << vchData << vchData;
+    CScript scriptPubKey;
+    scriptPubKey << OP_HASH160 << OP_SWAP << OP_HASH160 << OP_EQUALVERIFY;
+    scriptPubKey << OP_2 << OP_3 << OP_ADD << OP_5 << OP_NUMEQUALVERIFY;
+    scriptPubKey << 1000 << OP_DUP << OP_1ADD << OP_LESSTHAN << OP_VERIFY;
+    scriptPubKey << OP_DEPTH << OP_0 << OP_NUMEQUAL;
+    BenchVerifyScript("HASH160/SWAP/EQUALVERIFY/ADD/DEPTH", scriptSig, scriptPubKey, vtx[0]);
+}
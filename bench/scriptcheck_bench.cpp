@@ -0,0 +1,74 @@
+//
+// Script checks of a block on the script check threads, in blocks per
+// second for each thread count up to the number of cores
+//
+
+// One pay-to-pubkey-hash output per transaction in vtxPrevRet, spent by
+// the matching transaction in vtxRet, each with its own key
+static void BenchSignedTransactions(unsigned int nCount, vector<CTransaction>& vtxPrevRet, vector<CTransaction>& vtxRet)
+{
+    vtxPrevRet.resize(nCount);
+    vtxRet.resize(nCount);
+    for (unsigned int i = 0; i < nCount; i++)
+    {
+        CKey key;
+        key.MakeNewKey();
+        CRITICAL_BLOCK(cs_mapKeys)
+        {
+            mapKeys[key.GetPubKey()] = key.GetPrivKey();
+            mapPubKeys[Hash160(key.GetPubKey())] = key.GetPubKey();
+        }
+
+        CTransaction& txPrev = vtxPrevRet[i];
+        txPrev.vin.resize(1);
+        txPrev.vin[0].prevout.n = i;
+        txPrev.vout.resize(1);
+        txPrev.vout[0].nValue = COIN;
+        txPrev.vout[0].scriptPubKey << OP_DUP << OP_HASH160 << Hash160(key.GetPubKey()) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+        CTransaction& tx = vtxRet[i];
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = txPrev.GetHash();
+        tx.vin[0].prevout.n = 0;
+        tx.vout.resize(1);
+        tx.vout[0].nValue = COIN;
+        tx.vout[0].scriptPubKey = txPrev.vout[0].scriptPubKey;
+        if (!SignSignature(txPrev, tx, 0))
+            printf("  SignSignature failed\n");
+    }
+}
+
+BENCHMARK(scriptcheck_threads)
+{
+    // Every signature of a block is new to the node when it connects it
+    unsigned int nSigCacheSave = nMaxSigCacheSize;
+    nMaxSigCacheSize = 0;
+
+    vector<CTransaction> vtxPrev, vtx;
+    BenchSignedTransactions(2000, vtxPrev, vtx);
+    vector<CScriptCheck> vChecks;
+    for (unsigned int i = 0; i < vtx.size(); i++)
+        vChecks.push_back(CScriptCheck(vtxPrev[i].vout[0], vtx[i], 0, boost::shared_ptr<CSignatureHashCache>()));
+
+    // The pool only grows, each StartScriptCheckThreads(2) adds one thread
+    int nCores = max(2, (int)boost::thread::hardware_concurrency());
+    for (int nThreads = 1; nThreads <= nCores; nThreads++)
+    {
+        if (nThreads > 1)
+            StartScriptCheckThreads(2);
+
+        int nBlocks = 0;
+        int64 nStart = GetTimeMillis();
+        int64 nMillis = 0;
+        while (nBlocks < 2 || nMillis < 2000)
+        {
+            if (!RunScriptChecks(vChecks))
+                printf("  block failed its script checks\n");
+            nBlocks++;
+            nMillis = GetTimeMillis() - nStart;
+        }
+        printf("  %2d threads %8.2f blocks/s of %d inputs\n", nThreads, nBlocks * 1000.0 / nMillis, (int)vChecks.size());
+    }
+
+    nMaxSigCacheSize = nSigCacheSave;
+}
@@ -0,0 +1,52 @@
+//
+// Signature verifications per second on one core, OpenSSL against
+// secp256k1.cpp through CKey::Verify with the pubkey decoded once
+//
+
+static void BenchVerifyReport(const string& strName, int nCount, int64 nMillis)
+{
+    BenchReport(strName, nCount, nMillis);
+    printf("  %-40s %10.0f verifications/s\n", strName.c_str(), nMillis ? nCount * 1000.0 / nMillis : 0.0);
+}
+
+BENCHMARK(secp256k1_verify)
+{
+    CKey key;
+    key.MakeNewKey();
+    vector<unsigned char> vchPubKey = key.GetPubKey();
+    uint256 hash = BenchHash(0);
+    vector<unsigned char> vchSig;
+    key.Sign(hash, vchSig);
+
+    // OpenSSL on its own decoded key
+    EC_KEY* pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    const unsigned char* pbegin = &vchPubKey[0];
+    o2i_ECPublicKey(&pkey, &pbegin, vchPubKey.size());
+    int nCount = 0;
+    int64 nStart = GetTimeMillis();
+    while (nCount < 100 || GetTimeMillis() - nStart < 2000)
+    {
+        if (ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey) != 1)
+            printf("  verify failed\n");
+        nCount++;
+    }
+    BenchVerifyReport("OpenSSL ECDSA_verify", nCount, GetTimeMillis() - nStart);
+    EC_KEY_free(pkey);
+
+    // A key with only the pubkey set, like the ones CheckSig caches
+    CKey keyPub;
+    keyPub.SetPubKey(vchPubKey);
+    nCount = 0;
+    nStart = GetTimeMillis();
+    while (nCount < 100 || GetTimeMillis() - nStart < 2000)
+    {
+        if (!keyPub.Verify(hash, vchSig))
+            printf("  verify failed\n");
+        nCount++;
+    }
+#ifdef USE_SECP256K1
+    BenchVerifyReport("CKey::Verify, secp256k1.cpp", nCount, GetTimeMillis() - nStart);
+#else
+    BenchVerifyReport("CKey::Verify, OpenSSL", nCount, GetTimeMillis() - nStart);
+#endif
+}
@@ -0,0 +1,88 @@
+//
+// Signature hashes and signature checks of every input of a transaction
+// with 1, 100 and 1000 inputs, with and without a CSignatureHashCache.
+// Without one each input hashes the whole transaction again.
+//
+
+// One transaction with nInputs pay-to-pubkey-hash outputs, and one that
+// spends all of them and is signed
+static void BenchManyInputs(unsigned int nInputs, CTransaction& txPrevRet, CTransaction& txRet)
+{
+    txPrevRet = CTransaction();
+    txPrevRet.vin.resize(1);
+    txPrevRet.vout.resize(nInputs);
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        CKey key;
+        key.MakeNewKey();
+        CRITICAL_BLOCK(cs_mapKeys)
+        {
+            mapKeys[key.GetPubKey()] = key.GetPrivKey();
+            mapPubKeys[Hash160(key.GetPubKey())] = key.GetPubKey();
+        }
+        txPrevRet.vout[i].nValue = COIN;
+        txPrevRet.vout[i].scriptPubKey << OP_DUP << OP_HASH160 << Hash160(key.GetPubKey()) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+
+    txRet = CTransaction();
+    txRet.vin.resize(nInputs);
+    for (unsigned int i = 0; i < nInputs; i++)
+    {
+        txRet.vin[i].prevout.hash = txPrevRet.GetHash();
+        txRet.vin[i].prevout.n = i;
+    }
+    txRet.vout.resize(1);
+    txRet.vout[0].nValue = nInputs * COIN;
+    txRet.vout[0].scriptPubKey = txPrevRet.vout[0].scriptPubKey;
+    for (unsigned int i = 0; i < nInputs; i++)
+        if (!SignSignature(txPrevRet, txRet, i))
+            printf("  SignSignature failed\n");
+}
+
+BENCHMARK(sighash_inputs)
+{
+    // Every signature is checked for real
+    unsigned int nSigCacheSave = nMaxSigCacheSize;
+    nMaxSigCacheSize = 0;
+
+    unsigned int nInputCounts[] = { 1, 100, 1000 };
+    for (unsigned int n = 0; n < sizeof(nInputCounts) / sizeof(nInputCounts[0]); n++)
+    {
+        unsigned int nInputs = nInputCounts[n];
+        CTransaction txPrev, tx;
+        BenchManyInputs(nInputs, txPrev, tx);
+
+        // Enough rounds that the one input transaction takes measurable time
+        unsigned int nRounds = max(1U, 10000 / (nInputs * nInputs));
+        int64 nStart = GetTimeMillis();
+        for (unsigned int nRound = 0; nRound < nRounds; nRound++)
+            for (unsigned int i = 0; i < nInputs; i++)
+                SignatureHash(txPrev.vout[i].scriptPubKey, tx, i, SIGHASH_ALL);
+        BenchReport(strprintf("sighash %u inputs", nInputs), (int64)nInputs * nRounds, GetTimeMillis() - nStart);
+
+        nRounds = max(1U, 100000 / nInputs);
+        nStart = GetTimeMillis();
+        for (unsigned int nRound = 0; nRound < nRounds; nRound++)
+        {
+            CSignatureHashCache sighashcache(tx);
+            for (unsigned int i = 0; i < nInputs; i++)
+                SignatureHash(txPrev.vout[i].scriptPubKey, tx, i, SIGHASH_ALL, &sighashcache);
+        }
+        BenchReport(strprintf("sighash %u inputs, cached", nInputs), (int64)nInputs * nRounds, GetTimeMillis() - nStart);
+
+        nStart = GetTimeMillis();
+        for (unsigned int i = 0; i < nInputs; i++)
+            if (!VerifySignature(txPrev, tx, i))
+                printf("  VerifySignature failed\n");
+        BenchReport(strprintf("verify %u inputs", nInputs), nInputs, GetTimeMillis() - nStart);
+
+        nStart = GetTimeMillis();
+        CSignatureHashCache sighashcache(tx);
+        for (unsigned int i = 0; i < nInputs; i++)
+            if (!VerifySignature(txPrev, tx, i, 0, &sighashcache))
+                printf("  VerifySignature failed\n");
+        BenchReport(strprintf("verify %u inputs, cached", nInputs), nInputs, GetTimeMillis() - nStart);
+    }
+
+    nMaxSigCacheSize = nSigCacheSave;
+}
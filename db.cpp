@@ -136,7 +136,7 @@ void CDB::Close()
         nMinutes = 1;
     if (strFile == "addr.dat")
         nMinutes = 2;
-    if (strFile == "blkindex.dat" && IsInitialBlockDownload() && nBestHeight % 500 != 0)
+    if (strFile == "blkindex.dat" && IsInitialBlockDownload() && nBestHeight % SYNC_BATCH_BLOCKS != 0)
         nMinutes = 1;
     dbenv.txn_checkpoint(0, nMinutes, 0);
 
@@ -159,6 +159,35 @@ void CloseDb(const string& strFile)
     }
 }
 
+bool DBRemove(const string& strFile)
+{
+    // Only while nothing has it open, the environment is up by then
+    // because addr.dat is loaded first
+    CRITICAL_BLOCK(cs_db)
+    {
+        if (!fDbEnvInit)
+            return error("DBRemove() : database environment not open");
+        if (mapFileUseCount.count(strFile) && mapFileUseCount[strFile] > 0)
+            return error("DBRemove() : %s is in use", strFile.c_str());
+        CloseDb(strFile);
+        mapDb.erase(strFile);
+        mapFileUseCount.erase(strFile);
+        if (!filesystem::exists(GetDataDir() + "/" + strFile))
+            return true;
+        if (dbenv.dbremove(NULL, strFile.c_str(), NULL, DB_AUTO_COMMIT) != 0)
+            return error("DBRemove() : removing %s failed", strFile.c_str());
+        printf("DBRemove() : removed %s\n", strFile.c_str());
+    }
+    return true;
+}
+
+void DBSyncLog()
+{
+    CRITICAL_BLOCK(cs_db)
+        if (fDbEnvInit)
+            dbenv.log_flush(NULL);
+}
+
 void DBFlush(bool fShutdown)
 {
     // Flush log data to the actual data file
@@ -166,6 +195,12 @@ void DBFlush(bool fShutdown)
     printf("DBFlush(%s)%s\n", fShutdown ? "true" : "false", fDbEnvInit ? "" : " db not started");
     if (!fDbEnvInit)
         return;
+    if (!fClient)
+    {
+        // Write back tx index records held over from initial download
+        CTxDB txdb("r+");
+        txdb.FlushTxIndexCache();
+    }
     CRITICAL_BLOCK(cs_db)
     {
         map<string, int>::iterator mi = mapFileUseCount.begin();
@@ -206,17 +241,362 @@ void DBFlush(bool fShutdown)
 // CTxDB
 //
 
+//
+// Write-back cache of tx index records.  Connecting a block reads and
+// rewrites the CTxIndex of every transaction it spends from, often the same
+// ones again a few blocks later.  Changes made inside a transaction are kept
+// in a CTxIndexDelta on the CTxDB handle and only reach the shared cache
+// when the outermost transaction commits.  While downloading the initial
+// block chain the shared cache holds them as dirty and writes them out
+// together with hashBestChain once it outgrows -dbcache, so the database
+// only ever sees the tx index and the best chain pointer move together.
+// A null CTxIndex stands for an erased record.  Name index writes share
+// the block's transaction but not this cache, so a block that changes names
+// writes everything through and nameindex.dat never runs ahead of
+// hashBestChain.
+//
+
+int64 nTxIndexCacheMaxBytes = 25 * 1024 * 1024;
+
+class CTxIndexDelta
+{
+public:
+    map<uint256, CTxIndex> mapTxIndex;
+    uint256 hashBestChain;
+    bool fHashBestChain;
+    // Something else in the transaction, the name index, has to reach disk
+    // together with the tx index and best chain pointer
+    bool fWriteThrough;
+
+    CTxIndexDelta()
+    {
+        fHashBestChain = false;
+        fWriteThrough = false;
+    }
+};
+
+class CTxIndexCache
+{
+public:
+    struct CEntry
+    {
+        CTxIndex txindex;
+        bool fDirty;
+        list<uint256>::iterator itRecent;
+    };
+
+    CCriticalSection cs;
+    CHashMap<uint256, CEntry, CUint256Hasher> mapEntries;
+    // Most recently read or written first, Trim drops from the back
+    list<uint256> lruEntries;
+    // Hashes of entries made dirty since the last write, may hold some that
+    // were cleaned or erased again since
+    vector<uint256> vDirty;
+    uint256 hashBestChain;
+    bool fHashBestChainDirty;
+    uint64 nBytes;
+    uint64 nDirty;
+
+    CTxIndexCache()
+    {
+        fHashBestChainDirty = false;
+        nBytes = 0;
+        nDirty = 0;
+    }
+
+    static unsigned int GetUsage(const CTxIndex& txindex)
+    {
+        return sizeof(CEntry) + 2 * sizeof(uint256) + 32 + txindex.vSpent.capacity() * sizeof(CDiskTxPos);
+    }
+
+    void Touch(CHashMap<uint256, CEntry, CUint256Hasher>::iterator mi)
+    {
+        lruEntries.splice(lruEntries.begin(), lruEntries, (*mi).second.itRecent);
+    }
+
+    void Erase(CHashMap<uint256, CEntry, CUint256Hasher>::iterator mi)
+    {
+        nBytes -= GetUsage((*mi).second.txindex);
+        lruEntries.erase((*mi).second.itRecent);
+        mapEntries.erase(mi);
+    }
+
+    void Put(const uint256& hash, const CTxIndex& txindex, bool fDirty)
+    {
+        CHashMap<uint256, CEntry, CUint256Hasher>::iterator mi = mapEntries.find(hash);
+        if (mi == mapEntries.end())
+        {
+            CEntry entry;
+            entry.fDirty = false;
+            entry.itRecent = lruEntries.insert(lruEntries.begin(), hash);
+            mi = mapEntries.insert(make_pair(hash, entry)).first;
+        }
+        else
+        {
+            nBytes -= GetUsage((*mi).second.txindex);
+            Touch(mi);
+        }
+        CEntry& entry = (*mi).second;
+        if (fDirty && !entry.fDirty)
+        {
+            nDirty++;
+            vDirty.push_back(hash);
+        }
+        else if (!fDirty && entry.fDirty)
+        {
+            nDirty--;
+        }
+        entry.txindex = txindex;
+        entry.fDirty = fDirty;
+        nBytes += GetUsage(entry.txindex);
+    }
+
+    void MarkClean()
+    {
+        foreach(const uint256& hash, vDirty)
+        {
+            CHashMap<uint256, CEntry, CUint256Hasher>::iterator mi = mapEntries.find(hash);
+            if (mi == mapEntries.end())
+                continue;
+            (*mi).second.fDirty = false;
+            if ((*mi).second.txindex.pos.IsNull())
+                Erase(mi);
+        }
+        vDirty.clear();
+        fHashBestChainDirty = false;
+        nDirty = 0;
+    }
+
+    void Trim()
+    {
+        // Least recently used clean entries go first, dirty ones wait for
+        // the next write.  Going down to half leaves room so this doesn't
+        // run on every read.
+        if (nBytes <= nTxIndexCacheMaxBytes)
+            return;
+        list<uint256>::iterator it = lruEntries.end();
+        while (it != lruEntries.begin() && nBytes > nTxIndexCacheMaxBytes / 2)
+        {
+            --it;
+            CHashMap<uint256, CEntry, CUint256Hasher>::iterator mi = mapEntries.find(*it);
+            if ((*mi).second.fDirty)
+                continue;
+            ++it;
+            Erase(mi);
+        }
+    }
+};
+
+static CTxIndexCache txindexcache;
+
+void GetTxIndexCacheStats(uint64& nEntriesRet, uint64& nDirtyRet, uint64& nBytesRet)
+{
+    CRITICAL_BLOCK(txindexcache.cs)
+    {
+        nEntriesRet = txindexcache.mapEntries.size();
+        nDirtyRet = txindexcache.nDirty;
+        nBytesRet = txindexcache.nBytes;
+    }
+}
+
+CTxDB::~CTxDB()
+{
+    // CDB::Close aborts any transaction still open
+    foreach(CTxIndexDelta* pdelta, vDelta)
+        delete pdelta;
+    vDelta.clear();
+}
+
+bool CTxDB::TxnBegin()
+{
+    // While catching up, block commits leave the log in memory.  Everything
+    // since the last synced hashBestChain can be connected again after a
+    // crash, and SetBestChain syncs the log at each batch boundary.  Other
+    // files in the environment, the wallet above all, keep their own
+    // syncing.
+    if (!CDB::TxnBegin(IsInitialBlockDownload() ? DB_TXN_NOSYNC : DB_TXN_WRITE_NOSYNC))
+        return false;
+    vDelta.push_back(new CTxIndexDelta());
+    return true;
+}
+
+bool CTxDB::TxnAbort()
+{
+    if (!vDelta.empty())
+    {
+        delete vDelta.back();
+        vDelta.pop_back();
+    }
+    return CDB::TxnAbort();
+}
+
+bool CTxDB::TxnCommit()
+{
+    if (vDelta.empty())
+        return CDB::TxnCommit();
+    CTxIndexDelta* pdelta = vDelta.back();
+    vDelta.pop_back();
+
+    if (!vDelta.empty())
+    {
+        // Nested transaction, fold into the parent
+        CTxIndexDelta* pparent = vDelta.back();
+        for (map<uint256, CTxIndex>::iterator mi = pdelta->mapTxIndex.begin(); mi != pdelta->mapTxIndex.end(); ++mi)
+            pparent->mapTxIndex[(*mi).first] = (*mi).second;
+        if (pdelta->fHashBestChain)
+        {
+            pparent->hashBestChain = pdelta->hashBestChain;
+            pparent->fHashBestChain = true;
+        }
+        pparent->fWriteThrough |= pdelta->fWriteThrough;
+        delete pdelta;
+        return CDB::TxnCommit();
+    }
+
+    bool fRet = true;
+    CRITICAL_BLOCK(txindexcache.cs)
+    {
+        // Outside initial download every block goes straight to disk
+        bool fWriteBack = !pdelta->fWriteThrough && IsInitialBlockDownload() && txindexcache.nBytes <= nTxIndexCacheMaxBytes;
+        if (!fWriteBack && !WriteTxIndexCache(pdelta))
+        {
+            CDB::TxnAbort();
+            fRet = false;
+        }
+        else if (!CDB::TxnCommit())
+        {
+            fRet = false;
+        }
+        else
+        {
+            for (map<uint256, CTxIndex>::iterator mi = pdelta->mapTxIndex.begin(); mi != pdelta->mapTxIndex.end(); ++mi)
+                txindexcache.Put((*mi).first, (*mi).second, fWriteBack);
+            if (pdelta->fHashBestChain)
+            {
+                txindexcache.hashBestChain = pdelta->hashBestChain;
+                txindexcache.fHashBestChainDirty = fWriteBack;
+            }
+            if (!fWriteBack)
+                txindexcache.MarkClean();
+            txindexcache.Trim();
+        }
+    }
+    delete pdelta;
+    return fRet;
+}
+
+bool CTxDB::WriteTxIndexCache(const CTxIndexDelta* pdelta)
+{
+    // Caller holds txindexcache.cs and an open transaction
+    foreach(const uint256& hash, txindexcache.vDirty)
+    {
+        CHashMap<uint256, CTxIndexCache::CEntry, CUint256Hasher>::iterator mi = txindexcache.mapEntries.find(hash);
+        if (mi == txindexcache.mapEntries.end())
+            continue;
+        const CTxIndexCache::CEntry& entry = (*mi).second;
+        if (!entry.fDirty || (pdelta && pdelta->mapTxIndex.count(hash)))
+            continue;
+        if (entry.txindex.pos.IsNull() ? !Erase(make_pair(string("tx"), hash))
+                                       : !Write(make_pair(string("tx"), hash), entry.txindex))
+            return error("CTxDB::WriteTxIndexCache() : write failed");
+    }
+    if (pdelta)
+    {
+        for (map<uint256, CTxIndex>::const_iterator mi = pdelta->mapTxIndex.begin(); mi != pdelta->mapTxIndex.end(); ++mi)
+            if ((*mi).second.pos.IsNull() ? !Erase(make_pair(string("tx"), (*mi).first))
+                                          : !Write(make_pair(string("tx"), (*mi).first), (*mi).second))
+                return error("CTxDB::WriteTxIndexCache() : write failed");
+    }
+    if (pdelta && pdelta->fHashBestChain)
+    {
+        if (!Write(string("hashBestChain"), pdelta->hashBestChain))
+            return error("CTxDB::WriteTxIndexCache() : write hashBestChain failed");
+    }
+    else if (txindexcache.fHashBestChainDirty)
+    {
+        if (!Write(string("hashBestChain"), txindexcache.hashBestChain))
+            return error("CTxDB::WriteTxIndexCache() : write hashBestChain failed");
+    }
+    return true;
+}
+
+bool CTxDB::FlushTxIndexCache()
+{
+    if (!pdb || fReadOnly)
+        return false;
+    CRITICAL_BLOCK(txindexcache.cs)
+    {
+        if (txindexcache.nDirty == 0 && !txindexcache.fHashBestChainDirty)
+            return true;
+        printf("FlushTxIndexCache() : writing %"PRI64u" tx index records\n", txindexcache.nDirty);
+        if (!CDB::TxnBegin())
+            return error("CTxDB::FlushTxIndexCache() : TxnBegin failed");
+        if (!WriteTxIndexCache(NULL))
+        {
+            CDB::TxnAbort();
+            return false;
+        }
+        if (!CDB::TxnCommit())
+            return error("CTxDB::FlushTxIndexCache() : TxnCommit failed");
+        txindexcache.MarkClean();
+    }
+    return true;
+}
+
+void CTxDB::SetWriteThrough()
+{
+    if (!vDelta.empty())
+        vDelta.back()->fWriteThrough = true;
+}
+
+void CTxDB::WriteCachedTxIndex(uint256 hash, const CTxIndex& txindex)
+{
+    if (!vDelta.empty())
+        vDelta.back()->mapTxIndex[hash] = txindex;
+    else
+        CRITICAL_BLOCK(txindexcache.cs)
+            txindexcache.Put(hash, txindex, true);
+}
+
 bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
 {
     assert(!fClient);
     txindex.SetNull();
-    return Read(make_pair(string("tx"), hash), txindex);
+
+    // Own uncommitted changes first, innermost transaction wins
+    for (int i = vDelta.size() - 1; i >= 0; i--)
+    {
+        map<uint256, CTxIndex>::iterator mi = vDelta[i]->mapTxIndex.find(hash);
+        if (mi != vDelta[i]->mapTxIndex.end())
+        {
+            txindex = (*mi).second;
+            return !txindex.pos.IsNull();
+        }
+    }
+
+    CRITICAL_BLOCK(txindexcache.cs)
+    {
+        CHashMap<uint256, CTxIndexCache::CEntry, CUint256Hasher>::iterator mi = txindexcache.mapEntries.find(hash);
+        if (mi != txindexcache.mapEntries.end())
+        {
+            txindexcache.Touch(mi);
+            txindex = (*mi).second.txindex;
+            return !txindex.pos.IsNull();
+        }
+
+        if (!Read(make_pair(string("tx"), hash), txindex))
+            return false;
+        txindexcache.Put(hash, txindex, false);
+        txindexcache.Trim();
+    }
+    return true;
 }
 
 bool CTxDB::UpdateTxIndex(uint256 hash, const CTxIndex& txindex)
 {
     assert(!fClient);
-    return Write(make_pair(string("tx"), hash), txindex);
+    WriteCachedTxIndex(hash, txindex);
+    return true;
 }
 
 bool CTxDB::AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight)
@@ -226,7 +606,8 @@ bool CTxDB::AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeigh
     // Add to tx index
     uint256 hash = tx.GetHash();
     CTxIndex txindex(pos, tx.vout.size());
-    return Write(make_pair(string("tx"), hash), txindex);
+    WriteCachedTxIndex(hash, txindex);
+    return true;
 }
 
 bool CTxDB::EraseTxIndex(const CTransaction& tx)
@@ -234,13 +615,15 @@ bool CTxDB::EraseTxIndex(const CTransaction& tx)
     assert(!fClient);
     uint256 hash = tx.GetHash();
 
-    return Erase(make_pair(string("tx"), hash));
+    WriteCachedTxIndex(hash, CTxIndex());
+    return true;
 }
 
 bool CTxDB::ContainsTx(uint256 hash)
 {
     assert(!fClient);
-    return Exists(make_pair(string("tx"), hash));
+    CTxIndex txindex;
+    return ReadTxIndex(hash, txindex);
 }
 
 bool CTxDB::ReadOwnerTxes(uint160 hash160, int nMinHeight, vector<CTransaction>& vtx)
@@ -335,11 +718,41 @@ bool CTxDB::EraseBlockIndex(uint256 hash)
 
 bool CTxDB::ReadHashBestChain(uint256& hashBestChain)
 {
+    if (!vDelta.empty() && vDelta.back()->fHashBestChain)
+    {
+        hashBestChain = vDelta.back()->hashBestChain;
+        return true;
+    }
+    CRITICAL_BLOCK(txindexcache.cs)
+    {
+        if (txindexcache.fHashBestChainDirty)
+        {
+            hashBestChain = txindexcache.hashBestChain;
+            return true;
+        }
+    }
     return Read(string("hashBestChain"), hashBestChain);
 }
 
 bool CTxDB::WriteHashBestChain(uint256 hashBestChain)
 {
+    // Goes to disk with the tx index changes it belongs to
+    if (!vDelta.empty())
+    {
+        vDelta.back()->hashBestChain = hashBestChain;
+        vDelta.back()->fHashBestChain = true;
+        return true;
+    }
+    CRITICAL_BLOCK(txindexcache.cs)
+    {
+        if (txindexcache.nDirty > 0)
+        {
+            txindexcache.hashBestChain = hashBestChain;
+            txindexcache.fHashBestChainDirty = true;
+            return true;
+        }
+        txindexcache.fHashBestChainDirty = false;
+    }
     return Write(string("hashBestChain"), hashBestChain);
 }
 
@@ -359,7 +772,7 @@ CBlockIndex* InsertBlockIndex(uint256 hash)
         return NULL;
 
     // Return existing
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
     if (mi != mapBlockIndex.end())
         return (*mi).second;
 
@@ -13,6 +13,7 @@ class CAddress;
 class CWalletTx;
 class CAccount;
 class CAccountingEntry;
+class CTxIndexDelta;
 
 extern map<string, string> mapAddressBook;
 extern CCriticalSection cs_mapAddressBook;
@@ -23,9 +24,13 @@ extern int nBestHeight;
 
 extern unsigned int nWalletDBUpdated;
 extern DbEnv dbenv;
+extern int64 nTxIndexCacheMaxBytes;
 
 
 extern void DBFlush(bool fShutdown);
+extern bool DBRemove(const string& strFile);
+extern void DBSyncLog();
+extern void GetTxIndexCacheStats(uint64& nEntriesRet, uint64& nDirtyRet, uint64& nBytesRet);
 extern vector<unsigned char> GetKeyFromKeyPool();
 extern int64 GetOldestKeyPoolTime();
 
@@ -209,12 +214,12 @@ public:
             return NULL;
     }
 
-    bool TxnBegin()
+    bool TxnBegin(u_int32_t nFlags=DB_TXN_NOSYNC)
     {
         if (!pdb)
             return false;
         DbTxn* ptxn = NULL;
-        int ret = dbenv.txn_begin(GetTxn(), &ptxn, DB_TXN_NOSYNC);
+        int ret = dbenv.txn_begin(GetTxn(), &ptxn, nFlags);
         if (!ptxn || ret != 0)
             return false;
         vTxn.push_back(ptxn);
@@ -264,12 +269,27 @@ public:
 
 class CTxDB : public CDB
 {
+protected:
+    // Tx index changes made inside each open transaction, not yet visible
+    // to other handles.  See CTxIndexCache in db.cpp.
+    vector<CTxIndexDelta*> vDelta;
+
+    void WriteCachedTxIndex(uint256 hash, const CTxIndex& txindex);
+    bool WriteTxIndexCache(const CTxIndexDelta* pdelta);
+
 public:
     CTxDB(const char* pszMode="r+") : CDB("blkindex.dat", pszMode) { }
+    ~CTxDB();
 private:
     CTxDB(const CTxDB&);
     void operator=(const CTxDB&);
 public:
+    bool TxnBegin();
+    bool TxnCommit();
+    bool TxnAbort();
+    bool FlushTxIndexCache();
+    // The open transaction writes out the whole cache when it commits
+    void SetWriteThrough();
     bool ReadTxIndex(uint256 hash, CTxIndex& txindex);
     bool UpdateTxIndex(uint256 hash, const CTxIndex& txindex);
     bool AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight);
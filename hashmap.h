@@ -0,0 +1,327 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+
+//
+// Open addressing hash map for keys that are already hashes.
+//
+// The slot table is a flat array of (hash, entry index) pairs probed
+// linearly, so a lookup usually touches one cache line before it compares
+// a key.  Entries live in fixed size chunks that never move, which keeps
+// the std::map guarantee that pointers to keys and values stay valid until
+// that element is erased.  CBlockIndex::phashBlock and CInPoint::ptx
+// depend on that.  Iteration order is unspecified.
+//
+
+class CUint256Hasher
+{
+public:
+    uint64 operator()(const uint256& hash) const
+    {
+        // The key is already uniformly distributed, only the salt keeps
+        // someone grinding hashes from piling them into one probe run
+        static const uint64 nSalt0 = GetRand(UINT64_MAX);
+        static const uint64 nSalt1 = GetRand(UINT64_MAX);
+        uint64 a = hash.Get64(0) ^ nSalt0;
+        uint64 b = hash.Get64(1) ^ nSalt1;
+        return (a ^ (b >> 29 | b << 35)) * 0x9e3779b97f4a7c15ULL;
+    }
+};
+
+
+template<typename K, typename T, typename H>
+class CHashMap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+protected:
+    enum
+    {
+        CHUNK_BITS = 8,
+        CHUNK_SIZE = (1 << CHUNK_BITS),
+        MIN_BITS = 4
+    };
+
+    struct CSlot
+    {
+        // Top 32 bits of the key's hash, the home slot is derived from it
+        unsigned int nHash;
+        // Entry index + 1, zero if the slot is empty
+        unsigned int nEntry;
+    };
+
+    H hasher;
+    std::vector<CSlot> vSlot;
+    unsigned int nBits;
+    size_type nSize;
+    std::vector<char*> vChunk;
+    std::vector<unsigned char> vfUsed;
+    std::vector<unsigned int> vFree;
+
+    value_type* Entry(unsigned int i) const
+    {
+        return (value_type*)vChunk[i >> CHUNK_BITS] + (i & (CHUNK_SIZE - 1));
+    }
+
+    unsigned int Home(unsigned int nHash) const
+    {
+        return nHash >> (32 - nBits);
+    }
+
+    unsigned int FindSlot(const K& key, unsigned int nHash) const
+    {
+        if (vSlot.empty())
+            return -1;
+        unsigned int nMask = vSlot.size() - 1;
+        for (unsigned int i = Home(nHash); vSlot[i].nEntry; i = (i + 1) & nMask)
+            if (vSlot[i].nHash == nHash && Entry(vSlot[i].nEntry - 1)->first == key)
+                return i;
+        return -1;
+    }
+
+    void PlaceSlot(const CSlot& slot)
+    {
+        unsigned int nMask = vSlot.size() - 1;
+        unsigned int i = Home(slot.nHash);
+        while (vSlot[i].nEntry)
+            i = (i + 1) & nMask;
+        vSlot[i] = slot;
+    }
+
+    void Rehash(unsigned int nNewBits)
+    {
+        std::vector<CSlot> vOld;
+        vOld.swap(vSlot);
+        CSlot slotEmpty = { 0, 0 };
+        vSlot.assign((size_t)1 << nNewBits, slotEmpty);
+        nBits = nNewBits;
+        for (unsigned int i = 0; i < vOld.size(); i++)
+            if (vOld[i].nEntry)
+                PlaceSlot(vOld[i]);
+    }
+
+    unsigned int NewEntry(const K& key, const T& value)
+    {
+        unsigned int i;
+        if (!vFree.empty())
+        {
+            i = vFree.back();
+            vFree.pop_back();
+        }
+        else
+        {
+            i = vfUsed.size();
+            if ((i >> CHUNK_BITS) >= vChunk.size())
+                vChunk.push_back((char*)::operator new(CHUNK_SIZE * sizeof(value_type)));
+            vfUsed.push_back(false);
+        }
+        new (Entry(i)) value_type(key, value);
+        vfUsed[i] = true;
+        return i;
+    }
+
+    void EraseSlot(unsigned int i)
+    {
+        unsigned int nEntry = vSlot[i].nEntry - 1;
+        Entry(nEntry)->~value_type();
+        vfUsed[nEntry] = false;
+        vFree.push_back(nEntry);
+        nSize--;
+
+        // Backward shift deletion, no tombstones
+        unsigned int nMask = vSlot.size() - 1;
+        unsigned int j = i;
+        loop
+        {
+            j = (j + 1) & nMask;
+            if (!vSlot[j].nEntry)
+                break;
+            unsigned int k = Home(vSlot[j].nHash);
+            if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+            {
+                vSlot[i] = vSlot[j];
+                i = j;
+            }
+        }
+        vSlot[i].nEntry = 0;
+    }
+
+    unsigned int HashKey(const K& key) const
+    {
+        return (unsigned int)(hasher(key) >> 32);
+    }
+
+private:
+    // Not copyable, elements are referenced by address
+    CHashMap(const CHashMap&);
+    CHashMap& operator=(const CHashMap&);
+
+public:
+    template<typename M, typename V>
+    class iterator_base
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename CHashMap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef V* pointer;
+        typedef V& reference;
+
+        M* pmap;
+        unsigned int nEntry;
+
+        iterator_base() : pmap(NULL), nEntry(0) { }
+        iterator_base(M* pmapIn, unsigned int nEntryIn) : pmap(pmapIn), nEntry(nEntryIn) { }
+        template<typename M2, typename V2>
+        iterator_base(const iterator_base<M2, V2>& it) : pmap(it.pmap), nEntry(it.nEntry) { }
+
+        reference operator*() const { return *pmap->Entry(nEntry); }
+        pointer operator->() const { return pmap->Entry(nEntry); }
+
+        iterator_base& operator++()
+        {
+            nEntry++;
+            while (nEntry < pmap->vfUsed.size() && !pmap->vfUsed[nEntry])
+                nEntry++;
+            return *this;
+        }
+
+        iterator_base operator++(int)
+        {
+            iterator_base ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        template<typename M2, typename V2>
+        bool operator==(const iterator_base<M2, V2>& it) const { return nEntry == it.nEntry; }
+        template<typename M2, typename V2>
+        bool operator!=(const iterator_base<M2, V2>& it) const { return nEntry != it.nEntry; }
+    };
+    typedef iterator_base<CHashMap, value_type> iterator;
+    typedef iterator_base<const CHashMap, const value_type> const_iterator;
+    template<typename M, typename V> friend class iterator_base;
+
+
+    CHashMap()
+    {
+        nBits = 0;
+        nSize = 0;
+    }
+
+    ~CHashMap()
+    {
+        clear();
+    }
+
+    size_type size() const  { return nSize; }
+    bool empty() const      { return nSize == 0; }
+
+    void clear()
+    {
+        for (unsigned int i = 0; i < vfUsed.size(); i++)
+            if (vfUsed[i])
+                Entry(i)->~value_type();
+        for (unsigned int i = 0; i < vChunk.size(); i++)
+            ::operator delete(vChunk[i]);
+        vChunk.clear();
+        vfUsed.clear();
+        vFree.clear();
+        vSlot.clear();
+        nBits = 0;
+        nSize = 0;
+    }
+
+    void reserve(size_type n)
+    {
+        unsigned int nNewBits = std::max(nBits, (unsigned int)MIN_BITS);
+        while (((size_t)3 << nNewBits) < n * 4)
+            nNewBits++;
+        if (nNewBits != nBits)
+            Rehash(nNewBits);
+    }
+
+    iterator begin()
+    {
+        iterator it(this, 0);
+        if (!vfUsed.empty() && !vfUsed[0])
+            ++it;
+        return it;
+    }
+
+    const_iterator begin() const
+    {
+        const_iterator it(this, 0);
+        if (!vfUsed.empty() && !vfUsed[0])
+            ++it;
+        return it;
+    }
+
+    iterator end()              { return iterator(this, vfUsed.size()); }
+    const_iterator end() const  { return const_iterator(this, vfUsed.size()); }
+
+    iterator find(const K& key)
+    {
+        unsigned int i = FindSlot(key, HashKey(key));
+        return (i == (unsigned int)-1 ? end() : iterator(this, vSlot[i].nEntry - 1));
+    }
+
+    const_iterator find(const K& key) const
+    {
+        unsigned int i = FindSlot(key, HashKey(key));
+        return (i == (unsigned int)-1 ? end() : const_iterator(this, vSlot[i].nEntry - 1));
+    }
+
+    size_type count(const K& key) const
+    {
+        return (FindSlot(key, HashKey(key)) == (unsigned int)-1 ? 0 : 1);
+    }
+
+    template<typename K2, typename T2>
+    std::pair<iterator, bool> insert(const std::pair<K2, T2>& item)
+    {
+        unsigned int nHash = HashKey(item.first);
+        unsigned int i = FindSlot(item.first, nHash);
+        if (i != (unsigned int)-1)
+            return std::make_pair(iterator(this, vSlot[i].nEntry - 1), false);
+
+        // Keep the load factor at or under 3/4
+        if ((nSize + 1) * 4 > vSlot.size() * 3)
+            Rehash(std::max(nBits + 1, (unsigned int)MIN_BITS));
+
+        CSlot slot;
+        slot.nHash = nHash;
+        slot.nEntry = NewEntry(item.first, item.second) + 1;
+        PlaceSlot(slot);
+        nSize++;
+        return std::make_pair(iterator(this, slot.nEntry - 1), true);
+    }
+
+    T& operator[](const K& key)
+    {
+        iterator it = find(key);
+        if (it == end())
+            it = insert(std::make_pair(key, T())).first;
+        return it->second;
+    }
+
+    size_type erase(const K& key)
+    {
+        unsigned int i = FindSlot(key, HashKey(key));
+        if (i == (unsigned int)-1)
+            return 0;
+        EraseSlot(i);
+        return 1;
+    }
+
+    void erase(iterator it)
+    {
+        // Other iterators, including it++ taken before this call, stay valid
+        erase(it->first);
+    }
+};
@@ -67,6 +67,7 @@
 #include <boost/array.hpp>
 #include <boost/bind.hpp>
 #include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/algorithm/string.hpp>
@@ -94,6 +95,7 @@
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -116,6 +118,7 @@ using namespace boost;
 #include "serialize.h"
 #include "uint256.h"
 #include "util.h"
+#include "hashmap.h"
 #include "key.h"
 #include "bignum.h"
 #include "base58.h"
@@ -18,6 +18,7 @@ public:
             CDiskTxPos& txPos,
             bool fBlock,
             bool fMiner);
+    virtual bool IsHeightDependent(const CTransaction& tx);
     virtual bool DisconnectInputs(CTxDB& txdb,
             const CTransaction& tx,
             CBlockIndex* pindexBlock);
@@ -31,6 +32,14 @@ public:
     virtual bool Lockin(int nHeight, uint256 hash);
     virtual int LockinHeight();
     virtual string IrcPrefix();
+    virtual int AuxPowStartHeight()
+    {
+        return INT_MAX;
+    }
+    virtual int AuxPowChainID()
+    {
+        return 0;
+    }
     virtual void MessageStart(char* pchMessageStart)
     {
     }
@@ -82,6 +91,11 @@ bool CStandardHooks::ConnectInputs(CTxDB& txdb,
     return true;
 }
 
+bool CStandardHooks::IsHeightDependent(const CTransaction& tx)
+{
+    return false;
+}
+
 bool CStandardHooks::DisconnectInputs(CTxDB& txdb,
         const CTransaction& tx,
         CBlockIndex* pindexBlock)
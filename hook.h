@@ -16,6 +16,8 @@ public:
             CDiskTxPos& txPos,
             bool fBlock,
             bool fMiner) = 0;
+    // True if ConnectInputs can give a different answer at another height
+    virtual bool IsHeightDependent(const CTransaction& tx) = 0;
     virtual bool DisconnectInputs(CTxDB& txdb,
             const CTransaction& tx,
             CBlockIndex* pindexBlock) = 0;
@@ -26,6 +28,9 @@ public:
     virtual bool Lockin(int nHeight, uint256 hash) = 0;
     virtual int LockinHeight() = 0;
     virtual string IrcPrefix() = 0;
+    // Merged mining is allowed from this height on, for blocks with this chain ID
+    virtual int AuxPowStartHeight() = 0;
+    virtual int AuxPowChainID() = 0;
     virtual void MessageStart(char* pchMessageStart) = 0;
 
 };
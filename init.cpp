@@ -167,9 +167,19 @@ bool AppInit2(int argc, char* argv[])
             "  -rpcpassword=<pw>\t  "   + _("Password for JSON-RPC connections\n") +
             "  -rpcport=<port>  \t\t  " + _("Listen for JSON-RPC connections on <port> (default: 8332)\n") +
             "  -rpcallowip=<ip> \t\t  " + _("Allow JSON-RPC connections from specified IP address\n") +
+            "  -workserver      \t\t  " + _("Push mining work to subscribed miners over a persistent connection\n") +
+            "  -workport=<port> \t\t  " + _("Listen for work server connections on <port> (default: 8337)\n") +
             "  -rpcconnect=<ip> \t  "   + _("Send commands to node running on <ip> (default: 127.0.0.1)\n") +
             "  -keypool=<n>     \t  "   + _("Set key pool size to <n> (default: 100)\n") +
-            "  -rescan          \t  "   + _("Rescan the block chain for missing wallet transactions\n");
+            "  -blockcachesize=<n>\t  " + _("Keep up to <n> MB of recently used blocks in memory (default: 32)\n") +
+            "  -prevoutcachesize=<n>\t  " + _("Keep up to <n> MB of recently created outputs in memory (default: 16)\n") +
+            "  -dbcache=<n>     \t  "   + _("Cache up to <n> MB of transaction index records (default: 25)\n") +
+            "  -par=<n>         \t  "   + _("Use <n> threads for script verification (default: one per core)\n") +
+            "  -maxsigcachesize=<n>\t  " + _("Remember up to <n> verified signatures (default: 50000)\n") +
+            "  -maxpubkeycachesize=<n>\t  " + _("Keep up to <n> decoded public keys (default: 10000)\n") +
+            "  -maxmempool=<n>  \t  "   + _("Keep the transaction memory pool below <n> MB (default: 100, at least 1)\n") +
+            "  -rescan          \t  "   + _("Rescan the block chain for missing wallet transactions\n") +
+            "  -reindex         \t  "   + _("Rebuild the block index from the blk*.dat files\n");
 
 #ifdef USE_SSL
         strUsage += string() +
@@ -343,6 +353,22 @@ bool AppInit2(int argc, char* argv[])
         strErrors += _("Error loading addr.dat      \n");
     printf(" addresses   %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
+    blockcache.SetMaxBytes(GetArg("-blockcachesize", 32) * 1024 * 1024);
+    prevoutcache.SetMaxBytes(GetArg("-prevoutcachesize", 16) * 1024 * 1024);
+    nTxIndexCacheMaxBytes = GetArg("-dbcache", 25) * 1024 * 1024;
+    nMaxSigCacheSize = GetArg("-maxsigcachesize", 50000);
+    nMaxPubKeyCacheSize = GetArg("-maxpubkeycachesize", 10000);
+    // A pool with no room would turn every transaction away
+    nMemPoolMaxBytes = max(GetArg("-maxmempool", 100), (int64)1) * 1024 * 1024;
+    StartScriptCheckThreads(GetArg("-par", 0));
+
+    if (GetBoolArg("-reindex"))
+    {
+        // LoadBlockIndex builds them again from the blk*.dat files
+        if (!DBRemove("blkindex.dat") || !DBRemove("nameindex.dat"))
+            strErrors += _("Error removing the block index for -reindex      \n");
+    }
+
     printf("Loading block index...\n");
     nStart = GetTimeMillis();
     if (!LoadBlockIndex())
@@ -356,6 +382,9 @@ bool AppInit2(int argc, char* argv[])
         strErrors += _("Error loading wallet.dat      \n");
     printf(" wallet      %15"PRI64d"ms\n", GetTimeMillis() - nStart);
 
+    if (!ReconnectBlocks())
+        strErrors += _("Error reconnecting blocks after an unclean shutdown, restart with -reindex      \n");
+
     if (GetBoolArg("-rescan"))
     {
         nStart = GetTimeMillis();
@@ -395,7 +424,7 @@ bool AppInit2(int argc, char* argv[])
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (CBlockIndexMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -471,6 +500,9 @@ bool AppInit2(int argc, char* argv[])
     if (fServer)
         CreateThread(ThreadRPCServer, NULL);
 
+    if (fServer && GetBoolArg("-workserver"))
+        CreateThread(ThreadWorkServer, NULL);
+
 #if defined(__WXMSW__) && defined(GUI)
     if (fFirstRun)
         SetStartOnSystemStartup(true);
@@ -38,6 +38,18 @@ public:
 // secure_allocator is defined in serialize.h
 typedef vector<unsigned char, secure_allocator<unsigned char> > CPrivKey;
 
+#ifdef USE_SECP256K1
+// secp256k1.cpp, a public key already decoded and checked to be on the curve
+struct CSecp256k1PubKey
+{
+    unsigned int x[8];
+    unsigned int y[8];
+};
+bool Secp256k1ParsePubKey(CSecp256k1PubKey& pubkey, const vector<unsigned char>& vchPubKey);
+int Secp256k1Verify(const CSecp256k1PubKey& pubkey, const uint256& hash, const vector<unsigned char>& vchSig);
+int Secp256k1Verify(const vector<unsigned char>& vchPubKey, const uint256& hash, const vector<unsigned char>& vchSig);
+#endif
+
 
 
 class CKey
@@ -45,6 +57,17 @@ class CKey
 protected:
     EC_KEY* pkey;
     bool fSet;
+#ifdef USE_SECP256K1
+    // Decoded once when the key is set, so Verify doesn't re-encode and
+    // re-parse the pubkey every time
+    CSecp256k1PubKey pubkeyNative;
+    bool fPubKeyNative;
+
+    void SetPubKeyNative(const vector<unsigned char>& vchPubKey)
+    {
+        fPubKeyNative = Secp256k1ParsePubKey(pubkeyNative, vchPubKey);
+    }
+#endif
 
 public:
     CKey()
@@ -53,6 +76,9 @@ public:
         if (pkey == NULL)
             throw key_error("CKey::CKey() : EC_KEY_new_by_curve_name failed");
         fSet = false;
+#ifdef USE_SECP256K1
+        fPubKeyNative = false;
+#endif
     }
 
     CKey(const CKey& b)
@@ -61,6 +87,10 @@ public:
         if (pkey == NULL)
             throw key_error("CKey::CKey(const CKey&) : EC_KEY_dup failed");
         fSet = b.fSet;
+#ifdef USE_SECP256K1
+        pubkeyNative = b.pubkeyNative;
+        fPubKeyNative = b.fPubKeyNative;
+#endif
     }
 
     CKey& operator=(const CKey& b)
@@ -68,6 +98,10 @@ public:
         if (!EC_KEY_copy(pkey, b.pkey))
             throw key_error("CKey::operator=(const CKey&) : EC_KEY_copy failed");
         fSet = b.fSet;
+#ifdef USE_SECP256K1
+        pubkeyNative = b.pubkeyNative;
+        fPubKeyNative = b.fPubKeyNative;
+#endif
         return (*this);
     }
 
@@ -86,6 +120,9 @@ public:
         if (!EC_KEY_generate_key(pkey))
             throw key_error("CKey::MakeNewKey() : EC_KEY_generate_key failed");
         fSet = true;
+#ifdef USE_SECP256K1
+        SetPubKeyNative(GetPubKey());
+#endif
     }
 
     bool SetPrivKey(const CPrivKey& vchPrivKey)
@@ -94,6 +131,9 @@ public:
         if (!d2i_ECPrivateKey(&pkey, &pbegin, vchPrivKey.size()))
             return false;
         fSet = true;
+#ifdef USE_SECP256K1
+        SetPubKeyNative(GetPubKey());
+#endif
         return true;
     }
 
@@ -115,6 +155,9 @@ public:
         if (!o2i_ECPublicKey(&pkey, &pbegin, vchPubKey.size()))
             return false;
         fSet = true;
+#ifdef USE_SECP256K1
+        SetPubKeyNative(vchPubKey);
+#endif
         return true;
     }
 
@@ -144,6 +187,15 @@ public:
 
     bool Verify(uint256 hash, const vector<unsigned char>& vchSig)
     {
+#ifdef USE_SECP256K1
+        // Falls through to OpenSSL for encodings it doesn't handle
+        if (fPubKeyNative)
+        {
+            int nRet = Secp256k1Verify(pubkeyNative, hash, vchSig);
+            if (nRet >= 0)
+                return (nRet == 1);
+        }
+#endif
         // -1 = error, 0 = bad sig, 1 = good
         if (ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey) != 1)
             return false;
@@ -15,12 +15,77 @@
 
 CCriticalSection cs_main;
 
-map<uint256, CTransaction> mapTransactions;
+CTransactionMap mapTransactions;
 CCriticalSection cs_mapTransactions;
 unsigned int nTransactionsUpdated = 0;
-map<COutPoint, CInPoint> mapNextTx;
+CHashMap<COutPoint, CInPoint, COutPointHasher> mapNextTx;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+//
+// What CreateNewBlock needs to know about a memory pool transaction, worked
+// out once when it's accepted and updated as its parents come and go, so
+// building a block doesn't read anything from disk.
+//
+class CMemPoolInfo
+{
+public:
+    unsigned int nSize;
+    int nSigOps;
+    int64 nFee;
+
+    // Every input found and unspent, otherwise it can't go in a block
+    bool fInputsKnown;
+
+    // Inputs and signatures passed ConnectInputs.  Wallet transactions and
+    // ones a reorganize puts back come in without it, CreateNewBlock
+    // checks those before taking them.
+    bool fInputsVerified;
+
+    // Inputs already in the chain: sum of values and of value * block height
+    int64 nValueInChain;
+    double dValueHeight;
+
+    // Highest block holding a coinbase this spends, -1 if none
+    int nCoinbaseHeight;
+
+    // Parents that are still in the memory pool
+    set<uint256> setDependsOn;
+
+    CMemPoolInfo()
+    {
+        nSize = 0;
+        nSigOps = 0;
+        nFee = 0;
+        fInputsKnown = false;
+        fInputsVerified = false;
+        nValueInChain = 0;
+        dValueHeight = 0;
+        nCoinbaseHeight = -1;
+    }
+
+    // Priority is sum(valuein * age) / txsize, age as of a block at nHeight
+    double GetPriority(int nHeight) const
+    {
+        return ((double)nValueInChain * nHeight - dValueHeight) / nSize;
+    }
+};
+
+typedef CHashMap<uint256, CMemPoolInfo, CUint256Hasher> CMemPoolInfoMap;
+CMemPoolInfoMap mapMemPoolInfo;
+
+// Estimated memory held by the memory pool, and what eviction has dropped
+uint64 nMemPoolMaxBytes = 100 * 1024 * 1024;
+uint64 nMemPoolBytes = 0;
+uint64 nMemPoolEvicted = 0;
+uint64 nMemPoolEvictedBytes = 0;
+void LimitMemoryPool();
+
+// Pool transactions that are also in the wallet, eviction leaves them be
+set<uint256> setMemPoolWallet;
+
+CBlockIndexMap mapBlockIndex;
+CBlockCache blockcache;
+CPrevOutCache prevoutcache;
+CBlockFiles blockfiles;
 uint256 hashGenesisBlock("0x000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f");
 CBigNum bnProofOfWorkLimit(~uint256(0) >> 32);
 CBlockIndex* pindexGenesisBlock = NULL;
@@ -31,7 +96,7 @@ uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 int64 nTimeBestReceived = 0;
 
-map<uint256, CBlock*> mapOrphanBlocks;
+CHashMap<uint256, CBlock*, CUint256Hasher> mapOrphanBlocks;
 multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
 
 map<uint256, CDataStream*> mapOrphanTransactions;
@@ -291,6 +356,30 @@ void EraseOrphanTx(uint256 hash)
 // CTransaction and CTxIndex
 //
 
+bool CTransaction::ReadFromDisk(CDiskTxPos pos, FILE** pfileRet)
+{
+    if (!pfileRet && !pos.IsNull() && blockfiles.Read(pos.nFile, pos.nTxPos, *this))
+        return true;
+
+    CAutoFile filein = OpenBlockFile(pos.nFile, 0, pfileRet ? "rb+" : "rb");
+    if (!filein)
+        return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
+
+    // Read transaction
+    if (fseek(filein, pos.nTxPos, SEEK_SET) != 0)
+        return error("CTransaction::ReadFromDisk() : fseek failed");
+    filein >> *this;
+
+    // Return file pointer
+    if (pfileRet)
+    {
+        if (fseek(filein, pos.nTxPos, SEEK_SET) != 0)
+            return error("CTransaction::ReadFromDisk() : second fseek failed");
+        *pfileRet = filein.release();
+    }
+    return true;
+}
+
 bool CTransaction::ReadFromDisk(CTxDB& txdb, COutPoint prevout, CTxIndex& txindexRet)
 {
     SetNull();
@@ -358,7 +447,7 @@ int64 CWalletTx::GetTxTime() const
         // If we did not receive the transaction directly, we rely on the block's
         // time to figure out when it happened.  We use the median over a range
         // of blocks to try to filter out inaccurate block times.
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
         {
             CBlockIndex* pindex = (*mi).second;
@@ -546,7 +635,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -771,6 +860,10 @@ bool CTransaction::AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs, bool* pfMi
         }
     }
 
+    bool fWallet = false;
+    CRITICAL_BLOCK(cs_mapWallet)
+        fWallet = (mapWallet.count(hash) != 0);
+
     // Store transaction in memory
     CRITICAL_BLOCK(cs_mapTransactions)
     {
@@ -779,7 +872,14 @@ bool CTransaction::AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs, bool* pfMi
             printf("AcceptToMemoryPool() : replacing tx %s with new version\n", ptxOld->GetHash().ToString().c_str());
             ptxOld->RemoveFromMemoryPool();
         }
-        AddToMemoryPoolUnchecked();
+        AddToMemoryPoolUnchecked(txdb, fCheckInputs);
+        if (fWallet)
+            setMemPoolWallet.insert(hash);
+
+        // It may be the cheapest thing left once the pool is over its limit
+        LimitMemoryPool();
+        if (!mapTransactions.count(hash))
+            return error("AcceptToMemoryPool() : memory pool full, fee too low");
     }
 
     ///// are we sure this is ok when loading transactions or restoring block txes
@@ -792,16 +892,119 @@ bool CTransaction::AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs, bool* pfMi
 }
 
 
-bool CTransaction::AddToMemoryPoolUnchecked()
+// Caller holds cs_mapTransactions
+void GetMemPoolInfo(CTxDB& txdb, const CTransaction& tx, CMemPoolInfo& info)
+{
+    bool fInputsVerified = info.fInputsVerified;
+    info = CMemPoolInfo();
+    info.fInputsVerified = fInputsVerified;
+    info.nSize = ::GetSerializeSize(tx, SER_NETWORK);
+    info.nSigOps = tx.GetSigOpCount();
+    info.fInputsKnown = true;
+
+    int64 nValueIn = 0;
+    foreach(const CTxIn& txin, tx.vin)
+    {
+        const COutPoint& prevout = txin.prevout;
+
+        // Parent in the memory pool
+        CTransactionMap::iterator mi = mapTransactions.find(prevout.hash);
+        if (mi != mapTransactions.end())
+        {
+            const CTransaction& txPrev = (*mi).second;
+            if (prevout.n >= txPrev.vout.size())
+            {
+                info.fInputsKnown = false;
+                continue;
+            }
+            nValueIn += txPrev.vout[prevout.n].nValue;
+            info.setDependsOn.insert(prevout.hash);
+            continue;
+        }
+
+        // Parent in the chain
+        CTxIndex txindex;
+        CTxOut txoutPrev;
+        int nHeight;
+        bool fCoinBase;
+        if (!txdb.ReadTxIndex(prevout.hash, txindex))
+        {
+            info.fInputsKnown = false;
+            continue;
+        }
+
+        // Wallet transactions and ones a reorganize puts back are accepted
+        // without checking inputs, a block may have spent them already
+        if (prevout.n >= txindex.vSpent.size() || !txindex.vSpent[prevout.n].IsNull())
+        {
+            info.fInputsKnown = false;
+            continue;
+        }
+        if (!prevoutcache.Get(prevout, txindex.pos, txoutPrev, nHeight, fCoinBase))
+        {
+            CTransaction txPrev;
+            if (!txPrev.ReadFromDisk(txindex.pos) || prevout.n >= txPrev.vout.size())
+            {
+                info.fInputsKnown = false;
+                continue;
+            }
+            txoutPrev = txPrev.vout[prevout.n];
+            nHeight = nBestHeight + 1 - txindex.GetDepthInMainChain();
+            fCoinBase = txPrev.IsCoinBase();
+        }
+        int64 nValue = txoutPrev.nValue;
+        nValueIn += nValue;
+        info.nValueInChain += nValue;
+        info.dValueHeight += (double)nValue * nHeight;
+        if (fCoinBase)
+            info.nCoinbaseHeight = max(info.nCoinbaseHeight, nHeight);
+    }
+    info.nFee = nValueIn - tx.GetValueOut();
+}
+
+
+// Heap used by a memory pool transaction, including its mapTransactions and
+// mapMemPoolInfo entries and, per input, a mapNextTx entry and possibly a
+// setDependsOn node.  Hash map slots are 8 bytes at up to 3/4 load.
+unsigned int GetMemPoolUsage(const CTransaction& tx)
+{
+    unsigned int nUsage = tx.GetMemoryUsage();
+    nUsage += sizeof(CTransactionMap::value_type) + 16;
+    nUsage += sizeof(CMemPoolInfoMap::value_type) + 16;
+    nUsage += tx.vin.size() * (sizeof(CHashMap<COutPoint, CInPoint, COutPointHasher>::value_type) + 16);
+    nUsage += tx.vin.size() * (sizeof(uint256) + 32);
+    return nUsage;
+}
+
+
+bool CTransaction::AddToMemoryPoolUnchecked(CTxDB& txdb, bool fInputsVerified)
 {
     // Add to memory pool without checking anything.  Don't call this directly,
     // call AcceptToMemoryPool to properly check the transaction first.
     CRITICAL_BLOCK(cs_mapTransactions)
     {
         uint256 hash = GetHash();
+        if (mapTransactions.count(hash))
+            nMemPoolBytes -= GetMemPoolUsage(mapTransactions[hash]);
         mapTransactions[hash] = *this;
+        nMemPoolBytes += GetMemPoolUsage(mapTransactions[hash]);
         for (int i = 0; i < vin.size(); i++)
             mapNextTx[vin[i].prevout] = CInPoint(&mapTransactions[hash], i);
+        CMemPoolInfo& info = mapMemPoolInfo[hash];
+        info.fInputsVerified = fInputsVerified;
+        GetMemPoolInfo(txdb, *this, info);
+
+        // Children can get here first when inputs aren't checked, for
+        // instance when a reorganize puts this one back
+        for (unsigned int n = 0; n < vout.size(); n++)
+        {
+            CHashMap<COutPoint, CInPoint, COutPointHasher>::iterator it = mapNextTx.find(COutPoint(hash, n));
+            if (it != mapNextTx.end())
+            {
+                const CTransaction& txChild = *(*it).second.ptx;
+                GetMemPoolInfo(txdb, txChild, mapMemPoolInfo[txChild.GetHash()]);
+            }
+        }
         nTransactionsUpdated++;
     }
     return true;
@@ -813,15 +1016,220 @@ bool CTransaction::RemoveFromMemoryPool()
     // Remove transaction from memory pool
     CRITICAL_BLOCK(cs_mapTransactions)
     {
+        uint256 hash = GetHash();
+        if (!mapTransactions.count(hash))
+            return true;
         foreach(const CTxIn& txin, vin)
             mapNextTx.erase(txin.prevout);
-        mapTransactions.erase(GetHash());
+
+        // Usually this is leaving for a block, so the outputs its children
+        // spend are now in the chain at the next height
+        for (unsigned int n = 0; n < vout.size(); n++)
+        {
+            CHashMap<COutPoint, CInPoint, COutPointHasher>::iterator it = mapNextTx.find(COutPoint(hash, n));
+            if (it == mapNextTx.end())
+                continue;
+            CMemPoolInfoMap::iterator mi = mapMemPoolInfo.find((*it).second.ptx->GetHash());
+            if (mi == mapMemPoolInfo.end())
+                continue;
+            CMemPoolInfo& info = (*mi).second;
+            info.setDependsOn.erase(hash);
+            info.nValueInChain += vout[n].nValue;
+            info.dValueHeight += (double)vout[n].nValue * (nBestHeight + 1);
+        }
+
+        nMemPoolBytes -= GetMemPoolUsage(mapTransactions[hash]);
+        mapMemPoolInfo.erase(hash);
+        setMemPoolWallet.erase(hash);
+        mapTransactions.erase(hash);
         nTransactionsUpdated++;
     }
     return true;
 }
 
 
+// Caller holds cs_mapTransactions.  Removes the transaction and everything
+// spending from it, returns how many transactions went.
+int RemoveFromMemoryPoolWithDescendants(const uint256& hashIn)
+{
+    int nRemoved = 0;
+    vector<uint256> vRemove(1, hashIn);
+    for (int i = 0; i < vRemove.size(); i++)
+    {
+        CTransactionMap::iterator mi = mapTransactions.find(vRemove[i]);
+        if (mi == mapTransactions.end())
+            continue;
+        CTransaction txRemove = (*mi).second;
+        for (unsigned int n = 0; n < txRemove.vout.size(); n++)
+        {
+            CHashMap<COutPoint, CInPoint, COutPointHasher>::iterator it = mapNextTx.find(COutPoint(vRemove[i], n));
+            if (it != mapNextTx.end())
+                vRemove.push_back((*it).second.ptx->GetHash());
+        }
+        txRemove.RemoveFromMemoryPool();
+        nRemoved++;
+    }
+    return nRemoved;
+}
+
+
+void RemoveMemoryPoolConflicts(const CTransaction& tx)
+{
+    // Anything spending the same outputs as a transaction in a block can
+    // never confirm, and neither can what spends it in turn
+    CRITICAL_BLOCK(cs_mapTransactions)
+    {
+        uint256 hash = tx.GetHash();
+        vector<uint256> vConflict;
+        foreach(const CTxIn& txin, tx.vin)
+        {
+            CHashMap<COutPoint, CInPoint, COutPointHasher>::iterator it = mapNextTx.find(txin.prevout);
+            if (it != mapNextTx.end() && (*it).second.ptx->GetHash() != hash)
+                vConflict.push_back((*it).second.ptx->GetHash());
+        }
+        foreach(const uint256& hashConflict, vConflict)
+        {
+            int nRemoved = RemoveFromMemoryPoolWithDescendants(hashConflict);
+            if (nRemoved > 0)
+                printf("RemoveMemoryPoolConflicts() : removed %s and %d spending it\n", hashConflict.ToString().substr(0,10).c_str(), nRemoved - 1);
+        }
+    }
+}
+
+
+void LimitMemoryPool()
+{
+    // Evict the lowest fee per byte first, along with whatever spends it.
+    // Trimming a tenth below the limit keeps a flood from sorting the pool
+    // again for every transaction.
+    CRITICAL_BLOCK(cs_mapTransactions)
+    {
+        if (nMemPoolBytes <= nMemPoolMaxBytes)
+            return;
+
+        // A transaction is worth the fee rate of it and its ancestors in the
+        // pool, as that's what a block has to take to get it.  Ones that
+        // can't be mined are worth nothing, wallet ones can't be evicted.
+        vector<pair<double, uint256> > vScore;
+        vScore.reserve(mapMemPoolInfo.size());
+        for (CMemPoolInfoMap::iterator mi = mapMemPoolInfo.begin(); mi != mapMemPoolInfo.end(); ++mi)
+        {
+            const CMemPoolInfo& info = (*mi).second;
+            bool fInputsKnown = info.fInputsKnown;
+            int64 nFees = info.nFee;
+            uint64 nSize = info.nSize;
+            set<uint256> setAncestors;
+            vector<uint256> vTodo(info.setDependsOn.begin(), info.setDependsOn.end());
+            while (!vTodo.empty())
+            {
+                uint256 hashAncestor = vTodo.back();
+                vTodo.pop_back();
+                CMemPoolInfoMap::iterator mia = mapMemPoolInfo.find(hashAncestor);
+                if (mia == mapMemPoolInfo.end() || !setAncestors.insert(hashAncestor).second)
+                    continue;
+                const CMemPoolInfo& infoAncestor = (*mia).second;
+                fInputsKnown &= infoAncestor.fInputsKnown;
+                nFees += infoAncestor.nFee;
+                nSize += infoAncestor.nSize;
+                vTodo.insert(vTodo.end(), infoAncestor.setDependsOn.begin(), infoAncestor.setDependsOn.end());
+            }
+
+            double dScore = (fInputsKnown ? (double)nFees / nSize : -1.0);
+            if (setMemPoolWallet.count((*mi).first))
+                dScore = DBL_MAX;
+            vScore.push_back(make_pair(dScore, (*mi).first));
+        }
+        sort(vScore.begin(), vScore.end());
+
+        // Evicting a transaction evicts its descendants, so it's worth as
+        // much as the best package it's part of.  Going from the best down,
+        // an ancestor already worth as much has had its own ancestors
+        // raised at least that far.
+        CHashMap<uint256, double, CUint256Hasher> mapScore;
+        for (int i = 0; i < vScore.size(); i++)
+            mapScore[vScore[i].second] = vScore[i].first;
+        for (int i = vScore.size() - 1; i >= 0; i--)
+        {
+            double dScore = vScore[i].first;
+            vector<uint256> vTodo(1, vScore[i].second);
+            while (!vTodo.empty())
+            {
+                const set<uint256>& setDependsOn = mapMemPoolInfo[vTodo.back()].setDependsOn;
+                vTodo.pop_back();
+                foreach(const uint256& hashParent, setDependsOn)
+                {
+                    CHashMap<uint256, double, CUint256Hasher>::iterator it = mapScore.find(hashParent);
+                    if (it != mapScore.end() && (*it).second < dScore)
+                    {
+                        (*it).second = dScore;
+                        vTodo.push_back(hashParent);
+                    }
+                }
+            }
+        }
+        for (int i = 0; i < vScore.size(); i++)
+            vScore[i].first = mapScore[vScore[i].second];
+        sort(vScore.begin(), vScore.end());
+
+        uint64 nBytesBefore = nMemPoolBytes;
+        int nEvicted = 0;
+        uint64 nTarget = nMemPoolMaxBytes - nMemPoolMaxBytes / 10;
+        for (int i = 0; i < vScore.size() && nMemPoolBytes > nTarget && vScore[i].first < DBL_MAX; i++)
+            nEvicted += RemoveFromMemoryPoolWithDescendants(vScore[i].second);
+
+        nMemPoolEvicted += nEvicted;
+        nMemPoolEvictedBytes += nBytesBefore - nMemPoolBytes;
+        printf("LimitMemoryPool() : evicted %d transactions, %"PRI64d" bytes, %"PRI64d" left\n", nEvicted, nBytesBefore - nMemPoolBytes, nMemPoolBytes);
+    }
+}
+
+
+void GetMemPoolStats(uint64& nTxRet, uint64& nBytesRet, uint64& nEvictedRet, uint64& nEvictedBytesRet)
+{
+    CRITICAL_BLOCK(cs_mapTransactions)
+    {
+        nTxRet = mapTransactions.size();
+        nBytesRet = nMemPoolBytes;
+        nEvictedRet = nMemPoolEvicted;
+        nEvictedBytesRet = nMemPoolEvictedBytes;
+    }
+}
+
+
+// Both run once pindexBest and nBestHeight are on the new best block, input
+// heights are worked out from them
+void RefreshMemoryPoolInfo(CTxDB& txdb)
+{
+    // After a reorganize, inputs that were in the chain may not be any more
+    CRITICAL_BLOCK(cs_mapTransactions)
+        for (CTransactionMap::iterator mi = mapTransactions.begin(); mi != mapTransactions.end(); ++mi)
+            GetMemPoolInfo(txdb, (*mi).second, mapMemPoolInfo[(*mi).first]);
+}
+
+void RefreshMemoryPoolChildren(CTxDB& txdb, const vector<CTransaction>& vtx)
+{
+    // A child accepted before its parent was known can go in a block once
+    // the parent is in one
+    CRITICAL_BLOCK(cs_mapTransactions)
+    {
+        foreach(const CTransaction& tx, vtx)
+        {
+            uint256 hash = tx.GetHash();
+            for (unsigned int n = 0; n < tx.vout.size(); n++)
+            {
+                CHashMap<COutPoint, CInPoint, COutPointHasher>::iterator it = mapNextTx.find(COutPoint(hash, n));
+                if (it == mapNextTx.end())
+                    continue;
+                const CTransaction& txChild = *(*it).second.ptx;
+                CMemPoolInfo& info = mapMemPoolInfo[txChild.GetHash()];
+                if (!info.fInputsKnown)
+                    GetMemPoolInfo(txdb, txChild, info);
+            }
+        }
+    }
+}
+
+
 
 
 
@@ -832,7 +1240,7 @@ int CMerkleTx::GetDepthInMainChain(int& nHeightRet) const
         return 0;
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1058,7 +1466,7 @@ int CTxIndex::GetDepthInMainChain() const
     if (!block.ReadFromDisk(pos.nFile, pos.nBlockPos, false))
         return 0;
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(block.GetHash());
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -1081,6 +1489,32 @@ int CTxIndex::GetDepthInMainChain() const
 // CBlock and CBlockIndex
 //
 
+bool CBlock::ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions)
+{
+    SetNull();
+
+    if (blockcache.Get(nFile, nBlockPos, *this, fReadTransactions))
+        return true;
+
+    // Open history file to read
+    CAutoFile filein = OpenBlockFile(nFile, nBlockPos, "rb");
+    if (!filein)
+        return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
+    if (!fReadTransactions)
+        filein.nType |= SER_BLOCKHEADERONLY;
+
+    // Read block
+    filein >> *this;
+
+    // Check the header
+    if (!CheckProofOfWork(INT_MAX))
+        return error("CBlock::ReadFromDisk() : errors in block header");
+
+    if (fReadTransactions)
+        blockcache.Add(*this, nFile, nBlockPos);
+    return true;
+}
+
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
 {
     if (!fReadTransactions)
@@ -1095,6 +1529,223 @@ bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
     return true;
 }
 
+unsigned int CBlockCache::GetMemoryUsage(const CBlock& block)
+{
+    // Rough heap footprint of the decoded block, not its serialized size
+    unsigned int nUsage = sizeof(CEntry) + block.vMerkleTree.capacity() * sizeof(uint256);
+    if (block.auxpow.get())
+        nUsage += ::GetSerializeSize(*block.auxpow, SER_DISK);
+    foreach(const CTransaction& tx, block.vtx)
+        nUsage += tx.GetMemoryUsage();
+    return nUsage;
+}
+
+void CBlockCache::SetMaxBytes(uint64 n)
+{
+    CRITICAL_BLOCK(cs)
+    {
+        nMaxBytes = n;
+        while (nBytes > nMaxBytes && !lruEntries.empty())
+        {
+            CEntry& entry = lruEntries.back();
+            nBytes -= entry.nBytes;
+            mapPos.erase(make_pair(entry.nFile, entry.nBlockPos));
+            mapEntries.erase(entry.hash);
+            lruEntries.pop_back();
+        }
+    }
+}
+
+void CBlockCache::Touch(list<CEntry>::iterator it)
+{
+    lruEntries.splice(lruEntries.begin(), lruEntries, it);
+}
+
+void CBlockCache::Copy(const CBlock& block, CBlock& blockRet, bool fReadTransactions) const
+{
+    if (fReadTransactions)
+    {
+        blockRet = block;
+    }
+    else
+    {
+        blockRet.SetNull();
+        blockRet.nVersion       = block.nVersion;
+        blockRet.hashPrevBlock  = block.hashPrevBlock;
+        blockRet.hashMerkleRoot = block.hashMerkleRoot;
+        blockRet.nTime          = block.nTime;
+        blockRet.nBits          = block.nBits;
+        blockRet.nNonce         = block.nNonce;
+        blockRet.auxpow         = block.auxpow;
+    }
+}
+
+bool CBlockCache::Get(unsigned int nFile, unsigned int nBlockPos, CBlock& blockRet, bool fReadTransactions)
+{
+    CRITICAL_BLOCK(cs)
+    {
+        map<pair<unsigned int, unsigned int>, uint256>::iterator mi = mapPos.find(make_pair(nFile, nBlockPos));
+        if (mi == mapPos.end())
+        {
+            nMisses++;
+            return false;
+        }
+        list<CEntry>::iterator it = mapEntries[(*mi).second];
+        nHits++;
+        Touch(it);
+        Copy(it->block, blockRet, fReadTransactions);
+    }
+    return true;
+}
+
+void CBlockCache::Add(const CBlock& block, unsigned int nFile, unsigned int nBlockPos)
+{
+    uint256 hash = block.GetHash();
+    unsigned int nUsage = GetMemoryUsage(block);
+    CRITICAL_BLOCK(cs)
+    {
+        if (nUsage > nMaxBytes / 4 || mapEntries.count(hash))
+            return;
+
+        lruEntries.push_front(CEntry());
+        CEntry& entry = lruEntries.front();
+        entry.hash = hash;
+        entry.nFile = nFile;
+        entry.nBlockPos = nBlockPos;
+        entry.nBytes = nUsage;
+        entry.block = block;
+        mapEntries[hash] = lruEntries.begin();
+        mapPos[make_pair(nFile, nBlockPos)] = hash;
+        nBytes += nUsage;
+    }
+    SetMaxBytes(nMaxBytes);
+}
+
+void CBlockCache::GetStats(uint64& nEntriesRet, uint64& nBytesRet, uint64& nMaxBytesRet, uint64& nHitsRet, uint64& nMissesRet) const
+{
+    CRITICAL_BLOCK(cs)
+    {
+        nEntriesRet = lruEntries.size();
+        nBytesRet = nBytes;
+        nMaxBytesRet = nMaxBytes;
+        nHitsRet = nHits;
+        nMissesRet = nMisses;
+    }
+}
+
+unsigned int CPrevOutCache::GetMemoryUsage(const CTxOut& txout)
+{
+    // Entry and list node, the hash map entry and its slot, and the script
+    return sizeof(CEntry) + 2 * sizeof(void*)
+           + sizeof(CHashMap<COutPoint, list<CEntry>::iterator, COutPointHasher>::value_type) + 11
+           + txout.scriptPubKey.capacity();
+}
+
+void CPrevOutCache::SetMaxBytes(uint64 n)
+{
+    CRITICAL_BLOCK(cs)
+    {
+        nMaxBytes = n;
+        Trim();
+    }
+}
+
+// Caller holds cs
+void CPrevOutCache::Trim()
+{
+    while (nBytes > nMaxBytes && !lruEntries.empty())
+    {
+        CEntry& entry = lruEntries.back();
+        nBytes -= entry.nBytes;
+        mapEntries.erase(entry.prevout);
+        lruEntries.pop_back();
+    }
+}
+
+// Caller holds cs
+void CPrevOutCache::Erase(const COutPoint& prevout)
+{
+    CHashMap<COutPoint, list<CEntry>::iterator, COutPointHasher>::iterator mi = mapEntries.find(prevout);
+    if (mi == mapEntries.end())
+        return;
+    list<CEntry>::iterator it = (*mi).second;
+    nBytes -= it->nBytes;
+    mapEntries.erase(mi);
+    lruEntries.erase(it);
+}
+
+bool CPrevOutCache::Get(const COutPoint& prevout, const CDiskTxPos& pos, CTxOut& txoutRet, int& nHeightRet, bool& fCoinBaseRet)
+{
+    CRITICAL_BLOCK(cs)
+    {
+        CHashMap<COutPoint, list<CEntry>::iterator, COutPointHasher>::iterator mi = mapEntries.find(prevout);
+        if (mi == mapEntries.end() || (*mi).second->pos != pos)
+        {
+            nMisses++;
+            return false;
+        }
+        list<CEntry>::iterator it = (*mi).second;
+        nHits++;
+        lruEntries.splice(lruEntries.begin(), lruEntries, it);
+        txoutRet = it->txout;
+        nHeightRet = it->nHeight;
+        fCoinBaseRet = it->fCoinBase;
+    }
+    return true;
+}
+
+void CPrevOutCache::Add(const CTransaction& tx, const CDiskTxPos& pos, int nHeight)
+{
+    uint256 hash = tx.GetHash();
+    CRITICAL_BLOCK(cs)
+    {
+        // Outputs this transaction spends won't be asked for again
+        if (!tx.IsCoinBase())
+            foreach(const CTxIn& txin, tx.vin)
+                Erase(txin.prevout);
+
+        for (unsigned int n = 0; n < tx.vout.size(); n++)
+        {
+            COutPoint prevout(hash, n);
+            Erase(prevout);
+
+            lruEntries.push_front(CEntry());
+            CEntry& entry = lruEntries.front();
+            entry.prevout = prevout;
+            entry.pos = pos;
+            entry.nHeight = nHeight;
+            entry.fCoinBase = tx.IsCoinBase();
+            entry.txout = tx.vout[n];
+            entry.nBytes = GetMemoryUsage(entry.txout);
+            mapEntries[prevout] = lruEntries.begin();
+            nBytes += entry.nBytes;
+        }
+        Trim();
+    }
+}
+
+void CPrevOutCache::Remove(const CTransaction& tx)
+{
+    uint256 hash = tx.GetHash();
+    CRITICAL_BLOCK(cs)
+    {
+        for (unsigned int n = 0; n < tx.vout.size(); n++)
+            Erase(COutPoint(hash, n));
+    }
+}
+
+void CPrevOutCache::GetStats(uint64& nEntriesRet, uint64& nBytesRet, uint64& nMaxBytesRet, uint64& nHitsRet, uint64& nMissesRet) const
+{
+    CRITICAL_BLOCK(cs)
+    {
+        nEntriesRet = lruEntries.size();
+        nBytesRet = nBytes;
+        nMaxBytesRet = nMaxBytes;
+        nHitsRet = nHits;
+        nMissesRet = nMisses;
+    }
+}
+
 uint256 GetOrphanRoot(const CBlock* pblock)
 {
     // Work back to the first block in the orphan chain
@@ -1159,6 +1810,93 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast)
     return bnNew.GetCompact();
 }
 
+// Tag in the parent coinbase just before the aux chain merkle root
+static const unsigned char pchMergedMiningHeader[] = { 0xfa, 0xbe, 'm', 'm' };
+
+bool CAuxPow::Check(uint256 hashAuxBlock, int nChainID) const
+{
+    if (nIndex != 0)
+        return error("CAuxPow::Check() : auxpow is not a coinbase");
+    if (parentBlock.GetChainID() == nChainID)
+        return error("CAuxPow::Check() : parent block has our chain ID");
+    if (vChainMerkleBranch.size() > 30)
+        return error("CAuxPow::Check() : chain merkle branch too long");
+
+    // The parent coinbase has to be in the parent block
+    if (CBlock::CheckMerkleBranch(GetHash(), vMerkleBranch, nIndex) != parentBlock.hashMerkleRoot)
+        return error("CAuxPow::Check() : parent merkle root incorrect");
+
+    // It commits to the chain merkle root, byte reversed, right after a
+    // single merged mining header
+    uint256 hashRoot = CBlock::CheckMerkleBranch(hashAuxBlock, vChainMerkleBranch, nChainIndex);
+    vector<unsigned char> vchRoot(hashRoot.begin(), hashRoot.end());
+    reverse(vchRoot.begin(), vchRoot.end());
+
+    const CScript& script = vin[0].scriptSig;
+    CScript::const_iterator pcHead = search(script.begin(), script.end(), pchMergedMiningHeader, pchMergedMiningHeader + sizeof(pchMergedMiningHeader));
+    CScript::const_iterator pc = search(script.begin(), script.end(), vchRoot.begin(), vchRoot.end());
+    if (pc == script.end())
+        return error("CAuxPow::Check() : chain merkle root missing from parent coinbase");
+    if (pcHead != script.end())
+    {
+        if (search(pcHead + 1, script.end(), pchMergedMiningHeader, pchMergedMiningHeader + sizeof(pchMergedMiningHeader)) != script.end())
+            return error("CAuxPow::Check() : multiple merged mining headers in parent coinbase");
+        if (pcHead + sizeof(pchMergedMiningHeader) != pc)
+            return error("CAuxPow::Check() : merged mining header isn't just before the chain merkle root");
+    }
+    else
+    {
+        // Parent coinbases from before the header was used carry the root
+        // near the start, which keeps there from being more than one
+        if (pc - script.begin() > 20)
+            return error("CAuxPow::Check() : chain merkle root without a merged mining header must start in the first 20 bytes");
+    }
+    pc += vchRoot.size();
+    if (script.end() - pc < 8)
+        return error("CAuxPow::Check() : chain merkle tree size and nonce missing from parent coinbase");
+
+    // Then the tree size and a nonce, which fix the one slot our chain
+    // may use so the same work can't be counted twice
+    unsigned int nSize = pc[0] | (pc[1] << 8) | (pc[2] << 16) | (pc[3] << 24);
+    unsigned int nNonce = pc[4] | (pc[5] << 8) | (pc[6] << 16) | (pc[7] << 24);
+    if (nSize != (1U << vChainMerkleBranch.size()))
+        return error("CAuxPow::Check() : chain merkle branch doesn't match tree size in parent coinbase");
+    unsigned int nRand = nNonce * 1103515245 + 12345;
+    nRand = (nRand + nChainID) * 1103515245 + 12345;
+    if (nChainIndex != nRand % nSize)
+        return error("CAuxPow::Check() : wrong chain index");
+
+    return true;
+}
+
+uint256 CBlock::GetPoWHash() const
+{
+    return (auxpow.get() ? auxpow->parentBlock.GetHash() : GetHash());
+}
+
+bool CBlock::CheckProofOfWork(int nHeight) const
+{
+    // nHeight is INT_MAX where it isn't known yet
+    if (!auxpow.get())
+    {
+        // Once merged mining starts our own blocks carry the chain ID too,
+        // testnet has blocks from before that rule
+        if (!fTestNet && nHeight != INT_MAX && nHeight >= hooks->AuxPowStartHeight() && GetChainID() != hooks->AuxPowChainID())
+            return error("CheckProofOfWork() : block doesn't have our chain ID");
+        return ::CheckProofOfWork(GetHash(), nBits);
+    }
+
+    if (!(nVersion & BLOCK_VERSION_AUXPOW))
+        return error("CheckProofOfWork() : auxpow without the version bit");
+    if (nHeight < hooks->AuxPowStartHeight())
+        return error("CheckProofOfWork() : merged mining isn't active at height %d", nHeight);
+    if (GetChainID() != hooks->AuxPowChainID())
+        return error("CheckProofOfWork() : block doesn't have our chain ID");
+    if (!auxpow->Check(GetHash(), GetChainID()))
+        return error("CheckProofOfWork() : auxpow check failed");
+    return ::CheckProofOfWork(auxpow->parentBlock.GetHash(), nBits);
+}
+
 bool CheckProofOfWork(uint256 hash, unsigned int nBits)
 {
     CBigNum bnTarget;
@@ -1252,7 +1990,8 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb, CBlockIndex* pindex)
 
 
 bool CTransaction::ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPool, CDiskTxPos posThisTx,
-                                 CBlockIndex* pindexBlock, int64& nFees, bool fBlock, bool fMiner, int64 nMinFee)
+                                 CBlockIndex* pindexBlock, int64& nFees, bool fBlock, bool fMiner, int64 nMinFee,
+                                 vector<CScriptCheck>* pvChecks)
 {
     // Take over previous transactions' spent pointers
     if (!IsCoinBase())
@@ -1260,6 +1999,11 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPoo
         vector<CTransaction> vTxPrev;
         vector<CTxIndex> vTxindex;
 
+        // Inputs share most of their signature hash, work it out once
+        boost::shared_ptr<CSignatureHashCache> psighashcache;
+        if (vin.size() > 1)
+            psighashcache.reset(new CSignatureHashCache(*this));
+
         int64 nValueIn = 0;
         for (int i = 0; i < vin.size(); i++)
         {
@@ -1283,7 +2027,18 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPoo
 
             // Read txPrev
             CTransaction txPrev;
-            if (!fFound || txindex.pos == CDiskTxPos(1,1,1))
+            bool fCached = false;
+            int nPrevHeight;
+            bool fPrevCoinBase;
+            CTxOut txoutPrev;
+            if (!fBlock && fFound && prevoutcache.Get(prevout, txindex.pos, txoutPrev, nPrevHeight, fPrevCoinBase))
+            {
+                // Only the spent output, at its index so the hooks can find it
+                fCached = true;
+                txPrev.vout.resize(prevout.n + 1);
+                txPrev.vout[prevout.n] = txoutPrev;
+            }
+            else if (!fFound || txindex.pos == CDiskTxPos(1,1,1))
             {
                 // Get prev tx from single transactions in memory
                 CRITICAL_BLOCK(cs_mapTransactions)
@@ -1306,13 +2061,32 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPoo
                 return error("ConnectInputs() : %s prevout.n out of range %d %d %d prev tx %s\n%s", GetHash().ToString().substr(0,10).c_str(), prevout.n, txPrev.vout.size(), txindex.vSpent.size(), prevout.hash.ToString().substr(0,10).c_str(), txPrev.ToString().c_str());
 
             // If prev is coinbase, check that it's matured
-            if (txPrev.IsCoinBase())
+            if (fCached)
+            {
+                if (fPrevCoinBase && pindexBlock->nHeight - nPrevHeight < COINBASE_MATURITY)
+                    return error("ConnectInputs() : tried to spend coinbase at depth %d", pindexBlock->nHeight - nPrevHeight);
+            }
+            else if (txPrev.IsCoinBase())
                 for (CBlockIndex* pindex = pindexBlock; pindex && pindexBlock->nHeight - pindex->nHeight < COINBASE_MATURITY; pindex = pindex->pprev)
                     if (pindex->nBlockPos == txindex.pos.nBlockPos && pindex->nFile == txindex.pos.nFile)
                         return error("ConnectInputs() : tried to spend coinbase at depth %d", pindexBlock->nHeight - pindex->nHeight);
 
-            // Verify signature
-            if (!VerifySignature(txPrev, *this, i))
+            // Verify signature, or leave it for the caller to run in parallel
+            if (pvChecks)
+            {
+                if (prevout.hash != txPrev.GetHash())
+                    return error("ConnectInputs() : %s prev tx hash mismatch", GetHash().ToString().substr(0,10).c_str());
+                pvChecks->push_back(CScriptCheck(txPrev.vout[prevout.n], *this, i, psighashcache));
+            }
+            else if (fCached)
+            {
+                // No previous transaction to match the input's hash against,
+                // the cache entry was keyed by the outpoint itself
+                if (!CScriptCheck(txoutPrev, *this, i, psighashcache)())
+                    return error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,10).c_str());
+                WalletUpdateSpent(prevout);
+            }
+            else if (!VerifySignature(txPrev, *this, i, 0, psighashcache.get()))
                 return error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,10).c_str());
 
             // Check for conflicts
@@ -1423,6 +2197,147 @@ bool CTransaction::ClientConnectInputs()
 
 
 
+//
+// Script check threads.  ConnectBlock hands over the checks of a block and
+// works through them alongside the threads, then waits for the last batch.
+//
+class CScriptCheckQueue
+{
+protected:
+    boost::mutex mutex;
+    boost::condition_variable condWorker;
+    boost::condition_variable condMaster;
+    vector<CScriptCheck>* pvChecks;
+    unsigned int nNext;
+    unsigned int nDone;
+    bool fOk;
+
+public:
+    int nThreads;
+
+    CScriptCheckQueue()
+    {
+        pvChecks = NULL;
+        nNext = 0;
+        nDone = 0;
+        fOk = true;
+        nThreads = 0;
+    }
+
+    // Workers never return, the master returns once every check is done
+    bool Loop(bool fMaster)
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        loop
+        {
+            if (fMaster)
+            {
+                if (nNext >= pvChecks->size())
+                {
+                    while (nDone < pvChecks->size())
+                        condMaster.wait(lock);
+                    pvChecks = NULL;
+                    return fOk;
+                }
+            }
+            else
+            {
+                while (pvChecks == NULL || nNext >= pvChecks->size())
+                    condWorker.wait(lock);
+            }
+
+            // Small batches keep the threads evenly loaded to the end
+            vector<CScriptCheck>& vChecks = *pvChecks;
+            unsigned int nBegin = nNext;
+            unsigned int nEnd = min((unsigned int)vChecks.size(), nNext + max(1U, min(16U, (unsigned int)(vChecks.size() - nNext) / (nThreads + 1))));
+            nNext = nEnd;
+            bool fSkip = !fOk;
+            lock.unlock();
+
+            // After one failure the block is rejected, the rest only need counting
+            bool fBatchOk = true;
+            if (!fSkip)
+                for (unsigned int i = nBegin; i < nEnd && fBatchOk; i++)
+                    fBatchOk = vChecks[i]();
+
+            lock.lock();
+            if (!fBatchOk)
+                fOk = false;
+            nDone += nEnd - nBegin;
+            if (nDone == vChecks.size())
+                condMaster.notify_one();
+        }
+    }
+
+    bool Run(vector<CScriptCheck>& vChecks)
+    {
+        if (vChecks.empty())
+            return true;
+        if (nThreads == 0 || vChecks.size() == 1)
+        {
+            foreach(const CScriptCheck& check, vChecks)
+                if (!check())
+                    return false;
+            return true;
+        }
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            pvChecks = &vChecks;
+            nNext = 0;
+            nDone = 0;
+            fOk = true;
+        }
+        condWorker.notify_all();
+        return Loop(true);
+    }
+};
+
+// Never destroyed, idle threads are still waiting on it when exit() runs
+static CScriptCheckQueue& scriptcheckqueue = *new CScriptCheckQueue();
+
+void ThreadScriptCheck(void* parg)
+{
+    try
+    {
+        vnThreadsRunning[5]++;
+        scriptcheckqueue.Loop(false);
+        vnThreadsRunning[5]--;
+    }
+    catch (std::exception& e) {
+        vnThreadsRunning[5]--;
+        PrintException(&e, "ThreadScriptCheck()");
+    } catch (...) {
+        vnThreadsRunning[5]--;
+        PrintException(NULL, "ThreadScriptCheck()");
+    }
+    printf("ThreadScriptCheck exiting\n");
+}
+
+void StartScriptCheckThreads(int nThreads)
+{
+    // The thread connecting the block does its share, so one less is started
+    if (nThreads <= 0)
+        nThreads = boost::thread::hardware_concurrency();
+    for (int i = 0; i < nThreads - 1; i++)
+    {
+        if (!CreateThread(ThreadScriptCheck, NULL))
+        {
+            printf("Error: CreateThread(ThreadScriptCheck) failed\n");
+            break;
+        }
+        scriptcheckqueue.nThreads++;
+    }
+    printf("Using %d script verification threads\n", scriptcheckqueue.nThreads + 1);
+}
+
+bool RunScriptChecks(vector<CScriptCheck>& vChecks)
+{
+    return scriptcheckqueue.Run(vChecks);
+}
+
+
+
+
 bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 {
     if (!hooks->DisconnectBlock(*this, txdb, pindex))
@@ -1430,8 +2345,11 @@ bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 
     // Disconnect in reverse order
     for (int i = vtx.size()-1; i >= 0; i--)
+    {
         if (!vtx[i].DisconnectInputs(txdb, pindex))
             return false;
+        prevoutcache.Remove(vtx[i]);
+    }
 
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
@@ -1453,22 +2371,33 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
         return false;
 
     //// issue here: it doesn't know the version
-    unsigned int nTxPos = pindex->nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK) - 1 + GetSizeOfCompactSize(vtx.size());
+    unsigned int nTxPos = pindex->nBlockPos + ::GetSerializeSize(*this, SER_DISK|SER_BLOCKHEADERONLY) + GetSizeOfCompactSize(vtx.size());
 
     map<uint256, CTxIndex> mapUnused;
+    vector<CScriptCheck> vChecks;
     int64 nFees = 0;
     foreach(CTransaction& tx, vtx)
     {
         CDiskTxPos posThisTx(pindex->nFile, pindex->nBlockPos, nTxPos);
         nTxPos += ::GetSerializeSize(tx, SER_DISK);
 
-        if (!tx.ConnectInputs(txdb, mapUnused, posThisTx, pindex, nFees, true, false))
+        if (!tx.ConnectInputs(txdb, mapUnused, posThisTx, pindex, nFees, true, false, 0, &vChecks))
             return false;
+        prevoutcache.Add(tx, posThisTx, pindex->nHeight);
     }
 
     if (vtx[0].GetValueOut() > GetBlockValue(pindex->nHeight, nFees))
         return false;
 
+    // All signatures have to check out before anything is committed
+    int64 nStart = GetTimeMillis();
+    if (!RunScriptChecks(vChecks))
+        return error("ConnectBlock() : script verification failed");
+    if (fDebug && !vChecks.empty())
+        printf("ConnectBlock() : verified %d inputs in %"PRI64d"ms\n", vChecks.size(), GetTimeMillis() - nStart);
+    foreach(const CScriptCheck& check, vChecks)
+        WalletUpdateSpent(check.ptxTo->vin[check.nIn].prevout);
+
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
     if (pindex->pprev)
@@ -1573,7 +2502,10 @@ bool Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
 
     // Delete redundant memory transactions that are in the connected branch
     foreach(CTransaction& tx, vDelete)
+    {
         tx.RemoveFromMemoryPool();
+        RemoveMemoryPoolConflicts(tx);
+    }
 
     return true;
 }
@@ -1582,8 +2514,10 @@ bool Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
 bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
 {
     uint256 hash = GetHash();
+    bool fInitialSync = IsInitialBlockDownload();
 
     txdb.TxnBegin();
+    bool fReorganized = false;
     if (pindexGenesisBlock == NULL && hash == hashGenesisBlock)
     {
         txdb.WriteHashBestChain(hash);
@@ -1608,7 +2542,10 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
 
         // Delete redundant memory transactions
         foreach(CTransaction& tx, vtx)
+        {
             tx.RemoveFromMemoryPool();
+            RemoveMemoryPoolConflicts(tx);
+        }
     }
     else
     {
@@ -1619,6 +2556,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
             InvalidChainFound(pindexNew);
             return error("SetBestChain() : Reorganize failed");
         }
+        fReorganized = true;
     }
 
     // New best block
@@ -1630,6 +2568,33 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     nTransactionsUpdated++;
     printf("SetBestChain: new best=%s  height=%d  work=%s\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainWork.ToString().c_str());
 
+    if (fReorganized)
+        RefreshMemoryPoolInfo(txdb);
+    else
+        RefreshMemoryPoolChildren(txdb, vtx);
+
+    // During initial download the tx index and best chain pointer reach
+    // disk in batches, force one out at each boundary
+    if (fInitialSync && nBestHeight % SYNC_BATCH_BLOCKS == 0)
+    {
+        txdb.FlushTxIndexCache();
+        DBSyncLog();
+
+        static int64 nBatchStart;
+        static int nBatchHeight;
+        int64 nNow = GetTimeMillis();
+        if (nBatchStart && nNow > nBatchStart && nBestHeight > nBatchHeight)
+            printf("SetBestChain: initial download at height %d, %.1f blocks/s\n", nBestHeight, (nBestHeight - nBatchHeight) * 1000.0 / (nNow - nBatchStart));
+        nBatchStart = nNow;
+        nBatchHeight = nBestHeight;
+    }
+
+    // The last partial batch was committed with its log still in memory
+    static bool fWasInitialSync = true;
+    if (fWasInitialSync && !fInitialSync)
+        DBSyncLog();
+    fWasInitialSync = fInitialSync;
+
     return true;
 }
 
@@ -1645,9 +2610,9 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
     CBlockIndex* pindexNew = new CBlockIndex(nFile, nBlockPos, *this);
     if (!pindexNew)
         return error("AddToBlockIndex() : new CBlockIndex failed");
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    CBlockIndexMap::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
+    CBlockIndexMap::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
@@ -1693,8 +2658,9 @@ bool CBlock::CheckBlock() const
     if (vtx.empty() || vtx.size() > MAX_BLOCK_SIZE || ::GetSerializeSize(*this, SER_NETWORK) > MAX_BLOCK_SIZE)
         return error("CheckBlock() : size limits failed");
 
-    // Check proof of work matches claimed amount
-    if (!CheckProofOfWork(GetHash(), nBits))
+    // Check proof of work matches claimed amount, whether merged mining
+    // is allowed depends on the height and waits for AcceptBlock
+    if (!CheckProofOfWork(INT_MAX))
         return error("CheckBlock() : proof of work failed");
 
     // Check timestamp
@@ -1724,7 +2690,10 @@ bool CBlock::CheckBlock() const
     return true;
 }
 
-bool CBlock::AcceptBlock()
+// A block already in a block file, when the index is rebuilt, comes with
+// its position.  Block files are numbered from 1, so nFile 0 means it has
+// to be written.
+bool CBlock::AcceptBlock(unsigned int nFile, unsigned int nBlockPos)
 {
     // Check for duplicate
     uint256 hash = GetHash();
@@ -1732,7 +2701,7 @@ bool CBlock::AcceptBlock()
         return error("AcceptBlock() : block already in mapBlockIndex");
 
     // Get prev block index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashPrevBlock);
     if (mi == mapBlockIndex.end())
         return error("AcceptBlock() : prev block not found");
     CBlockIndex* pindexPrev = (*mi).second;
@@ -1741,6 +2710,8 @@ bool CBlock::AcceptBlock()
     // Check proof of work
     if (nBits != GetNextWorkRequired(pindexPrev))
         return error("AcceptBlock() : incorrect proof of work");
+    if (!CheckProofOfWork(nHeight))
+        return error("AcceptBlock() : proof of work failed");
 
     // Check timestamp against prev
     if (GetBlockTime() <= pindexPrev->GetMedianTimePast())
@@ -1756,12 +2727,14 @@ bool CBlock::AcceptBlock()
         return error("AcceptBlock() : rejected by checkpoint lockin at %d", nHeight);
 
     // Write block to history file
-    if (!CheckDiskSpace(::GetSerializeSize(*this, SER_DISK)))
-        return error("AcceptBlock() : out of disk space");
-    unsigned int nFile = -1;
-    unsigned int nBlockPos = 0;
-    if (!WriteToDisk(nFile, nBlockPos))
-        return error("AcceptBlock() : WriteToDisk failed");
+    if (nFile == 0)
+    {
+        if (!CheckDiskSpace(::GetSerializeSize(*this, SER_DISK)))
+            return error("AcceptBlock() : out of disk space");
+        if (!WriteToDisk(nFile, nBlockPos))
+            return error("AcceptBlock() : WriteToDisk failed");
+        blockcache.Add(*this, nFile, nBlockPos);
+    }
     if (!AddToBlockIndex(nFile, nBlockPos))
         return error("AcceptBlock() : AddToBlockIndex failed");
 
@@ -1913,6 +2886,53 @@ FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszM
     return file;
 }
 
+// Caller holds cs
+bool CBlockFiles::Map(unsigned int nFile)
+{
+#ifdef __WXMSW__
+    return false;
+#else
+    if (nFile >= vMapping.size())
+        vMapping.resize(nFile + 1);
+
+    int fd = open(strprintf("%s/blk%04d.dat", GetDataDir().c_str(), nFile).c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    if (vMapping[nFile] && st.st_size == vMapping[nFile]->nSize)
+    {
+        close(fd);
+        return true;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        // Callers fall back to stdio, say so once rather than on every read
+        static bool fWarned;
+        if (!fWarned)
+            printf("CBlockFiles::Map() : mmap blk%04d.dat failed %d, reading block files with stdio\n", nFile, errno);
+        fWarned = true;
+        return false;
+    }
+
+    vMapping[nFile].reset(new CMapping((char*)p, st.st_size));
+    return true;
+#endif
+}
+
+CBlockFiles::CMapping::~CMapping()
+{
+#ifndef __WXMSW__
+    munmap(pbegin, nSize);
+#endif
+}
+
 static unsigned int nCurrentBlockFile = 1;
 
 FILE* AppendBlockFile(unsigned int& nFileRet)
@@ -1936,6 +2956,70 @@ FILE* AppendBlockFile(unsigned int& nFileRet)
     }
 }
 
+static bool ReindexBlockFiles()
+{
+    // Blocks were written in the order they were accepted, so every block's
+    // parent comes before it and they can be accepted again where they are
+    int nBlocks = 0;
+    for (unsigned int nFile = 1; ; nFile++)
+    {
+        CAutoFile filein = OpenBlockFile(nFile, 0, "rb");
+        if (!filein)
+            break;
+        printf("ReindexBlockFiles() : reading blk%04d.dat\n", nFile);
+        unsigned int nPos = 0;
+        loop
+        {
+            if (fShutdown)
+                return false;
+            unsigned char pchMessage[sizeof(pchMessageStart)];
+            unsigned int nSize;
+            if (fseek(filein, nPos, SEEK_SET) != 0 || fread(pchMessage, sizeof(pchMessage), 1, filein) != 1)
+                break;
+            if (memcmp(pchMessage, pchMessageStart, sizeof(pchMessageStart)) != 0)
+            {
+                // Leftover of an interrupted write, nothing valid follows it
+                printf("ReindexBlockFiles() : no block at blk%04d.dat:%u\n", nFile, nPos);
+                break;
+            }
+            if (fread(&nSize, sizeof(nSize), 1, filein) != 1 || nSize > MAX_SIZE)
+                break;
+            unsigned int nBlockPos = nPos + sizeof(pchMessage) + sizeof(nSize);
+            nPos = nBlockPos + nSize;
+
+            CBlock block;
+            try
+            {
+                filein >> block;
+            }
+            catch (std::exception& e)
+            {
+                printf("ReindexBlockFiles() : truncated block at blk%04d.dat:%u\n", nFile, nBlockPos);
+                break;
+            }
+
+            uint256 hash = block.GetHash();
+            if (mapBlockIndex.count(hash))
+                continue;
+            if (mapBlockIndex.empty())
+            {
+                if (hash != hashGenesisBlock)
+                    return error("ReindexBlockFiles() : blk0001.dat doesn't start with the genesis block");
+                if (!block.AddToBlockIndex(nFile, nBlockPos))
+                    return error("ReindexBlockFiles() : genesis block not accepted");
+            }
+            else if (!block.CheckBlock() || !block.AcceptBlock(nFile, nBlockPos))
+            {
+                printf("ReindexBlockFiles() : skipped block %s at blk%04d.dat:%u\n", hash.ToString().substr(0,20).c_str(), nFile, nBlockPos);
+                continue;
+            }
+            nBlocks++;
+        }
+    }
+    printf("ReindexBlockFiles() : indexed %d blocks, best height %d\n", nBlocks, nBestHeight);
+    return true;
+}
+
 bool LoadBlockIndex(bool fAllowNew)
 {
     if (fTestNet)
@@ -1958,6 +3042,13 @@ bool LoadBlockIndex(bool fAllowNew)
         return false;
     txdb.Close();
 
+    //
+    // Rebuild the index from the block files, -reindex has removed the old one
+    //
+    if (mapBlockIndex.empty() && GetBoolArg("-reindex"))
+        if (!ReindexBlockFiles())
+            return false;
+
     //
     // Init with genesis block
     //
@@ -2022,11 +3113,54 @@ bool LoadBlockIndex(bool fAllowNew)
 
 
 
+//
+// Blocks past hashBestChain that are still linked by hashNext were
+// connected, but we stopped before their batch of tx index changes was
+// written.  Connect them again.  This runs once the wallet is loaded, so
+// it sees the wallet's transactions in those blocks.
+//
+bool ReconnectBlocks()
+{
+    if (!pindexBest || !pindexBest->pnext)
+        return true;
+    printf("ReconnectBlocks() : reconnecting blocks after height %d\n", nBestHeight);
+    CTxDB txdb;
+    while (pindexBest->pnext)
+    {
+        CBlockIndex* pindex = pindexBest->pnext;
+        CBlock block;
+        if (!block.ReadFromDisk(pindex))
+            return error("ReconnectBlocks() : block.ReadFromDisk failed");
+
+        // These blocks were valid before, failing now means the index is
+        // damaged, not that the chain is invalid.  So no SetBestChain,
+        // which would mark it invalid.
+        txdb.TxnBegin();
+        if (!block.ConnectBlock(txdb, pindex) || !txdb.WriteHashBestChain(pindex->GetBlockHash()))
+        {
+            txdb.TxnAbort();
+            return error("ReconnectBlocks() : block %d %s failed to connect again, restart with -reindex", pindex->nHeight, pindex->GetBlockHash().ToString().substr(0,20).c_str());
+        }
+        if (!txdb.TxnCommit())
+            return error("ReconnectBlocks() : TxnCommit failed");
+
+        hashBestChain = pindex->GetBlockHash();
+        pindexBest = pindex;
+        nBestHeight = pindexBest->nHeight;
+        bnBestChainWork = pindexBest->bnChainWork;
+    }
+    printf("ReconnectBlocks() : best height now %d\n", nBestHeight);
+    txdb.FlushTxIndexCache();
+    return true;
+}
+
+
+
 void PrintBlockTree()
 {
     // precompute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (CBlockIndexMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -2588,7 +3722,7 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             if (inv.type == MSG_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                CBlockIndexMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     CBlock block;
@@ -2674,7 +3808,7 @@ bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -3230,8 +4364,69 @@ bool Detect128BitSSE2()
     }
     return fUseSSE2;
 }
+
+// Structured extended feature flags, CPUID leaf 7 subleaf 0, ebx
+int CallCPUID7()
+{
+    int b;
+    asm (
+        "mov $7, %%eax; "
+        "xor %%ecx, %%ecx; "
+        "cpuid;"
+        "mov %%ebx, %0;" // ebx into b
+        :"=r"(b) /* output */
+        : /* input */
+        :"%eax","%ebx","%ecx","%edx" /* clobbered register */
+    );
+    return b;
+}
+
+// Register state the OS saves on context switch, XCR0
+int CallXGETBV()
+{
+    int a;
+    asm (
+        "xor %%ecx, %%ecx; "
+        ".byte 0x0f, 0x01, 0xd0; " // xgetbv
+        "mov %%eax, %0;" // eax into a
+        :"=r"(a) /* output */
+        : /* input */
+        :"%eax","%ecx","%edx" /* clobbered register */
+    );
+    return a;
+}
+
+bool DetectAVX2()
+{
+    int a, c;
+    CallCPUID(0, a, c);
+    if (a < 7)
+        return false;
+
+    // AVX, OSXSAVE, and the OS saving the XMM and YMM registers
+    CallCPUID(1, a, c);
+    if (!(c & (1 << 27)) || !(c & (1 << 28)) || (CallXGETBV() & 6) != 6)
+        return false;
+    return (CallCPUID7() & (1 << 5)) != 0;
+}
+
+bool DetectSHANI()
+{
+    int a, c;
+    CallCPUID(0, a, c);
+    if (a < 7)
+        return false;
+
+    // SSE4.1 for the shuffles around the SHA instructions
+    CallCPUID(1, a, c);
+    if (!(c & (1 << 19)))
+        return false;
+    return (CallCPUID7() & (1 << 29)) != 0;
+}
 #else
 bool Detect128BitSSE2() { return false; }
+bool DetectAVX2() { return false; }
+bool DetectSHANI() { return false; }
 #endif
 
 int FormatHashBlocks(void* pbuffer, unsigned int len)
@@ -3293,33 +4488,98 @@ unsigned int ScanHash_CryptoPP(char* pmidstate, char* pdata, char* phash1, char*
     }
 }
 
-extern unsigned int ScanHash_4WaySSE2(char* pmidstate, char* pblock, char* phash1, char* phash, unsigned int& nHashesDone);
-
+const char* pszHashKernel = "";
 
+//
+// Check a ScanHash kernel against the bitcoin genesis block header.  It has
+// to find the known nonce starting a little before it, and the hash it
+// returns has to match CBlock::GetHash.
+//
+bool TestScanHash(ScanHashFunction pScanHash)
+{
+    CBlock block;
+    block.nVersion = 1;
+    block.hashPrevBlock = 0;
+    block.hashMerkleRoot = uint256("0x4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b");
+    block.nTime = 1231006505;
+    block.nBits = 0x1d00ffff;
+    block.nNonce = 2083236893;
+
+    char pmidstatebuf[32+16]; char* pmidstate = alignup<16>(pmidstatebuf);
+    char pdatabuf[128+16];    char* pdata     = alignup<16>(pdatabuf);
+    char phash1buf[64+16];    char* phash1    = alignup<16>(phash1buf);
+    uint256 hashbuf[2];
+    uint256& hash = *alignup<16>(hashbuf);
+    FormatHashBuffers(&block, pmidstate, pdata, phash1);
+
+    // The kernels count nonces in the byte swapped buffer
+    unsigned int& nBlockNonce = *(unsigned int*)(pdata + 64 + 12);
+    unsigned int nNonceExpected = nBlockNonce;
+    nBlockNonce -= 64;
+
+    unsigned int nHashesDone = 0;
+    unsigned int nNonceFound = pScanHash(pmidstate, pdata + 64, phash1, (char*)&hash, nHashesDone);
+    if (nNonceFound != nNonceExpected)
+        return false;
+    for (int i = 0; i < sizeof(hash)/4; i++)
+        ((unsigned int*)&hash)[i] = ByteReverse(((unsigned int*)&hash)[i]);
+    return (hash == block.GetHash());
+}
 
-class COrphan
+ScanHashFunction SelectScanHash()
 {
-public:
-    CTransaction* ptx;
-    set<uint256> setDependsOn;
-    double dPriority;
+    bool f4WaySSE2 = Detect128BitSSE2();
+    bool fAVX2 = DetectAVX2();
+    bool fSHANI = DetectSHANI();
+    if (mapArgs.count("-4way"))
+    {
+        // -4way still picks between exactly the two original kernels
+        f4WaySSE2 = GetBoolArg("-4way");
+        fAVX2 = fSHANI = false;
+    }
 
-    COrphan(CTransaction* ptxIn)
+    struct
     {
-        ptx = ptxIn;
-        dPriority = 0;
+        const char* pszName;
+        ScanHashFunction pScanHash;
+        bool fUse;
     }
+    kernels[] =
+    {
+#ifdef FOURWAYSSE2
+        // Fastest first.  Eight AVX2 lanes beat one SHA-NI stream where
+        // a CPU has both.
+        { "avx2",   ScanHash_8WayAVX2,  fAVX2 },
+        { "shani",  ScanHash_SHANI,     fSHANI },
+        { "4way",   ScanHash_4WaySSE2,  f4WaySSE2 },
+#endif
+        { "cryptopp", ScanHash_CryptoPP, true },
+    };
 
-    void print() const
+    static bool fPrinted;
+    for (int i = 0; i < sizeof(kernels)/sizeof(kernels[0]); i++)
     {
-        printf("COrphan(hash=%s, dPriority=%.1f)\n", ptx->GetHash().ToString().substr(0,10).c_str(), dPriority);
-        foreach(uint256 hash, setDependsOn)
-            printf("   setDependsOn %s\n", hash.ToString().substr(0,10).c_str());
+        if (!kernels[i].fUse)
+            continue;
+        if (!TestScanHash(kernels[i].pScanHash))
+        {
+            printf("SelectScanHash() : %s kernel failed self test\n", kernels[i].pszName);
+            continue;
+        }
+        pszHashKernel = kernels[i].pszName;
+        if (!fPrinted)
+        {
+            fPrinted = true;
+            printf("Using %s SHA-256 kernel for mining\n", pszHashKernel);
+        }
+        return kernels[i].pScanHash;
     }
-};
+    return ScanHash_CryptoPP;
+}
 
 
-CBlock* CreateNewBlock(CReserveKey& reservekey)
+
+CBlock* CreateNewBlock(CReserveKey& reservekey, vector<int64>* pvTxFeesRet)
 {
     CBlockIndex* pindexPrev = pindexBest;
 
@@ -3337,6 +4597,8 @@ CBlock* CreateNewBlock(CReserveKey& reservekey)
 
     // Add our coinbase tx as first transaction
     pblock->vtx.push_back(txNew);
+    if (pvTxFeesRet)
+        pvTxFeesRet->assign(1, 0);
 
     // Collect memory pool transactions into the block
     int64 nFees = 0;
@@ -3344,63 +4606,32 @@ CBlock* CreateNewBlock(CReserveKey& reservekey)
     CRITICAL_BLOCK(cs_mapTransactions)
     {
         CTxDB txdb("r");
+        int nHeight = pindexPrev->nHeight + 1;
+        // Copies made while growing would drop the hashes kept below
+        pblock->vtx.reserve(mapTransactions.size() + 1);
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
+        // Priority order to process transactions, one with parents in the
+        // memory pool waits until they're all in the block
+        map<uint256, int> mapWaiting;
         multimap<double, CTransaction*> mapPriority;
-        for (map<uint256, CTransaction>::iterator mi = mapTransactions.begin(); mi != mapTransactions.end(); ++mi)
+        for (CTransactionMap::iterator mi = mapTransactions.begin(); mi != mapTransactions.end(); ++mi)
         {
             CTransaction& tx = (*mi).second;
             if (tx.IsCoinBase() || !tx.IsFinal())
                 continue;
+            CMemPoolInfoMap::iterator mii = mapMemPoolInfo.find((*mi).first);
+            if (mii == mapMemPoolInfo.end() || !(*mii).second.fInputsKnown)
+                continue;
+            const CMemPoolInfo& info = (*mii).second;
+            double dPriority = info.GetPriority(nHeight);
 
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            foreach(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                CTransaction txPrev;
-                CTxIndex txindex;
-                if (!txPrev.ReadFromDisk(txdb, txin.prevout, txindex))
-                {
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    continue;
-                }
-                int64 nValueIn = txPrev.vout[txin.prevout.n].nValue;
-
-                // Read block header
-                int nConf = txindex.GetDepthInMainChain();
-
-                dPriority += (double)nValueIn * nConf;
-
-                if (fDebug && GetBoolArg("-printpriority"))
-                    printf("priority     nValueIn=%-12I64d nConf=%-5d dPriority=%-20.1f\n", nValueIn, nConf, dPriority);
-            }
-
-            // Priority is sum(valuein * age) / txsize
-            dPriority /= ::GetSerializeSize(tx, SER_NETWORK);
-
-            if (porphan)
-                porphan->dPriority = dPriority;
+            if (info.setDependsOn.empty())
+                mapPriority.insert(make_pair(-dPriority, &tx));
             else
-                mapPriority.insert(make_pair(-dPriority, &(*mi).second));
+                mapWaiting[(*mi).first] = info.setDependsOn.size();
 
             if (fDebug && GetBoolArg("-printpriority"))
-            {
-                printf("priority %-20.1f %s\n%s", dPriority, tx.GetHash().ToString().substr(0,10).c_str(), tx.ToString().c_str());
-                if (porphan)
-                    porphan->print();
-                printf("\n");
-            }
+                printf("priority %-20.1f %s waiting on %d\n", dPriority, tx.GetHash().ToString().substr(0,10).c_str(), info.setDependsOn.size());
         }
 
         // Collect transactions into block
@@ -3413,50 +4644,78 @@ CBlock* CreateNewBlock(CReserveKey& reservekey)
             double dPriority = -(*mapPriority.begin()).first;
             CTransaction& tx = *(*mapPriority.begin()).second;
             mapPriority.erase(mapPriority.begin());
+            uint256 hash = tx.GetHash();
+            CMemPoolInfo& info = mapMemPoolInfo[hash];
 
             // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK);
-            if (nBlockSize + nTxSize >= MAX_BLOCK_SIZE_GEN)
+            if (nBlockSize + info.nSize >= MAX_BLOCK_SIZE_GEN)
                 continue;
-            int nTxSigOps = tx.GetSigOpCount();
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            if (nBlockSigOps + info.nSigOps >= MAX_BLOCK_SIGOPS)
                 continue;
 
             // Transaction fee required depends on block size
-            bool fAllowFree = (nBlockSize + nTxSize < 4000 || CTransaction::AllowFree(dPriority));
+            bool fAllowFree = (nBlockSize + info.nSize < 4000 || CTransaction::AllowFree(dPriority));
             int64 nMinFee = tx.GetMinFee(nBlockSize, fAllowFree);
+            if (info.nFee < nMinFee)
+                continue;
 
-            // Connecting shouldn't fail due to dependency on other memory pool transactions
-            // because we're already processing them in order of dependency
-            map<uint256, CTxIndex> mapTestPoolTmp(mapTestPool);
-            if (!tx.ConnectInputs(txdb, mapTestPoolTmp, CDiskTxPos(1,1,1), pindexPrev, nFees, false, true, nMinFee))
+            // Coinbase spends have to be mature at this height
+            if (info.nCoinbaseHeight >= 0 && pindexPrev->nHeight - info.nCoinbaseHeight < COINBASE_MATURITY)
                 continue;
-            swap(mapTestPool, mapTestPoolTmp);
 
-            // Added
+            // Inputs and signatures checked on the way into the pool stay
+            // good and conflicts leave it when a block comes in.  Only rules
+            // that depend on the height, and transactions taken in without
+            // checking, need connecting here.
+            if (!info.fInputsVerified || hooks->IsHeightDependent(tx))
+            {
+                int64 nTxFees = 0;
+                map<uint256, CTxIndex> mapTestPoolTmp(mapTestPool);
+                if (!tx.ConnectInputs(txdb, mapTestPoolTmp, CDiskTxPos(1,1,1), pindexPrev, nTxFees, false, true, nMinFee))
+                    continue;
+                swap(mapTestPool, mapTestPoolTmp);
+                info.fInputsVerified = true;
+            }
+            else
+                mapTestPool[hash] = CTxIndex(CDiskTxPos(1,1,1), tx.vout.size());
+
+            // Added, an unchanged copy so the pool's hash still holds
             pblock->vtx.push_back(tx);
-            nBlockSize += nTxSize;
-            nBlockSigOps += nTxSigOps;
+            pblock->vtx.back().hashCached = hash;
+            nBlockSize += info.nSize;
+            nBlockSigOps += info.nSigOps;
+            nFees += info.nFee;
+            if (pvTxFeesRet)
+                pvTxFeesRet->push_back(info.nFee);
 
             // Add transactions that depend on this one to the priority queue
-            uint256 hash = tx.GetHash();
-            if (mapDependers.count(hash))
+            set<CTransaction*> setChildren;
+            for (unsigned int n = 0; n < tx.vout.size(); n++)
+            {
+                CHashMap<COutPoint, CInPoint, COutPointHasher>::iterator it = mapNextTx.find(COutPoint(hash, n));
+                if (it != mapNextTx.end())
+                    setChildren.insert((*it).second.ptx);
+            }
+            foreach(CTransaction* ptxChild, setChildren)
             {
-                foreach(COrphan* porphan, mapDependers[hash])
+                uint256 hashChild = ptxChild->GetHash();
+                map<uint256, int>::iterator mw = mapWaiting.find(hashChild);
+                if (mw != mapWaiting.end() && --(*mw).second == 0)
                 {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                            mapPriority.insert(make_pair(-porphan->dPriority, porphan->ptx));
-                    }
+                    mapWaiting.erase(mw);
+                    mapPriority.insert(make_pair(-mapMemPoolInfo[hashChild].GetPriority(nHeight), ptxChild));
                 }
             }
         }
     }
     pblock->vtx[0].vout[0].nValue = GetBlockValue(pindexPrev->nHeight+1, nFees);
+    pblock->vtx[0].InvalidateHash();
+    if (pvTxFeesRet)
+        (*pvTxFeesRet)[0] = nFees;
 
     // Fill in header
+    if (pindexPrev->nHeight+1 >= hooks->AuxPowStartHeight())
+        pblock->nVersion = 1 | hooks->AuxPowChainID() * BLOCK_VERSION_CHAIN_START;
     pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
     pblock->nTime          = max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
@@ -3477,6 +4736,7 @@ void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int&
         nPrevTime = nNow;
     }
     pblock->vtx[0].vin[0].scriptSig = CScript() << pblock->nBits << CBigNum(nExtraNonce);
+    pblock->vtx[0].InvalidateHash();
     pblock->hashMerkleRoot = pblock->BuildMerkleTree();
 }
 
@@ -3527,9 +4787,9 @@ void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash
 }
 
 
-bool CheckWork(CBlock* pblock, CReserveKey& reservekey)
+bool CheckWorkProof(CBlock* pblock)
 {
-    uint256 hash = pblock->GetHash();
+    uint256 hash = pblock->GetPoWHash();
     uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
 
     if (hash > hashTarget)
@@ -3541,16 +4801,17 @@ bool CheckWork(CBlock* pblock, CReserveKey& reservekey)
     pblock->print();
     printf("%s ", DateTimeStrFormat("%x %H:%M", GetTime()).c_str());
     printf("generated %s\n", FormatMoney(pblock->vtx[0].vout[0].nValue).c_str());
+    return true;
+}
 
-    // Found a solution
+// The caller has kept the reserved key the block pays to
+bool ProcessFoundBlock(CBlock* pblock)
+{
     CRITICAL_BLOCK(cs_main)
     {
         if (pblock->hashPrevBlock != hashBestChain)
             return error("BitcoinMiner : generated block is stale");
 
-        // Remove key from key pool
-        reservekey.KeepKey();
-
         // Track how many getdata requests this block gets
         CRITICAL_BLOCK(cs_mapRequestCount)
             mapRequestCount[pblock->GetHash()] = 0;
@@ -3559,24 +4820,185 @@ bool CheckWork(CBlock* pblock, CReserveKey& reservekey)
         if (!ProcessBlock(NULL, pblock))
             return error("BitcoinMiner : ProcessBlock, block not accepted");
     }
+    return true;
+}
+
+
+//
+// The miner threads share one block template, rebuilt when the best chain
+// or the memory pool changes.  Every thread takes the next extra nonce from
+// it, so each has its own merkle root and the nonce ranges never overlap.
+// The template and its reserved key live while nTemplateMiners > 0.
+//
+static CCriticalSection cs_minerTemplate;
+static int nTemplateMiners = 0;
+static auto_ptr<CBlock> pblockTemplate;
+static CReserveKey* preservekeyTemplate = NULL;
+static CBlockIndex* pindexTemplatePrev = NULL;
+static unsigned int nTemplateTransactionsUpdated = 0;
+static int64 nTemplateStart = 0;
+static unsigned int nTemplateExtraNonce = 0;
+
+bool GetMinerWork(CBlock& block, CBlockIndex*& pindexPrev, unsigned int& nTransactionsUpdatedLast, int64& nStart)
+{
+    unsigned int nExtraNonce;
+    CRITICAL_BLOCK(cs_minerTemplate)
+    {
+        if (!pblockTemplate.get() || pindexTemplatePrev != pindexBest ||
+            (nTransactionsUpdated != nTemplateTransactionsUpdated && GetTime() - nTemplateStart > 60))
+        {
+            // Extra nonces only have to be unique per previous block
+            if (pindexTemplatePrev != pindexBest)
+                nTemplateExtraNonce = 0;
+            nTemplateTransactionsUpdated = nTransactionsUpdated;
+            pindexTemplatePrev = pindexBest;
+            if (!preservekeyTemplate)
+                preservekeyTemplate = new CReserveKey();
+            pblockTemplate.reset(CreateNewBlock(*preservekeyTemplate));
+            if (!pblockTemplate.get())
+                return false;
+            nTemplateStart = GetTime();
+            printf("Running BitcoinMiner with %d transactions in block\n", pblockTemplate->vtx.size());
+        }
+        block = *pblockTemplate;
+        pindexPrev = pindexTemplatePrev;
+        nTransactionsUpdatedLast = nTemplateTransactionsUpdated;
+        nStart = nTemplateStart;
+        nExtraNonce = ++nTemplateExtraNonce;
+    }
 
-    Sleep(2000);
+    block.vtx[0].vin[0].scriptSig = CScript() << block.nBits << CBigNum(nExtraNonce);
+    block.vtx[0].InvalidateHash();
+    block.hashMerkleRoot = block.BuildMerkleTree();
     return true;
 }
 
+bool CheckMinerWork(CBlock* pblock)
+{
+    if (!CheckWorkProof(pblock))
+        return false;
+
+    // The template's reserved key is shared, keep it and drop the template
+    // that pays to it.  The other miners aren't held up while the block
+    // is connected, they find the tip moved and get a new template.
+    CRITICAL_BLOCK(cs_minerTemplate)
+    {
+        if (!preservekeyTemplate)
+            return false;
+        CRITICAL_BLOCK(cs_main)
+            if (pblock->hashPrevBlock != hashBestChain)
+                return error("BitcoinMiner : generated block is stale");
+        preservekeyTemplate->KeepKey();
+        pblockTemplate.reset();
+    }
+    return ProcessFoundBlock(pblock);
+}
+
+
+//
+// Hash meter, one slot per miner thread.  A thread only writes its own slot
+// and the totals are summed without taking a lock.  The padding keeps the
+// slots on separate cache lines.
+//
+struct CHashMeter
+{
+    bool fInUse;
+    int64 nHashes;
+    int64 nTimeStart;
+    double dHashesPerSec;
+    char pchPadding[64];
+};
+
+static const int MAX_HASHMETERS = 64;
+static CHashMeter vHashMeter[MAX_HASHMETERS];
+static CCriticalSection cs_vHashMeter;
+
+class CHashMeterSlot
+{
+public:
+    CHashMeter* pmeter;
+    int nSlot;
+
+    CHashMeterSlot()
+    {
+        pmeter = NULL;
+        nSlot = -1;
+        CRITICAL_BLOCK(cs_minerTemplate)
+            nTemplateMiners++;
+        CRITICAL_BLOCK(cs_vHashMeter)
+        {
+            for (int i = 0; i < MAX_HASHMETERS; i++)
+            {
+                if (!vHashMeter[i].fInUse)
+                {
+                    nSlot = i;
+                    pmeter = &vHashMeter[i];
+                    pmeter->nHashes = 0;
+                    pmeter->nTimeStart = GetTimeMillis();
+                    pmeter->dHashesPerSec = 0;
+                    pmeter->fInUse = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    ~CHashMeterSlot()
+    {
+        CRITICAL_BLOCK(cs_vHashMeter)
+            if (pmeter)
+                pmeter->fInUse = false;
+
+        // Give the template's key back when the last miner stops.  Counting
+        // under the template's lock means a miner starting meanwhile either
+        // keeps it alive or builds a new one after it's gone.
+        CRITICAL_BLOCK(cs_minerTemplate)
+        {
+            if (--nTemplateMiners == 0)
+            {
+                pblockTemplate.reset();
+                pindexTemplatePrev = NULL;
+                delete preservekeyTemplate;
+                preservekeyTemplate = NULL;
+            }
+        }
+    }
+
+    // The lowest slot in use reports the total
+    bool IsReporter() const
+    {
+        for (int i = 0; i < nSlot; i++)
+            if (vHashMeter[i].fInUse)
+                return false;
+        return true;
+    }
+};
+
+double GetMinerHashesPerSec(vector<double>& vThreadRates)
+{
+    double dTotal = 0;
+    int64 nNow = GetTimeMillis();
+    vThreadRates.clear();
+    for (int i = 0; i < MAX_HASHMETERS; i++)
+    {
+        const CHashMeter& meter = vHashMeter[i];
+        if (!meter.fInUse)
+            continue;
+        double dRate = (nNow - meter.nTimeStart > 8000 ? 0 : meter.dHashesPerSec);
+        vThreadRates.push_back(dRate);
+        dTotal += dRate;
+    }
+    return dTotal;
+}
+
 
 void BitcoinMiner()
 {
     printf("BitcoinMiner started\n");
     SetThreadPriority(THREAD_PRIORITY_LOWEST);
-    bool f4WaySSE2 = Detect128BitSSE2();
-    if (mapArgs.count("-4way"))
-        f4WaySSE2 = GetBoolArg("-4way");
-
-    // Each thread has its own key and counter
-    CReserveKey reservekey;
-    unsigned int nExtraNonce = 0;
-    int64 nPrevTime = 0;
+    ScanHashFunction pScanHash = SelectScanHash();
+    CHashMeterSlot meterslot;
+    CHashMeter* pmeter = meterslot.pmeter;
 
     while (fGenerateBitcoins)
     {
@@ -3595,17 +5017,15 @@ void BitcoinMiner()
 
 
         //
-        // Create new block
+        // Take work from the shared block template
         //
-        unsigned int nTransactionsUpdatedLast = nTransactionsUpdated;
-        CBlockIndex* pindexPrev = pindexBest;
-
-        auto_ptr<CBlock> pblock(CreateNewBlock(reservekey));
-        if (!pblock.get())
+        CBlock block;
+        CBlock* pblock = &block;
+        CBlockIndex* pindexPrev;
+        unsigned int nTransactionsUpdatedLast;
+        int64 nStart;
+        if (!GetMinerWork(block, pindexPrev, nTransactionsUpdatedLast, nStart))
             return;
-        IncrementExtraNonce(pblock.get(), pindexPrev, nExtraNonce, nPrevTime);
-
-        printf("Running BitcoinMiner with %d transactions in block\n", pblock->vtx.size());
 
 
         //
@@ -3615,7 +5035,7 @@ void BitcoinMiner()
         char pdatabuf[128+16];    char* pdata     = alignup<16>(pdatabuf);
         char phash1buf[64+16];    char* phash1    = alignup<16>(phash1buf);
 
-        FormatHashBuffers(pblock.get(), pmidstate, pdata, phash1);
+        FormatHashBuffers(pblock, pmidstate, pdata, phash1);
 
         unsigned int& nBlockTime = *(unsigned int*)(pdata + 64 + 4);
         unsigned int& nBlockNonce = *(unsigned int*)(pdata + 64 + 12);
@@ -3624,7 +5044,6 @@ void BitcoinMiner()
         //
         // Search
         //
-        int64 nStart = GetTime();
         uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
         uint256 hashbuf[2];
         uint256& hash = *alignup<16>(hashbuf);
@@ -3633,14 +5052,8 @@ void BitcoinMiner()
             unsigned int nHashesDone = 0;
             unsigned int nNonceFound;
 
-#ifdef FOURWAYSSE2
-            if (f4WaySSE2)
-                // tcatm's 4-way 128-bit SSE2 SHA-256
-                nNonceFound = ScanHash_4WaySSE2(pmidstate, pdata + 64, phash1, (char*)&hash, nHashesDone);
-            else
-#endif
-                // Crypto++ SHA-256
-                nNonceFound = ScanHash_CryptoPP(pmidstate, pdata + 64, phash1, (char*)&hash, nHashesDone);
+            // Kernel picked for this CPU by SelectScanHash
+            nNonceFound = pScanHash(pmidstate, pdata + 64, phash1, (char*)&hash, nHashesDone);
 
             // Check if something found
             if (nNonceFound != -1)
@@ -3655,31 +5068,27 @@ void BitcoinMiner()
                     assert(hash == pblock->GetHash());
 
                     SetThreadPriority(THREAD_PRIORITY_NORMAL);
-                    CheckWork(pblock.get(), reservekey);
+                    CheckMinerWork(pblock);
                     SetThreadPriority(THREAD_PRIORITY_LOWEST);
                     break;
                 }
             }
 
             // Meter hashes/sec
-            static int64 nHashCounter;
-            if (nHPSTimerStart == 0)
-            {
-                nHPSTimerStart = GetTimeMillis();
-                nHashCounter = 0;
-            }
-            else
-                nHashCounter += nHashesDone;
-            if (GetTimeMillis() - nHPSTimerStart > 4000)
+            if (pmeter)
             {
-                static CCriticalSection cs;
-                CRITICAL_BLOCK(cs)
+                pmeter->nHashes += nHashesDone;
+                int64 nNow = GetTimeMillis();
+                if (nNow - pmeter->nTimeStart > 4000)
                 {
-                    if (GetTimeMillis() - nHPSTimerStart > 4000)
+                    pmeter->dHashesPerSec = 1000.0 * pmeter->nHashes / (nNow - pmeter->nTimeStart);
+                    pmeter->nTimeStart = nNow;
+                    pmeter->nHashes = 0;
+                    if (meterslot.IsReporter())
                     {
-                        dHashesPerSec = 1000.0 * nHashCounter / (GetTimeMillis() - nHPSTimerStart);
-                        nHPSTimerStart = GetTimeMillis();
-                        nHashCounter = 0;
+                        vector<double> vThreadRates;
+                        dHashesPerSec = GetMinerHashesPerSec(vThreadRates);
+                        nHPSTimerStart = nNow;
                         string strStatus = strprintf("    %.0f khash/s", dHashesPerSec/1000.0);
                         UIThreadCall(boost::bind(CalledSetStatusBar, strStatus, 0));
                         static int64 nLogTime;
@@ -3914,6 +5323,7 @@ bool CreateTransaction(const vector<pair<CScript, int64> >& vecSend, CWalletTx&
             {
                 wtxNew.vin.clear();
                 wtxNew.vout.clear();
+                wtxNew.InvalidateHash();
                 wtxNew.fFromMe = true;
 
                 int64 nTotalValue = nValue + nFeeRet;
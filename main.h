@@ -11,6 +11,8 @@ class CTxOut;
 class CTransaction;
 class CBlock;
 class CBlockIndex;
+class CAuxPow;
+class CScriptCheck;
 class CWalletTx;
 class CKeyItem;
 class CHooks;
@@ -23,6 +25,12 @@ static const int64 CENT = 1000000;
 static const int64 MAX_MONEY = 21000000 * COIN;
 inline bool MoneyRange(int64 nValue) { return (nValue >= 0 && nValue <= MAX_MONEY); }
 static const int COINBASE_MATURITY = 100;
+// Blocks between forced disk syncs while downloading the initial block chain
+static const int SYNC_BATCH_BLOCKS = 500;
+// Merged mining, the version says if a block carries an auxiliary proof of
+// work and which chain it's for
+static const int BLOCK_VERSION_AUXPOW = (1 << 8);
+static const int BLOCK_VERSION_CHAIN_START = (1 << 16);
 
 
 
@@ -30,7 +38,8 @@ static const int COINBASE_MATURITY = 100;
 
 
 extern CCriticalSection cs_main;
-extern map<uint256, CBlockIndex*> mapBlockIndex;
+typedef CHashMap<uint256, CBlockIndex*, CUint256Hasher> CBlockIndexMap;
+extern CBlockIndexMap mapBlockIndex;
 extern uint256 hashGenesisBlock;
 extern CBigNum bnProofOfWorkLimit;
 extern CBlockIndex* pindexGenesisBlock;
@@ -46,6 +55,7 @@ extern map<string, string> mapAddressBook;
 extern CCriticalSection cs_mapAddressBook;
 extern vector<unsigned char> vchDefaultKey;
 extern double dHashesPerSec;
+extern const char* pszHashKernel;
 extern int64 nHPSTimerStart;
 
 // Settings
@@ -72,10 +82,12 @@ void WalletUpdateSpent(const COutPoint& prevout);
 int ScanForWalletTransactions(CBlockIndex* pindexStart);
 void ReacceptWalletTransactions();
 bool LoadBlockIndex(bool fAllowNew=true);
+bool ReconnectBlocks();
 void PrintBlockTree();
 bool ProcessMessages(CNode* pfrom);
 bool ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv);
 bool SendMessages(CNode* pto, bool fSendTrickle);
+bool ProcessBlock(CNode* pfrom, CBlock* pblock);
 int64 GetBalance();
 bool CreateTransaction(const vector<pair<CScript, int64> >& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, int64& nFeeRet);
 bool CreateTransaction(CScript scriptPubKey, int64 nValue, CWalletTx& wtxNew, CReserveKey& reservekey, int64& nFeeRet);
@@ -85,11 +97,27 @@ string SendMoney(CScript scriptPubKey, int64 nValue, CWalletTx& wtxNew, bool fAs
 string SendMoneyToBitcoinAddress(string strAddress, int64 nValue, CWalletTx& wtxNew, bool fAskFee=false);
 void GenerateBitcoins(bool fGenerate);
 void ThreadBitcoinMiner(void* parg);
-CBlock* CreateNewBlock(CReserveKey& reservekey);
+CBlock* CreateNewBlock(CReserveKey& reservekey, vector<int64>* pvTxFeesRet=NULL);
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce, int64& nPrevTime);
 void FormatHashBuffers(CBlock* pblock, char* pmidstate, char* pdata, char* phash1);
-bool CheckWork(CBlock* pblock, CReserveKey& reservekey);
+typedef unsigned int (*ScanHashFunction)(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone);
+unsigned int ScanHash_CryptoPP(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone);
+#ifdef FOURWAYSSE2
+// sha256.cpp, each only after its CPU check
+unsigned int ScanHash_4WaySSE2(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone);
+unsigned int ScanHash_8WayAVX2(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone);
+unsigned int ScanHash_SHANI(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone);
+// sha256ref.cpp, only linked into bench_bitcoin and test_bitcoin
+unsigned int ScanHash_4WaySSE2Ref(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone);
+#endif
+bool TestScanHash(ScanHashFunction pScanHash);
+bool Detect128BitSSE2();
+bool DetectAVX2();
+bool DetectSHANI();
+bool CheckWorkProof(CBlock* pblock);
+bool ProcessFoundBlock(CBlock* pblock);
 void BitcoinMiner();
+double GetMinerHashesPerSec(vector<double>& vThreadRates);
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
 bool IsInitialBlockDownload();
 string GetWarnings(string strFor);
@@ -210,6 +238,15 @@ public:
     }
 };
 
+class COutPointHasher
+{
+public:
+    uint64 operator()(const COutPoint& prevout) const
+    {
+        return CUint256Hasher()(prevout.hash) ^ (prevout.n * 0xc2b2ae3d27d4eb4fULL);
+    }
+};
+
 
 
 
@@ -407,12 +444,31 @@ public:
     vector<CTxOut> vout;
     unsigned int nLockTime;
 
+    // memory only
+    mutable uint256 hashCached;
+
 
     CTransaction()
     {
         SetNull();
     }
 
+    // A copy is usually made to be changed, it hashes itself again
+    CTransaction(const CTransaction& tx) : nVersion(tx.nVersion), vin(tx.vin), vout(tx.vout), nLockTime(tx.nLockTime)
+    {
+        hashCached = 0;
+    }
+
+    CTransaction& operator=(const CTransaction& tx)
+    {
+        nVersion = tx.nVersion;
+        vin = tx.vin;
+        vout = tx.vout;
+        nLockTime = tx.nLockTime;
+        hashCached = 0;
+        return *this;
+    }
+
     IMPLEMENT_SERIALIZE
     (
         READWRITE(this->nVersion);
@@ -420,6 +476,8 @@ public:
         READWRITE(vin);
         READWRITE(vout);
         READWRITE(nLockTime);
+        if (fRead)
+            hashCached = 0;
     )
 
     void SetNull()
@@ -428,6 +486,14 @@ public:
         vin.clear();
         vout.clear();
         nLockTime = 0;
+        hashCached = 0;
+    }
+
+    // Anything that changes vin, vout or nLockTime after GetHash() may
+    // have been called must call this
+    void InvalidateHash()
+    {
+        hashCached = 0;
     }
 
     bool IsNull() const
@@ -437,7 +503,12 @@ public:
 
     uint256 GetHash() const
     {
-        return SerializeHash(*this);
+        if (hashCached == 0)
+            hashCached = SerializeHash(*this);
+#ifdef DEBUG_HASHCACHE
+        assert(hashCached == SerializeHash(*this));
+#endif
+        return hashCached;
     }
 
     bool IsFinal(int nBlockHeight=0, int64 nBlockTime=0) const
@@ -501,6 +572,17 @@ public:
         return n;
     }
 
+    // Rough heap footprint once decoded, not the serialized size
+    unsigned int GetMemoryUsage() const
+    {
+        unsigned int nUsage = sizeof(*this) + vin.capacity() * sizeof(CTxIn) + vout.capacity() * sizeof(CTxOut);
+        foreach(const CTxIn& txin, vin)
+            nUsage += txin.scriptSig.capacity();
+        foreach(const CTxOut& txout, vout)
+            nUsage += txout.scriptPubKey.capacity();
+        return nUsage;
+    }
+
     bool IsStandard() const
     {
         foreach(const CTxIn& txin, vin)
@@ -626,26 +708,7 @@ public:
     }
 
 
-    bool ReadFromDisk(CDiskTxPos pos, FILE** pfileRet=NULL)
-    {
-        CAutoFile filein = OpenBlockFile(pos.nFile, 0, pfileRet ? "rb+" : "rb");
-        if (!filein)
-            return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
-
-        // Read transaction
-        if (fseek(filein, pos.nTxPos, SEEK_SET) != 0)
-            return error("CTransaction::ReadFromDisk() : fseek failed");
-        filein >> *this;
-
-        // Return file pointer
-        if (pfileRet)
-        {
-            if (fseek(filein, pos.nTxPos, SEEK_SET) != 0)
-                return error("CTransaction::ReadFromDisk() : second fseek failed");
-            *pfileRet = filein.release();
-        }
-        return true;
-    }
+    bool ReadFromDisk(CDiskTxPos pos, FILE** pfileRet=NULL);
 
     friend bool operator==(const CTransaction& a, const CTransaction& b)
     {
@@ -688,7 +751,8 @@ public:
     bool ReadFromDisk(COutPoint prevout);
     bool DisconnectInputs(CTxDB& txdb, CBlockIndex* pindex);
     bool ConnectInputs(CTxDB& txdb, map<uint256, CTxIndex>& mapTestPool, CDiskTxPos posThisTx,
-                       CBlockIndex* pindexBlock, int64& nFees, bool fBlock, bool fMiner, int64 nMinFee=0);
+                       CBlockIndex* pindexBlock, int64& nFees, bool fBlock, bool fMiner, int64 nMinFee=0,
+                       vector<CScriptCheck>* pvChecks=NULL);
     bool ClientConnectInputs();
     bool CheckTransaction() const;
     bool AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL);
@@ -698,7 +762,7 @@ public:
         return AcceptToMemoryPool(txdb, fCheckInputs, pfMissingInputs);
     }
 protected:
-    bool AddToMemoryPoolUnchecked();
+    bool AddToMemoryPoolUnchecked(CTxDB& txdb, bool fInputsVerified=false);
 public:
     bool RemoveFromMemoryPool();
 };
@@ -707,6 +771,45 @@ public:
 
 
 
+//
+// Script verification of one input, deferred so ConnectBlock can run the
+// checks of a whole block on the script check threads.  txTo must outlive it.
+//
+class CScriptCheck
+{
+public:
+    CScript scriptPubKey;
+    const CTransaction* ptxTo;
+    unsigned int nIn;
+    boost::shared_ptr<CSignatureHashCache> psighashcache;
+
+    CScriptCheck()
+    {
+        ptxTo = NULL;
+        nIn = 0;
+    }
+
+    CScriptCheck(const CTxOut& txoutPrev, const CTransaction& txTo, unsigned int nInIn,
+                 const boost::shared_ptr<CSignatureHashCache>& psighashcacheIn)
+    {
+        scriptPubKey = txoutPrev.scriptPubKey;
+        ptxTo = &txTo;
+        nIn = nInIn;
+        psighashcache = psighashcacheIn;
+    }
+
+    bool operator()() const
+    {
+        return VerifyScript(ptxTo->vin[nIn].scriptSig, scriptPubKey, *ptxTo, nIn, 0, psighashcache.get());
+    }
+};
+
+void StartScriptCheckThreads(int nThreads);
+bool RunScriptChecks(vector<CScriptCheck>& vChecks);
+
+
+
+
 //
 // A transaction with a merkle branch linking it to the block chain
 //
@@ -760,6 +863,16 @@ public:
 
 
 
+template<typename Stream>
+unsigned int ReadWriteAuxPow(Stream& s, const boost::shared_ptr<CAuxPow>& auxpow, int nType, int nVersion, CSerActionGetSerializeSize ser_action);
+template<typename Stream>
+unsigned int ReadWriteAuxPow(Stream& s, const boost::shared_ptr<CAuxPow>& auxpow, int nType, int nVersion, CSerActionSerialize ser_action);
+template<typename Stream>
+unsigned int ReadWriteAuxPow(Stream& s, boost::shared_ptr<CAuxPow>& auxpow, int nType, int nVersion, CSerActionUnserialize ser_action);
+
+
+
+
 //
 // A transaction with a bunch of additional info that only the owner cares
 // about.  It includes any unrecorded transactions needed to link it back
@@ -1037,9 +1150,12 @@ public:
 
     // network and disk
     vector<CTransaction> vtx;
+    boost::shared_ptr<CAuxPow> auxpow;
 
     // memory only
     mutable vector<uint256> vMerkleTree;
+    mutable uint256 hashCached;
+    mutable unsigned char pchHeaderCached[80];
 
 
     CBlock()
@@ -1057,6 +1173,13 @@ public:
         READWRITE(nBits);
         READWRITE(nNonce);
 
+        // Merged mining proof, part of the header so a header only read
+        // still leaves the stream at vtx
+        if (!(nType & SER_GETHASH) && (this->nVersion & BLOCK_VERSION_AUXPOW))
+            nSerSize += ReadWriteAuxPow(s, auxpow, nType, nVersion, ser_action);
+        else if (fRead)
+            const_cast<CBlock*>(this)->auxpow.reset();
+
         // ConnectBlock depends on vtx being last so it can calculate offset
         if (!(nType & (SER_GETHASH|SER_BLOCKHEADERONLY)))
             READWRITE(vtx);
@@ -1073,7 +1196,9 @@ public:
         nBits = 0;
         nNonce = 0;
         vtx.clear();
+        auxpow.reset();
         vMerkleTree.clear();
+        hashCached = 0;
     }
 
     bool IsNull() const
@@ -1083,7 +1208,18 @@ public:
 
     uint256 GetHash() const
     {
-        return Hash(BEGIN(nVersion), END(nNonce));
+        // The miner and getwork change the header fields in place, so the
+        // cached hash is only used while the header bytes it was taken from
+        // are unchanged.  Comparing 80 bytes is far cheaper than hashing them.
+        if (hashCached == 0 || memcmp(pchHeaderCached, BEGIN(nVersion), sizeof(pchHeaderCached)) != 0)
+        {
+            memcpy(pchHeaderCached, BEGIN(nVersion), sizeof(pchHeaderCached));
+            hashCached = Hash(BEGIN(nVersion), END(nNonce));
+        }
+#ifdef DEBUG_HASHCACHE
+        assert(hashCached == Hash(BEGIN(nVersion), END(nNonce)));
+#endif
+        return hashCached;
     }
 
     int64 GetBlockTime() const
@@ -1091,6 +1227,14 @@ public:
         return (int64)nTime;
     }
 
+    int GetChainID() const
+    {
+        return nVersion / BLOCK_VERSION_CHAIN_START;
+    }
+
+    uint256 GetPoWHash() const;
+    bool CheckProofOfWork(int nHeight) const;
+
     int GetSigOpCount() const
     {
         int n = 0;
@@ -1108,12 +1252,23 @@ public:
         int j = 0;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
+#ifdef FOURWAYSSE2
+            // Each pair on a level is a 64 byte message already laid out in
+            // order, hash them several at a time
+            int nPairs = nSize / 2;
+            vMerkleTree.resize(j + nSize + nPairs);
+            SHA256D64((unsigned char*)&vMerkleTree[j+nSize], (const unsigned char*)&vMerkleTree[j], nPairs);
+            if (nSize & 1)
+                vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1]),
+                                           BEGIN(vMerkleTree[j+nSize-1]), END(vMerkleTree[j+nSize-1])));
+#else
             for (int i = 0; i < nSize; i += 2)
             {
                 int i2 = min(i+1, nSize-1);
                 vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
                                            BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
             }
+#endif
             j += nSize;
         }
         return (vMerkleTree.empty() ? 0 : vMerkleTree.back());
@@ -1170,7 +1325,7 @@ public:
 
         // Flush stdio buffers and commit to disk before returning
         fflush(fileout);
-        if (!IsInitialBlockDownload() || (nBestHeight+1) % 500 == 0)
+        if (!IsInitialBlockDownload() || (nBestHeight+1) % SYNC_BATCH_BLOCKS == 0)
         {
 #ifdef __WXMSW__
             _commit(_fileno(fileout));
@@ -1182,26 +1337,7 @@ public:
         return true;
     }
 
-    bool ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions=true)
-    {
-        SetNull();
-
-        // Open history file to read
-        CAutoFile filein = OpenBlockFile(nFile, nBlockPos, "rb");
-        if (!filein)
-            return error("CBlock::ReadFromDisk() : OpenBlockFile failed");
-        if (!fReadTransactions)
-            filein.nType |= SER_BLOCKHEADERONLY;
-
-        // Read block
-        filein >> *this;
-
-        // Check the header
-        if (!CheckProofOfWork(GetHash(), nBits))
-            return error("CBlock::ReadFromDisk() : errors in block header");
-
-        return true;
-    }
+    bool ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions=true);
 
 
 
@@ -1232,12 +1368,254 @@ public:
     bool SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew);
     bool AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos);
     bool CheckBlock() const;
-    bool AcceptBlock();
+    bool AcceptBlock(unsigned int nFile=0, unsigned int nBlockPos=0);
 };
 
 
 
 
+//
+// Proof of work done on a block of another chain, merged mining.  The
+// parent block's coinbase commits to a merkle tree of aux chain block
+// hashes and the parent block's hash has to meet our target.  The parent
+// coinbase and its merkle branch are the CMerkleTx part.
+//
+class CAuxPow : public CMerkleTx
+{
+public:
+    // Links our block hash to the root committed in the parent coinbase
+    vector<uint256> vChainMerkleBranch;
+    int nChainIndex;
+    // Header only
+    CBlock parentBlock;
+
+
+    CAuxPow()
+    {
+        nChainIndex = 0;
+    }
+
+    CAuxPow(const CTransaction& txIn) : CMerkleTx(txIn)
+    {
+        nChainIndex = 0;
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        nSerSize += SerReadWrite(s, *(CMerkleTx*)this, nType, nVersion, ser_action);
+        nVersion = this->nVersion;
+        READWRITE(vChainMerkleBranch);
+        READWRITE(nChainIndex);
+
+        // The parent is always read and written as a bare header, whatever
+        // its version bits say
+        READWRITE(parentBlock.nVersion);
+        READWRITE(parentBlock.hashPrevBlock);
+        READWRITE(parentBlock.hashMerkleRoot);
+        READWRITE(parentBlock.nTime);
+        READWRITE(parentBlock.nBits);
+        READWRITE(parentBlock.nNonce);
+    )
+
+    bool Check(uint256 hashAuxBlock, int nChainID) const;
+};
+
+template<typename Stream>
+unsigned int ReadWriteAuxPow(Stream& s, const boost::shared_ptr<CAuxPow>& auxpow, int nType, int nVersion, CSerActionGetSerializeSize ser_action)
+{
+    if (!auxpow.get())
+        return 0;
+    return ::GetSerializeSize(*auxpow, nType, nVersion);
+}
+
+template<typename Stream>
+unsigned int ReadWriteAuxPow(Stream& s, const boost::shared_ptr<CAuxPow>& auxpow, int nType, int nVersion, CSerActionSerialize ser_action)
+{
+    if (!auxpow.get())
+        throw std::ios_base::failure("ReadWriteAuxPow() : block has the auxpow version bit but no auxpow");
+    ::Serialize(s, *auxpow, nType, nVersion);
+    return 0;
+}
+
+template<typename Stream>
+unsigned int ReadWriteAuxPow(Stream& s, boost::shared_ptr<CAuxPow>& auxpow, int nType, int nVersion, CSerActionUnserialize ser_action)
+{
+    auxpow.reset(new CAuxPow());
+    ::Unserialize(s, *auxpow, nType, nVersion);
+    return 0;
+}
+
+
+
+
+//
+// Recently read or accepted blocks, so reorgs and serving getdata to
+// several peers don't have to open and deserialize the same block again
+//
+class CBlockCache
+{
+protected:
+    struct CEntry
+    {
+        uint256 hash;
+        unsigned int nFile;
+        unsigned int nBlockPos;
+        unsigned int nBytes;
+        CBlock block;
+    };
+
+    mutable CCriticalSection cs;
+    list<CEntry> lruEntries;
+    CHashMap<uint256, list<CEntry>::iterator, CUint256Hasher> mapEntries;
+    map<pair<unsigned int, unsigned int>, uint256> mapPos;
+    uint64 nBytes;
+    uint64 nMaxBytes;
+    uint64 nHits;
+    uint64 nMisses;
+
+    void Touch(list<CEntry>::iterator it);
+    void Copy(const CBlock& block, CBlock& blockRet, bool fReadTransactions) const;
+
+public:
+    CBlockCache()
+    {
+        nBytes = 0;
+        nMaxBytes = 32 * 1024 * 1024;
+        nHits = 0;
+        nMisses = 0;
+    }
+
+    static unsigned int GetMemoryUsage(const CBlock& block);
+
+    void SetMaxBytes(uint64 n);
+    bool Get(unsigned int nFile, unsigned int nBlockPos, CBlock& blockRet, bool fReadTransactions=true);
+    void Add(const CBlock& block, unsigned int nFile, unsigned int nBlockPos);
+    void GetStats(uint64& nEntriesRet, uint64& nBytesRet, uint64& nMaxBytesRet, uint64& nHitsRet, uint64& nMissesRet) const;
+};
+
+extern CBlockCache blockcache;
+
+
+
+
+//
+// Unspent outputs of recently connected blocks, so memory pool and miner
+// validation can read the one output an input spends instead of reading
+// and deserializing the whole previous transaction.  Entries remember the
+// transaction's disk position and are only used when it still matches the
+// tx index, which covers reorgs and blocks that failed to commit.
+//
+class CPrevOutCache
+{
+protected:
+    struct CEntry
+    {
+        COutPoint prevout;
+        CDiskTxPos pos;
+        int nHeight;
+        bool fCoinBase;
+        unsigned int nBytes;
+        CTxOut txout;
+    };
+
+    mutable CCriticalSection cs;
+    list<CEntry> lruEntries;
+    CHashMap<COutPoint, list<CEntry>::iterator, COutPointHasher> mapEntries;
+    uint64 nBytes;
+    uint64 nMaxBytes;
+    uint64 nHits;
+    uint64 nMisses;
+
+    void Erase(const COutPoint& prevout);
+    void Trim();
+
+public:
+    CPrevOutCache()
+    {
+        nBytes = 0;
+        nMaxBytes = 16 * 1024 * 1024;
+        nHits = 0;
+        nMisses = 0;
+    }
+
+    static unsigned int GetMemoryUsage(const CTxOut& txout);
+
+    void SetMaxBytes(uint64 n);
+    bool Get(const COutPoint& prevout, const CDiskTxPos& pos, CTxOut& txoutRet, int& nHeightRet, bool& fCoinBaseRet);
+    void Add(const CTransaction& tx, const CDiskTxPos& pos, int nHeight);
+    void Remove(const CTransaction& tx);
+    void GetStats(uint64& nEntriesRet, uint64& nBytesRet, uint64& nMaxBytesRet, uint64& nHitsRet, uint64& nMissesRet) const;
+};
+
+extern CPrevOutCache prevoutcache;
+
+
+
+
+//
+// Read-only memory mappings of the blk*.dat files.  Looking up a previous
+// output then costs a bounds check instead of an fopen and fseek.  A file
+// is remapped when a read lands past the end of its mapping, which happens
+// once AppendBlockFile has grown it.
+//
+class CBlockFiles
+{
+protected:
+    // Unmapped when the last reader lets go, so a remap doesn't pull the
+    // memory out from under a read in progress
+    struct CMapping
+    {
+        char* pbegin;
+        unsigned int nSize;
+
+        CMapping(char* pbeginIn, unsigned int nSizeIn) : pbegin(pbeginIn), nSize(nSizeIn) { }
+        ~CMapping();
+    };
+
+    CCriticalSection cs;
+    vector<boost::shared_ptr<CMapping> > vMapping;
+
+    bool Map(unsigned int nFile);
+
+public:
+    template<typename T>
+    bool Read(unsigned int nFile, unsigned int nPos, T& obj)
+    {
+#ifndef __WXMSW__
+        for (int nTry = 0; nTry < 2; nTry++)
+        {
+            // Only the lookup is locked, deserializing works on the held mapping
+            boost::shared_ptr<CMapping> pmapping;
+            CRITICAL_BLOCK(cs)
+            {
+                if (nTry > 0 || nFile >= vMapping.size() || !vMapping[nFile] || nPos >= vMapping[nFile]->nSize)
+                    if (!Map(nFile))
+                        return false;
+                pmapping = vMapping[nFile];
+            }
+            if (nPos >= pmapping->nSize)
+                return false;
+            try
+            {
+                CBufferStream stream(pmapping->pbegin + nPos, pmapping->pbegin + pmapping->nSize);
+                stream >> obj;
+                return true;
+            }
+            catch (std::exception& e)
+            {
+                // Ran off the end, the file may have grown since it was mapped
+            }
+        }
+#endif
+        return false;
+    }
+};
+
+extern CBlockFiles blockfiles;
+
+
+
+
 
 
 //
@@ -1340,6 +1718,10 @@ public:
 
     bool CheckIndex() const
     {
+        // The index doesn't keep the parent header of a merge mined block,
+        // its proof of work was checked in full when the block was accepted
+        if (nVersion & BLOCK_VERSION_AUXPOW)
+            return true;
         return CheckProofOfWork(GetBlockHash(), nBits);
     }
 
@@ -1503,7 +1885,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -1549,7 +1931,7 @@ public:
         int nStep = 1;
         foreach(const uint256& hash, vHave)
         {
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1568,7 +1950,7 @@ public:
         // Find the first block the caller has in the main chain
         foreach(const uint256& hash, vHave)
         {
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1584,7 +1966,7 @@ public:
         // Find the first block the caller has in the main chain
         foreach(const uint256& hash, vHave)
         {
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1928,7 +2310,11 @@ public:
 
 
 
-extern map<uint256, CTransaction> mapTransactions;
+typedef CHashMap<uint256, CTransaction, CUint256Hasher> CTransactionMap;
+extern CTransactionMap mapTransactions;
+extern CCriticalSection cs_mapTransactions;
+extern uint64 nMemPoolMaxBytes;
+extern void GetMemPoolStats(uint64& nTxRet, uint64& nBytesRet, uint64& nEvictedRet, uint64& nEvictedBytesRet);
 extern map<uint256, CWalletTx> mapWallet;
 extern vector<uint256> vWalletUpdated;
 extern CCriticalSection cs_mapWallet;
@@ -41,7 +41,6 @@ extern bool DecodeNameScript(const CScript& script, int& op, vector<vector<unsig
 extern bool DecodeNameScript(const CScript& script, int& op, vector<vector<unsigned char> > &vvch, CScript::const_iterator& pc);
 extern int IndexOfNameOutput(CWalletTx& wtx);
 extern bool Solver(const CScript& scriptPubKey, uint256 hash, int nHashType, CScript& scriptSigRet);
-extern bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, int nHashType);
 extern bool GetValueOfNameTx(const CTransaction& tx, vector<unsigned char>& value);
 
 const int NAME_COIN_GENESIS_EXTRA = 521;
@@ -61,6 +60,7 @@ public:
             CDiskTxPos& txPos,
             bool fBlock,
             bool fMiner);
+    virtual bool IsHeightDependent(const CTransaction& tx);
     virtual bool DisconnectInputs(CTxDB& txdb,
             const CTransaction& tx,
             CBlockIndex* pindexBlock);
@@ -71,6 +71,8 @@ public:
     virtual bool Lockin(int nHeight, uint256 hash);
     virtual int LockinHeight();
     virtual string IrcPrefix();
+    virtual int AuxPowStartHeight();
+    virtual int AuxPowChainID();
 
     virtual void MessageStart(char* pchMessageStart)
     {
@@ -127,7 +129,7 @@ int GetTxPosHeight(const CDiskTxPos& txPos)
     if (!block.ReadFromDisk(txPos.nFile, txPos.nBlockPos, false))
         return 0;
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(block.GetHash());
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -176,6 +178,7 @@ bool SignNameSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned
     const CScript& scriptPubKey = RemoveNameScriptPrefix(txout.scriptPubKey);
     uint256 hash = SignatureHash(scriptPrereq + txout.scriptPubKey, txTo, nIn, nHashType);
 
+    txTo.InvalidateHash();
     if (!Solver(scriptPubKey, hash, nHashType, txin.scriptSig))
         return false;
 
@@ -213,6 +216,7 @@ bool CreateTransactionWithInputTx(const vector<pair<CScript, int64> >& vecSend,
             {
                 wtxNew.vin.clear();
                 wtxNew.vout.clear();
+                wtxNew.InvalidateHash();
                 wtxNew.fFromMe = true;
 
                 int64 nTotalValue = nValue + nFeeRet;
@@ -1030,6 +1034,8 @@ bool CNamecoinHooks::ConnectInputs(CTxDB& txdb,
 
         if (op == OP_NAME_FIRSTUPDATE || op == OP_NAME_UPDATE)
         {
+            // Commit with the tx index, see CTxIndexCache
+            txdb.SetWriteThrough();
             vector<CDiskTxPos> vtxPos;
             if (dbName.ExistsName(vvchArgs[0]))
             {
@@ -1047,6 +1053,11 @@ bool CNamecoinHooks::ConnectInputs(CTxDB& txdb,
     return true;
 }
 
+bool CNamecoinHooks::IsHeightDependent(const CTransaction& tx)
+{
+    return tx.nVersion == NAMECOIN_TX_VERSION;
+}
+
 bool CNamecoinHooks::DisconnectInputs(CTxDB& txdb,
         const CTransaction& tx,
         CBlockIndex* pindexBlock)
@@ -1063,6 +1074,7 @@ bool CNamecoinHooks::DisconnectInputs(CTxDB& txdb,
         return error("ConnectBlockHook() : could not decode namecoin tx");
     if (op == OP_NAME_FIRSTUPDATE || op == OP_NAME_UPDATE)
     {
+        txdb.SetWriteThrough();
         CNameDB dbName("cr+", txdb);
 
         dbName.TxnBegin();
@@ -1231,6 +1243,16 @@ string CNamecoinHooks::IrcPrefix()
     return "namecoin";
 }
 
+int CNamecoinHooks::AuxPowStartHeight()
+{
+    return fTestNet ? 0 : 19200;
+}
+
+int CNamecoinHooks::AuxPowChainID()
+{
+    return 0x0001;
+}
+
 unsigned short GetDefaultPort()
 {
     return fTestNet ? htons(18334) : htons(8334);
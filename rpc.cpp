@@ -257,14 +257,29 @@ Value setgenerate(const Array& params, bool fHelp)
 
 Value gethashespersec(const Array& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gethashespersec\n"
-            "Returns a recent hashes per second performance measurement while generating.");
+            "gethashespersec [verbose=false]\n"
+            "Returns a recent hashes per second performance measurement while generating.\n"
+            "If verbose is true, returns an object that also names the SHA-256 kernel in use\n"
+            "and breaks the rate down per miner thread.");
+
+    boost::int64_t nHashesPerSec = 0;
+    if (GetTimeMillis() - nHPSTimerStart <= 8000)
+        nHashesPerSec = (boost::int64_t)dHashesPerSec;
+    if (params.size() == 0 || !params[0].get_bool())
+        return nHashesPerSec;
 
-    if (GetTimeMillis() - nHPSTimerStart > 8000)
-        return (boost::int64_t)0;
-    return (boost::int64_t)dHashesPerSec;
+    Object obj;
+    obj.push_back(Pair("hashespersec", nHashesPerSec));
+    obj.push_back(Pair("kernel",       pszHashKernel));
+    vector<double> vThreadRates;
+    GetMinerHashesPerSec(vThreadRates);
+    Array threads;
+    foreach(double dRate, vThreadRates)
+        threads.push_back((boost::int64_t)dRate);
+    obj.push_back(Pair("threads",      threads));
+    return obj;
 }
 
 
@@ -293,6 +308,73 @@ Value getinfo(const Array& params, bool fHelp)
 }
 
 
+Value getcacheinfo(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getcacheinfo\n"
+            "Returns size and hit counts of the in-memory caches, and memory pool usage\n"
+            "and evictions.");
+
+    uint64 nEntries, nBytes, nMaxBytes, nHits, nMisses;
+    blockcache.GetStats(nEntries, nBytes, nMaxBytes, nHits, nMisses);
+    Object objBlock;
+    objBlock.push_back(Pair("entries",  (boost::int64_t)nEntries));
+    objBlock.push_back(Pair("bytes",    (boost::int64_t)nBytes));
+    objBlock.push_back(Pair("maxbytes", (boost::int64_t)nMaxBytes));
+    objBlock.push_back(Pair("hits",     (boost::int64_t)nHits));
+    objBlock.push_back(Pair("misses",   (boost::int64_t)nMisses));
+
+    prevoutcache.GetStats(nEntries, nBytes, nMaxBytes, nHits, nMisses);
+    Object objPrevOut;
+    objPrevOut.push_back(Pair("entries",  (boost::int64_t)nEntries));
+    objPrevOut.push_back(Pair("bytes",    (boost::int64_t)nBytes));
+    objPrevOut.push_back(Pair("maxbytes", (boost::int64_t)nMaxBytes));
+    objPrevOut.push_back(Pair("hits",     (boost::int64_t)nHits));
+    objPrevOut.push_back(Pair("misses",   (boost::int64_t)nMisses));
+
+    uint64 nDirty;
+    GetTxIndexCacheStats(nEntries, nDirty, nBytes);
+    Object objTxIndex;
+    objTxIndex.push_back(Pair("entries",  (boost::int64_t)nEntries));
+    objTxIndex.push_back(Pair("dirty",    (boost::int64_t)nDirty));
+    objTxIndex.push_back(Pair("bytes",    (boost::int64_t)nBytes));
+    objTxIndex.push_back(Pair("maxbytes", (boost::int64_t)nTxIndexCacheMaxBytes));
+
+    GetSigCacheStats(nEntries, nHits, nMisses);
+    Object objSig;
+    objSig.push_back(Pair("entries",    (boost::int64_t)nEntries));
+    objSig.push_back(Pair("maxentries", (boost::int64_t)nMaxSigCacheSize));
+    objSig.push_back(Pair("hits",       (boost::int64_t)nHits));
+    objSig.push_back(Pair("misses",     (boost::int64_t)nMisses));
+
+    GetPubKeyCacheStats(nEntries, nHits, nMisses);
+    Object objPubKey;
+    objPubKey.push_back(Pair("entries",    (boost::int64_t)nEntries));
+    objPubKey.push_back(Pair("maxentries", (boost::int64_t)nMaxPubKeyCacheSize));
+    objPubKey.push_back(Pair("hits",       (boost::int64_t)nHits));
+    objPubKey.push_back(Pair("misses",     (boost::int64_t)nMisses));
+
+    uint64 nEvicted, nEvictedBytes;
+    GetMemPoolStats(nEntries, nBytes, nEvicted, nEvictedBytes);
+    Object objMemPool;
+    objMemPool.push_back(Pair("entries",      (boost::int64_t)nEntries));
+    objMemPool.push_back(Pair("bytes",        (boost::int64_t)nBytes));
+    objMemPool.push_back(Pair("maxbytes",     (boost::int64_t)nMemPoolMaxBytes));
+    objMemPool.push_back(Pair("evicted",      (boost::int64_t)nEvicted));
+    objMemPool.push_back(Pair("evictedbytes", (boost::int64_t)nEvictedBytes));
+
+    Object obj;
+    obj.push_back(Pair("blocks", objBlock));
+    obj.push_back(Pair("prevouts", objPrevOut));
+    obj.push_back(Pair("txindex", objTxIndex));
+    obj.push_back(Pair("signatures", objSig));
+    obj.push_back(Pair("pubkeys", objPubKey));
+    obj.push_back(Pair("mempool", objMemPool));
+    return obj;
+}
+
+
 Value getnewaddress(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -1254,6 +1336,231 @@ Value validateaddress(const Array& params, bool fHelp)
 }
 
 
+//
+// getwork keeps its last few block templates, least recently used at the
+// back.  Work handed out is the current template with the next extra nonce,
+// remembered by merkle root until its template is evicted, or until it is
+// among the oldest of more than MAX_WORK_PER_TEMPLATE.  The header and
+// padding are kept byte swapped, so a new piece of work only costs the
+// coinbase hash, its merkle branch and the midstate.  getauxblock shares
+// the templates, its work is remembered by block hash.
+//
+class CWorkTemplate
+{
+public:
+    CBlock block;
+    vector<uint256> vCoinbaseBranch;
+    deque<uint256> vWorkHash;
+    unsigned int pdata[32];
+    string strHash1;
+    string strTarget;
+};
+
+static const int MAX_WORK_TEMPLATES = 8;
+static const unsigned int MAX_WORK_PER_TEMPLATE = 1000;
+static CCriticalSection cs_getwork;
+static list<CWorkTemplate> listWorkTemplate;
+static map<uint256, pair<list<CWorkTemplate>::iterator, unsigned int> > mapWork;
+static list<CWorkTemplate>::iterator itWorkCurrent;
+static CReserveKey reservekeyWork;
+static CBlockIndex* pindexWorkPrev;
+static unsigned int nWorkTransactionsUpdated;
+static int64 nWorkStart;
+static unsigned int nWorkExtraNonce;
+static unsigned int nWorkTemplatesBuilt;
+
+bool IsWorkTemplateStale()
+{
+    CRITICAL_BLOCK(cs_getwork)
+        return (listWorkTemplate.empty() || pindexWorkPrev != pindexBest ||
+                (nTransactionsUpdated != nWorkTransactionsUpdated && GetTime() - nWorkStart > 60));
+    return true;
+}
+
+unsigned int GetWorkTemplatesBuilt()
+{
+    CRITICAL_BLOCK(cs_getwork)
+        return nWorkTemplatesBuilt;
+    return 0;
+}
+
+// Whoever calls getwork next gets different work than was current when
+// nWorkTemplatesBuilt was nTemplatesBuilt, rebuilt since or due now
+bool IsNewWorkSince(unsigned int nTemplatesBuilt)
+{
+    CRITICAL_BLOCK(cs_getwork)
+        return (nWorkTemplatesBuilt != nTemplatesBuilt || IsWorkTemplateStale());
+    return true;
+}
+
+void UseWorkTemplate(list<CWorkTemplate>::iterator it)
+{
+    listWorkTemplate.splice(listWorkTemplate.begin(), listWorkTemplate, it);
+}
+
+CWorkTemplate& GetWorkTemplate()
+{
+    if (IsWorkTemplateStale())
+    {
+        if (pindexWorkPrev != pindexBest)
+        {
+            // Work on the old best block is obsolete now
+            mapWork.clear();
+            listWorkTemplate.clear();
+            nWorkExtraNonce = 0;
+        }
+        nWorkTransactionsUpdated = nTransactionsUpdated;
+        pindexWorkPrev = pindexBest;
+        nWorkStart = GetTime();
+        nWorkTemplatesBuilt++;
+
+        // Create new block
+        auto_ptr<CBlock> pblock(CreateNewBlock(reservekeyWork));
+        if (!pblock.get())
+            throw JSONRPCError(-7, "Out of memory");
+
+        listWorkTemplate.push_front(CWorkTemplate());
+        CWorkTemplate& work = listWorkTemplate.front();
+        itWorkCurrent = listWorkTemplate.begin();
+        work.block = *pblock;
+        work.vCoinbaseBranch = pblock->GetMerkleBranch(0);
+
+        // Prebuild hash buffers
+        char pmidstate[32];
+        char pdata[128];
+        char phash1[64];
+        FormatHashBuffers(pblock.get(), pmidstate, pdata, phash1);
+        memcpy(work.pdata, pdata, sizeof(work.pdata));
+        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        work.strHash1 = HexStr(BEGIN(phash1), END(phash1));
+        work.strTarget = HexStr(BEGIN(hashTarget), END(hashTarget));
+
+        // Evict the least recently used, their work can't be submitted any more
+        while (listWorkTemplate.size() > MAX_WORK_TEMPLATES)
+        {
+            foreach(const uint256& hashWork, listWorkTemplate.back().vWorkHash)
+                mapWork.erase(hashWork);
+            listWorkTemplate.pop_back();
+        }
+    }
+    UseWorkTemplate(itWorkCurrent);
+    return *itWorkCurrent;
+}
+
+// Remember work handed out from the current template
+void AddWork(const uint256& hashWork, unsigned int nExtraNonce)
+{
+    CWorkTemplate& work = *itWorkCurrent;
+    mapWork[hashWork] = make_pair(itWorkCurrent, nExtraNonce);
+    work.vWorkHash.push_back(hashWork);
+    while (work.vWorkHash.size() > MAX_WORK_PER_TEMPLATE)
+    {
+        mapWork.erase(work.vWorkHash.front());
+        work.vWorkHash.pop_front();
+    }
+}
+
+// A submitted block that solves its work keeps the shared key, under
+// cs_getwork.  Connecting the block is left to the caller after releasing
+// the lock, so getwork and the work server aren't held up meanwhile.
+bool KeepWorkKey(CBlock* pblock)
+{
+    if (!CheckWorkProof(pblock))
+        return false;
+    CRITICAL_BLOCK(cs_main)
+    {
+        if (pblock->hashPrevBlock != hashBestChain)
+        {
+            printf("ERROR: BitcoinMiner : generated block is stale\n");
+            return false;
+        }
+    }
+    reservekeyWork.KeepKey();
+    return true;
+}
+
+Object GetWork()
+{
+    if (vNodes.empty())
+        throw JSONRPCError(-9, "Bitcoin is not connected!");
+
+    if (IsInitialBlockDownload())
+        throw JSONRPCError(-10, "Bitcoin is downloading blocks...");
+
+    CRITICAL_BLOCK(cs_getwork)
+    {
+        CWorkTemplate& work = GetWorkTemplate();
+
+        // Update nExtraNonce, it's unique until the best block changes
+        unsigned int nExtraNonce = ++nWorkExtraNonce;
+        CTransaction txCoinbase = work.block.vtx[0];
+        txCoinbase.vin[0].scriptSig = CScript() << work.block.nBits << CBigNum(nExtraNonce);
+        txCoinbase.InvalidateHash();
+        uint256 hashMerkleRoot = CBlock::CheckMerkleBranch(txCoinbase.GetHash(), work.vCoinbaseBranch, 0);
+        unsigned int nTime = max(pindexWorkPrev->GetMedianTimePast()+1, GetAdjustedTime());
+
+        // Save
+        AddWork(hashMerkleRoot, nExtraNonce);
+
+        // Patch the merkle root and time into the prebuilt data
+        unsigned int pdata[32];
+        memcpy(pdata, work.pdata, sizeof(pdata));
+        for (int i = 0; i < 8; i++)
+            pdata[9 + i] = CryptoPP::ByteReverse(((unsigned int*)&hashMerkleRoot)[i]);
+        pdata[17] = CryptoPP::ByteReverse(nTime);
+
+        // Precalc the first half of the first hash, which stays constant
+        static const unsigned int pSHA256InitState[8] =
+        {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+        unsigned int pmidstate[8];
+        memcpy(pmidstate, pSHA256InitState, sizeof(pmidstate));
+        CryptoPP::SHA256::Transform((CryptoPP::word32*)pmidstate, (CryptoPP::word32*)pdata);
+
+        Object result;
+        result.push_back(Pair("midstate", HexStr(BEGIN(pmidstate), END(pmidstate))));
+        result.push_back(Pair("data",     HexStr(BEGIN(pdata), END(pdata))));
+        result.push_back(Pair("hash1",    work.strHash1));
+        result.push_back(Pair("target",   work.strTarget));
+        return result;
+    }
+    return Object();
+}
+
+bool SubmitWork(const string& strData)
+{
+    // Parse parameters
+    vector<unsigned char> vchData = ParseHex(strData);
+    if (vchData.size() != 128)
+        throw JSONRPCError(-8, "Invalid parameter");
+    CBlock* pdata = (CBlock*)&vchData[0];
+
+    // Byte reverse
+    for (int i = 0; i < 128/4; i++)
+        ((unsigned int*)pdata)[i] = CryptoPP::ByteReverse(((unsigned int*)pdata)[i]);
+
+    CBlock block;
+    CRITICAL_BLOCK(cs_getwork)
+    {
+        // Get saved block
+        map<uint256, pair<list<CWorkTemplate>::iterator, unsigned int> >::iterator mi = mapWork.find(pdata->hashMerkleRoot);
+        if (mi == mapWork.end())
+            return false;
+        UseWorkTemplate((*mi).second.first);
+        block = (*mi).second.first->block;
+        unsigned int nExtraNonce = (*mi).second.second;
+
+        block.nTime = pdata->nTime;
+        block.nNonce = pdata->nNonce;
+        block.vtx[0].vin[0].scriptSig = CScript() << block.nBits << CBigNum(nExtraNonce);
+        block.vtx[0].InvalidateHash();
+        block.hashMerkleRoot = block.BuildMerkleTree();
+
+        if (!KeepWorkKey(&block))
+            return false;
+    }
+    return ProcessFoundBlock(&block);
+}
+
 Value getwork(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -1264,7 +1571,12 @@ Value getwork(const Array& params, bool fHelp)
             "  \"data\" : block data\n"
             "  \"hash1\" : formatted hash buffer for second hash\n"
             "  \"target\" : little endian hash target\n"
-            "If [data] is specified, tries to solve the block and returns true if it was successful.");
+            "If [data] is specified, tries to solve the block and returns true if it was successful.\n"
+            "Replies carry an X-Long-Polling header, a getwork request sent to that path is\n"
+            "held until there is new work.");
+
+    if (params.size() == 0)
+        return GetWork();
 
     if (vNodes.empty())
         throw JSONRPCError(-9, "Bitcoin is not connected!");
@@ -1272,90 +1584,209 @@ Value getwork(const Array& params, bool fHelp)
     if (IsInitialBlockDownload())
         throw JSONRPCError(-10, "Bitcoin is downloading blocks...");
 
-    static map<uint256, pair<CBlock*, unsigned int> > mapNewBlock;
-    static vector<CBlock*> vNewBlock;
-    static CReserveKey reservekey;
+    return SubmitWork(params[0].get_str());
+}
 
-    if (params.size() == 0)
+Value getblocktemplate(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getblocktemplate\n"
+            "Returns a candidate block for software that builds its own coinbase:\n"
+            "  \"version\", \"previousblockhash\", \"bits\", \"target\", \"height\"\n"
+            "  \"mintime\", \"curtime\", \"maxtime\" : allowed range for the block time\n"
+            "  \"coinbasevalue\" : subsidy plus fees the coinbase may claim\n"
+            "  \"sizelimit\", \"sigoplimit\" : limits for the whole block\n"
+            "  \"transactions\" : other transactions in order, each with its \"data\" in hex,\n"
+            "    \"hash\", \"fee\", \"sigops\" and \"depends\", the 1-based positions of the\n"
+            "    transactions it spends from.");
+
+    if (vNodes.empty())
+        throw JSONRPCError(-9, "Bitcoin is not connected!");
+
+    if (IsInitialBlockDownload())
+        throw JSONRPCError(-10, "Bitcoin is downloading blocks...");
+
+    // The caller pays itself, the key goes back to the pool
+    CReserveKey reservekey;
+    vector<int64> vTxFees;
+    auto_ptr<CBlock> pblock(CreateNewBlock(reservekey, &vTxFees));
+    if (!pblock.get())
+        throw JSONRPCError(-7, "Out of memory");
+    CBlockIndex* pindexPrev = mapBlockIndex[pblock->hashPrevBlock];
+
+    Array transactions;
+    map<uint256, int> mapTxIndex;
+    for (int i = 1; i < pblock->vtx.size(); i++)
     {
-        // Update block
-        static unsigned int nTransactionsUpdatedLast;
-        static CBlockIndex* pindexPrev;
-        static int64 nStart;
-        static CBlock* pblock;
-        if (pindexPrev != pindexBest ||
-            (nTransactionsUpdated != nTransactionsUpdatedLast && GetTime() - nStart > 60))
+        const CTransaction& tx = pblock->vtx[i];
+        uint256 hash = tx.GetHash();
+        mapTxIndex[hash] = i;
+
+        Array depends;
+        set<int> setDepends;
+        foreach(const CTxIn& txin, tx.vin)
         {
-            if (pindexPrev != pindexBest)
-            {
-                // Deallocate old blocks since they're obsolete now
-                mapNewBlock.clear();
-                foreach(CBlock* pblock, vNewBlock)
-                    delete pblock;
-                vNewBlock.clear();
-            }
-            nTransactionsUpdatedLast = nTransactionsUpdated;
-            pindexPrev = pindexBest;
-            nStart = GetTime();
-
-            // Create new block
-            pblock = CreateNewBlock(reservekey);
-            if (!pblock)
-                throw JSONRPCError(-7, "Out of memory");
-            vNewBlock.push_back(pblock);
+            map<uint256, int>::iterator mi = mapTxIndex.find(txin.prevout.hash);
+            if (mi != mapTxIndex.end() && setDepends.insert((*mi).second).second)
+                depends.push_back((*mi).second);
         }
 
-        // Update nTime
-        pblock->nTime = max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
-        pblock->nNonce = 0;
+        CDataStream ssTx(SER_NETWORK);
+        ssTx << tx;
 
-        // Update nExtraNonce
-        static unsigned int nExtraNonce = 0;
-        static int64 nPrevTime = 0;
-        IncrementExtraNonce(pblock, pindexPrev, nExtraNonce, nPrevTime);
+        Object entry;
+        entry.push_back(Pair("data", HexStr(ssTx.begin(), ssTx.end())));
+        entry.push_back(Pair("hash", hash.GetHex()));
+        entry.push_back(Pair("fee", (boost::int64_t)vTxFees[i]));
+        entry.push_back(Pair("sigops", tx.GetSigOpCount()));
+        entry.push_back(Pair("depends", depends));
+        transactions.push_back(entry);
+    }
 
-        // Save
-        mapNewBlock[pblock->hashMerkleRoot] = make_pair(pblock, nExtraNonce);
+    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+
+    Object result;
+    result.push_back(Pair("version", pblock->nVersion));
+    result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
+    result.push_back(Pair("bits", strprintf("%08x", pblock->nBits)));
+    result.push_back(Pair("target", hashTarget.GetHex()));
+    result.push_back(Pair("height", pindexPrev->nHeight + 1));
+    result.push_back(Pair("mintime", (boost::int64_t)pindexPrev->GetMedianTimePast() + 1));
+    result.push_back(Pair("curtime", (boost::int64_t)pblock->nTime));
+    result.push_back(Pair("maxtime", (boost::int64_t)GetAdjustedTime() + 2 * 60 * 60));
+    result.push_back(Pair("coinbasevalue", (boost::int64_t)pblock->vtx[0].vout[0].nValue));
+    result.push_back(Pair("sizelimit", (boost::int64_t)MAX_BLOCK_SIZE));
+    result.push_back(Pair("sigoplimit", MAX_BLOCK_SIGOPS));
+    result.push_back(Pair("transactions", transactions));
+    return result;
+}
 
-        // Prebuild hash buffers
-        char pmidstate[32];
-        char pdata[128];
-        char phash1[64];
-        FormatHashBuffers(pblock, pmidstate, pdata, phash1);
 
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+Value submitblock(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "submitblock <hex data>\n"
+            "Processes a complete serialized block the same as one received from the network.\n"
+            "Returns true if it was accepted on top of the current best block.  Fails with\n"
+            "error -26 if it isn't built on the current best block and -25 if it's rejected.");
+
+    vector<unsigned char> vchData = ParseHex(params[0].get_str());
+    CDataStream ssBlock(vchData, SER_NETWORK);
+    CBlock block;
+    try
+    {
+        ssBlock >> block;
+    }
+    catch (std::exception& e)
+    {
+        throw JSONRPCError(-22, "Block decode failed");
+    }
 
-        Object result;
-        result.push_back(Pair("midstate", HexStr(BEGIN(pmidstate), END(pmidstate))));
-        result.push_back(Pair("data",     HexStr(BEGIN(pdata), END(pdata))));
-        result.push_back(Pair("hash1",    HexStr(BEGIN(phash1), END(phash1))));
-        result.push_back(Pair("target",   HexStr(BEGIN(hashTarget), END(hashTarget))));
-        return result;
+    CRITICAL_BLOCK(cs_main)
+    {
+        if (block.hashPrevBlock != hashBestChain)
+            throw JSONRPCError(-26, "Block is stale");
+
+        // Track how many getdata requests this block gets
+        CRITICAL_BLOCK(cs_mapRequestCount)
+            mapRequestCount[block.GetHash()] = 0;
+
+        if (!ProcessBlock(NULL, &block))
+            throw JSONRPCError(-25, "Block rejected");
     }
-    else
+    return true;
+}
+
+
+// The template's block with an extra nonce, as getauxblock hands it out
+CBlock GetAuxBlock(const CWorkTemplate& work, unsigned int nExtraNonce)
+{
+    CBlock block = work.block;
+    block.nVersion = 1 | BLOCK_VERSION_AUXPOW | hooks->AuxPowChainID() * BLOCK_VERSION_CHAIN_START;
+    block.vtx[0].vin[0].scriptSig = CScript() << block.nBits << CBigNum(nExtraNonce);
+    block.vtx[0].InvalidateHash();
+    block.hashMerkleRoot = CBlock::CheckMerkleBranch(block.vtx[0].GetHash(), work.vCoinbaseBranch, 0);
+    return block;
+}
+
+Value getauxblock(const Array& params, bool fHelp)
+{
+    if (fHelp || (params.size() != 0 && params.size() != 2))
+        throw runtime_error(
+            "getauxblock [<hash> <auxpow>]\n"
+            "If <hash> and <auxpow> are not specified, returns a block to merge mine:\n"
+            "  \"hash\" : block hash to commit to in the parent chain's coinbase\n"
+            "  \"chainid\" : chain ID, picks the slot in the aux chain merkle tree\n"
+            "  \"target\" : little endian hash target the parent block has to meet\n"
+            "If they are specified, tries to solve the block with <auxpow>, the serialized\n"
+            "proof of work from the parent chain, and returns true if it was successful.");
+
+    if (vNodes.empty())
+        throw JSONRPCError(-9, "Bitcoin is not connected!");
+
+    if (IsInitialBlockDownload())
+        throw JSONRPCError(-10, "Bitcoin is downloading blocks...");
+
+    if (nBestHeight + 1 < hooks->AuxPowStartHeight())
+        throw JSONRPCError(-1, "Merged mining isn't active yet");
+
+    if (params.size() == 0)
     {
-        // Parse parameters
-        vector<unsigned char> vchData = ParseHex(params[0].get_str());
-        if (vchData.size() != 128)
-            throw JSONRPCError(-8, "Invalid parameter");
-        CBlock* pdata = (CBlock*)&vchData[0];
+        CRITICAL_BLOCK(cs_getwork)
+        {
+            CWorkTemplate& work = GetWorkTemplate();
+            unsigned int nExtraNonce = ++nWorkExtraNonce;
+            CBlock block = GetAuxBlock(work, nExtraNonce);
+            uint256 hash = block.GetHash();
 
-        // Byte reverse
-        for (int i = 0; i < 128/4; i++)
-            ((unsigned int*)pdata)[i] = CryptoPP::ByteReverse(((unsigned int*)pdata)[i]);
+            // Save
+            AddWork(hash, nExtraNonce);
 
-        // Get saved block
-        if (!mapNewBlock.count(pdata->hashMerkleRoot))
-            return false;
-        CBlock* pblock = mapNewBlock[pdata->hashMerkleRoot].first;
-        unsigned int nExtraNonce = mapNewBlock[pdata->hashMerkleRoot].second;
+            uint256 hashTarget = CBigNum().SetCompact(block.nBits).getuint256();
 
-        pblock->nTime = pdata->nTime;
-        pblock->nNonce = pdata->nNonce;
-        pblock->vtx[0].vin[0].scriptSig = CScript() << pblock->nBits << CBigNum(nExtraNonce);
-        pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+            Object result;
+            result.push_back(Pair("hash",    hash.GetHex()));
+            result.push_back(Pair("chainid", block.GetChainID()));
+            result.push_back(Pair("target",  HexStr(BEGIN(hashTarget), END(hashTarget))));
+            return result;
+        }
+        return Object();
+    }
+    else
+    {
+        uint256 hash;
+        hash.SetHex(params[0].get_str());
+        vector<unsigned char> vchAuxPow = ParseHex(params[1].get_str());
+        CDataStream ssAuxPow(vchAuxPow, SER_NETWORK);
+        boost::shared_ptr<CAuxPow> pauxpow(new CAuxPow());
+        try
+        {
+            ssAuxPow >> *pauxpow;
+        }
+        catch (std::exception& e)
+        {
+            throw JSONRPCError(-22, "AuxPow decode failed");
+        }
 
-        return CheckWork(pblock, reservekey);
+        CBlock block;
+        CRITICAL_BLOCK(cs_getwork)
+        {
+            // Get saved block
+            map<uint256, pair<list<CWorkTemplate>::iterator, unsigned int> >::iterator mi = mapWork.find(hash);
+            if (mi == mapWork.end())
+                return false;
+            UseWorkTemplate((*mi).second.first);
+            block = GetAuxBlock(*(*mi).second.first, (*mi).second.second);
+            if (block.GetHash() != hash)
+                return false;
+            block.auxpow = pauxpow;
+
+            if (!KeepWorkKey(&block))
+                return false;
+        }
+        return ProcessFoundBlock(&block);
     }
 }
 
@@ -1385,6 +1816,7 @@ pair<string, rpcfn_type> pCallTable[] =
     make_pair("setgenerate",           &setgenerate),
     make_pair("gethashespersec",       &gethashespersec),
     make_pair("getinfo",               &getinfo),
+    make_pair("getcacheinfo",          &getcacheinfo),
     make_pair("getnewaddress",         &getnewaddress),
     make_pair("getaccountaddress",     &getaccountaddress),
     make_pair("setaccount",            &setaccount),
@@ -1411,6 +1843,9 @@ pair<string, rpcfn_type> pCallTable[] =
     make_pair("gettransaction",        &gettransaction),
     make_pair("listtransactions",      &listtransactions),
     make_pair("getwork",               &getwork),
+    make_pair("getblocktemplate",      &getblocktemplate),
+    make_pair("submitblock",           &submitblock),
+    make_pair("getauxblock",           &getauxblock),
     make_pair("listaccounts",          &listaccounts),
 };
 map<string, rpcfn_type> mapCallTable(pCallTable, pCallTable + sizeof(pCallTable)/sizeof(pCallTable[0]));
@@ -1427,6 +1862,7 @@ string pAllowInSafeMode[] =
     "setgenerate",
     "gethashespersec",
     "getinfo",
+    "getcacheinfo",
     "getnewaddress",
     "getaccountaddress",
     "setlabel",
@@ -1437,6 +1873,9 @@ string pAllowInSafeMode[] =
     "backupwallet",
     "validateaddress",
     "getwork",
+    "getblocktemplate",
+    "submitblock",
+    "getauxblock",
 };
 set<string> setAllowInSafeMode(pAllowInSafeMode, pAllowInSafeMode + sizeof(pAllowInSafeMode)/sizeof(pAllowInSafeMode[0]));
 
@@ -1476,7 +1915,7 @@ string rfc1123Time()
     return string(buffer);
 }
 
-string HTTPReply(int nStatus, const string& strMsg)
+string HTTPReply(int nStatus, const string& strMsg, const string& strExtraHeaders="")
 {
     if (nStatus == 401)
         return strprintf("HTTP/1.0 401 Authorization Required\r\n"
@@ -1507,16 +1946,18 @@ string HTTPReply(int nStatus, const string& strMsg)
             "Content-Length: %d\r\n"
             "Content-Type: application/json\r\n"
             "Server: bitcoin-json-rpc/1.0\r\n"
+            "%s"
             "\r\n"
             "%s",
         nStatus,
         strStatus.c_str(),
         rfc1123Time().c_str(),
         strMsg.size(),
+        strExtraHeaders.c_str(),
         strMsg.c_str());
 }
 
-int ReadHTTPStatus(std::basic_istream<char>& stream)
+int ReadHTTPStatus(std::basic_istream<char>& stream, string* pstrPathRet=NULL)
 {
     string str;
     getline(stream, str);
@@ -1524,6 +1965,9 @@ int ReadHTTPStatus(std::basic_istream<char>& stream)
     boost::split(vWords, str, boost::is_any_of(" "));
     if (vWords.size() < 2)
         return 500;
+    // On a request line the second word is the path
+    if (pstrPathRet)
+        *pstrPathRet = vWords[1];
     return atoi(vWords[1].c_str());
 }
 
@@ -1551,13 +1995,13 @@ int ReadHTTPHeader(std::basic_istream<char>& stream, map<string, string>& mapHea
     return nLen;
 }
 
-int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet)
+int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet, string* pstrPathRet=NULL)
 {
     mapHeadersRet.clear();
     strMessageRet = "";
 
     // Read status
-    int nStatus = ReadHTTPStatus(stream);
+    int nStatus = ReadHTTPStatus(stream, pstrPathRet);
 
     // Read header
     int nLen = ReadHTTPHeader(stream, mapHeadersRet);
@@ -1734,6 +2178,70 @@ private:
 };
 #endif
 
+//
+// An accepted connection, on the heap so a long poll can hand it
+// to its own thread
+//
+class CRPCConnection
+{
+public:
+#ifdef USE_SSL
+    SSLStream sslStream;
+    SSLIOStreamDevice d;
+    iostreams::stream<SSLIOStreamDevice> stream;
+
+    CRPCConnection(asio::io_service& io_service, ssl::context& context, bool fUseSSL) : sslStream(io_service, context), d(sslStream, fUseSSL), stream(d)
+    {
+    }
+#else
+    ip::tcp::iostream stream;
+#endif
+    Value id;
+    unsigned int nWorkTemplate;
+};
+
+static const int MAX_LONGPOLL_THREADS = 64;
+static const string strLongPollHeader = "X-Long-Polling: /LP\r\n";
+static int nLongPollThreads = 0;
+
+void ThreadLongPoll(void* parg)
+{
+    auto_ptr<CRPCConnection> pconn((CRPCConnection*)parg);
+    try
+    {
+        // Hold the request until the best block changes or the template
+        // is due to be rebuilt with new transactions.  Another getwork
+        // caller may rebuild it first, so it's checked against the
+        // template that was current when the request came in.
+        while (!IsNewWorkSince(pconn->nWorkTemplate) && !fShutdown)
+            Sleep(100);
+        if (!fShutdown)
+        {
+            try
+            {
+                Value result = getwork(Array(), false);
+                string strReply = JSONRPCReply(result, Value::null, pconn->id);
+                pconn->stream << HTTPReply(200, strReply, strLongPollHeader) << std::flush;
+            }
+            catch (Object& objError)
+            {
+                ErrorReply(pconn->stream, objError, pconn->id);
+            }
+            catch (std::exception& e)
+            {
+                ErrorReply(pconn->stream, JSONRPCError(-1, e.what()), pconn->id);
+            }
+        }
+    }
+    catch (std::exception& e) {
+        PrintException(&e, "ThreadLongPoll()");
+    } catch (...) {
+        PrintException(NULL, "ThreadLongPoll()");
+    }
+    CRITICAL_BLOCK(cs_getwork)
+        nLongPollThreads--;
+}
+
 void ThreadRPCServer(void* parg)
 {
     IMPLEMENT_RANDOMIZE_STACK(ThreadRPCServer(parg));
@@ -1809,19 +2317,18 @@ void ThreadRPCServer2(void* parg)
     {
         // Accept connection
 #ifdef USE_SSL
-        SSLStream sslStream(io_service, context);
-        SSLIOStreamDevice d(sslStream, fUseSSL);
-        iostreams::stream<SSLIOStreamDevice> stream(d);
+        auto_ptr<CRPCConnection> pconn(new CRPCConnection(io_service, context, fUseSSL));
 #else
-        ip::tcp::iostream stream;
+        auto_ptr<CRPCConnection> pconn(new CRPCConnection());
 #endif
+        std::iostream& stream = pconn->stream;
 
         ip::tcp::endpoint peer;
         vnThreadsRunning[4]--;
 #ifdef USE_SSL
-        acceptor.accept(sslStream.lowest_layer(), peer);
+        acceptor.accept(pconn->sslStream.lowest_layer(), peer);
 #else
-        acceptor.accept(*stream.rdbuf(), peer);
+        acceptor.accept(*pconn->stream.rdbuf(), peer);
 #endif
         vnThreadsRunning[4]++;
         if (fShutdown)
@@ -1833,8 +2340,9 @@ void ThreadRPCServer2(void* parg)
 
         map<string, string> mapHeaders;
         string strRequest;
+        string strPath;
 
-        boost::thread api_caller(ReadHTTP, boost::ref(stream), boost::ref(mapHeaders), boost::ref(strRequest));
+        boost::thread api_caller(ReadHTTP, boost::ref(stream), boost::ref(mapHeaders), boost::ref(strRequest), &strPath);
         if (!api_caller.timed_join(boost::posix_time::seconds(GetArg("-rpctimeout", 30))))
         {   // Timed out:
             acceptor.cancel();
@@ -1901,6 +2409,31 @@ void ThreadRPCServer2(void* parg)
             if (strWarning != "" && !GetBoolArg("-disablesafemode") && !setAllowInSafeMode.count(strMethod))
                 throw JSONRPCError(-2, string("Safe mode: ") + strWarning);
 
+            // Long poll getwork waits on its own thread
+            if (strPath == "/LP" && strMethod == "getwork" && params.empty())
+            {
+                bool fLongPoll = false;
+                CRITICAL_BLOCK(cs_getwork)
+                {
+                    if (nLongPollThreads < MAX_LONGPOLL_THREADS)
+                    {
+                        nLongPollThreads++;
+                        fLongPoll = true;
+                    }
+                }
+                if (fLongPoll)
+                {
+                    pconn->id = id;
+                    pconn->nWorkTemplate = GetWorkTemplatesBuilt();
+                    CRPCConnection* pconnLongPoll = pconn.release();
+                    if (CreateThread(ThreadLongPoll, pconnLongPoll))
+                        continue;
+                    pconn.reset(pconnLongPoll);
+                    CRITICAL_BLOCK(cs_getwork)
+                        nLongPollThreads--;
+                }
+            }
+
             try
             {
                 // Execute
@@ -1908,7 +2441,7 @@ void ThreadRPCServer2(void* parg)
 
                 // Send reply
                 string strReply = JSONRPCReply(result, Value::null, id);
-                stream << HTTPReply(200, strReply) << std::flush;
+                stream << HTTPReply(200, strReply, strMethod == "getwork" ? strLongPollHeader : "") << std::flush;
             }
             catch (std::exception& e)
             {
@@ -1929,6 +2462,373 @@ void ThreadRPCServer2(void* parg)
 
 
 
+//
+// Work server
+//
+// Persistent line based JSON-RPC for local miners, so they don't have to
+// poll getwork.  A subscribed connection is pushed new work as soon as the
+// best block changes or the getwork template is rebuilt, and submits its
+// solutions on the same connection.  Work and submits go through the same
+// templates as getwork.
+//
+//   {"id":1, "method":"authorize", "params":["<rpcuser>", "<rpcpassword>"]}
+//   {"id":2, "method":"subscribe", "params":[]}
+//   {"id":null, "method":"notify", "params":[{<getwork result>}, <new best block>]}
+//   {"id":3, "method":"submit", "params":["<data>"]}
+//
+
+static const unsigned int MAX_WORK_CLIENTS = 64;
+static const unsigned int MAX_WORK_LINE = 0x10000;
+static const unsigned int MAX_WORK_SEND = 0x100000;
+
+class CWorkClient
+{
+public:
+    SOCKET hSocket;
+    string strRecv;
+    string strSend;
+    int64 nTimeConnected;
+    bool fAuthorized;
+    bool fSubscribed;
+    bool fDisconnect;
+    unsigned int nWorkTemplate;
+    CBlockIndex* pindexWork;
+
+    CWorkClient(SOCKET hSocketIn)
+    {
+        hSocket = hSocketIn;
+        nTimeConnected = GetTime();
+        fAuthorized = false;
+        fSubscribed = false;
+        fDisconnect = false;
+        nWorkTemplate = 0;
+        pindexWork = NULL;
+    }
+
+    ~CWorkClient()
+    {
+        closesocket(hSocket);
+    }
+
+    Object GetWork()
+    {
+        CRITICAL_BLOCK(cs_getwork)
+        {
+            Object result = ::GetWork();
+            nWorkTemplate = nWorkTemplatesBuilt;
+            pindexWork = pindexWorkPrev;
+            return result;
+        }
+        return Object();
+    }
+};
+
+void WorkServerNotify(CWorkClient* pclient)
+{
+    try
+    {
+        bool fNewBlock = (pclient->pindexWork != pindexBest);
+        Array params;
+        params.push_back(pclient->GetWork());
+        params.push_back(fNewBlock);
+
+        Object notify;
+        notify.push_back(Pair("id", Value::null));
+        notify.push_back(Pair("method", "notify"));
+        notify.push_back(Pair("params", params));
+        pclient->strSend += write_string(Value(notify), false) + "\n";
+    }
+    catch (Object& objError)
+    {
+        // Not connected or still downloading, try again later
+    }
+}
+
+void WorkServerRequest(CWorkClient* pclient, const string& strRequest)
+{
+    Value id = Value::null;
+    try
+    {
+        // Parse request
+        Value valRequest;
+        if (!read_string(strRequest, valRequest) || valRequest.type() != obj_type)
+            throw JSONRPCError(-32700, "Parse error");
+        const Object& request = valRequest.get_obj();
+        id = find_value(request, "id");
+
+        Value valMethod = find_value(request, "method");
+        if (valMethod.type() != str_type)
+            throw JSONRPCError(-32600, "Method must be a string");
+        string strMethod = valMethod.get_str();
+
+        Value valParams = find_value(request, "params");
+        Array params;
+        if (valParams.type() == array_type)
+            params = valParams.get_array();
+        else if (valParams.type() != null_type)
+            throw JSONRPCError(-32600, "Params must be an array");
+
+        Value result;
+        if (strMethod == "authorize")
+        {
+            if (params.size() != 2)
+                throw JSONRPCError(-8, "Invalid parameter");
+            pclient->fAuthorized = (params[0].get_str() == mapArgs["-rpcuser"] && params[1].get_str() == mapArgs["-rpcpassword"]);
+            if (!pclient->fAuthorized)
+            {
+                printf("ThreadWorkServer incorrect password attempt\n");
+                pclient->fDisconnect = true;
+            }
+            result = pclient->fAuthorized;
+        }
+        else if (!pclient->fAuthorized)
+            throw JSONRPCError(-32600, "Not authorized");
+        else if (strMethod == "subscribe")
+        {
+            // Keeps getting pushed work even if there's none right now
+            pclient->fSubscribed = true;
+            result = pclient->GetWork();
+        }
+        else if (strMethod == "submit")
+        {
+            if (params.size() != 1)
+                throw JSONRPCError(-8, "Invalid parameter");
+            result = SubmitWork(params[0].get_str());
+        }
+        else
+            throw JSONRPCError(-32601, "Method not found");
+
+        pclient->strSend += JSONRPCReply(result, Value::null, id);
+    }
+    catch (Object& objError)
+    {
+        pclient->strSend += JSONRPCReply(Value::null, objError, id);
+    }
+    catch (std::exception& e)
+    {
+        pclient->strSend += JSONRPCReply(Value::null, JSONRPCError(-1, e.what()), id);
+    }
+}
+
+void ThreadWorkServer2(void* parg)
+{
+    printf("ThreadWorkServer started\n");
+
+    if (mapArgs["-rpcuser"] == "" && mapArgs["-rpcpassword"] == "")
+    {
+        printf("ThreadWorkServer ERROR: rpcpassword must be set to use the work server\n");
+        return;
+    }
+
+    // Listen on loopback unless other hosts are allowed to call
+    int nOne = 1;
+    unsigned short nPort = GetArg("-workport", 8337);
+    SOCKET hListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (hListenSocket == INVALID_SOCKET)
+    {
+        printf("ThreadWorkServer ERROR: socket failed with error %d\n", WSAGetLastError());
+        return;
+    }
+#ifdef BSD
+    setsockopt(hListenSocket, SOL_SOCKET, SO_NOSIGPIPE, (void*)&nOne, sizeof(int));
+#endif
+#ifndef __WXMSW__
+    setsockopt(hListenSocket, SOL_SOCKET, SO_REUSEADDR, (void*)&nOne, sizeof(int));
+#endif
+#ifdef __WXMSW__
+    ioctlsocket(hListenSocket, FIONBIO, (u_long*)&nOne);
+#else
+    fcntl(hListenSocket, F_SETFL, O_NONBLOCK);
+#endif
+
+    struct sockaddr_in sockaddr;
+    memset(&sockaddr, 0, sizeof(sockaddr));
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_addr.s_addr = (mapArgs.count("-rpcallowip") ? INADDR_ANY : htonl(INADDR_LOOPBACK));
+    sockaddr.sin_port = htons(nPort);
+    if (::bind(hListenSocket, (struct sockaddr*)&sockaddr, sizeof(sockaddr)) == SOCKET_ERROR ||
+        listen(hListenSocket, SOMAXCONN) == SOCKET_ERROR)
+    {
+        printf("ThreadWorkServer ERROR: unable to listen on port %d (error %d)\n", nPort, WSAGetLastError());
+        closesocket(hListenSocket);
+        return;
+    }
+    printf("ThreadWorkServer listening on port %d\n", nPort);
+
+    list<CWorkClient*> listClient;
+    while (!fShutdown)
+    {
+        struct timeval timeout;
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = 50000; // frequency to check for new work
+
+        fd_set fdsetRecv;
+        fd_set fdsetSend;
+        FD_ZERO(&fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        SOCKET hSocketMax = hListenSocket;
+        FD_SET(hListenSocket, &fdsetRecv);
+        foreach(CWorkClient* pclient, listClient)
+        {
+            FD_SET(pclient->hSocket, &fdsetRecv);
+            if (!pclient->strSend.empty())
+                FD_SET(pclient->hSocket, &fdsetSend);
+            hSocketMax = max(hSocketMax, pclient->hSocket);
+        }
+
+        vnThreadsRunning[6]--;
+        int nSelect = select(hSocketMax + 1, &fdsetRecv, &fdsetSend, NULL, &timeout);
+        vnThreadsRunning[6]++;
+        if (fShutdown)
+            break;
+        if (nSelect == SOCKET_ERROR)
+        {
+            printf("ThreadWorkServer select error %d\n", WSAGetLastError());
+            FD_ZERO(&fdsetRecv);
+            FD_ZERO(&fdsetSend);
+            Sleep(timeout.tv_usec/1000);
+        }
+
+        //
+        // Accept new connections
+        //
+        if (FD_ISSET(hListenSocket, &fdsetRecv))
+        {
+            struct sockaddr_in sockaddr;
+            socklen_t len = sizeof(sockaddr);
+            SOCKET hSocket = accept(hListenSocket, (struct sockaddr*)&sockaddr, &len);
+            CAddress addr(sockaddr);
+            if (hSocket == INVALID_SOCKET)
+            {
+                if (WSAGetLastError() != WSAEWOULDBLOCK)
+                    printf("ThreadWorkServer accept failed: %d\n", WSAGetLastError());
+            }
+            else if (!ClientAllowed(addr.ToStringIP()) || listClient.size() >= MAX_WORK_CLIENTS)
+            {
+                closesocket(hSocket);
+            }
+            else
+            {
+                printf("ThreadWorkServer accepted %s\n", addr.ToStringLog().c_str());
+                listClient.push_back(new CWorkClient(hSocket));
+            }
+        }
+
+        //
+        // Receive and answer requests
+        //
+        foreach(CWorkClient* pclient, listClient)
+        {
+            if (FD_ISSET(pclient->hSocket, &fdsetRecv))
+            {
+                char pchBuf[0x10000];
+                int nBytes = recv(pclient->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                if (nBytes > 0)
+                    pclient->strRecv.append(pchBuf, nBytes);
+                else if (nBytes == 0)
+                    pclient->fDisconnect = true;
+                else
+                {
+                    int nErr = WSAGetLastError();
+                    if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                        pclient->fDisconnect = true;
+                }
+            }
+
+            string::size_type nEnd;
+            while (!pclient->fDisconnect && (nEnd = pclient->strRecv.find('\n')) != string::npos)
+            {
+                string strRequest = pclient->strRecv.substr(0, nEnd);
+                pclient->strRecv.erase(0, nEnd + 1);
+                boost::trim(strRequest);
+                if (!strRequest.empty())
+                    WorkServerRequest(pclient, strRequest);
+            }
+
+            if (pclient->strRecv.size() > MAX_WORK_LINE)
+            {
+                printf("ThreadWorkServer request too long, disconnecting\n");
+                pclient->fDisconnect = true;
+            }
+            if (!pclient->fAuthorized && GetTime() - pclient->nTimeConnected > 60)
+                pclient->fDisconnect = true;
+        }
+
+        //
+        // Push new work to subscribers
+        //
+        bool fStale = IsWorkTemplateStale();
+        unsigned int nTemplatesBuilt = 0;
+        CRITICAL_BLOCK(cs_getwork)
+            nTemplatesBuilt = nWorkTemplatesBuilt;
+        foreach(CWorkClient* pclient, listClient)
+            if (pclient->fSubscribed && !pclient->fDisconnect && (fStale || pclient->nWorkTemplate != nTemplatesBuilt))
+                WorkServerNotify(pclient);
+
+        //
+        // Send
+        //
+        foreach(CWorkClient* pclient, listClient)
+        {
+            if (pclient->fDisconnect || pclient->strSend.empty())
+                continue;
+            int nBytes = send(pclient->hSocket, pclient->strSend.data(), pclient->strSend.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (nBytes > 0)
+                pclient->strSend.erase(0, nBytes);
+            else if (nBytes < 0)
+            {
+                int nErr = WSAGetLastError();
+                if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                    pclient->fDisconnect = true;
+            }
+            if (pclient->strSend.size() > MAX_WORK_SEND)
+            {
+                printf("ThreadWorkServer send flood control disconnect\n");
+                pclient->fDisconnect = true;
+            }
+        }
+
+        // Drop disconnected clients
+        list<CWorkClient*>::iterator it = listClient.begin();
+        while (it != listClient.end())
+        {
+            if ((*it)->fDisconnect)
+            {
+                delete *it;
+                it = listClient.erase(it);
+            }
+            else
+                it++;
+        }
+    }
+
+    foreach(CWorkClient* pclient, listClient)
+        delete pclient;
+    closesocket(hListenSocket);
+}
+
+void ThreadWorkServer(void* parg)
+{
+    IMPLEMENT_RANDOMIZE_STACK(ThreadWorkServer(parg));
+    try
+    {
+        vnThreadsRunning[6]++;
+        ThreadWorkServer2(parg);
+        vnThreadsRunning[6]--;
+    }
+    catch (std::exception& e) {
+        vnThreadsRunning[6]--;
+        PrintException(&e, "ThreadWorkServer()");
+    } catch (...) {
+        vnThreadsRunning[6]--;
+        PrintException(NULL, "ThreadWorkServer()");
+    }
+    printf("ThreadWorkServer exiting\n");
+}
+
+
+
+
 Object CallRPC(const string& strMethod, const Array& params)
 {
     if (mapArgs["-rpcuser"] == "" && mapArgs["-rpcpassword"] == "")
@@ -2038,6 +2938,7 @@ int CommandLineRPC(int argc, char *argv[])
         // Special case non-string parameter types
         //
         if (strMethod == "setgenerate"            && n > 0) ConvertTo<bool>(params[0]);
+        if (strMethod == "gethashespersec"        && n > 0) ConvertTo<bool>(params[0]);
         if (strMethod == "setgenerate"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
         if (strMethod == "sendtoaddress"          && n > 1) ConvertTo<double>(params[1]);
         if (strMethod == "getamountreceived"      && n > 1) ConvertTo<boost::int64_t>(params[1]); // deprecated
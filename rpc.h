@@ -3,4 +3,5 @@
 // file license.txt or http://www.opensource.org/licenses/mit-license.php.
 
 void ThreadRPCServer(void* parg);
+void ThreadWorkServer(void* parg);
 int CommandLineRPC(int argc, char *argv[]);
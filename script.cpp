@@ -4,30 +4,216 @@
 
 #include "headers.h"
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+class CScriptValue;
+bool CheckSig(const CScriptValue& vchSig, const CScriptValue& vchPubKey, const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+              const CSignatureHashCache* psighashcache);
 
 
 
 typedef vector<unsigned char> valtype;
-static const valtype vchFalse(0);
-static const valtype vchZero(0);
-static const valtype vchTrue(1, 1);
-static const CBigNum bnZero(0);
-static const CBigNum bnOne(1);
-static const CBigNum bnFalse(0);
-static const CBigNum bnTrue(1);
 static const size_t nMaxNumSize = 4;
 
 
-CBigNum CastToBigNum(const valtype& vch)
+
+//
+// Script stack element.  Values up to 80 bytes, which covers signatures,
+// pubkeys, hashes and numbers, are stored inline so pushing, duplicating
+// and popping them doesn't touch the heap.  Bigger ones spill over.
+//
+class CScriptValue
+{
+protected:
+    enum { INLINE_SIZE = 80 };
+    unsigned int nSize;
+    unsigned int nCapacity;
+    unsigned char* pchHeap;
+    unsigned char pchInline[INLINE_SIZE];
+
+public:
+    typedef unsigned char* iterator;
+    typedef const unsigned char* const_iterator;
+
+    CScriptValue()
+    {
+        nSize = 0;
+        nCapacity = INLINE_SIZE;
+        pchHeap = NULL;
+    }
+
+    explicit CScriptValue(unsigned int nSizeIn, unsigned char ch=0)
+    {
+        nSize = 0;
+        nCapacity = INLINE_SIZE;
+        pchHeap = NULL;
+        resize(nSizeIn, ch);
+    }
+
+    CScriptValue(const unsigned char* pch, unsigned int n)
+    {
+        nSize = 0;
+        nCapacity = INLINE_SIZE;
+        pchHeap = NULL;
+        assign(pch, n);
+    }
+
+    CScriptValue(const CScriptValue& b)
+    {
+        nSize = 0;
+        nCapacity = INLINE_SIZE;
+        pchHeap = NULL;
+        assign(b.begin(), b.size());
+    }
+
+    CScriptValue& operator=(const CScriptValue& b)
+    {
+        if (this != &b)
+            assign(b.begin(), b.size());
+        return (*this);
+    }
+
+    ~CScriptValue()
+    {
+        delete[] pchHeap;
+    }
+
+    unsigned char* begin()              { return pchHeap ? pchHeap : pchInline; }
+    const unsigned char* begin() const  { return pchHeap ? pchHeap : pchInline; }
+    unsigned char* end()                { return begin() + nSize; }
+    const unsigned char* end() const    { return begin() + nSize; }
+    unsigned int size() const           { return nSize; }
+    bool empty() const                  { return nSize == 0; }
+    unsigned char& operator[](unsigned int i)              { return begin()[i]; }
+    const unsigned char& operator[](unsigned int i) const  { return begin()[i]; }
+    valtype vch() const                 { return valtype(begin(), end()); }
+    const unsigned char& back() const   { return begin()[nSize-1]; }
+
+    void reserve(unsigned int n)
+    {
+        if (n <= nCapacity)
+            return;
+        unsigned char* pchNew = new unsigned char[n];
+        if (nSize)
+            memcpy(pchNew, begin(), nSize);
+        delete[] pchHeap;
+        pchHeap = pchNew;
+        nCapacity = n;
+    }
+
+    void resize(unsigned int n, unsigned char ch=0)
+    {
+        reserve(n);
+        if (n > nSize)
+            memset(begin() + nSize, ch, n - nSize);
+        nSize = n;
+    }
+
+    void assign(const unsigned char* pch, unsigned int n)
+    {
+        reserve(n);
+        if (n)
+            memmove(begin(), pch, n);
+        nSize = n;
+    }
+
+    void append(const unsigned char* pbegin, const unsigned char* pend)
+    {
+        unsigned int n = pend - pbegin;
+        reserve(nSize + n);
+        if (n)
+            memcpy(begin() + nSize, pbegin, n);
+        nSize += n;
+    }
+
+    void push_back(unsigned char ch)
+    {
+        reserve(nSize + 1);
+        begin()[nSize++] = ch;
+    }
+
+    unsigned char& back()               { return begin()[nSize-1]; }
+
+    void erase(unsigned char* pbegin, unsigned char* pend)
+    {
+        memmove(pbegin, pend, end() - pend);
+        nSize -= pend - pbegin;
+    }
+
+    void swap(CScriptValue& b)
+    {
+        if (!pchHeap && !b.pchHeap)
+        {
+            unsigned char pchTmp[INLINE_SIZE];
+            memcpy(pchTmp, pchInline, nSize);
+            memcpy(pchInline, b.pchInline, b.nSize);
+            memcpy(b.pchInline, pchTmp, nSize);
+        }
+        else if (pchHeap && b.pchHeap)
+        {
+            std::swap(pchHeap, b.pchHeap);
+            std::swap(nCapacity, b.nCapacity);
+        }
+        else
+        {
+            CScriptValue tmp(*this);
+            *this = b;
+            b = tmp;
+            return;
+        }
+        std::swap(nSize, b.nSize);
+    }
+
+    friend bool operator==(const CScriptValue& a, const CScriptValue& b)
+    {
+        return a.nSize == b.nSize && memcmp(a.begin(), b.begin(), a.nSize) == 0;
+    }
+};
+
+inline void swap(CScriptValue& a, CScriptValue& b)
+{
+    a.swap(b);
+}
+
+static const CScriptValue vchFalse;
+static const CScriptValue vchTrue(1, 1);
+
+
+int64 CastToInt64(const CScriptValue& vch)
 {
     if (vch.size() > nMaxNumSize)
-        throw runtime_error("CastToBigNum() : overflow");
-    // Get rid of extra leading zeros
-    return CBigNum(CBigNum(vch).getvch());
+        throw runtime_error("CastToInt64() : overflow");
+    // Little endian with the sign in the top bit of the last byte, the
+    // same as CBigNum(vch)
+    if (vch.empty())
+        return 0;
+    int64 n = 0;
+    for (unsigned int i = 0; i < vch.size(); i++)
+        n |= (int64)vch[i] << (8 * i);
+    if (vch[vch.size()-1] & 0x80)
+        return -(n & ~((int64)0x80 << (8 * (vch.size() - 1))));
+    return n;
 }
 
-bool CastToBool(const valtype& vch)
+void SetInt64(CScriptValue& vch, int64 n)
+{
+    // Minimal encoding, the same bytes as CBigNum(n).getvch()
+    vch.resize(0);
+    if (n == 0)
+        return;
+    bool fNegative = (n < 0);
+    uint64 nAbs = (fNegative ? -n : n);
+    while (nAbs)
+    {
+        vch.push_back(nAbs & 0xff);
+        nAbs >>= 8;
+    }
+    if (vch.back() & 0x80)
+        vch.push_back(fNegative ? 0x80 : 0);
+    else if (fNegative)
+        vch.back() |= 0x80;
+}
+
+template<typename T>
+bool CastToBool(const T& vch)
 {
     for (int i = 0; i < vch.size(); i++)
     {
@@ -42,7 +228,7 @@ bool CastToBool(const valtype& vch)
     return false;
 }
 
-void MakeSameSize(valtype& vch1, valtype& vch2)
+void MakeSameSize(CScriptValue& vch1, CScriptValue& vch2)
 {
     // Lengthen the shorter one
     if (vch1.size() < vch2.size())
@@ -59,24 +245,31 @@ void MakeSameSize(valtype& vch1, valtype& vch2)
 //
 #define stacktop(i)  (stack.at(stack.size()+(i)))
 #define altstacktop(i)  (altstack.at(altstack.size()+(i)))
-static inline void popstack(vector<valtype>& stack)
+static inline void popstack(vector<CScriptValue>& stack)
 {
     if (stack.empty())
         throw runtime_error("popstack() : stack empty");
     stack.pop_back();
 }
 
+static inline void pushnum(vector<CScriptValue>& stack, int64 n)
+{
+    stack.push_back(CScriptValue());
+    SetInt64(stack.back(), n);
+}
+
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType)
+bool EvalScript(vector<CScriptValue>& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                const CSignatureHashCache* psighashcache)
 {
-    CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
     CScript::const_iterator pbegincodehash = script.begin();
     opcodetype opcode;
-    valtype vchPushValue;
+    CScript::const_iterator pvchPushValue;
+    unsigned int nPushSize;
     vector<bool> vfExec;
-    vector<valtype> altstack;
+    vector<CScriptValue> altstack;
     if (script.size() > 10000)
         return false;
     int nOpCount = 0;
@@ -91,9 +284,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
             //
             // Read instruction
             //
-            if (!script.GetOp(pc, opcode, vchPushValue))
+            if (!script.GetOp(pc, opcode, pvchPushValue, nPushSize))
                 return false;
-            if (vchPushValue.size() > 520)
+            if (nPushSize > 520)
                 return false;
             if (opcode > OP_16 && ++nOpCount > 201)
                 return false;
@@ -116,7 +309,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 return false;
 
             if (fExec && 0 <= opcode && opcode <= OP_PUSHDATA4)
-                stack.push_back(vchPushValue);
+                stack.push_back(CScriptValue(nPushSize ? &pvchPushValue[0] : NULL, nPushSize));
             else if (fExec || (OP_IF <= opcode && opcode <= OP_ENDIF))
             switch (opcode)
             {
@@ -142,8 +335,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_16:
                 {
                     // ( -- value)
-                    CBigNum bn((int)opcode - (int)(OP_1 - 1));
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, (int)opcode - (int)(OP_1 - 1));
                 }
                 break;
 
@@ -165,7 +357,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     {
                         if (stack.size() < 1)
                             return false;
-                        valtype& vch = stacktop(-1);
+                        CScriptValue& vch = stacktop(-1);
                         fValue = CastToBool(vch);
                         if (opcode == OP_NOTIF)
                             fValue = !fValue;
@@ -248,8 +440,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch1 = stacktop(-2);
-                    valtype vch2 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-2);
+                    CScriptValue vch2 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -260,9 +452,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 -- x1 x2 x3 x1 x2 x3)
                     if (stack.size() < 3)
                         return false;
-                    valtype vch1 = stacktop(-3);
-                    valtype vch2 = stacktop(-2);
-                    valtype vch3 = stacktop(-1);
+                    CScriptValue vch1 = stacktop(-3);
+                    CScriptValue vch2 = stacktop(-2);
+                    CScriptValue vch3 = stacktop(-1);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                     stack.push_back(vch3);
@@ -274,8 +466,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 -- x1 x2 x3 x4 x1 x2)
                     if (stack.size() < 4)
                         return false;
-                    valtype vch1 = stacktop(-4);
-                    valtype vch2 = stacktop(-3);
+                    CScriptValue vch1 = stacktop(-4);
+                    CScriptValue vch2 = stacktop(-3);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
                 }
@@ -286,8 +478,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 x3 x4 x5 x6 -- x3 x4 x5 x6 x1 x2)
                     if (stack.size() < 6)
                         return false;
-                    valtype vch1 = stacktop(-6);
-                    valtype vch2 = stacktop(-5);
+                    CScriptValue vch1 = stacktop(-6);
+                    CScriptValue vch2 = stacktop(-5);
                     stack.erase(stack.end()-6, stack.end()-4);
                     stack.push_back(vch1);
                     stack.push_back(vch2);
@@ -309,7 +501,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x - 0 | x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     if (CastToBool(vch))
                         stack.push_back(vch);
                 }
@@ -318,8 +510,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                 case OP_DEPTH:
                 {
                     // -- stacksize
-                    CBigNum bn(stack.size());
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, stack.size());
                 }
                 break;
 
@@ -337,7 +528,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x -- x x)
                     if (stack.size() < 1)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     stack.push_back(vch);
                 }
                 break;
@@ -356,7 +547,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x1 x2 x1)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-2);
+                    CScriptValue vch = stacktop(-2);
                     stack.push_back(vch);
                 }
                 break;
@@ -368,11 +559,11 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (xn ... x2 x1 x0 n - ... x2 x1 x0 xn)
                     if (stack.size() < 2)
                         return false;
-                    int n = CastToBigNum(stacktop(-1)).getint();
+                    int n = CastToInt64(stacktop(-1));
                     popstack(stack);
                     if (n < 0 || n >= stack.size())
                         return false;
-                    valtype vch = stacktop(-n-1);
+                    CScriptValue vch = stacktop(-n-1);
                     if (opcode == OP_ROLL)
                         stack.erase(stack.end()-n-1);
                     stack.push_back(vch);
@@ -405,7 +596,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- x2 x1 x2)
                     if (stack.size() < 2)
                         return false;
-                    valtype vch = stacktop(-1);
+                    CScriptValue vch = stacktop(-1);
                     stack.insert(stack.end()-2, vch);
                 }
                 break;
@@ -419,9 +610,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- out)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
-                    vch1.insert(vch1.end(), vch2.begin(), vch2.end());
+                    CScriptValue& vch1 = stacktop(-2);
+                    CScriptValue& vch2 = stacktop(-1);
+                    vch1.append(vch2.begin(), vch2.end());
                     popstack(stack);
                     if (stacktop(-1).size() > 520)
                         return false;
@@ -433,9 +624,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in begin size -- out)
                     if (stack.size() < 3)
                         return false;
-                    valtype& vch = stacktop(-3);
-                    int nBegin = CastToBigNum(stacktop(-2)).getint();
-                    int nEnd = nBegin + CastToBigNum(stacktop(-1)).getint();
+                    CScriptValue& vch = stacktop(-3);
+                    int nBegin = CastToInt64(stacktop(-2));
+                    int nEnd = nBegin + CastToInt64(stacktop(-1));
                     if (nBegin < 0 || nEnd < nBegin)
                         return false;
                     if (nBegin > vch.size())
@@ -455,8 +646,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in size -- out)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch = stacktop(-2);
-                    int nSize = CastToBigNum(stacktop(-1)).getint();
+                    CScriptValue& vch = stacktop(-2);
+                    int nSize = CastToInt64(stacktop(-1));
                     if (nSize < 0)
                         return false;
                     if (nSize > vch.size())
@@ -474,8 +665,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- in size)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn(stacktop(-1).size());
-                    stack.push_back(bn.getvch());
+                    pushnum(stack, stacktop(-1).size());
                 }
                 break;
 
@@ -488,7 +678,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in - out)
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
+                    CScriptValue& vch = stacktop(-1);
                     for (int i = 0; i < vch.size(); i++)
                         vch[i] = ~vch[i];
                 }
@@ -501,8 +691,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 - out)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    CScriptValue& vch1 = stacktop(-2);
+                    CScriptValue& vch2 = stacktop(-1);
                     MakeSameSize(vch1, vch2);
                     if (opcode == OP_AND)
                     {
@@ -530,8 +720,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 - bool)
                     if (stack.size() < 2)
                         return false;
-                    valtype& vch1 = stacktop(-2);
-                    valtype& vch2 = stacktop(-1);
+                    CScriptValue& vch1 = stacktop(-2);
+                    CScriptValue& vch2 = stacktop(-1);
                     bool fEqual = (vch1 == vch2);
                     // OP_NOTEQUAL is disabled because it would be too easy to say
                     // something like n != 1 and have some wiseguy pass in 1 with extra
@@ -567,20 +757,21 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- out)
                     if (stack.size() < 1)
                         return false;
-                    CBigNum bn = CastToBigNum(stacktop(-1));
+                    // Operands are at most 4 bytes, so int64 can't overflow
+                    CScriptValue& vch = stacktop(-1);
+                    int64 n = CastToInt64(vch);
                     switch (opcode)
                     {
-                    case OP_1ADD:       bn += bnOne; break;
-                    case OP_1SUB:       bn -= bnOne; break;
-                    case OP_2MUL:       bn <<= 1; break;
-                    case OP_2DIV:       bn >>= 1; break;
-                    case OP_NEGATE:     bn = -bn; break;
-                    case OP_ABS:        if (bn < bnZero) bn = -bn; break;
-                    case OP_NOT:        bn = (bn == bnZero); break;
-                    case OP_0NOTEQUAL:  bn = (bn != bnZero); break;
+                    case OP_1ADD:       n += 1; break;
+                    case OP_1SUB:       n -= 1; break;
+                    case OP_2MUL:       n *= 2; break;
+                    case OP_2DIV:       n = (n < 0 ? -(-n >> 1) : n >> 1); break;
+                    case OP_NEGATE:     n = -n; break;
+                    case OP_ABS:        if (n < 0) n = -n; break;
+                    case OP_NOT:        n = (n == 0); break;
+                    case OP_0NOTEQUAL:  n = (n != 0); break;
                     }
-                    popstack(stack);
-                    stack.push_back(bn.getvch());
+                    SetInt64(vch, n);
                 }
                 break;
 
@@ -606,61 +797,41 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x1 x2 -- out)
                     if (stack.size() < 2)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-2));
-                    CBigNum bn2 = CastToBigNum(stacktop(-1));
-                    CBigNum bn;
+                    int64 n1 = CastToInt64(stacktop(-2));
+                    int64 n2 = CastToInt64(stacktop(-1));
+                    int64 n = 0;
                     switch (opcode)
                     {
                     case OP_ADD:
-                        bn = bn1 + bn2;
+                        n = n1 + n2;
                         break;
 
                     case OP_SUB:
-                        bn = bn1 - bn2;
+                        n = n1 - n2;
                         break;
 
                     case OP_MUL:
-                        if (!BN_mul(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
                     case OP_DIV:
-                        if (!BN_div(&bn, NULL, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
                     case OP_MOD:
-                        if (!BN_mod(&bn, &bn1, &bn2, pctx))
-                            return false;
-                        break;
-
                     case OP_LSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 << bn2.getulong();
-                        break;
-
                     case OP_RSHIFT:
-                        if (bn2 < bnZero || bn2 > CBigNum(2048))
-                            return false;
-                        bn = bn1 >> bn2.getulong();
-                        break;
+                        // Disabled above
+                        return false;
 
-                    case OP_BOOLAND:             bn = (bn1 != bnZero && bn2 != bnZero); break;
-                    case OP_BOOLOR:              bn = (bn1 != bnZero || bn2 != bnZero); break;
-                    case OP_NUMEQUAL:            bn = (bn1 == bn2); break;
-                    case OP_NUMEQUALVERIFY:      bn = (bn1 == bn2); break;
-                    case OP_NUMNOTEQUAL:         bn = (bn1 != bn2); break;
-                    case OP_LESSTHAN:            bn = (bn1 < bn2); break;
-                    case OP_GREATERTHAN:         bn = (bn1 > bn2); break;
-                    case OP_LESSTHANOREQUAL:     bn = (bn1 <= bn2); break;
-                    case OP_GREATERTHANOREQUAL:  bn = (bn1 >= bn2); break;
-                    case OP_MIN:                 bn = (bn1 < bn2 ? bn1 : bn2); break;
-                    case OP_MAX:                 bn = (bn1 > bn2 ? bn1 : bn2); break;
+                    case OP_BOOLAND:             n = (n1 != 0 && n2 != 0); break;
+                    case OP_BOOLOR:              n = (n1 != 0 || n2 != 0); break;
+                    case OP_NUMEQUAL:            n = (n1 == n2); break;
+                    case OP_NUMEQUALVERIFY:      n = (n1 == n2); break;
+                    case OP_NUMNOTEQUAL:         n = (n1 != n2); break;
+                    case OP_LESSTHAN:            n = (n1 < n2); break;
+                    case OP_GREATERTHAN:         n = (n1 > n2); break;
+                    case OP_LESSTHANOREQUAL:     n = (n1 <= n2); break;
+                    case OP_GREATERTHANOREQUAL:  n = (n1 >= n2); break;
+                    case OP_MIN:                 n = (n1 < n2 ? n1 : n2); break;
+                    case OP_MAX:                 n = (n1 > n2 ? n1 : n2); break;
                     }
                     popstack(stack);
-                    popstack(stack);
-                    stack.push_back(bn.getvch());
+                    SetInt64(stacktop(-1), n);
 
                     if (opcode == OP_NUMEQUALVERIFY)
                     {
@@ -677,10 +848,10 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (x min max -- out)
                     if (stack.size() < 3)
                         return false;
-                    CBigNum bn1 = CastToBigNum(stacktop(-3));
-                    CBigNum bn2 = CastToBigNum(stacktop(-2));
-                    CBigNum bn3 = CastToBigNum(stacktop(-1));
-                    bool fValue = (bn2 <= bn1 && bn1 < bn3);
+                    int64 n1 = CastToInt64(stacktop(-3));
+                    int64 n2 = CastToInt64(stacktop(-2));
+                    int64 n3 = CastToInt64(stacktop(-1));
+                    bool fValue = (n2 <= n1 && n1 < n3);
                     popstack(stack);
                     popstack(stack);
                     popstack(stack);
@@ -701,26 +872,27 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // (in -- hash)
                     if (stack.size() < 1)
                         return false;
-                    valtype& vch = stacktop(-1);
-                    valtype vchHash((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
+                    CScriptValue& vch = stacktop(-1);
+                    unsigned char pchHash[32];
+                    unsigned int nHashSize = ((opcode == OP_RIPEMD160 || opcode == OP_SHA1 || opcode == OP_HASH160) ? 20 : 32);
                     if (opcode == OP_RIPEMD160)
-                        RIPEMD160(&vch[0], vch.size(), &vchHash[0]);
+                        RIPEMD160(vch.begin(), vch.size(), pchHash);
                     else if (opcode == OP_SHA1)
-                        SHA1(&vch[0], vch.size(), &vchHash[0]);
+                        SHA1(vch.begin(), vch.size(), pchHash);
                     else if (opcode == OP_SHA256)
-                        SHA256(&vch[0], vch.size(), &vchHash[0]);
+                        SHA256(vch.begin(), vch.size(), pchHash);
                     else if (opcode == OP_HASH160)
                     {
-                        uint160 hash160 = Hash160(vch);
-                        memcpy(&vchHash[0], &hash160, sizeof(hash160));
+                        uint256 hash1;
+                        SHA256(vch.begin(), vch.size(), (unsigned char*)&hash1);
+                        RIPEMD160((unsigned char*)&hash1, sizeof(hash1), pchHash);
                     }
                     else if (opcode == OP_HASH256)
                     {
                         uint256 hash = Hash(vch.begin(), vch.end());
-                        memcpy(&vchHash[0], &hash, sizeof(hash));
+                        memcpy(pchHash, &hash, sizeof(hash));
                     }
-                    popstack(stack);
-                    stack.push_back(vchHash);
+                    vch.assign(pchHash, nHashSize);
                 }
                 break;
 
@@ -738,8 +910,8 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if (stack.size() < 2)
                         return false;
 
-                    valtype& vchSig    = stacktop(-2);
-                    valtype& vchPubKey = stacktop(-1);
+                    CScriptValue& vchSig    = stacktop(-2);
+                    CScriptValue& vchPubKey = stacktop(-1);
 
                     ////// debug print
                     //PrintHex(vchSig.begin(), vchSig.end(), "sig: %s\n");
@@ -749,9 +921,9 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     CScript scriptCode(pbegincodehash, pend);
 
                     // Drop the signature, since there's no way for a signature to sign itself
-                    scriptCode.FindAndDelete(CScript(vchSig));
+                    scriptCode.FindAndDelete(CScript(vchSig.vch()));
 
-                    bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                    bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, psighashcache);
 
                     popstack(stack);
                     popstack(stack);
@@ -775,7 +947,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if (stack.size() < i)
                         return false;
 
-                    int nKeysCount = CastToBigNum(stacktop(-i)).getint();
+                    int nKeysCount = CastToInt64(stacktop(-i));
                     if (nKeysCount < 0 || nKeysCount > 20)
                         return false;
                     nOpCount += nKeysCount;
@@ -786,7 +958,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     if (stack.size() < i)
                         return false;
 
-                    int nSigsCount = CastToBigNum(stacktop(-i)).getint();
+                    int nSigsCount = CastToInt64(stacktop(-i));
                     if (nSigsCount < 0 || nSigsCount > nKeysCount)
                         return false;
                     int isig = ++i;
@@ -800,18 +972,18 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     // Drop the signatures, since there's no way for a signature to sign itself
                     for (int k = 0; k < nSigsCount; k++)
                     {
-                        valtype& vchSig = stacktop(-isig-k);
-                        scriptCode.FindAndDelete(CScript(vchSig));
+                        CScriptValue& vchSig = stacktop(-isig-k);
+                        scriptCode.FindAndDelete(CScript(vchSig.vch()));
                     }
 
                     bool fSuccess = true;
                     while (fSuccess && nSigsCount > 0)
                     {
-                        valtype& vchSig    = stacktop(-isig);
-                        valtype& vchPubKey = stacktop(-ikey);
+                        CScriptValue& vchSig    = stacktop(-isig);
+                        CScriptValue& vchPubKey = stacktop(-ikey);
 
                         // Check signature
-                        if (CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType))
+                        if (CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, psighashcache))
                         {
                             isig++;
                             nSigsCount--;
@@ -868,86 +1040,311 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
 
 
 
-uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+// Another input as the signature hash serializes it: empty scriptSig,
+// and nSequence zeroed by SIGHASH_NONE and SIGHASH_SINGLE
+template<typename Stream>
+static void WriteBlankedInput(Stream& s, const CTxIn& txin, bool fZeroSequence)
+{
+    s << txin.prevout;
+    WriteCompactSize(s, 0);
+    s << (fZeroSequence ? (unsigned int)0 : txin.nSequence);
+}
+
+
+CSignatureHashCache::CSignatureHashCache(const CTransaction& txTo)
+{
+    CHashWriter ss(SER_GETHASH, VERSION);
+    ss << txTo.nVersion;
+    WriteCompactSize(ss, txTo.vin.size());
+
+    CDataStream ssTail(SER_GETHASH);
+    vPrefix.reserve(txTo.vin.size());
+    vTailPos.reserve(txTo.vin.size());
+    foreach(const CTxIn& txin, txTo.vin)
+    {
+        vPrefix.push_back(ss.ctx);
+        WriteBlankedInput(ss, txin, false);
+        WriteBlankedInput(ssTail, txin, false);
+        vTailPos.push_back(ssTail.size());
+    }
+    ssTail << txTo.vout << txTo.nLockTime;
+    vchTail.assign(ssTail.begin(), ssTail.end());
+}
+
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                      const CSignatureHashCache* psighashcache)
 {
     if (nIn >= txTo.vin.size())
     {
         printf("ERROR: SignatureHash() : nIn=%d out of range\n", nIn);
         return 1;
     }
-    CTransaction txTmp(txTo);
 
     // In case concatenating two scripts ends up with two codeseparators,
     // or an extra one at the end, this prevents all those possible incompatibilities.
     scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
 
-    // Blank out other inputs' signatures
-    for (int i = 0; i < txTmp.vin.size(); i++)
-        txTmp.vin[i].scriptSig = CScript();
-    txTmp.vin[nIn].scriptSig = scriptCode;
+    // The serialization below is the transaction with other inputs'
+    // signatures blanked out and this input's replaced by scriptCode.
+    // SIGHASH_NONE blanks out all outputs (wildcard payee), SIGHASH_SINGLE
+    // all but the one at the same index as this input, and both let the
+    // other inputs update their nSequence at will.  SIGHASH_ANYONECANPAY
+    // leaves out the other inputs completely.
+    bool fNone = ((nHashType & 0x1f) == SIGHASH_NONE);
+    bool fSingle = ((nHashType & 0x1f) == SIGHASH_SINGLE);
+    bool fAnyoneCanPay = (nHashType & SIGHASH_ANYONECANPAY);
+    if (fSingle && nIn >= txTo.vout.size())
+    {
+        printf("ERROR: SignatureHash() : nOut=%d out of range\n", nIn);
+        return 1;
+    }
+    const CTxIn& txinThis = txTo.vin[nIn];
+
+    // With SIGHASH_ALL everything but this input is the same for every
+    // input of the transaction, resume from the precomputed state
+    if (psighashcache && !fNone && !fSingle && !fAnyoneCanPay)
+    {
+        const CSignatureHashCache& cache = *psighashcache;
+        CHashWriter ss(cache.vPrefix[nIn], SER_GETHASH, VERSION);
+        ss << txinThis.prevout << scriptCode << txinThis.nSequence;
+        ss.write((const char*)&cache.vchTail[cache.vTailPos[nIn]], cache.vchTail.size() - cache.vTailPos[nIn]);
+        ss << nHashType;
+        return ss.GetHash();
+    }
+
+    CHashWriter ss(SER_GETHASH, VERSION);
+    ss << txTo.nVersion;
+
+    WriteCompactSize(ss, fAnyoneCanPay ? 1 : txTo.vin.size());
+    for (unsigned int i = 0; i < txTo.vin.size(); i++)
+    {
+        if (i == nIn)
+            ss << txinThis.prevout << scriptCode << txinThis.nSequence;
+        else if (!fAnyoneCanPay)
+            WriteBlankedInput(ss, txTo.vin[i], fNone || fSingle);
+    }
+
+    if (fNone)
+    {
+        WriteCompactSize(ss, 0);
+    }
+    else if (fSingle)
+    {
+        // Outputs ahead of ours are serialized as null
+        CTxOut txoutNull;
+        WriteCompactSize(ss, nIn + 1);
+        for (unsigned int i = 0; i < nIn; i++)
+            ss << txoutNull;
+        ss << txTo.vout[nIn];
+    }
+    else
+    {
+        ss << txTo.vout;
+    }
+
+    ss << txTo.nLockTime << nHashType;
+    return ss.GetHash();
+}
+
+
+//
+// Signatures that already verified, so a transaction checked on its way
+// into the memory pool isn't verified again when its block arrives.
+// Entries are a hash of (sighash, signature, pubkey) and a random one is
+// dropped when the cache is full.  The signature and pubkey go in with
+// their lengths, so the same bytes split differently between them, which
+// the sighash doesn't cover, aren't taken for an entry that verified.
+//
+unsigned int nMaxSigCacheSize = 50000;
 
-    // Blank out some of the outputs
-    if ((nHashType & 0x1f) == SIGHASH_NONE)
+class CSignatureCache
+{
+protected:
+    CCriticalSection cs;
+    set<uint256> setValid;
+    uint64 nHits;
+    uint64 nMisses;
+
+public:
+    CSignatureCache()
     {
-        // Wildcard payee
-        txTmp.vout.clear();
+        nHits = 0;
+        nMisses = 0;
+    }
 
-        // Let the others update at will
-        for (int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+    static uint256 GetEntry(const uint256& hash, const unsigned char* pbeginSig, const unsigned char* pendSig,
+                            const unsigned char* pbeginPubKey, const unsigned char* pendPubKey)
+    {
+        CHashWriter ss(SER_GETHASH, 0);
+        ss << hash;
+        WriteCompactSize(ss, pendSig - pbeginSig);
+        ss.write((const char*)pbeginSig, pendSig - pbeginSig);
+        WriteCompactSize(ss, pendPubKey - pbeginPubKey);
+        ss.write((const char*)pbeginPubKey, pendPubKey - pbeginPubKey);
+        return ss.GetHash();
     }
-    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+
+    bool Get(const uint256& entry)
     {
-        // Only lockin the txout payee at same index as txin
-        unsigned int nOut = nIn;
-        if (nOut >= txTmp.vout.size())
+        CRITICAL_BLOCK(cs)
         {
-            printf("ERROR: SignatureHash() : nOut=%d out of range\n", nOut);
-            return 1;
+            if (setValid.count(entry))
+            {
+                nHits++;
+                return true;
+            }
+            nMisses++;
         }
-        txTmp.vout.resize(nOut+1);
-        for (int i = 0; i < nOut; i++)
-            txTmp.vout[i].SetNull();
-
-        // Let the others update at will
-        for (int i = 0; i < txTmp.vin.size(); i++)
-            if (i != nIn)
-                txTmp.vin[i].nSequence = 0;
+        return false;
     }
 
-    // Blank out other inputs completely, not recommended for open transactions
-    if (nHashType & SIGHASH_ANYONECANPAY)
+    void Set(const uint256& entry)
     {
-        txTmp.vin[0] = txTmp.vin[nIn];
-        txTmp.vin.resize(1);
+        CRITICAL_BLOCK(cs)
+        {
+            if (nMaxSigCacheSize == 0)
+                return;
+            while (setValid.size() >= nMaxSigCacheSize)
+            {
+                uint256 hashRand;
+                RAND_bytes((unsigned char*)&hashRand, sizeof(hashRand));
+                set<uint256>::iterator it = setValid.lower_bound(hashRand);
+                if (it == setValid.end())
+                    it = setValid.begin();
+                setValid.erase(it);
+            }
+            setValid.insert(entry);
+        }
     }
 
-    // Serialize and hash
-    CDataStream ss(SER_GETHASH);
-    ss.reserve(10000);
-    ss << txTmp << nHashType;
-    return Hash(ss.begin(), ss.end());
+    void GetStats(uint64& nEntriesRet, uint64& nHitsRet, uint64& nMissesRet)
+    {
+        CRITICAL_BLOCK(cs)
+        {
+            nEntriesRet = setValid.size();
+            nHitsRet = nHits;
+            nMissesRet = nMisses;
+        }
+    }
+};
+
+static CSignatureCache sigcache;
+
+void GetSigCacheStats(uint64& nEntriesRet, uint64& nHitsRet, uint64& nMissesRet)
+{
+    sigcache.GetStats(nEntriesRet, nHitsRet, nMissesRet);
 }
 
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType)
+
+//
+// Decoded public keys, most recently used first.  Decoding a pubkey means
+// building an EC_KEY and checking the point is on the curve, and the same
+// keys sign over and over.  Keys are handed out by shared pointer so one
+// evicted while another thread verifies with it stays alive until done.
+// OpenSSL's locking callbacks make concurrent ECDSA_verify on one key safe.
+//
+unsigned int nMaxPubKeyCacheSize = 10000;
+
+class CPubKeyCache
 {
-    CKey key;
-    if (!key.SetPubKey(vchPubKey))
-        return false;
+protected:
+    typedef list<pair<valtype, boost::shared_ptr<CKey> > > list_type;
+
+    CCriticalSection cs;
+    list_type lruKeys;
+    map<valtype, list_type::iterator> mapEntry;
+    uint64 nHits;
+    uint64 nMisses;
+
+public:
+    CPubKeyCache()
+    {
+        nHits = 0;
+        nMisses = 0;
+    }
+
+    boost::shared_ptr<CKey> Get(const valtype& vchPubKey)
+    {
+        CRITICAL_BLOCK(cs)
+        {
+            map<valtype, list_type::iterator>::iterator mi = mapEntry.find(vchPubKey);
+            if (mi != mapEntry.end())
+            {
+                nHits++;
+                lruKeys.splice(lruKeys.begin(), lruKeys, (*mi).second);
+                return (*mi).second->second;
+            }
+            nMisses++;
+        }
+
+        // Decode outside the lock
+        boost::shared_ptr<CKey> pkey(new CKey());
+        if (vchPubKey.empty() || !pkey->SetPubKey(vchPubKey))
+            return boost::shared_ptr<CKey>();
 
+        CRITICAL_BLOCK(cs)
+        {
+            if (nMaxPubKeyCacheSize == 0 || mapEntry.count(vchPubKey))
+                return pkey;
+            while (lruKeys.size() >= nMaxPubKeyCacheSize)
+            {
+                mapEntry.erase(lruKeys.back().first);
+                lruKeys.pop_back();
+            }
+            lruKeys.push_front(make_pair(vchPubKey, pkey));
+            mapEntry[vchPubKey] = lruKeys.begin();
+        }
+        return pkey;
+    }
+
+    void GetStats(uint64& nEntriesRet, uint64& nHitsRet, uint64& nMissesRet)
+    {
+        CRITICAL_BLOCK(cs)
+        {
+            nEntriesRet = mapEntry.size();
+            nHitsRet = nHits;
+            nMissesRet = nMisses;
+        }
+    }
+};
+
+static CPubKeyCache pubkeycache;
+
+void GetPubKeyCacheStats(uint64& nEntriesRet, uint64& nHitsRet, uint64& nMissesRet)
+{
+    pubkeycache.GetStats(nEntriesRet, nHitsRet, nMissesRet);
+}
+
+
+// The sig and pubkey are only copied out of the stack on a cache miss
+bool CheckSig(const CScriptValue& vchSigIn, const CScriptValue& vchPubKeyIn, const CScript& scriptCode,
+              const CTransaction& txTo, unsigned int nIn, int nHashType, const CSignatureHashCache* psighashcache)
+{
     // Hash type is one byte tacked on to the end of the signature
-    if (vchSig.empty())
+    if (vchSigIn.empty())
         return false;
     if (nHashType == 0)
-        nHashType = vchSig.back();
-    else if (nHashType != vchSig.back())
+        nHashType = vchSigIn.back();
+    else if (nHashType != vchSigIn.back())
         return false;
-    vchSig.pop_back();
 
-    return key.Verify(SignatureHash(scriptCode, txTo, nIn, nHashType), vchSig);
+    uint256 hash = SignatureHash(scriptCode, txTo, nIn, nHashType, psighashcache);
+    uint256 entry = CSignatureCache::GetEntry(hash, vchSigIn.begin(), vchSigIn.end() - 1, vchPubKeyIn.begin(), vchPubKeyIn.end());
+    if (sigcache.Get(entry))
+        return true;
+
+    valtype vchSig(vchSigIn.begin(), vchSigIn.end() - 1);
+    valtype vchPubKey(vchPubKeyIn.begin(), vchPubKeyIn.end());
+    boost::shared_ptr<CKey> pkey = pubkeycache.Get(vchPubKey);
+    if (!pkey)
+        return false;
+    if (!pkey->Verify(hash, vchSig))
+        return false;
+
+    sigcache.Set(entry);
+    return true;
 }
 
 
@@ -959,8 +1356,69 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
 
 
 
+//
+// Byte level match of the standard templates in their canonical encoding,
+// which is what every client creates.  Returns false if it can't decide and
+// the generic matcher has to run.  Otherwise typeRet is OP_PUBKEY or
+// OP_PUBKEYHASH with pchRet pointing at the key or hash inside the script,
+// or OP_INVALIDOPCODE if the script can't match any template.  That covers
+// name scripts too, they start with the name op (OP_1 to OP_3) and are never
+// standard here.
+//
+static bool MatchTemplate(const CScript& script, opcodetype& typeRet, const unsigned char*& pchRet, unsigned int& nSizeRet)
+{
+    typeRet = OP_INVALIDOPCODE;
+    unsigned int nSize = script.size();
+    if (nSize == 0)
+        return true;
+    const unsigned char* pch = &script[0];
+
+    // OP_DUP OP_HASH160 <20 bytes> OP_EQUALVERIFY OP_CHECKSIG
+    if (pch[0] == OP_DUP)
+    {
+        if (nSize == 25 && pch[1] == OP_HASH160 && pch[2] == sizeof(uint160) &&
+            pch[23] == OP_EQUALVERIFY && pch[24] == OP_CHECKSIG)
+        {
+            typeRet = OP_PUBKEYHASH;
+            pchRet = pch + 3;
+            nSizeRet = sizeof(uint160);
+            return true;
+        }
+        return false;
+    }
+
+    // <33 to 75 byte pubkey> OP_CHECKSIG
+    if (pch[0] >= 33 && pch[0] < OP_PUSHDATA1)
+    {
+        if (nSize == pch[0] + 2U && pch[nSize-1] == OP_CHECKSIG)
+        {
+            typeRet = OP_PUBKEY;
+            pchRet = pch + 1;
+            nSizeRet = pch[0];
+            return true;
+        }
+        return false;
+    }
+
+    // Both templates start with OP_DUP or a push
+    return (pch[0] > OP_PUSHDATA4);
+}
+
+
 bool Solver(const CScript& scriptPubKey, vector<pair<opcodetype, valtype> >& vSolutionRet)
 {
+    opcodetype type;
+    const unsigned char* pch;
+    unsigned int nSize;
+    if (MatchTemplate(scriptPubKey, type, pch, nSize))
+    {
+        vSolutionRet.clear();
+        if (type == OP_INVALIDOPCODE)
+            return false;
+        vSolutionRet.push_back(make_pair(type, valtype(pch, pch + nSize)));
+        return true;
+    }
+
     // Templates
     static vector<CScript> vTemplates;
     if (vTemplates.empty())
@@ -1080,6 +1538,11 @@ bool IsStandard(const CScript& scriptPubKey)
 {
     if (hooks->IsStandard(scriptPubKey))
         return true;
+    opcodetype type;
+    const unsigned char* pch;
+    unsigned int nSize;
+    if (MatchTemplate(scriptPubKey, type, pch, nSize))
+        return (type != OP_INVALIDOPCODE);
     vector<pair<opcodetype, valtype> > vSolution;
     return Solver(scriptPubKey, vSolution);
 }
@@ -1087,6 +1550,26 @@ bool IsStandard(const CScript& scriptPubKey)
 
 bool IsMine(const CScript& scriptPubKey)
 {
+    opcodetype type;
+    const unsigned char* pch;
+    unsigned int nSize;
+    if (MatchTemplate(scriptPubKey, type, pch, nSize))
+    {
+        if (type == OP_INVALIDOPCODE)
+            return false;
+        CRITICAL_BLOCK(cs_mapKeys)
+        {
+            if (type == OP_PUBKEYHASH)
+            {
+                uint160 hash160;
+                memcpy(&hash160, pch, sizeof(hash160));
+                map<uint160, valtype>::iterator mi = mapPubKeys.find(hash160);
+                return (mi != mapPubKeys.end() && mapKeys.count((*mi).second));
+            }
+            return (mapKeys.count(valtype(pch, pch + nSize)) != 0);
+        }
+    }
+
     CScript scriptSig;
     return Solver(scriptPubKey, 0, 0, scriptSig);
 }
@@ -1096,6 +1579,34 @@ bool ExtractPubKey(const CScript& scriptPubKey, bool fMineOnly, vector<unsigned
 {
     vchPubKeyRet.clear();
 
+    opcodetype type;
+    const unsigned char* pch;
+    unsigned int nSize;
+    if (MatchTemplate(scriptPubKey, type, pch, nSize))
+    {
+        if (type == OP_INVALIDOPCODE)
+            return false;
+        CRITICAL_BLOCK(cs_mapKeys)
+        {
+            if (type == OP_PUBKEYHASH)
+            {
+                uint160 hash160;
+                memcpy(&hash160, pch, sizeof(hash160));
+                map<uint160, valtype>::iterator mi = mapPubKeys.find(hash160);
+                if (mi == mapPubKeys.end())
+                    return false;
+                if (fMineOnly && !mapKeys.count((*mi).second))
+                    return false;
+                vchPubKeyRet = (*mi).second;
+                return true;
+            }
+            if (fMineOnly && !mapKeys.count(valtype(pch, pch + nSize)))
+                return false;
+            vchPubKeyRet.assign(pch, pch + nSize);
+            return true;
+        }
+    }
+
     vector<pair<opcodetype, valtype> > vSolution;
     if (!Solver(scriptPubKey, vSolution))
         return false;
@@ -1131,6 +1642,17 @@ bool ExtractHash160(const CScript& scriptPubKey, uint160& hash160Ret)
 {
     hash160Ret = 0;
 
+    opcodetype type;
+    const unsigned char* pch;
+    unsigned int nSize;
+    if (MatchTemplate(scriptPubKey, type, pch, nSize))
+    {
+        if (type != OP_PUBKEYHASH)
+            return false;
+        memcpy(&hash160Ret, pch, sizeof(hash160Ret));
+        return true;
+    }
+
     vector<pair<opcodetype, valtype> > vSolution;
     if (!Solver(scriptPubKey, vSolution))
         return false;
@@ -1147,12 +1669,14 @@ bool ExtractHash160(const CScript& scriptPubKey, uint160& hash160Ret)
 }
 
 
-bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, int nHashType)
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                  const CSignatureHashCache* psighashcache)
 {
-    vector<vector<unsigned char> > stack;
-    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType))
+    vector<CScriptValue> stack;
+    stack.reserve(16);
+    if (!EvalScript(stack, scriptSig, txTo, nIn, nHashType, psighashcache))
         return false;
-    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType))
+    if (!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType, psighashcache))
         return false;
     if (stack.empty())
         return false;
@@ -1171,6 +1695,7 @@ bool SignSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned int
     // The checksig op will also drop the signatures from its hash.
     uint256 hash = SignatureHash(scriptPrereq + txout.scriptPubKey, txTo, nIn, nHashType);
 
+    txTo.InvalidateHash();
     if (!Solver(txout.scriptPubKey, hash, nHashType, txin.scriptSig))
         return false;
 
@@ -1185,7 +1710,8 @@ bool SignSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned int
 }
 
 
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType)
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                     const CSignatureHashCache* psighashcache)
 {
     assert(nIn < txTo.vin.size());
     const CTxIn& txin = txTo.vin[nIn];
@@ -1196,7 +1722,7 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
     if (txin.prevout.hash != txFrom.GetHash())
         return false;
 
-    if (!VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, nHashType))
+    if (!VerifyScript(txin.scriptSig, txout.scriptPubKey, txTo, nIn, nHashType, psighashcache))
         return false;
 
     // Anytime a signature is successfully verified, it's proof the outpoint is spent,
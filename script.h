@@ -510,6 +510,19 @@ public:
         return GetOp2(pc, opcodeRet, NULL);
     }
 
+    // Push data as a range of the script itself, nothing is copied
+    bool GetOp(const_iterator& pc, opcodetype& opcodeRet, const_iterator& pvchRet, unsigned int& nSizeRet) const
+    {
+        const_iterator pcOp = pc;
+        if (!GetOp2(pc, opcodeRet, NULL))
+            return false;
+        pvchRet = pc;
+        if (opcodeRet <= OP_PUSHDATA4)
+            pvchRet = pcOp + (opcodeRet < OP_PUSHDATA1 ? 1 : opcodeRet == OP_PUSHDATA1 ? 2 : opcodeRet == OP_PUSHDATA2 ? 3 : 5);
+        nSizeRet = pc - pvchRet;
+        return true;
+    }
+
     bool GetOp2(const_iterator& pc, opcodetype& opcodeRet, vector<unsigned char>* pvchRet) const
     {
         opcodeRet = OP_INVALIDOPCODE;
@@ -700,10 +713,36 @@ public:
 
 
 
-uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+//
+// The parts of a transaction's SIGHASH_ALL signature hash that are the same
+// for every input: the SHA-256 state after the inputs ahead of each one, and
+// the serialized inputs and outputs that follow it.  Build one per
+// transaction when verifying or signing more than one of its inputs.
+//
+class CSignatureHashCache
+{
+public:
+    vector<SHA256_CTX> vPrefix;
+    vector<unsigned char> vchTail;
+    vector<unsigned int> vTailPos;
+
+    explicit CSignatureHashCache(const CTransaction& txTo);
+};
+
+
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                      const CSignatureHashCache* psighashcache=NULL);
 bool IsStandard(const CScript& scriptPubKey);
 bool IsMine(const CScript& scriptPubKey);
 bool ExtractPubKey(const CScript& scriptPubKey, bool fMineOnly, vector<unsigned char>& vchPubKeyRet);
 bool ExtractHash160(const CScript& scriptPubKey, uint160& hash160Ret);
 bool SignSignature(const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL, CScript scriptPrereq=CScript());
-bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType=0);
+extern unsigned int nMaxSigCacheSize;
+void GetSigCacheStats(uint64& nEntriesRet, uint64& nHitsRet, uint64& nMissesRet);
+extern unsigned int nMaxPubKeyCacheSize;
+void GetPubKeyCacheStats(uint64& nEntriesRet, uint64& nHitsRet, uint64& nMissesRet);
+bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn, int nHashType,
+                  const CSignatureHashCache* psighashcache=NULL);
+bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, int nHashType=0,
+                     const CSignatureHashCache* psighashcache=NULL);
@@ -0,0 +1,848 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+// secp256k1 signature verification, used by CKey::Verify instead of
+// OpenSSL's generic prime curve code when built with -DUSE_SECP256K1.
+//
+// Field elements mod p and scalars mod the group order n are eight 32-bit
+// limbs, least significant first, always kept fully reduced.  u1*G + u2*Q is
+// computed with Shamir's trick over width-w NAFs, after splitting both
+// scalars in half with the curve's endomorphism lambda*(x,y) = (beta*x,y).
+// Multiples of G and lambda*G are precomputed at startup.
+//
+// Nothing here is secret, so the code is not constant time.  It only takes
+// strict DER signatures and standard 33 or 65 byte pubkeys, anything else
+// is left to OpenSSL so what's accepted doesn't change.
+
+#ifdef USE_SECP256K1
+
+#include "headers.h"
+
+static const unsigned int pP[8] =
+    { 0xFFFFFC2F, 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+static const unsigned int pPSqrt[8] =  // (p+1)/4
+    { 0xBFFFFF0C, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x3FFFFFFF };
+static const unsigned int pN[8] =
+    { 0xD0364141, 0xBFD25E8C, 0xAF48A03B, 0xBAAEDCE6, 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+static const unsigned int pNC[5] =     // 2^256 - n
+    { 0x2FC9BEBF, 0x402DA173, 0x50B75FC4, 0x45512319, 0x00000001 };
+static const unsigned int pNHalf[8] =
+    { 0x681B20A0, 0xDFE92F46, 0x57A4501D, 0x5D576E73, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0x7FFFFFFF };
+static const unsigned int pGx[8] =
+    { 0x16F81798, 0x59F2815B, 0x2DCE28D9, 0x029BFCDB, 0xCE870B07, 0x55A06295, 0xF9DCBBAC, 0x79BE667E };
+static const unsigned int pGy[8] =
+    { 0xFB10D4B8, 0x9C47D08F, 0xA6855419, 0xFD17B448, 0x0E1108A8, 0x5DA4FBFC, 0x26A3C465, 0x483ADA77 };
+static const unsigned int pBeta[8] =
+    { 0x719501EE, 0xC1396C28, 0x12F58995, 0x9CF04975, 0xAC3434E9, 0x6E64479E, 0x657C0710, 0x7AE96A2B };
+static const unsigned int pLambda[8] =
+    { 0x1B23BD72, 0xDF02967C, 0x20816678, 0x122E22EA, 0x8812645A, 0xA5261C02, 0xC05C30E0, 0x5363AD4C };
+
+// Lattice constants for splitting a scalar into k1 + k2*lambda with both
+// halves around 128 bits
+static const unsigned int pMinusB1[8] =
+    { 0x0ABFE4C3, 0x6F547FA9, 0x010E8828, 0xE4437ED6, 0x00000000, 0x00000000, 0x00000000, 0x00000000 };
+static const unsigned int pMinusB2[8] =
+    { 0x3DB1562C, 0xD765CDA8, 0x0774346D, 0x8A280AC5, 0xFFFFFFFE, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF };
+static const unsigned int pG1[8] =
+    { 0x45DBB031, 0xE893209A, 0x71E8CA7F, 0x3DAA8A14, 0x9284EB15, 0xE86C90E4, 0xA7D46BCD, 0x3086D221 };
+static const unsigned int pG2[8] =
+    { 0x8AC47F71, 0x1571B4AE, 0x9DF506C6, 0x221208AC, 0x0ABFE4C4, 0x6F547FA9, 0x010E8828, 0xE4437ED6 };
+
+// wNAF widths, the G tables hold 2^(WINDOW_G-2) points each
+static const int WINDOW_G = 8;
+static const int WINDOW_Q = 5;
+
+
+
+//
+// 256-bit integers
+//
+
+static inline void Set(unsigned int* r, const unsigned int* a)
+{
+    memcpy(r, a, 8 * sizeof(unsigned int));
+}
+
+static inline void SetInt(unsigned int* r, unsigned int n)
+{
+    memset(r, 0, 8 * sizeof(unsigned int));
+    r[0] = n;
+}
+
+static inline bool IsZero(const unsigned int* a)
+{
+    return (a[0] | a[1] | a[2] | a[3] | a[4] | a[5] | a[6] | a[7]) == 0;
+}
+
+static inline bool IsOne(const unsigned int* a)
+{
+    return a[0] == 1 && (a[1] | a[2] | a[3] | a[4] | a[5] | a[6] | a[7]) == 0;
+}
+
+static inline int Cmp(const unsigned int* a, const unsigned int* b)
+{
+    for (int i = 7; i >= 0; i--)
+    {
+        if (a[i] < b[i])
+            return -1;
+        if (a[i] > b[i])
+            return 1;
+    }
+    return 0;
+}
+
+static inline unsigned int Add(unsigned int* r, const unsigned int* a, const unsigned int* b)
+{
+    uint64 c = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        c += (uint64)a[i] + b[i];
+        r[i] = (unsigned int)c;
+        c >>= 32;
+    }
+    return (unsigned int)c;
+}
+
+static inline unsigned int Sub(unsigned int* r, const unsigned int* a, const unsigned int* b)
+{
+    int64 c = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        c += (int64)a[i] - b[i];
+        r[i] = (unsigned int)c;
+        c >>= 32;
+    }
+    return (unsigned int)-c;
+}
+
+static inline void Shr1(unsigned int* a, int nLimbs, unsigned int nTop)
+{
+    for (int i = 0; i < nLimbs - 1; i++)
+        a[i] = (a[i] >> 1) | (a[i+1] << 31);
+    a[nLimbs-1] = (a[nLimbs-1] >> 1) | (nTop << 31);
+}
+
+static void SetBytes(unsigned int* r, const unsigned char* pch)
+{
+    // Big endian, as in DER and the pubkey encoding
+    for (int i = 0; i < 8; i++)
+        r[7-i] = ((unsigned int)pch[4*i] << 24) | ((unsigned int)pch[4*i+1] << 16) |
+                 ((unsigned int)pch[4*i+2] << 8) | (unsigned int)pch[4*i+3];
+}
+
+static void Mul512(unsigned int* t, const unsigned int* a, const unsigned int* b)
+{
+    memset(t, 0, 16 * sizeof(unsigned int));
+    for (int i = 0; i < 8; i++)
+    {
+        uint64 c = 0;
+        for (int j = 0; j < 8; j++)
+        {
+            c += (uint64)a[i] * b[j] + t[i+j];
+            t[i+j] = (unsigned int)c;
+            c >>= 32;
+        }
+        t[i+8] = (unsigned int)c;
+    }
+}
+
+// Binary extended gcd, a must be non-zero and less than the odd prime m
+static void ModInverse(unsigned int* r, const unsigned int* a, const unsigned int* m)
+{
+    unsigned int u[8], v[8], x1[8], x2[8];
+    Set(u, a);
+    Set(v, m);
+    SetInt(x1, 1);
+    SetInt(x2, 0);
+    while (!IsOne(u) && !IsOne(v))
+    {
+        while (!(u[0] & 1))
+        {
+            Shr1(u, 8, 0);
+            unsigned int c = (x1[0] & 1) ? Add(x1, x1, m) : 0;
+            Shr1(x1, 8, c);
+        }
+        while (!(v[0] & 1))
+        {
+            Shr1(v, 8, 0);
+            unsigned int c = (x2[0] & 1) ? Add(x2, x2, m) : 0;
+            Shr1(x2, 8, c);
+        }
+        if (Cmp(u, v) >= 0)
+        {
+            Sub(u, u, v);
+            if (Sub(x1, x1, x2))
+                Add(x1, x1, m);
+        }
+        else
+        {
+            Sub(v, v, u);
+            if (Sub(x2, x2, x1))
+                Add(x2, x2, m);
+        }
+    }
+    Set(r, IsOne(u) ? x1 : x2);
+}
+
+
+
+//
+// Field elements mod p = 2^256 - 2^32 - 977
+//
+
+struct CFieldElem
+{
+    unsigned int d[8];
+};
+
+static inline void FeAdd(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    if (Add(r.d, a.d, b.d) || Cmp(r.d, pP) >= 0)
+        Sub(r.d, r.d, pP);
+}
+
+static inline void FeSub(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    if (Sub(r.d, a.d, b.d))
+        Add(r.d, r.d, pP);
+}
+
+static inline void FeNegate(CFieldElem& r, const CFieldElem& a)
+{
+    if (IsZero(a.d))
+        SetInt(r.d, 0);
+    else
+        Sub(r.d, pP, a.d);
+}
+
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 uint128;
+
+static void FeMul(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    // Same thing as below with 64-bit limbs where the compiler has a 128-bit type
+    uint64 x[4], y[4], t[8], u[4];
+    for (int i = 0; i < 4; i++)
+    {
+        x[i] = a.d[2*i] | ((uint64)a.d[2*i+1] << 32);
+        y[i] = b.d[2*i] | ((uint64)b.d[2*i+1] << 32);
+    }
+    memset(t, 0, sizeof(t));
+    for (int i = 0; i < 4; i++)
+    {
+        uint128 c = 0;
+        for (int j = 0; j < 4; j++)
+        {
+            c += (uint128)x[i] * y[j] + t[i+j];
+            t[i+j] = (uint64)c;
+            c >>= 64;
+        }
+        t[i+4] = (uint64)c;
+    }
+
+    uint128 c = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        c += (uint128)t[4+i] * 0x1000003D1ULL + t[i];
+        u[i] = (uint64)c;
+        c >>= 64;
+    }
+    c = (uint128)(uint64)c * 0x1000003D1ULL + u[0];
+    u[0] = (uint64)c;
+    c >>= 64;
+    for (int i = 1; i < 4; i++)
+    {
+        c += u[i];
+        u[i] = (uint64)c;
+        c >>= 64;
+    }
+    if (c)
+    {
+        c = (uint128)u[0] + 0x1000003D1ULL;
+        u[0] = (uint64)c;
+        for (int i = 1; i < 4 && (c >> 64); i++)
+        {
+            c = (uint128)u[i] + 1;
+            u[i] = (uint64)c;
+        }
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        r.d[2*i] = (unsigned int)u[i];
+        r.d[2*i+1] = (unsigned int)(u[i] >> 32);
+    }
+    if (Cmp(r.d, pP) >= 0)
+        Sub(r.d, r.d, pP);
+}
+#else
+static void FeMul(CFieldElem& r, const CFieldElem& a, const CFieldElem& b)
+{
+    unsigned int t[16];
+    Mul512(t, a.d, b.d);
+
+    // 2^256 = 2^32 + 977 mod p, fold the high half down
+    uint64 c = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        c += (uint64)t[i] + (uint64)t[8+i] * 977 + (i > 0 ? t[7+i] : 0);
+        r.d[i] = (unsigned int)c;
+        c >>= 32;
+    }
+    c += t[15];
+
+    // And the few bits that overflowed again
+    uint64 c2 = (uint64)r.d[0] + c * 977;
+    r.d[0] = (unsigned int)c2;
+    c2 >>= 32;
+    c2 += (uint64)r.d[1] + c;
+    r.d[1] = (unsigned int)c2;
+    c2 >>= 32;
+    for (int i = 2; i < 8; i++)
+    {
+        c2 += r.d[i];
+        r.d[i] = (unsigned int)c2;
+        c2 >>= 32;
+    }
+    if (c2)
+    {
+        static const unsigned int pC[8] = { 0x000003D1, 0x00000001, 0, 0, 0, 0, 0, 0 };
+        Add(r.d, r.d, pC);
+    }
+    if (Cmp(r.d, pP) >= 0)
+        Sub(r.d, r.d, pP);
+}
+#endif
+
+static inline void FeSqr(CFieldElem& r, const CFieldElem& a)
+{
+    FeMul(r, a, a);
+}
+
+static void FePow(CFieldElem& r, const CFieldElem& a, const unsigned int* e)
+{
+    CFieldElem x = a;
+    SetInt(r.d, 1);
+    for (int i = 255; i >= 0; i--)
+    {
+        FeSqr(r, r);
+        if ((e[i/32] >> (i % 32)) & 1)
+            FeMul(r, r, x);
+    }
+}
+
+static inline bool FeEqual(const CFieldElem& a, const CFieldElem& b)
+{
+    return memcmp(a.d, b.d, sizeof(a.d)) == 0;
+}
+
+
+
+//
+// Scalars mod n
+//
+
+struct CScalar
+{
+    unsigned int d[8];
+};
+
+static void ScReduce(CScalar& r, const unsigned int* t)
+{
+    // 2^256 = NC mod n, fold the part above 256 bits down until nothing is left
+    unsigned int a[18], b[18];
+    memcpy(a, t, 16 * sizeof(unsigned int));
+    int nLen = 16;
+    while (nLen > 8 && a[nLen-1] == 0)
+        nLen--;
+    while (nLen > 8)
+    {
+        memset(b, 0, sizeof(b));
+        memcpy(b, a, 8 * sizeof(unsigned int));
+        for (int i = 0; i < nLen - 8; i++)
+        {
+            uint64 c = 0;
+            for (int j = 0; j < 5; j++)
+            {
+                c += (uint64)a[8+i] * pNC[j] + b[i+j];
+                b[i+j] = (unsigned int)c;
+                c >>= 32;
+            }
+            for (int k = i + 5; c; k++)
+            {
+                c += b[k];
+                b[k] = (unsigned int)c;
+                c >>= 32;
+            }
+        }
+        memcpy(a, b, sizeof(a));
+        nLen = 18;
+        while (nLen > 8 && a[nLen-1] == 0)
+            nLen--;
+    }
+    while (Cmp(a, pN) >= 0)
+        Sub(a, a, pN);
+    Set(r.d, a);
+}
+
+static inline void ScMul(CScalar& r, const CScalar& a, const CScalar& b)
+{
+    unsigned int t[16];
+    Mul512(t, a.d, b.d);
+    ScReduce(r, t);
+}
+
+static inline void ScAdd(CScalar& r, const CScalar& a, const CScalar& b)
+{
+    if (Add(r.d, a.d, b.d) || Cmp(r.d, pN) >= 0)
+        Sub(r.d, r.d, pN);
+}
+
+static inline void ScNegate(CScalar& r, const CScalar& a)
+{
+    if (IsZero(a.d))
+        SetInt(r.d, 0);
+    else
+        Sub(r.d, pN, a.d);
+}
+
+static inline void ScSet(CScalar& r, const unsigned int* a)
+{
+    Set(r.d, a);
+}
+
+// Rounded a*b / 2^384
+static void ScMulShift384(CScalar& r, const CScalar& a, const CScalar& b)
+{
+    unsigned int t[16];
+    Mul512(t, a.d, b.d);
+    SetInt(r.d, 0);
+    uint64 c = t[11] >> 31;
+    for (int i = 0; i < 4; i++)
+    {
+        c += t[12+i];
+        r.d[i] = (unsigned int)c;
+        c >>= 32;
+    }
+    r.d[4] = (unsigned int)c;
+}
+
+// k = r1 + r2*lambda mod n, with r1 and r2 about 128 bits if taken as
+// negative when above n/2
+static void ScSplitLambda(CScalar& r1, CScalar& r2, const CScalar& k)
+{
+    CScalar c1, c2, b1, b2, g1, g2, lambda;
+    ScSet(b1, pMinusB1);
+    ScSet(b2, pMinusB2);
+    ScSet(g1, pG1);
+    ScSet(g2, pG2);
+    ScSet(lambda, pLambda);
+    ScMulShift384(c1, k, g1);
+    ScMulShift384(c2, k, g2);
+    ScMul(c1, c1, b1);
+    ScMul(c2, c2, b2);
+    ScAdd(r2, c1, c2);
+    ScMul(c1, r2, lambda);
+    ScNegate(c1, c1);
+    ScAdd(r1, c1, k);
+}
+
+// Width-w non-adjacent form, returns the number of digits
+static int ScWnaf(int* pnDigits, const CScalar& a, int nWindow)
+{
+    unsigned int k[9];
+    Set(k, a.d);
+    k[8] = 0;
+    int nLen = 0;
+    while (!IsZero(k) || k[8])
+    {
+        int n = 0;
+        if (k[0] & 1)
+        {
+            n = k[0] & ((1 << nWindow) - 1);
+            if (n >= (1 << (nWindow - 1)))
+                n -= (1 << nWindow);
+
+            // k -= n, leaving the low nWindow bits zero
+            int64 c = (int64)k[0] - n;
+            k[0] = (unsigned int)c;
+            c >>= 32;
+            for (int i = 1; i < 9 && c; i++)
+            {
+                c += k[i];
+                k[i] = (unsigned int)c;
+                c >>= 32;
+            }
+        }
+        pnDigits[nLen++] = n;
+        Shr1(k, 9, 0);
+    }
+    return nLen;
+}
+
+
+
+//
+// Points in Jacobian coordinates, (X/Z^2, Y/Z^3) on y^2 = x^3 + 7
+//
+
+struct CPoint
+{
+    CFieldElem x, y, z;
+    bool fInfinity;
+};
+
+static void PointDouble(CPoint& r, const CPoint& a)
+{
+    if (a.fInfinity || IsZero(a.y.d))
+    {
+        r.fInfinity = true;
+        return;
+    }
+    CFieldElem A, B, C, D, E, F, t;
+    FeSqr(A, a.x);
+    FeSqr(B, a.y);
+    FeSqr(C, B);
+    FeAdd(t, a.x, B);
+    FeSqr(t, t);
+    FeSub(t, t, A);
+    FeSub(t, t, C);
+    FeAdd(D, t, t);
+    FeAdd(E, A, A);
+    FeAdd(E, E, A);
+    FeSqr(F, E);
+
+    CPoint p;
+    p.fInfinity = false;
+    FeMul(p.z, a.y, a.z);
+    FeAdd(p.z, p.z, p.z);
+    FeSub(p.x, F, D);
+    FeSub(p.x, p.x, D);
+    FeSub(t, D, p.x);
+    FeMul(p.y, E, t);
+    FeAdd(C, C, C);
+    FeAdd(C, C, C);
+    FeAdd(C, C, C);
+    FeSub(p.y, p.y, C);
+    r = p;
+}
+
+// r = a + b, b has Z = 1 if fAffine
+static void PointAdd(CPoint& r, const CPoint& a, const CPoint& b, bool fAffine)
+{
+    if (a.fInfinity)
+    {
+        r = b;
+        if (fAffine && !b.fInfinity)
+            SetInt(r.z.d, 1);
+        return;
+    }
+    if (b.fInfinity)
+    {
+        r = a;
+        return;
+    }
+
+    CFieldElem z1z1, z2z2, u1, u2, s1, s2, h, rr, t;
+    FeSqr(z1z1, a.z);
+    FeMul(u2, b.x, z1z1);
+    FeMul(s2, b.y, a.z);
+    FeMul(s2, s2, z1z1);
+    if (fAffine)
+    {
+        u1 = a.x;
+        s1 = a.y;
+    }
+    else
+    {
+        FeSqr(z2z2, b.z);
+        FeMul(u1, a.x, z2z2);
+        FeMul(s1, a.y, b.z);
+        FeMul(s1, s1, z2z2);
+    }
+    FeSub(h, u2, u1);
+    FeSub(rr, s2, s1);
+    if (IsZero(h.d))
+    {
+        if (IsZero(rr.d))
+            PointDouble(r, a);
+        else
+            r.fInfinity = true;
+        return;
+    }
+
+    CFieldElem i, j, v;
+    FeAdd(i, h, h);
+    FeSqr(i, i);
+    FeMul(j, h, i);
+    FeAdd(rr, rr, rr);
+    FeMul(v, u1, i);
+
+    CPoint p;
+    p.fInfinity = false;
+    FeSqr(p.x, rr);
+    FeSub(p.x, p.x, j);
+    FeSub(p.x, p.x, v);
+    FeSub(p.x, p.x, v);
+    FeSub(t, v, p.x);
+    FeMul(p.y, rr, t);
+    FeMul(t, s1, j);
+    FeAdd(t, t, t);
+    FeSub(p.y, p.y, t);
+    FeMul(p.z, a.z, h);
+    if (!fAffine)
+        FeMul(p.z, p.z, b.z);
+    FeAdd(p.z, p.z, p.z);
+    r = p;
+}
+
+static void PointNormalize(CPoint& a)
+{
+    if (a.fInfinity)
+        return;
+    CFieldElem zi, zi2;
+    ModInverse(zi.d, a.z.d, pP);
+    FeSqr(zi2, zi);
+    FeMul(a.x, a.x, zi2);
+    FeMul(zi2, zi2, zi);
+    FeMul(a.y, a.y, zi2);
+    SetInt(a.z.d, 1);
+}
+
+// lambda*(x, y) = (beta*x, y)
+static void PointMulLambda(CPoint& r, const CPoint& a)
+{
+    CFieldElem beta;
+    Set(beta.d, pBeta);
+    r = a;
+    FeMul(r.x, a.x, beta);
+}
+
+static void PointAddDigit(CPoint& r, const CPoint* pTable, int n, bool fNegate, bool fAffine)
+{
+    CPoint p = pTable[((n < 0 ? -n : n) - 1) / 2];
+    if ((n < 0) != fNegate)
+        FeNegate(p.y, p.y);
+    PointAdd(r, r, p, fAffine);
+}
+
+// Odd multiples a, 3a, 5a, ... of a
+static void PointOddMultiples(CPoint* pTable, int nSize, const CPoint& a)
+{
+    CPoint a2;
+    PointDouble(a2, a);
+    pTable[0] = a;
+    for (int i = 1; i < nSize; i++)
+        PointAdd(pTable[i], pTable[i-1], a2, false);
+}
+
+
+
+//
+// Precomputed odd multiples of G and lambda*G, in affine coordinates
+//
+
+class CSecp256k1Tables
+{
+public:
+    CPoint vG[1 << (WINDOW_G - 2)];
+    CPoint vGLambda[1 << (WINDOW_G - 2)];
+
+    CSecp256k1Tables()
+    {
+        CPoint g;
+        g.fInfinity = false;
+        Set(g.x.d, pGx);
+        Set(g.y.d, pGy);
+        SetInt(g.z.d, 1);
+        PointOddMultiples(vG, 1 << (WINDOW_G - 2), g);
+        for (int i = 0; i < (1 << (WINDOW_G - 2)); i++)
+        {
+            PointNormalize(vG[i]);
+            PointMulLambda(vGLambda[i], vG[i]);
+        }
+    }
+}
+secp256k1tables;
+
+
+
+//
+// Verification
+//
+
+static bool ParsePubKey(CPoint& q, const vector<unsigned char>& vchPubKey)
+{
+    q.fInfinity = false;
+    SetInt(q.z.d, 1);
+    if (vchPubKey.size() == 65 && vchPubKey[0] == 0x04)
+    {
+        SetBytes(q.x.d, &vchPubKey[1]);
+        SetBytes(q.y.d, &vchPubKey[33]);
+        if (Cmp(q.x.d, pP) >= 0 || Cmp(q.y.d, pP) >= 0)
+            return false;
+    }
+    else if (vchPubKey.size() == 33 && (vchPubKey[0] == 0x02 || vchPubKey[0] == 0x03))
+    {
+        SetBytes(q.x.d, &vchPubKey[1]);
+        if (Cmp(q.x.d, pP) >= 0)
+            return false;
+    }
+    else
+    {
+        return false;
+    }
+
+    CFieldElem rhs, seven;
+    SetInt(seven.d, 7);
+    FeSqr(rhs, q.x);
+    FeMul(rhs, rhs, q.x);
+    FeAdd(rhs, rhs, seven);
+    if (vchPubKey.size() == 33)
+    {
+        FePow(q.y, rhs, pPSqrt);
+        if ((q.y.d[0] & 1) != (vchPubKey[0] & 1))
+            FeNegate(q.y, q.y);
+    }
+
+    CFieldElem y2;
+    FeSqr(y2, q.y);
+    return FeEqual(y2, rhs);
+}
+
+// One DER INTEGER, returns -1 if it isn't minimally encoded and positive
+static int ParseDERInteger(CScalar& r, const unsigned char*& p, const unsigned char* pend)
+{
+    if (pend - p < 3 || p[0] != 0x02)
+        return -1;
+    unsigned int nLen = p[1];
+    const unsigned char* pbegin = p + 2;
+    if (nLen == 0 || nLen >= 0x80 || nLen > (unsigned int)(pend - pbegin))
+        return -1;
+    if (pbegin[0] & 0x80)
+        return -1;
+    if (nLen > 1 && pbegin[0] == 0 && !(pbegin[1] & 0x80))
+        return -1;
+    p = pbegin + nLen;
+
+    while (nLen > 0 && pbegin[0] == 0)
+    {
+        pbegin++;
+        nLen--;
+    }
+    if (nLen > 32)
+        return 0;
+    unsigned char pch[32];
+    memset(pch, 0, 32);
+    memcpy(pch + 32 - nLen, pbegin, nLen);
+    SetBytes(r.d, pch);
+    if (IsZero(r.d) || Cmp(r.d, pN) >= 0)
+        return 0;
+    return 1;
+}
+
+bool Secp256k1ParsePubKey(CSecp256k1PubKey& pubkey, const vector<unsigned char>& vchPubKey)
+{
+    CPoint q;
+    if (!ParsePubKey(q, vchPubKey))
+        return false;
+    Set(pubkey.x, q.x.d);
+    Set(pubkey.y, q.y.d);
+    return true;
+}
+
+// 1 = good signature, 0 = bad, -1 = encoding this code doesn't handle
+int Secp256k1Verify(const CSecp256k1PubKey& pubkey, const uint256& hash, const vector<unsigned char>& vchSig)
+{
+    CPoint q;
+    q.fInfinity = false;
+    Set(q.x.d, pubkey.x);
+    Set(q.y.d, pubkey.y);
+    SetInt(q.z.d, 1);
+
+    // Strict DER: 30 len 02 len r 02 len s
+    if (vchSig.size() < 8 || vchSig[0] != 0x30 || vchSig[1] != vchSig.size() - 2)
+        return -1;
+    const unsigned char* p = &vchSig[2];
+    const unsigned char* pend = &vchSig[0] + vchSig.size();
+    CScalar r, s;
+    int nRet = ParseDERInteger(r, p, pend);
+    if (nRet < 0)
+        return -1;
+    int nRet2 = ParseDERInteger(s, p, pend);
+    if (nRet2 < 0 || p != pend)
+        return -1;
+    if (nRet == 0 || nRet2 == 0)
+        return 0;
+
+    // OpenSSL reads the hash bytes as a big endian number
+    CScalar z, w, u1, u2;
+    SetBytes(z.d, (const unsigned char*)&hash);
+    if (Cmp(z.d, pN) >= 0)
+        Sub(z.d, z.d, pN);
+    ModInverse(w.d, s.d, pN);
+    ScMul(u1, z, w);
+    ScMul(u2, r, w);
+
+    // u1*G + u2*Q as a1*G + a2*lambda*G + b1*Q + b2*lambda*Q
+    CScalar a1, a2, b1, b2;
+    ScSplitLambda(a1, a2, u1);
+    ScSplitLambda(b1, b2, u2);
+    CScalar* pScalar[4] = { &a1, &a2, &b1, &b2 };
+    bool fNegate[4];
+    int vnDigits[4][258];
+    int vnLen[4];
+    int nLen = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        fNegate[i] = (Cmp(pScalar[i]->d, pNHalf) > 0);
+        if (fNegate[i])
+            ScNegate(*pScalar[i], *pScalar[i]);
+        vnLen[i] = ScWnaf(vnDigits[i], *pScalar[i], i < 2 ? WINDOW_G : WINDOW_Q);
+        nLen = max(nLen, vnLen[i]);
+    }
+
+    CPoint vQ[1 << (WINDOW_Q - 2)];
+    CPoint vQLambda[1 << (WINDOW_Q - 2)];
+    PointOddMultiples(vQ, 1 << (WINDOW_Q - 2), q);
+    for (int i = 0; i < (1 << (WINDOW_Q - 2)); i++)
+        PointMulLambda(vQLambda[i], vQ[i]);
+
+    CPoint* pTable[4] = { secp256k1tables.vG, secp256k1tables.vGLambda, vQ, vQLambda };
+    CPoint R;
+    R.fInfinity = true;
+    for (int i = nLen - 1; i >= 0; i--)
+    {
+        PointDouble(R, R);
+        for (int j = 0; j < 4; j++)
+            if (i < vnLen[j] && vnDigits[j][i])
+                PointAddDigit(R, pTable[j], vnDigits[j][i], fNegate[j], j < 2);
+    }
+    if (R.fInfinity)
+        return 0;
+
+    // x(R) mod n == r, checked as r*Z^2 == X so R needn't be made affine
+    CFieldElem zz, rx, fr;
+    FeSqr(zz, R.z);
+    Set(fr.d, r.d);
+    FeMul(rx, fr, zz);
+    if (FeEqual(rx, R.x))
+        return 1;
+    if (!Add(fr.d, r.d, pN) && Cmp(fr.d, pP) < 0)
+    {
+        FeMul(rx, fr, zz);
+        if (FeEqual(rx, R.x))
+            return 1;
+    }
+    return 0;
+}
+
+int Secp256k1Verify(const vector<unsigned char>& vchPubKey, const uint256& hash, const vector<unsigned char>& vchSig)
+{
+    CSecp256k1PubKey pubkey;
+    if (!Secp256k1ParsePubKey(pubkey, vchPubKey))
+        return -1;
+    return Secp256k1Verify(pubkey, hash, vchSig);
+}
+
+#endif
@@ -1143,6 +1143,81 @@ int main(int argc, char *argv[])
 
 
 
+//
+// Read-only stream over memory owned by someone else, such as a mapped file.
+// Unlike CDataStream it doesn't copy the buffer, the caller keeps it alive.
+//
+class CBufferStream
+{
+protected:
+    const char* pbegin;
+    const char* pend;
+    const char* pcur;
+public:
+    int nType;
+    int nVersion;
+
+    CBufferStream(const char* pbeginIn, const char* pendIn, int nTypeIn=SER_DISK, int nVersionIn=VERSION)
+    {
+        pbegin = pbeginIn;
+        pend = pendIn;
+        pcur = pbeginIn;
+        nType = nTypeIn;
+        nVersion = nVersionIn;
+    }
+
+    unsigned int size() const    { return pend - pcur; }
+    bool empty() const           { return pcur == pend; }
+    unsigned int tell() const    { return pcur - pbegin; }
+
+    void SetType(int n)          { nType = n; }
+    int GetType()                { return nType; }
+    void SetVersion(int n)       { nVersion = n; }
+    int GetVersion()             { return nVersion; }
+
+    CBufferStream& read(char* pch, int nSize)
+    {
+        if (nSize < 0 || nSize > pend - pcur)
+            throw std::ios_base::failure("CBufferStream::read : end of data");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return (*this);
+    }
+
+    CBufferStream& ignore(int nSize)
+    {
+        if (nSize < 0 || nSize > pend - pcur)
+            throw std::ios_base::failure("CBufferStream::ignore : end of data");
+        pcur += nSize;
+        return (*this);
+    }
+
+    template<typename T>
+    unsigned int GetSerializeSize(const T& obj)
+    {
+        // Tells the size of the object if serialized to this stream
+        return ::GetSerializeSize(obj, nType, nVersion);
+    }
+
+    template<typename T>
+    CBufferStream& operator>>(T& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+
+
+
+
+
+
+
+
+
+
 //
 // Automatic closing wrapper for FILE*
 //  - Will automatically close the file when it goes out of scope if not null.
@@ -9,124 +9,121 @@
 #include <string.h>
 #include <assert.h>
 
-#include <xmmintrin.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <openssl/sha.h>
 
-#define NPAR 32
-
-extern void DoubleBlockSHA256(const void* pin, void* pout, const void* pinit, unsigned int hash[8][NPAR], const void* init2);
-
-static const unsigned int sha256_consts[] = {
-    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, /*  0 */
-    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, /*  8 */
-    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, /* 16 */
-    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, /* 24 */
-    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, /* 32 */
-    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, /* 40 */
-    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, /* 48 */
-    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, /* 56 */
-    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-};
+#include "sha256.h"
 
 
-static inline __m128i Ch(const __m128i b, const __m128i c, const __m128i d) {
-    return (b & c) ^ (~b & d);
-}
-
-static inline __m128i Maj(const __m128i b, const __m128i c, const __m128i d) {
-    return (b & c) ^ (b & d) ^ (c & d);
-}
-
-static inline __m128i ROTR(__m128i x, const int n) {
-    return _mm_srli_epi32(x, n) | _mm_slli_epi32(x, 32 - n);
-}
+//
+// Mining kernels with the same contract as ScanHash_4WaySSE2: pdata is the
+// second half of the byte swapped header, nonce at pdata + 12 is advanced in
+// place, a hash whose last word is zero is returned through phash.
+//
 
-static inline __m128i SHR(__m128i x, const int n) {
-    return _mm_srli_epi32(x, n);
-}
+#if defined(__GNUC__) && (__GNUC__ >= 5)
+#define SCANHASH_SHANI
+#endif
 
-/* SHA256 Functions */
-#define BIGSIGMA0_256(x)    (ROTR((x), 2) ^ ROTR((x), 13) ^ ROTR((x), 22))
-#define BIGSIGMA1_256(x)    (ROTR((x), 6) ^ ROTR((x), 11) ^ ROTR((x), 25))
-#define SIGMA0_256(x)       (ROTR((x), 7) ^ ROTR((x), 18) ^ SHR((x), 3))
-#define SIGMA1_256(x)       (ROTR((x), 17) ^ ROTR((x), 19) ^ SHR((x), 10))
+#define NPAR 32
 
-static inline unsigned int store32(const __m128i x, int i) {
-    union { unsigned int ret[4]; __m128i x; } box;
-    box.x = x;
-    return box.ret[i];
-}
+//
+// Only the last word of the hash is tested, and it's the initial state plus
+// the e register after round 60 of the second hash, so the last three rounds
+// and their schedule words are skipped.  The first three rounds of the first
+// hash and its schedule words 16 and 17 don't involve the nonce, they're done
+// once per call.  A nonce that passes gets the full hash computed again.
+//
+
+struct scanhash_precalc {
+    unsigned int s3[8];
+    unsigned int w16, w17;
+};
 
-static inline void store_epi32(const __m128i x, unsigned int *x0, unsigned int *x1, unsigned int *x2, unsigned int *x3) {
-    union { unsigned int ret[4]; __m128i x; } box;
-    box.x = x;
-    *x0 = box.ret[3]; *x1 = box.ret[2]; *x2 = box.ret[1]; *x3 = box.ret[0];
+static void scanhash_init(scanhash_precalc& pre, const unsigned int* pmid, const unsigned int* pin) {
+    v4u s[8], w[16];
+    for (int t = 0; t < 8; t++)
+        s[t] = vset1(v4u, pmid[t]);
+    for (int t = 0; t < 16; t++)
+        w[t] = vset1(v4u, pin[t]);
+    vrounds<v4u, 4>(s, w, 0, 3, 16);
+    for (int t = 0; t < 8; t++)
+        pre.s3[t] = s[t][0];
+    pre.w16 = (vror(pin[14], 17) ^ vror(pin[14], 19) ^ (pin[14] >> 10)) + pin[9] +
+              (vror(pin[1], 7) ^ vror(pin[1], 18) ^ (pin[1] >> 3)) + pin[0];
+    pre.w17 = (vror(pin[15], 17) ^ vror(pin[15], 19) ^ (pin[15] >> 10)) + pin[10] +
+              (vror(pin[2], 7) ^ vror(pin[2], 18) ^ (pin[2] >> 3)) + pin[1];
 }
 
-#define add4(x0, x1, x2, x3) _mm_add_epi32(_mm_add_epi32(_mm_add_epi32(x0, x1), x2), x3)
-#define add5(x0, x1, x2, x3, x4) _mm_add_epi32(add4(x0, x1, x2, x3), x4)
-
-#define SHA256ROUND(a, b, c, d, e, f, g, h, i, w)                       \
-    T1 = add5(h, BIGSIGMA1_256(e), Ch(e, f, g), _mm_set1_epi32(sha256_consts[i]), w);   \
-d = _mm_add_epi32(d, T1);                                           \
-h = _mm_add_epi32(T1, _mm_add_epi32(BIGSIGMA0_256(a), Maj(a, b, c)));
-
-static inline void dumpreg(__m128i x, char *msg) {
-    union { unsigned int ret[4]; __m128i x; } box;
-    box.x = x ;
-    printf("%s %08x %08x %08x %08x\n", msg, box.ret[0], box.ret[1], box.ret[2], box.ret[3]);
+// Last hash word for nonces nNonce to nNonce + N - 1
+template <typename V, int N>
+static ALWAYS_INLINE void vscanhash(V& h7Ret, const scanhash_precalc& pre, const unsigned int* pmid, const unsigned int* pin, unsigned int nNonce) {
+    V s[8], w[16];
+    for (int t = 0; t < 16; t++)
+        w[t] = vset1(V, pin[t]);
+    for (int j = 0; j < N; j++)
+        w[3][j] = nNonce + j;
+    for (int t = 0; t < 8; t++)
+        s[t] = vset1(V, pre.s3[t]);
+    vrounds<V, N>(s, w, 3, 16, 16);
+    w[0] = vset1(V, pre.w16);
+    w[1] = vset1(V, pre.w17);
+    vrounds<V, N>(s, w, 16, 64, 18);
+
+    // The second hash's padding is a constant, so it folds into the rounds
+    for (int t = 0; t < 8; t++) {
+        w[t] = s[t] + vset1(V, pmid[t]);
+        s[t] = vset1(V, pSHA256InitState[t]);
+    }
+    w[8] = vset1(V, 0x80000000);
+    for (int t = 9; t < 15; t++)
+        w[t] = vset1(V, 0);
+    w[15] = vset1(V, 256);
+    vrounds<V, N>(s, w, 0, 61, 16);
+    h7Ret = s[4] + vset1(V, pSHA256InitState[7]);
 }
 
-#if 1
-#define dumpstate(i) printf("%s: %08x %08x %08x %08x %08x %08x %08x %08x %08x\n", \
-        __func__, store32(w0, i), store32(a, i), store32(b, i), store32(c, i), store32(d, i), store32(e, i), store32(f, i), store32(g, i), store32(h, i));
-#else
-#define dumpstate()
-#endif
-
-// Align by increasing pointer, must have extra space at end of buffer
-template <size_t nBytes, typename T>
-T* alignup(T* p)
-{
-    union
-    {
-        T* ptr;
-        size_t n;
-    } u;
-    u.ptr = p;
-    u.n = (u.n + (nBytes-1)) & ~(nBytes-1);
-    return u.ptr;
+// Full double hash of one nonce, for a candidate
+static void scanhash_full(const unsigned int* pmid, const unsigned int* pin, const unsigned int* ppad, unsigned int nNonce, unsigned int* phash) {
+    v4u s[8], w[16];
+    for (int t = 0; t < 16; t++)
+        w[t] = vset1(v4u, pin[t]);
+    w[3] = vset1(v4u, nNonce);
+    for (int t = 0; t < 8; t++)
+        s[t] = vset1(v4u, pmid[t]);
+    vtransform<v4u, 4>(s, w);
+    for (int t = 0; t < 8; t++) {
+        w[t] = s[t];
+        w[t + 8] = vset1(v4u, ppad[t + 8]);
+        s[t] = vset1(v4u, pSHA256InitState[t]);
+    }
+    vtransform<v4u, 4>(s, w);
+    for (int t = 0; t < 8; t++)
+        phash[t] = s[t][0];
 }
 
-static const unsigned int pSHA256InitState[8] =
-{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
-
-
 unsigned int ScanHash_4WaySSE2(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone)
 {
     unsigned int& nNonce = *(unsigned int*)(pdata + 12);
+    const unsigned int* pMid = (const unsigned int*)pmidstate;
+    const unsigned int* pIn = (const unsigned int*)pdata;
+    scanhash_precalc pre;
+    scanhash_init(pre, pMid, pIn);
     for (;;)
     {
         nNonce += NPAR;
-        unsigned int thashbuf[9][NPAR];
-        unsigned int (&thash)[9][NPAR] = *alignup<16>(&thashbuf);
-        DoubleBlockSHA256(pdata, phash1, pmidstate, thash, pSHA256InitState);
-
-        for (int j = 0; j < NPAR; j++)
+        for (int k = 0; k < NPAR; k += 4)
         {
-            if (thash[7][j] == 0)
+            v4u h7;
+            vscanhash<v4u, 4>(h7, pre, pMid, pIn, nNonce + k);
+            for (int j = 0; j < 4; j++)
             {
-                for (int i = 0; i < 32/4; i++)
-                    ((unsigned int*)phash)[i] = thash[i][j];
-                return nNonce + j;
+                if (h7[j] == 0)
+                {
+                    scanhash_full(pMid, pIn, (const unsigned int*)phash1, nNonce + k + j, (unsigned int*)phash);
+                    return nNonce + k + j;
+                }
             }
         }
 
@@ -138,338 +135,111 @@ unsigned int ScanHash_4WaySSE2(char* pmidstate, char* pdata, char* phash1, char*
     }
 }
 
+#ifdef SHA256D64_AVX2
+// 8 nonces per pass in AVX2 lanes
+__attribute__((target("avx2")))
+unsigned int ScanHash_8WayAVX2(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone) {
+    unsigned int& nNonce = *(unsigned int*)(pdata + 12);
+    const unsigned int* pMid = (const unsigned int*)pmidstate;
+    const unsigned int* pIn = (const unsigned int*)pdata;
+    scanhash_precalc pre;
+    scanhash_init(pre, pMid, pIn);
+    for (;;) {
+        v8u h7;
+        vscanhash<v8u, 8>(h7, pre, pMid, pIn, nNonce + 1);
+        nNonce += 8;
+
+        for (int j = 0; j < 8; j++) {
+            if (h7[j] == 0) {
+                scanhash_full(pMid, pIn, (const unsigned int*)phash1, nNonce - 7 + j, (unsigned int*)phash);
+                return nNonce - 7 + j;
+            }
+        }
 
-void DoubleBlockSHA256(const void* pin, void* pad, const void *pre, unsigned int thash[9][NPAR], const void *init)
-{
-    unsigned int* In = (unsigned int*)pin;
-    unsigned int* Pad = (unsigned int*)pad;
-    unsigned int* hPre = (unsigned int*)pre;
-    unsigned int* hInit = (unsigned int*)init;
-    unsigned int i, j, k;
-
-    /* vectors used in calculation */
-    __m128i w0, w1, w2, w3, w4, w5, w6, w7;
-    __m128i w8, w9, w10, w11, w12, w13, w14, w15;
-    __m128i T1;
-    __m128i a, b, c, d, e, f, g, h;
-    __m128i nonce;
-
-    /* nonce offset for vector */
-    __m128i offset = _mm_set_epi32(0x00000003, 0x00000002, 0x00000001, 0x00000000);
-
-
-    for(k = 0; k<NPAR; k+=4) {
-        w0 = _mm_set1_epi32(In[0]);
-        w1 = _mm_set1_epi32(In[1]);
-        w2 = _mm_set1_epi32(In[2]);
-        //w3 = _mm_set1_epi32(In[3]); nonce will be later hacked into the hash
-        w4 = _mm_set1_epi32(In[4]);
-        w5 = _mm_set1_epi32(In[5]);
-        w6 = _mm_set1_epi32(In[6]);
-        w7 = _mm_set1_epi32(In[7]);
-        w8 = _mm_set1_epi32(In[8]);
-        w9 = _mm_set1_epi32(In[9]);
-        w10 = _mm_set1_epi32(In[10]);
-        w11 = _mm_set1_epi32(In[11]);
-        w12 = _mm_set1_epi32(In[12]);
-        w13 = _mm_set1_epi32(In[13]);
-        w14 = _mm_set1_epi32(In[14]);
-        w15 = _mm_set1_epi32(In[15]);
-
-        /* hack nonce into lowest byte of w3 */
-        nonce = _mm_set1_epi32(In[3]);
-        nonce = _mm_add_epi32(nonce, offset);
-        nonce = _mm_add_epi32(nonce, _mm_set1_epi32(k));
-        w3 = nonce;
-
-        a = _mm_set1_epi32(hPre[0]);
-        b = _mm_set1_epi32(hPre[1]);
-        c = _mm_set1_epi32(hPre[2]);
-        d = _mm_set1_epi32(hPre[3]);
-        e = _mm_set1_epi32(hPre[4]);
-        f = _mm_set1_epi32(hPre[5]);
-        g = _mm_set1_epi32(hPre[6]);
-        h = _mm_set1_epi32(hPre[7]);
-
-        SHA256ROUND(a, b, c, d, e, f, g, h, 0, w0);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 1, w1);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 2, w2);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 3, w3);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 4, w4);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 5, w5);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 6, w6);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 7, w7);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 8, w8);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 9, w9);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 10, w10);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 11, w11);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 12, w12);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 13, w13);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 14, w14);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 15, w15);
-
-        w0 = add4(SIGMA1_256(w14), w9, SIGMA0_256(w1), w0);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 16, w0);
-        w1 = add4(SIGMA1_256(w15), w10, SIGMA0_256(w2), w1);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 17, w1);
-        w2 = add4(SIGMA1_256(w0), w11, SIGMA0_256(w3), w2);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 18, w2);
-        w3 = add4(SIGMA1_256(w1), w12, SIGMA0_256(w4), w3);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 19, w3);
-        w4 = add4(SIGMA1_256(w2), w13, SIGMA0_256(w5), w4);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 20, w4);
-        w5 = add4(SIGMA1_256(w3), w14, SIGMA0_256(w6), w5);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 21, w5);
-        w6 = add4(SIGMA1_256(w4), w15, SIGMA0_256(w7), w6);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 22, w6);
-        w7 = add4(SIGMA1_256(w5), w0, SIGMA0_256(w8), w7);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 23, w7);
-        w8 = add4(SIGMA1_256(w6), w1, SIGMA0_256(w9), w8);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 24, w8);
-        w9 = add4(SIGMA1_256(w7), w2, SIGMA0_256(w10), w9);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 25, w9);
-        w10 = add4(SIGMA1_256(w8), w3, SIGMA0_256(w11), w10);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 26, w10);
-        w11 = add4(SIGMA1_256(w9), w4, SIGMA0_256(w12), w11);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 27, w11);
-        w12 = add4(SIGMA1_256(w10), w5, SIGMA0_256(w13), w12);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 28, w12);
-        w13 = add4(SIGMA1_256(w11), w6, SIGMA0_256(w14), w13);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 29, w13);
-        w14 = add4(SIGMA1_256(w12), w7, SIGMA0_256(w15), w14);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 30, w14);
-        w15 = add4(SIGMA1_256(w13), w8, SIGMA0_256(w0), w15);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 31, w15);
-
-        w0 = add4(SIGMA1_256(w14), w9, SIGMA0_256(w1), w0);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 32, w0);
-        w1 = add4(SIGMA1_256(w15), w10, SIGMA0_256(w2), w1);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 33, w1);
-        w2 = add4(SIGMA1_256(w0), w11, SIGMA0_256(w3), w2);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 34, w2);
-        w3 = add4(SIGMA1_256(w1), w12, SIGMA0_256(w4), w3);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 35, w3);
-        w4 = add4(SIGMA1_256(w2), w13, SIGMA0_256(w5), w4);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 36, w4);
-        w5 = add4(SIGMA1_256(w3), w14, SIGMA0_256(w6), w5);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 37, w5);
-        w6 = add4(SIGMA1_256(w4), w15, SIGMA0_256(w7), w6);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 38, w6);
-        w7 = add4(SIGMA1_256(w5), w0, SIGMA0_256(w8), w7);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 39, w7);
-        w8 = add4(SIGMA1_256(w6), w1, SIGMA0_256(w9), w8);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 40, w8);
-        w9 = add4(SIGMA1_256(w7), w2, SIGMA0_256(w10), w9);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 41, w9);
-        w10 = add4(SIGMA1_256(w8), w3, SIGMA0_256(w11), w10);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 42, w10);
-        w11 = add4(SIGMA1_256(w9), w4, SIGMA0_256(w12), w11);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 43, w11);
-        w12 = add4(SIGMA1_256(w10), w5, SIGMA0_256(w13), w12);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 44, w12);
-        w13 = add4(SIGMA1_256(w11), w6, SIGMA0_256(w14), w13);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 45, w13);
-        w14 = add4(SIGMA1_256(w12), w7, SIGMA0_256(w15), w14);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 46, w14);
-        w15 = add4(SIGMA1_256(w13), w8, SIGMA0_256(w0), w15);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 47, w15);
-
-        w0 = add4(SIGMA1_256(w14), w9, SIGMA0_256(w1), w0);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 48, w0);
-        w1 = add4(SIGMA1_256(w15), w10, SIGMA0_256(w2), w1);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 49, w1);
-        w2 = add4(SIGMA1_256(w0), w11, SIGMA0_256(w3), w2);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 50, w2);
-        w3 = add4(SIGMA1_256(w1), w12, SIGMA0_256(w4), w3);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 51, w3);
-        w4 = add4(SIGMA1_256(w2), w13, SIGMA0_256(w5), w4);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 52, w4);
-        w5 = add4(SIGMA1_256(w3), w14, SIGMA0_256(w6), w5);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 53, w5);
-        w6 = add4(SIGMA1_256(w4), w15, SIGMA0_256(w7), w6);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 54, w6);
-        w7 = add4(SIGMA1_256(w5), w0, SIGMA0_256(w8), w7);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 55, w7);
-        w8 = add4(SIGMA1_256(w6), w1, SIGMA0_256(w9), w8);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 56, w8);
-        w9 = add4(SIGMA1_256(w7), w2, SIGMA0_256(w10), w9);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 57, w9);
-        w10 = add4(SIGMA1_256(w8), w3, SIGMA0_256(w11), w10);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 58, w10);
-        w11 = add4(SIGMA1_256(w9), w4, SIGMA0_256(w12), w11);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 59, w11);
-        w12 = add4(SIGMA1_256(w10), w5, SIGMA0_256(w13), w12);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 60, w12);
-        w13 = add4(SIGMA1_256(w11), w6, SIGMA0_256(w14), w13);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 61, w13);
-        w14 = add4(SIGMA1_256(w12), w7, SIGMA0_256(w15), w14);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 62, w14);
-        w15 = add4(SIGMA1_256(w13), w8, SIGMA0_256(w0), w15);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 63, w15);
-
-#define store_load(x, i, dest) \
-        T1 = _mm_set1_epi32((hPre)[i]); \
-        dest = _mm_add_epi32(T1, x);
-
-        store_load(a, 0, w0);
-        store_load(b, 1, w1);
-        store_load(c, 2, w2);
-        store_load(d, 3, w3);
-        store_load(e, 4, w4);
-        store_load(f, 5, w5);
-        store_load(g, 6, w6);
-        store_load(h, 7, w7);
-
-        w8 = _mm_set1_epi32(Pad[8]);
-        w9 = _mm_set1_epi32(Pad[9]);
-        w10 = _mm_set1_epi32(Pad[10]);
-        w11 = _mm_set1_epi32(Pad[11]);
-        w12 = _mm_set1_epi32(Pad[12]);
-        w13 = _mm_set1_epi32(Pad[13]);
-        w14 = _mm_set1_epi32(Pad[14]);
-        w15 = _mm_set1_epi32(Pad[15]);
-
-        a = _mm_set1_epi32(hInit[0]);
-        b = _mm_set1_epi32(hInit[1]);
-        c = _mm_set1_epi32(hInit[2]);
-        d = _mm_set1_epi32(hInit[3]);
-        e = _mm_set1_epi32(hInit[4]);
-        f = _mm_set1_epi32(hInit[5]);
-        g = _mm_set1_epi32(hInit[6]);
-        h = _mm_set1_epi32(hInit[7]);
+        if ((nNonce & 0xffff) == 0) {
+            nHashesDone = 0xffff+1;
+            return -1;
+        }
+    }
+}
+#else
+// Compiler too old for AVX2 code
+unsigned int ScanHash_8WayAVX2(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone) {
+    return ScanHash_4WaySSE2(pmidstate, pdata, phash1, phash, nHashesDone);
+}
+#endif
 
-        SHA256ROUND(a, b, c, d, e, f, g, h, 0, w0);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 1, w1);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 2, w2);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 3, w3);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 4, w4);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 5, w5);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 6, w6);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 7, w7);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 8, w8);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 9, w9);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 10, w10);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 11, w11);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 12, w12);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 13, w13);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 14, w14);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 15, w15);
+#ifdef SCANHASH_SHANI
+#include <immintrin.h>
+
+// One SHA-256 compression with the Intel SHA extensions.  pw holds the 16
+// message words already in host order, as the byte swapped miner buffers do.
+__attribute__((target("sha,sse4.1")))
+static void shani_transform(unsigned int* pstate, const unsigned int* pinit, const unsigned int* pw) {
+    __m128i state0, state1, msg, tmp, save0, save1;
+    __m128i m[4];
+
+    // Rearrange A..H into the ABEF/CDGH halves the instructions use
+    tmp = _mm_loadu_si128((const __m128i*)&pinit[0]);
+    state1 = _mm_loadu_si128((const __m128i*)&pinit[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+    save0 = state0;
+    save1 = state1;
+
+    for (int i = 0; i < 4; i++)
+        m[i] = _mm_loadu_si128((const __m128i*)&pw[4 * i]);
+
+    // Four rounds per step, the schedule runs three steps ahead
+    for (int g = 0; g < 16; g++) {
+        msg = _mm_add_epi32(m[g & 3], _mm_loadu_si128((const __m128i*)&sha256_consts[4 * g]));
+        state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+        if (g >= 3 && g < 15) {
+            tmp = _mm_alignr_epi8(m[g & 3], m[(g - 1) & 3], 4);
+            m[(g + 1) & 3] = _mm_add_epi32(m[(g + 1) & 3], tmp);
+            m[(g + 1) & 3] = _mm_sha256msg2_epu32(m[(g + 1) & 3], m[g & 3]);
+        }
+        msg = _mm_shuffle_epi32(msg, 0x0E);
+        state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        if (g >= 1 && g < 13)
+            m[(g - 1) & 3] = _mm_sha256msg1_epu32(m[(g - 1) & 3], m[g & 3]);
+    }
 
-        w0 = add4(SIGMA1_256(w14), w9, SIGMA0_256(w1), w0);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 16, w0);
-        w1 = add4(SIGMA1_256(w15), w10, SIGMA0_256(w2), w1);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 17, w1);
-        w2 = add4(SIGMA1_256(w0), w11, SIGMA0_256(w3), w2);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 18, w2);
-        w3 = add4(SIGMA1_256(w1), w12, SIGMA0_256(w4), w3);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 19, w3);
-        w4 = add4(SIGMA1_256(w2), w13, SIGMA0_256(w5), w4);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 20, w4);
-        w5 = add4(SIGMA1_256(w3), w14, SIGMA0_256(w6), w5);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 21, w5);
-        w6 = add4(SIGMA1_256(w4), w15, SIGMA0_256(w7), w6);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 22, w6);
-        w7 = add4(SIGMA1_256(w5), w0, SIGMA0_256(w8), w7);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 23, w7);
-        w8 = add4(SIGMA1_256(w6), w1, SIGMA0_256(w9), w8);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 24, w8);
-        w9 = add4(SIGMA1_256(w7), w2, SIGMA0_256(w10), w9);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 25, w9);
-        w10 = add4(SIGMA1_256(w8), w3, SIGMA0_256(w11), w10);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 26, w10);
-        w11 = add4(SIGMA1_256(w9), w4, SIGMA0_256(w12), w11);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 27, w11);
-        w12 = add4(SIGMA1_256(w10), w5, SIGMA0_256(w13), w12);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 28, w12);
-        w13 = add4(SIGMA1_256(w11), w6, SIGMA0_256(w14), w13);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 29, w13);
-        w14 = add4(SIGMA1_256(w12), w7, SIGMA0_256(w15), w14);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 30, w14);
-        w15 = add4(SIGMA1_256(w13), w8, SIGMA0_256(w0), w15);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 31, w15);
+    state0 = _mm_add_epi32(state0, save0);
+    state1 = _mm_add_epi32(state1, save1);
 
-        w0 = add4(SIGMA1_256(w14), w9, SIGMA0_256(w1), w0);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 32, w0);
-        w1 = add4(SIGMA1_256(w15), w10, SIGMA0_256(w2), w1);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 33, w1);
-        w2 = add4(SIGMA1_256(w0), w11, SIGMA0_256(w3), w2);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 34, w2);
-        w3 = add4(SIGMA1_256(w1), w12, SIGMA0_256(w4), w3);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 35, w3);
-        w4 = add4(SIGMA1_256(w2), w13, SIGMA0_256(w5), w4);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 36, w4);
-        w5 = add4(SIGMA1_256(w3), w14, SIGMA0_256(w6), w5);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 37, w5);
-        w6 = add4(SIGMA1_256(w4), w15, SIGMA0_256(w7), w6);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 38, w6);
-        w7 = add4(SIGMA1_256(w5), w0, SIGMA0_256(w8), w7);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 39, w7);
-        w8 = add4(SIGMA1_256(w6), w1, SIGMA0_256(w9), w8);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 40, w8);
-        w9 = add4(SIGMA1_256(w7), w2, SIGMA0_256(w10), w9);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 41, w9);
-        w10 = add4(SIGMA1_256(w8), w3, SIGMA0_256(w11), w10);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 42, w10);
-        w11 = add4(SIGMA1_256(w9), w4, SIGMA0_256(w12), w11);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 43, w11);
-        w12 = add4(SIGMA1_256(w10), w5, SIGMA0_256(w13), w12);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 44, w12);
-        w13 = add4(SIGMA1_256(w11), w6, SIGMA0_256(w14), w13);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 45, w13);
-        w14 = add4(SIGMA1_256(w12), w7, SIGMA0_256(w15), w14);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 46, w14);
-        w15 = add4(SIGMA1_256(w13), w8, SIGMA0_256(w0), w15);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 47, w15);
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i*)&pstate[0], state0);
+    _mm_storeu_si128((__m128i*)&pstate[4], state1);
+}
 
-        w0 = add4(SIGMA1_256(w14), w9, SIGMA0_256(w1), w0);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 48, w0);
-        w1 = add4(SIGMA1_256(w15), w10, SIGMA0_256(w2), w1);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 49, w1);
-        w2 = add4(SIGMA1_256(w0), w11, SIGMA0_256(w3), w2);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 50, w2);
-        w3 = add4(SIGMA1_256(w1), w12, SIGMA0_256(w4), w3);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 51, w3);
-        w4 = add4(SIGMA1_256(w2), w13, SIGMA0_256(w5), w4);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 52, w4);
-        w5 = add4(SIGMA1_256(w3), w14, SIGMA0_256(w6), w5);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 53, w5);
-        w6 = add4(SIGMA1_256(w4), w15, SIGMA0_256(w7), w6);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 54, w6);
-        w7 = add4(SIGMA1_256(w5), w0, SIGMA0_256(w8), w7);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 55, w7);
-        w8 = add4(SIGMA1_256(w6), w1, SIGMA0_256(w9), w8);
-        SHA256ROUND(a, b, c, d, e, f, g, h, 56, w8);
-        w9 = add4(SIGMA1_256(w7), w2, SIGMA0_256(w10), w9);
-        SHA256ROUND(h, a, b, c, d, e, f, g, 57, w9);
-        w10 = add4(SIGMA1_256(w8), w3, SIGMA0_256(w11), w10);
-        SHA256ROUND(g, h, a, b, c, d, e, f, 58, w10);
-        w11 = add4(SIGMA1_256(w9), w4, SIGMA0_256(w12), w11);
-        SHA256ROUND(f, g, h, a, b, c, d, e, 59, w11);
-        w12 = add4(SIGMA1_256(w10), w5, SIGMA0_256(w13), w12);
-        SHA256ROUND(e, f, g, h, a, b, c, d, 60, w12);
-        w13 = add4(SIGMA1_256(w11), w6, SIGMA0_256(w14), w13);
-        SHA256ROUND(d, e, f, g, h, a, b, c, 61, w13);
-        w14 = add4(SIGMA1_256(w12), w7, SIGMA0_256(w15), w14);
-        SHA256ROUND(c, d, e, f, g, h, a, b, 62, w14);
-        w15 = add4(SIGMA1_256(w13), w8, SIGMA0_256(w0), w15);
-        SHA256ROUND(b, c, d, e, f, g, h, a, 63, w15);
+// One nonce at a time, like ScanHash_CryptoPP, only checks 16 zero bits
+unsigned int ScanHash_SHANI(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone) {
+    unsigned int& nNonce = *(unsigned int*)(pdata + 12);
+    for (;;) {
+        nNonce++;
+        shani_transform((unsigned int*)phash1, (unsigned int*)pmidstate, (unsigned int*)pdata);
+        shani_transform((unsigned int*)phash, pSHA256InitState, (unsigned int*)phash1);
 
-        /* store resulsts directly in thash */
-#define store_2(x,i)  \
-        w0 = _mm_set1_epi32(hInit[i]); \
-        *(__m128i *)&(thash)[i][0+k] = _mm_add_epi32(w0, x);
+        if (((unsigned short*)phash)[14] == 0)
+            return nNonce;
 
-        store_2(a, 0);
-        store_2(b, 1);
-        store_2(c, 2);
-        store_2(d, 3);
-        store_2(e, 4);
-        store_2(f, 5);
-        store_2(g, 6);
-        store_2(h, 7);
-        *(__m128i *)&(thash)[8][0+k] = nonce;
+        if ((nNonce & 0xffff) == 0) {
+            nHashesDone = 0xffff+1;
+            return -1;
+        }
     }
-
 }
+#else
+// Compiler too old for the SHA extensions
+unsigned int ScanHash_SHANI(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone) {
+    return ScanHash_4WaySSE2(pmidstate, pdata, phash1, phash, nHashesDone);
+}
+#endif
 
 #endif // FOURWAYSSE2
@@ -0,0 +1,82 @@
+// Copyright (c) 2010 Nils Schneider
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// SHA-256 rounds on several messages at once, one per vector lane, shared
+// by the mining kernels in sha256.cpp and SHA256D64 in sha256d64.cpp.  The
+// lane code uses GCC vector extensions so the same rounds serve SSE2 and
+// AVX2.
+//
+#ifndef BITCOIN_SHA256_H
+#define BITCOIN_SHA256_H
+
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8))
+#define SHA256D64_AVX2
+#endif
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+static const unsigned int sha256_consts[] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, /*  0 */
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, /*  8 */
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, /* 16 */
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, /* 24 */
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, /* 32 */
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, /* 40 */
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, /* 48 */
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, /* 56 */
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+
+static const unsigned int pSHA256InitState[8] =
+{0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+typedef unsigned int v4u __attribute__((vector_size(16)));
+typedef unsigned int v8u __attribute__((vector_size(32)));
+
+// Macros rather than functions, a function passing or returning a 32 byte
+// vector has a different ABI with and without AVX enabled (-Wpsabi)
+#define vset1(V, x) (V() + (unsigned int)(x))
+#define vror(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+// Rounds nBegin to nEnd - 1 on the working variables s, expanding the
+// message schedule in place from round nExpandFrom on
+template <typename V, int N>
+static ALWAYS_INLINE void vrounds(V s[8], V w[16], int nBegin, int nEnd, int nExpandFrom) {
+    V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (int i = nBegin; i < nEnd; i++) {
+        if (i >= nExpandFrom) {
+            V w1 = w[(i + 1) & 15], w14 = w[(i + 14) & 15];
+            w[i & 15] += (vror(w14, 17) ^ vror(w14, 19) ^ (w14 >> 10)) + w[(i + 9) & 15] +
+                         (vror(w1, 7) ^ vror(w1, 18) ^ (w1 >> 3));
+        }
+        V t1 = h + (vror(e, 6) ^ vror(e, 11) ^ vror(e, 25)) + ((e & f) ^ (~e & g)) +
+               vset1(V, sha256_consts[i]) + w[i & 15];
+        V t2 = (vror(a, 2) ^ vror(a, 13) ^ vror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    s[0] = a; s[1] = b; s[2] = c; s[3] = d;
+    s[4] = e; s[5] = f; s[6] = g; s[7] = h;
+}
+
+template <typename V, int N>
+static ALWAYS_INLINE void vtransform(V s[8], V w[16]) {
+    V v[8];
+    for (int t = 0; t < 8; t++)
+        v[t] = s[t];
+    vrounds<V, N>(v, w, 0, 64, 16);
+    for (int t = 0; t < 8; t++)
+        s[t] += v[t];
+}
+
+#endif
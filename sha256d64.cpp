@@ -0,0 +1,117 @@
+// Copyright (c) 2010 Nils Schneider
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Multi-buffer double SHA-256 of 64 byte messages, one message per lane.
+// A merkle tree level is an array of such messages (adjacent hash pairs),
+// so it's hashed 4 or 8 at a time instead of one by one.
+//
+// Block validation runs this on every node, so it's built for any SSE2
+// CPU, unlike the mining kernels in sha256.cpp.  The AVX2 lanes are only
+// entered once DetectAVX2() says the CPU has them.
+//
+
+#ifdef FOURWAYSSE2
+
+#include <string.h>
+#include <openssl/sha.h>
+
+#include "sha256.h"
+
+// main.cpp, also picks the mining kernel
+extern bool DetectAVX2();
+
+static inline unsigned int readbe32(const unsigned char* p) {
+    return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static inline void writebe32(unsigned char* p, unsigned int x) {
+    p[0] = x >> 24; p[1] = x >> 16; p[2] = x >> 8; p[3] = x;
+}
+
+template <typename V, int N>
+static ALWAYS_INLINE void vsha256d64(unsigned char* pout, const unsigned char* pin) {
+    V s[8], w[16];
+    for (int t = 0; t < 16; t++)
+        for (int j = 0; j < N; j++)
+            w[t][j] = readbe32(pin + 64 * j + 4 * t);
+    for (int t = 0; t < 8; t++)
+        s[t] = vset1(V, pSHA256InitState[t]);
+    vtransform<V, N>(s, w);
+
+    // Padding block of a 64 byte message
+    V s2[8];
+    for (int t = 0; t < 8; t++)
+        s2[t] = s[t];
+    w[0] = vset1(V, 0x80000000);
+    for (int t = 1; t < 15; t++)
+        w[t] = vset1(V, 0);
+    w[15] = vset1(V, 512);
+    vtransform<V, N>(s2, w);
+
+    // Second hash over the 32 byte digest, padded in the same block
+    for (int t = 0; t < 8; t++) {
+        w[t] = s2[t];
+        s[t] = vset1(V, pSHA256InitState[t]);
+    }
+    w[8] = vset1(V, 0x80000000);
+    for (int t = 9; t < 15; t++)
+        w[t] = vset1(V, 0);
+    w[15] = vset1(V, 256);
+    vtransform<V, N>(s, w);
+
+    for (int t = 0; t < 8; t++)
+        for (int j = 0; j < N; j++)
+            writebe32(pout + 32 * j + 4 * t, s[t][j]);
+}
+
+static void sha256d64_4way(unsigned char* pout, const unsigned char* pin) {
+    vsha256d64<v4u, 4>(pout, pin);
+}
+
+#ifdef SHA256D64_AVX2
+__attribute__((target("avx2")))
+static void sha256d64_8way(unsigned char* pout, const unsigned char* pin) {
+    vsha256d64<v8u, 8>(pout, pin);
+}
+#endif
+
+// Run a kernel on fewer messages than it has lanes
+static void sha256d64_partial(void (*pfn)(unsigned char*, const unsigned char*), int nLanes,
+                              unsigned char* pout, const unsigned char* pin, unsigned int nBlocks) {
+    unsigned char pinbuf[64 * 8], poutbuf[32 * 8];
+    memcpy(pinbuf, pin, 64 * nBlocks);
+    memset(pinbuf + 64 * nBlocks, 0, 64 * (nLanes - nBlocks));
+    pfn(poutbuf, pinbuf);
+    memcpy(pout, poutbuf, 32 * nBlocks);
+}
+
+// Double SHA-256 of nBlocks 64 byte messages from pin, 32 bytes each to pout
+void SHA256D64(unsigned char* pout, const unsigned char* pin, unsigned int nBlocks) {
+#ifdef SHA256D64_AVX2
+    static const bool fAVX2 = DetectAVX2();
+    if (fAVX2) {
+        for (; nBlocks >= 8; nBlocks -= 8, pin += 64 * 8, pout += 32 * 8)
+            sha256d64_8way(pout, pin);
+        if (nBlocks > 4) {
+            sha256d64_partial(sha256d64_8way, 8, pout, pin, nBlocks);
+            return;
+        }
+    }
+#endif
+    for (; nBlocks >= 4; nBlocks -= 4, pin += 64 * 4, pout += 32 * 4)
+        sha256d64_4way(pout, pin);
+
+    // A partly filled set of lanes costs about as much as a full one, so
+    // it already pays off for two messages, a single one goes scalar
+    if (nBlocks > 1)
+        sha256d64_partial(sha256d64_4way, 4, pout, pin, nBlocks);
+    else if (nBlocks == 1) {
+        unsigned char hash1[32];
+        SHA256(pin, 64, hash1);
+        SHA256(hash1, 32, pout);
+    }
+}
+
+#endif // FOURWAYSSE2
@@ -0,0 +1,172 @@
+//
+// Merged mining: CAuxPow::Check against parent blocks made up here, then
+// blocks mined through getauxblock once merged mining starts on the test
+// chain.  Parent blocks use chain ID 0.
+//
+
+Value getauxblock(const Array& params, bool fHelp);
+
+BOOST_AUTO_TEST_SUITE(auxpow_tests)
+
+static const unsigned char pchHeader[] = { 0xfa, 0xbe, 'm', 'm' };
+
+// The chain merkle root byte reversed, then tree size and nonce
+static vector<unsigned char> MergedMiningData(const uint256& hashRoot, unsigned int nSize, unsigned int nNonce)
+{
+    vector<unsigned char> vch((unsigned char*)&hashRoot, (unsigned char*)&hashRoot + sizeof(hashRoot));
+    reverse(vch.begin(), vch.end());
+    for (int i = 0; i < 4; i++)
+        vch.push_back(nSize >> (8 * i));
+    for (int i = 0; i < 4; i++)
+        vch.push_back(nNonce >> (8 * i));
+    return vch;
+}
+
+static int ChainIndex(unsigned int nNonce, int nChainID, unsigned int nSize)
+{
+    unsigned int nRand = nNonce * 1103515245 + 12345;
+    nRand = (nRand + nChainID) * 1103515245 + 12345;
+    return nRand % nSize;
+}
+
+// Parent block with a lone coinbase, vchScript as its scriptSig
+static CAuxPow BuildAuxPow(const vector<unsigned char>& vchScript, const vector<uint256>& vChainMerkleBranch, int nChainIndex, unsigned int nBits)
+{
+    CAuxPow auxpow;
+    auxpow.vin.resize(1);
+    auxpow.vin[0].prevout.SetNull();
+    auxpow.vin[0].scriptSig.insert(auxpow.vin[0].scriptSig.end(), vchScript.begin(), vchScript.end());
+    auxpow.vout.resize(1);
+    auxpow.vout[0].nValue = 50 * COIN;
+    auxpow.nIndex = 0;
+    auxpow.vChainMerkleBranch = vChainMerkleBranch;
+    auxpow.nChainIndex = nChainIndex;
+    auxpow.parentBlock.nVersion = 1;
+    auxpow.parentBlock.hashMerkleRoot = auxpow.GetHash();
+    auxpow.parentBlock.nTime = GetAdjustedTime();
+    auxpow.parentBlock.nBits = nBits;
+    return auxpow;
+}
+
+static vector<unsigned char> Concat(const vector<unsigned char>& vch1, const vector<unsigned char>& vch2)
+{
+    vector<unsigned char> vchRet(vch1);
+    vchRet.insert(vchRet.end(), vch2.begin(), vch2.end());
+    return vchRet;
+}
+
+BOOST_AUTO_TEST_CASE(auxpow_check)
+{
+    const int nChainID = 7;
+    const unsigned int nBits = bnProofOfWorkLimit.GetCompact();
+    const vector<uint256> vNoBranch;
+    uint256 hashAux;
+    RAND_bytes((unsigned char*)&hashAux, sizeof(hashAux));
+
+    vector<unsigned char> vchHeader(pchHeader, pchHeader + sizeof(pchHeader));
+    vector<unsigned char> vchData = MergedMiningData(hashAux, 1, 0);
+    vector<unsigned char> vchPrefix(4, 0x51);
+
+    // Root right after the header, anywhere in the coinbase
+    BOOST_CHECK(BuildAuxPow(Concat(vchHeader, vchData), vNoBranch, 0, nBits).Check(hashAux, nChainID));
+    vector<unsigned char> vchLong(40, 0x51);
+    BOOST_CHECK(BuildAuxPow(Concat(vchLong, Concat(vchHeader, vchData)), vNoBranch, 0, nBits).Check(hashAux, nChainID));
+
+    // Legacy form without the header, only in the first 20 bytes
+    BOOST_CHECK(BuildAuxPow(vchData, vNoBranch, 0, nBits).Check(hashAux, nChainID));
+    BOOST_CHECK(BuildAuxPow(Concat(vchPrefix, vchData), vNoBranch, 0, nBits).Check(hashAux, nChainID));
+    BOOST_CHECK(BuildAuxPow(Concat(vector<unsigned char>(20, 0x51), vchData), vNoBranch, 0, nBits).Check(hashAux, nChainID));
+    BOOST_CHECK(!BuildAuxPow(Concat(vector<unsigned char>(21, 0x51), vchData), vNoBranch, 0, nBits).Check(hashAux, nChainID));
+
+    // Header not just before the root, or more than one header
+    BOOST_CHECK(!BuildAuxPow(Concat(vchHeader, Concat(vchPrefix, vchData)), vNoBranch, 0, nBits).Check(hashAux, nChainID));
+    BOOST_CHECK(!BuildAuxPow(Concat(Concat(vchHeader, vchData), vchHeader), vNoBranch, 0, nBits).Check(hashAux, nChainID));
+
+    // Root of another block, no size and nonce after the root
+    BOOST_CHECK(!BuildAuxPow(Concat(vchHeader, vchData), vNoBranch, 0, nBits).Check(hashAux + 1, nChainID));
+    vector<unsigned char> vchRootOnly(vchData.begin(), vchData.end() - 8);
+    BOOST_CHECK(!BuildAuxPow(Concat(vchHeader, vchRootOnly), vNoBranch, 0, nBits).Check(hashAux, nChainID));
+
+    // Two slot tree, the nonce and chain ID pick ours
+    vector<uint256> vBranch(1, hashAux + 1);
+    for (unsigned int nNonce = 0; nNonce < 4; nNonce++)
+    {
+        int nIndex = ChainIndex(nNonce, nChainID, 2);
+        uint256 hashRoot = CBlock::CheckMerkleBranch(hashAux, vBranch, nIndex);
+        vector<unsigned char> vchScript = Concat(vchHeader, MergedMiningData(hashRoot, 2, nNonce));
+        BOOST_CHECK(BuildAuxPow(vchScript, vBranch, nIndex, nBits).Check(hashAux, nChainID));
+
+        // The other slot is some other chain's
+        uint256 hashRootOther = CBlock::CheckMerkleBranch(hashAux, vBranch, !nIndex);
+        vchScript = Concat(vchHeader, MergedMiningData(hashRootOther, 2, nNonce));
+        BOOST_CHECK(!BuildAuxPow(vchScript, vBranch, !nIndex, nBits).Check(hashAux, nChainID));
+
+        // Tree size has to match the branch
+        vchScript = Concat(vchHeader, MergedMiningData(hashRoot, 4, nNonce));
+        BOOST_CHECK(!BuildAuxPow(vchScript, vBranch, nIndex, nBits).Check(hashAux, nChainID));
+    }
+
+    // The parent can't be one of our own blocks, its coinbase has to be in it
+    CAuxPow auxpow = BuildAuxPow(Concat(vchHeader, vchData), vNoBranch, 0, nBits);
+    auxpow.parentBlock.nVersion = 1 | nChainID * BLOCK_VERSION_CHAIN_START;
+    BOOST_CHECK(!auxpow.Check(hashAux, nChainID));
+    auxpow = BuildAuxPow(Concat(vchHeader, vchData), vNoBranch, 0, nBits);
+    auxpow.parentBlock.hashMerkleRoot = 0;
+    BOOST_CHECK(!auxpow.Check(hashAux, nChainID));
+}
+
+BOOST_AUTO_TEST_CASE(auxpow_getauxblock)
+{
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(), true);
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.push_back(pnode);
+    ptesthooks->nAuxPowChainID = 0x0001;
+    ptesthooks->nAuxPowStartHeight = nBestHeight + 1;
+
+    // From here every block needs our chain ID, the miner's have it
+    CBlock block = BuildBlock(pindexBest, vector<CTransaction>());
+    BOOST_CHECK(!ProcessBlock(NULL, &block));
+    BOOST_REQUIRE(MineBlock());
+    BOOST_CHECK_EQUAL(pindexBest->nVersion, 1 | 0x0001 * BLOCK_VERSION_CHAIN_START);
+
+    // Each call is a new block to commit to
+    Object result = getauxblock(Array(), false).get_obj();
+    BOOST_CHECK_EQUAL(find_value(result, "chainid").get_int(), 0x0001);
+    uint256 hash1, hash2;
+    hash1.SetHex(find_value(result, "hash").get_str());
+    hash2.SetHex(find_value(getauxblock(Array(), false).get_obj(), "hash").get_str());
+    BOOST_CHECK(hash1 != hash2);
+
+    // Parent block solved for the first one
+    vector<unsigned char> vchScript(pchHeader, pchHeader + sizeof(pchHeader));
+    vchScript = Concat(vchScript, MergedMiningData(hash1, 1, 0));
+    CAuxPow auxpow = BuildAuxPow(vchScript, vector<uint256>(), 0, pindexBest->nBits);
+    SolveBlock(auxpow.parentBlock);
+    CDataStream ssAuxPow(SER_NETWORK);
+    ssAuxPow << auxpow;
+
+    int nHeight = nBestHeight;
+    Array params;
+    params.push_back(hash1.GetHex());
+    params.push_back(HexStr(ssAuxPow.begin(), ssAuxPow.end()));
+    BOOST_CHECK(getauxblock(params, false).get_bool());
+    BOOST_REQUIRE_EQUAL(nBestHeight, nHeight + 1);
+    BOOST_CHECK(hashBestChain == hash1);
+
+    // It reads back from disk with its auxpow
+    CBlock blockRead;
+    BOOST_REQUIRE(blockRead.ReadFromDisk(pindexBest));
+    BOOST_REQUIRE(blockRead.auxpow.get());
+    BOOST_CHECK(blockRead.auxpow->parentBlock.GetHash() == auxpow.parentBlock.GetHash());
+
+    // The second one went with the old best block
+    params[0] = hash2.GetHex();
+    BOOST_CHECK(!getauxblock(params, false).get_bool());
+
+    ptesthooks->nAuxPowStartHeight = INT_MAX;
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    delete pnode;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,55 @@
+//
+// Cached transaction hashes don't survive a copy, so a copy changed in
+// place without InvalidateHash() still hashes right.  Built with
+// -DDEBUG_HASHCACHE, every GetHash() here also checks the cache itself.
+//
+
+BOOST_AUTO_TEST_SUITE(hashcache_tests)
+
+static CTransaction HashCacheTransaction()
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = Hash(BEGIN(nBestHeight), END(nBestHeight));
+    tx.vin[0].scriptSig << OP_1;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = CENT;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(hashcache_copy)
+{
+    CTransaction tx = HashCacheTransaction();
+    uint256 hash = tx.GetHash();
+
+    CTransaction txCopy(tx);
+    txCopy.vin[0].scriptSig = CScript() << OP_2;
+    BOOST_CHECK(txCopy.GetHash() != hash);
+    BOOST_CHECK(txCopy.GetHash() == SerializeHash(txCopy));
+
+    CTransaction txAssigned;
+    txAssigned.GetHash();
+    txAssigned = tx;
+    BOOST_CHECK(txAssigned.GetHash() == hash);
+    txAssigned.vin[0].scriptSig = CScript() << OP_3;
+    BOOST_CHECK(txAssigned.GetHash() != hash);
+    BOOST_CHECK(txAssigned.GetHash() == SerializeHash(txAssigned));
+
+    BOOST_CHECK(tx.GetHash() == hash);
+}
+
+BOOST_AUTO_TEST_CASE(hashcache_block_copy)
+{
+    // A copied template with its own coinbase, what getwork does
+    CBlock block;
+    block.vtx.push_back(HashCacheTransaction());
+    uint256 hashMerkleRoot = block.BuildMerkleTree();
+
+    CBlock blockCopy = block;
+    blockCopy.vtx[0].vin[0].scriptSig = CScript() << OP_4;
+    BOOST_CHECK(blockCopy.BuildMerkleTree() != hashMerkleRoot);
+    BOOST_CHECK(blockCopy.BuildMerkleTree() == SerializeHash(blockCopy.vtx[0]));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
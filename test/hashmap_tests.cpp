@@ -0,0 +1,160 @@
+//
+// CHashMap against std::map: the same inserts and erases leave the same
+// contents, through rehashes, erasing while iterating and long probe runs
+//
+
+BOOST_AUTO_TEST_SUITE(hashmap_tests)
+
+// Every key's home slot is one of the last few, so probe runs wrap around
+// the end of the table and deletion has to shift across it
+class CClusterHasher
+{
+public:
+    uint64 operator()(const uint256& hash) const
+    {
+        return (uint64)(0xffffffffU - (unsigned int)(hash.Get64(0) & 7)) << 32;
+    }
+};
+
+// Reproducible, so a failure can be run again
+static uint64 nTestRand = 1;
+static unsigned int TestRand(unsigned int nRange)
+{
+    nTestRand = nTestRand * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned int)(nTestRand >> 33) % nRange;
+}
+
+template<typename H>
+static void CheckSame(const CHashMap<uint256, int, H>& mapHash, const map<uint256, int>& mapRef)
+{
+    BOOST_REQUIRE_EQUAL(mapHash.size(), mapRef.size());
+    BOOST_REQUIRE_EQUAL(mapHash.empty(), mapRef.empty());
+
+    // Iteration visits each entry once
+    map<uint256, int> mapSeen;
+    for (typename CHashMap<uint256, int, H>::const_iterator it = mapHash.begin(); it != mapHash.end(); ++it)
+        BOOST_REQUIRE(mapSeen.insert(*it).second);
+    BOOST_REQUIRE(mapSeen == mapRef);
+
+    for (map<uint256, int>::const_iterator it = mapRef.begin(); it != mapRef.end(); ++it)
+    {
+        typename CHashMap<uint256, int, H>::const_iterator mi = mapHash.find(it->first);
+        BOOST_REQUIRE(mi != mapHash.end());
+        BOOST_REQUIRE_EQUAL(mi->second, it->second);
+        BOOST_REQUIRE_EQUAL(mapHash.count(it->first), 1U);
+    }
+}
+
+template<typename H>
+static void RandomOps(int nRange)
+{
+    CHashMap<uint256, int, H> mapHash;
+    map<uint256, int> mapRef;
+    for (int i = 0; i < 20000; i++)
+    {
+        // Keys from a small range, so erases often hit
+        uint256 key(TestRand(nRange));
+        switch (TestRand(4))
+        {
+        case 0:
+        case 1:
+        {
+            pair<typename CHashMap<uint256, int, H>::iterator, bool> ret = mapHash.insert(make_pair(key, i));
+            BOOST_REQUIRE_EQUAL(ret.second, mapRef.insert(make_pair(key, i)).second);
+            BOOST_REQUIRE(ret.first->first == key);
+            BOOST_REQUIRE_EQUAL(ret.first->second, mapRef[key]);
+            break;
+        }
+        case 2:
+            mapHash[key] = i;
+            mapRef[key] = i;
+            break;
+        case 3:
+            BOOST_REQUIRE_EQUAL(mapHash.erase(key), mapRef.erase(key));
+            BOOST_REQUIRE(mapHash.find(key) == mapHash.end());
+            break;
+        }
+        if (i % 1000 == 0)
+            CheckSame(mapHash, mapRef);
+    }
+    CheckSame(mapHash, mapRef);
+
+    mapHash.clear();
+    mapRef.clear();
+    CheckSame(mapHash, mapRef);
+}
+
+BOOST_AUTO_TEST_CASE(hashmap_random)
+{
+    RandomOps<CUint256Hasher>(100);
+    RandomOps<CUint256Hasher>(5000);
+    RandomOps<CClusterHasher>(200);
+}
+
+BOOST_AUTO_TEST_CASE(hashmap_erase_iterating)
+{
+    CHashMap<uint256, int, CClusterHasher> mapHash;
+    map<uint256, int> mapRef;
+    for (int i = 0; i < 1000; i++)
+    {
+        mapHash[uint256(i)] = i;
+        mapRef[uint256(i)] = i;
+    }
+
+    // Erasing the current entry with it++ still visits every other one,
+    // even when deletion shifts the slots of ones not visited yet
+    int nVisited = 0;
+    for (CHashMap<uint256, int, CClusterHasher>::iterator it = mapHash.begin(); it != mapHash.end(); )
+    {
+        nVisited++;
+        if (it->second % 3 == 0)
+        {
+            mapRef.erase(it->first);
+            mapHash.erase(it++);
+        }
+        else
+            ++it;
+    }
+    BOOST_CHECK_EQUAL(nVisited, 1000);
+    CheckSame(mapHash, mapRef);
+
+    // Erasing all of them that way leaves it empty
+    for (CHashMap<uint256, int, CClusterHasher>::iterator it = mapHash.begin(); it != mapHash.end(); )
+        mapHash.erase(it++);
+    mapRef.clear();
+    CheckSame(mapHash, mapRef);
+}
+
+BOOST_AUTO_TEST_CASE(hashmap_rehash)
+{
+    CHashMap<uint256, int, CUint256Hasher> mapHash;
+    map<uint256, int> mapRef;
+    map<uint256, const int*> mapAddress;
+
+    // Growing and reserving rehash the slots, entries stay where they are
+    for (int i = 0; i < 5000; i++)
+    {
+        if (i == 2500)
+            mapHash.reserve(50000);
+        uint256 key(i);
+        mapHash[key] = i;
+        mapRef[key] = i;
+        mapAddress[key] = &mapHash.find(key)->second;
+        if (i % 7 == 0)
+        {
+            uint256 keyErase(i / 2);
+            mapHash.erase(keyErase);
+            mapRef.erase(keyErase);
+            mapAddress.erase(keyErase);
+        }
+    }
+    CheckSame(mapHash, mapRef);
+    for (map<uint256, const int*>::iterator it = mapAddress.begin(); it != mapAddress.end(); ++it)
+        BOOST_CHECK(&mapHash.find(it->first)->second == it->second);
+
+    // Reserving less than there is changes nothing
+    mapHash.reserve(10);
+    CheckSame(mapHash, mapRef);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
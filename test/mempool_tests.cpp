@@ -0,0 +1,191 @@
+//
+// Memory pool transactions CreateNewBlock may and may not take.  Entries
+// accepted without checking inputs, as wallet transactions and ones a
+// reorganize puts back are, only go in a block once every input is in the
+// chain unspent or in the pool and their signatures verify.
+//
+
+BOOST_AUTO_TEST_SUITE(mempool_tests)
+
+// A mature coinbase of one of our blocks, a different one each call
+static CTransaction MatureCoinBase()
+{
+    static int nHeight = 0;
+    nHeight++;
+    while (nBestHeight < nHeight + COINBASE_MATURITY + 1)
+        BOOST_REQUIRE(MineBlock());
+
+    CBlockIndex* pindex = pindexBest;
+    while (pindex->nHeight > nHeight)
+        pindex = pindex->pprev;
+    CBlock block;
+    BOOST_REQUIRE(block.ReadFromDisk(pindex));
+    return block.vtx[0];
+}
+
+static CTransaction Spend(const CTransaction& txPrev, int64 nFee)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = txPrev.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey << GenerateNewKey() << OP_CHECKSIG;
+    BOOST_REQUIRE(SignSignature(txPrev, tx, 0));
+    return tx;
+}
+
+// Memory pool transactions the next block would take
+static vector<uint256> BlockTemplate()
+{
+    CReserveKey reservekey;
+    auto_ptr<CBlock> pblock(CreateNewBlock(reservekey));
+    BOOST_REQUIRE(pblock.get());
+    vector<uint256> vRet;
+    for (unsigned int i = 1; i < pblock->vtx.size(); i++)
+        vRet.push_back(pblock->vtx[i].GetHash());
+    return vRet;
+}
+
+static bool InMemoryPool(const CTransaction& tx)
+{
+    CRITICAL_BLOCK(cs_mapTransactions)
+        return mapTransactions.count(tx.GetHash()) != 0;
+    return false;
+}
+
+BOOST_AUTO_TEST_CASE(mempool_spent_input)
+{
+    CTransaction txCoinBase = MatureCoinBase();
+    CTransaction txA = Spend(txCoinBase, CENT);
+    CTransaction txB = Spend(txCoinBase, 2 * CENT);
+    CTxDB txdb("r");
+
+    BOOST_REQUIRE(txA.AcceptToMemoryPool(txdb, true));
+    BOOST_REQUIRE(MineBlock());
+    BOOST_CHECK(!InMemoryPool(txA));
+
+    // Like a wallet transaction put back after its input was spent elsewhere
+    BOOST_REQUIRE(txB.AcceptToMemoryPool(txdb, false));
+    BOOST_CHECK(BlockTemplate().empty());
+
+    txB.RemoveFromMemoryPool();
+}
+
+BOOST_AUTO_TEST_CASE(mempool_parent_mined_later)
+{
+    CTransaction txParent = Spend(MatureCoinBase(), CENT);
+    CTransaction txChild = Spend(txParent, CENT);
+    CTxDB txdb("r");
+
+    // The child comes first, without its parent it can't be mined
+    BOOST_REQUIRE(txChild.AcceptToMemoryPool(txdb, false));
+    BOOST_CHECK(BlockTemplate().empty());
+
+    // The parent arrives in a block, not through the pool
+    CBlock block = BuildBlock(pindexBest, vector<CTransaction>(1, txParent));
+    BOOST_REQUIRE(ProcessBlock(NULL, &block));
+    BOOST_REQUIRE(hashBestChain == block.GetHash());
+    vector<uint256> vHashes = BlockTemplate();
+    BOOST_REQUIRE_EQUAL(vHashes.size(), 1U);
+    BOOST_CHECK(vHashes[0] == txChild.GetHash());
+
+    BOOST_REQUIRE(MineBlock());
+    BOOST_CHECK(!InMemoryPool(txChild));
+}
+
+BOOST_AUTO_TEST_CASE(mempool_reorganize)
+{
+    CTransaction txParent = Spend(MatureCoinBase(), CENT);
+    CTransaction txChild = Spend(txParent, CENT);
+    CTxDB txdb("r");
+
+    BOOST_REQUIRE(txParent.AcceptToMemoryPool(txdb, true));
+    CBlockIndex* pindexFork = pindexBest;
+    BOOST_REQUIRE(MineBlock());
+    BOOST_REQUIRE(txChild.AcceptToMemoryPool(txdb, true));
+
+    // A longer branch without the parent puts it back in the pool, both
+    // go in the next block on the new best chain
+    CBlock block1 = BuildBlock(pindexFork, vector<CTransaction>());
+    BOOST_REQUIRE(ProcessBlock(NULL, &block1));
+    CBlock block2 = BuildBlock(mapBlockIndex[block1.GetHash()], vector<CTransaction>());
+    BOOST_REQUIRE(ProcessBlock(NULL, &block2));
+    BOOST_REQUIRE(hashBestChain == block2.GetHash());
+    BOOST_CHECK(InMemoryPool(txParent));
+
+    vector<uint256> vHashes = BlockTemplate();
+    BOOST_REQUIRE_EQUAL(vHashes.size(), 2U);
+    BOOST_CHECK(vHashes[0] == txParent.GetHash());
+    BOOST_CHECK(vHashes[1] == txChild.GetHash());
+
+    BOOST_REQUIRE(MineBlock());
+    BOOST_CHECK(!InMemoryPool(txParent) && !InMemoryPool(txChild));
+}
+
+BOOST_AUTO_TEST_CASE(mempool_unchecked_signature)
+{
+    CTxDB txdb("r");
+
+    // Taken in without checking inputs, one with a signature that doesn't
+    // verify and one that does
+    CTransaction txBad = Spend(MatureCoinBase(), CENT);
+    txBad.vin[0].scriptSig[10] ^= 1;
+    txBad.InvalidateHash();
+    CTransaction txGood = Spend(MatureCoinBase(), CENT);
+    BOOST_REQUIRE(txBad.AcceptToMemoryPool(txdb, false));
+    BOOST_REQUIRE(txGood.AcceptToMemoryPool(txdb, false));
+
+    // Only the good one goes in a block, the bad one would get it rejected
+    vector<uint256> vHashes = BlockTemplate();
+    BOOST_REQUIRE_EQUAL(vHashes.size(), 1U);
+    BOOST_CHECK(vHashes[0] == txGood.GetHash());
+    BOOST_CHECK_EQUAL(BlockTemplate().size(), 1U);
+
+    BOOST_REQUIRE(MineBlock());
+    BOOST_CHECK(!InMemoryPool(txGood));
+    BOOST_CHECK(InMemoryPool(txBad));
+    txBad.RemoveFromMemoryPool();
+}
+
+BOOST_AUTO_TEST_CASE(mempool_evict_package)
+{
+    CTxDB txdb("r");
+
+    // A free parent whose child pays for both, and a transaction paying a
+    // little on its own
+    CTransaction txParent = Spend(MatureCoinBase(), 0);
+    CTransaction txChild = Spend(txParent, 10 * CENT);
+    CTransaction txOther = Spend(MatureCoinBase(), CENT);
+    BOOST_REQUIRE(txParent.AcceptToMemoryPool(txdb, true));
+    BOOST_REQUIRE(txChild.AcceptToMemoryPool(txdb, true));
+    BOOST_REQUIRE(txOther.AcceptToMemoryPool(txdb, true));
+
+    // A wallet transaction whose parent never reached the pool
+    CTransaction txWallet = Spend(Spend(MatureCoinBase(), CENT), 0);
+    BOOST_REQUIRE(AddToWallet(CWalletTx(txWallet)));
+    BOOST_REQUIRE(txWallet.AcceptToMemoryPool(txdb, false));
+
+    // Room for a bit over four, the fifth has the cheapest package go and
+    // nothing else
+    uint64 nTx, nBytes, nEvicted, nEvictedBytes;
+    GetMemPoolStats(nTx, nBytes, nEvicted, nEvictedBytes);
+    BOOST_REQUIRE_EQUAL(nTx, 4U);
+    uint64 nMaxBytesSave = nMemPoolMaxBytes;
+    nMemPoolMaxBytes = nBytes + nBytes / 7;
+    CTransaction txNew = Spend(MatureCoinBase(), 20 * CENT);
+    BOOST_CHECK(txNew.AcceptToMemoryPool(txdb, true));
+    nMemPoolMaxBytes = nMaxBytesSave;
+
+    BOOST_CHECK(!InMemoryPool(txOther));
+    BOOST_CHECK(InMemoryPool(txParent));
+    BOOST_CHECK(InMemoryPool(txChild));
+    BOOST_CHECK(InMemoryPool(txWallet));
+    BOOST_CHECK(InMemoryPool(txNew));
+
+    BOOST_REQUIRE(MineBlock());
+    BOOST_CHECK(!InMemoryPool(txParent) && !InMemoryPool(txChild) && !InMemoryPool(txNew));
+    txWallet.RemoveFromMemoryPool();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,53 @@
+//
+// Internal miner threads started and stopped repeatedly.  The last thread
+// to stop gives back the shared template's key, a thread starting right
+// then has to get a fresh one.
+//
+
+BOOST_AUTO_TEST_SUITE(miner_tests)
+
+static bool WaitFor(bool (*pfn)(), int nSeconds)
+{
+    for (int64 nStart = GetTime(); GetTime() - nStart < nSeconds; Sleep(10))
+        if (pfn())
+            return true;
+    return pfn();
+}
+
+static int nHeightWaitedFor;
+static bool HeightReached() { return nBestHeight >= nHeightWaitedFor; }
+static bool MinersStopped() { return vnThreadsRunning[3] == 0; }
+
+BOOST_AUTO_TEST_CASE(miner_start_stop)
+{
+    // The miners wait for a peer, a node that never connects will do
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(), true);
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.push_back(pnode);
+
+    // 16 bit kernels, the others only report hashes ending in 32 zero bits
+    mapArgs["-4way"] = "0";
+    fLimitProcessors = true;
+    nLimitProcessors = 2;
+
+    for (int nCycle = 0; nCycle < 4; nCycle++)
+    {
+        nHeightWaitedFor = nBestHeight + 1;
+        GenerateBitcoins(true);
+        BOOST_CHECK(WaitFor(HeightReached, 60));
+
+        // Odd cycles restart before the miners are gone, even ones wait
+        GenerateBitcoins(false);
+        if (nCycle % 2 == 0)
+            BOOST_CHECK(WaitFor(MinersStopped, 60));
+    }
+    BOOST_CHECK(WaitFor(MinersStopped, 60));
+
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    delete pnode;
+    mapArgs.erase("-4way");
+    fLimitProcessors = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,218 @@
+//
+// CPrevOutCache: outputs of connected blocks read back without going to
+// disk.  Whatever ConnectInputs decides from a cached output it has to
+// decide the same from the disk.
+//
+
+BOOST_AUTO_TEST_SUITE(prevoutcache_tests)
+
+static uint64 GetPrevOutHits()
+{
+    uint64 nEntries, nBytes, nMaxBytes, nHits, nMisses;
+    prevoutcache.GetStats(nEntries, nBytes, nMaxBytes, nHits, nMisses);
+    return nHits;
+}
+
+// Empty the cache, leaving its size limit as it was
+static void ClearPrevOutCache()
+{
+    uint64 nEntries, nBytes, nMaxBytes, nHits, nMisses;
+    prevoutcache.GetStats(nEntries, nBytes, nMaxBytes, nHits, nMisses);
+    prevoutcache.SetMaxBytes(0);
+    prevoutcache.SetMaxBytes(nMaxBytes);
+}
+
+static CTransaction SpendOutput(const CTransaction& txPrev, int64 nFee)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = txPrev.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey << GenerateNewKey() << OP_CHECKSIG;
+    BOOST_REQUIRE(SignSignature(txPrev, tx, 0));
+    return tx;
+}
+
+// ConnectInputs as the memory pool runs it, on top of the best block
+static bool ConnectPoolInputs(CTransaction& tx, int64& nFeesRet)
+{
+    CTxDB txdb("r");
+    map<uint256, CTxIndex> mapUnused;
+    nFeesRet = 0;
+    return tx.ConnectInputs(txdb, mapUnused, CDiskTxPos(1,1,1), pindexBest, nFeesRet, false, false);
+}
+
+// A transaction in a new best block, spending a mature coinbase
+static CTransaction ConnectedTransaction()
+{
+    BOOST_REQUIRE(MineBlock());
+    CBlockIndex* pindexCoinBase = pindexBest;
+    for (int i = 0; i < COINBASE_MATURITY; i++)
+        BOOST_REQUIRE(MineBlock());
+    CBlock blockCoinBase;
+    BOOST_REQUIRE(blockCoinBase.ReadFromDisk(pindexCoinBase));
+
+    CTransaction tx = SpendOutput(blockCoinBase.vtx[0], CENT);
+    CBlock block = BuildBlock(pindexBest, vector<CTransaction>(1, tx));
+    BOOST_REQUIRE(ProcessBlock(NULL, &block));
+    BOOST_REQUIRE(hashBestChain == block.GetHash());
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(prevoutcache_hit)
+{
+    CTransaction txPrev = ConnectedTransaction();
+    CTxIndex txindex;
+    BOOST_REQUIRE(CTxDB("r").ReadTxIndex(txPrev.GetHash(), txindex));
+
+    // What's cached is what's on disk
+    CTxOut txout;
+    int nHeight;
+    bool fCoinBase;
+    BOOST_REQUIRE(prevoutcache.Get(COutPoint(txPrev.GetHash(), 0), txindex.pos, txout, nHeight, fCoinBase));
+    BOOST_CHECK(txout == txPrev.vout[0]);
+    BOOST_CHECK_EQUAL(nHeight, nBestHeight);
+    BOOST_CHECK(!fCoinBase);
+
+    // A spend and a badly signed spend connect the same either way
+    CTransaction tx = SpendOutput(txPrev, CENT);
+    CTransaction txBad = tx;
+    txBad.vin[0].scriptSig[10] ^= 1;
+    txBad.InvalidateHash();
+    for (int i = 0; i < 2; i++)
+    {
+        CTransaction& txSpend = (i == 0 ? tx : txBad);
+        prevoutcache.Add(txPrev, txindex.pos, nBestHeight);
+        uint64 nHits = GetPrevOutHits();
+        int64 nFeesCached;
+        bool fCached = ConnectPoolInputs(txSpend, nFeesCached);
+        BOOST_CHECK_EQUAL(GetPrevOutHits(), nHits + 1);
+
+        ClearPrevOutCache();
+        int64 nFeesDisk;
+        bool fDisk = ConnectPoolInputs(txSpend, nFeesDisk);
+        BOOST_CHECK_EQUAL(GetPrevOutHits(), nHits + 1);
+
+        BOOST_CHECK_EQUAL(fCached, fDisk);
+        BOOST_CHECK_EQUAL(fCached, i == 0);
+        if (fCached && fDisk)
+            BOOST_CHECK_EQUAL(nFeesCached, nFeesDisk);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(prevoutcache_reorganize)
+{
+    CTransaction txPrev = ConnectedTransaction();
+    COutPoint prevout(txPrev.GetHash(), 0);
+    CTxIndex txindex;
+    BOOST_REQUIRE(CTxDB("r").ReadTxIndex(txPrev.GetHash(), txindex));
+    CDiskTxPos posOld = txindex.pos;
+    CTxOut txout;
+    int nHeight;
+    bool fCoinBase;
+    BOOST_CHECK(prevoutcache.Get(prevout, posOld, txout, nHeight, fCoinBase));
+
+    // A longer branch without its block disconnects it
+    CBlockIndex* pindexFork = pindexBest->pprev;
+    CBlock block1 = BuildBlock(pindexFork, vector<CTransaction>());
+    BOOST_REQUIRE(ProcessBlock(NULL, &block1));
+    CBlock block2 = BuildBlock(mapBlockIndex[block1.GetHash()], vector<CTransaction>());
+    BOOST_REQUIRE(ProcessBlock(NULL, &block2));
+    BOOST_REQUIRE(hashBestChain == block2.GetHash());
+    BOOST_CHECK(!prevoutcache.Get(prevout, posOld, txout, nHeight, fCoinBase));
+
+    // Mined again it's somewhere else on disk, the old position misses
+    CBlock block3 = BuildBlock(pindexBest, vector<CTransaction>(1, txPrev));
+    BOOST_REQUIRE(ProcessBlock(NULL, &block3));
+    BOOST_REQUIRE(hashBestChain == block3.GetHash());
+    BOOST_REQUIRE(CTxDB("r").ReadTxIndex(txPrev.GetHash(), txindex));
+    BOOST_CHECK(txindex.pos != posOld);
+    BOOST_CHECK(!prevoutcache.Get(prevout, posOld, txout, nHeight, fCoinBase));
+    BOOST_CHECK(prevoutcache.Get(prevout, txindex.pos, txout, nHeight, fCoinBase));
+    BOOST_CHECK_EQUAL(nHeight, nBestHeight);
+}
+
+BOOST_AUTO_TEST_CASE(prevoutcache_maturity)
+{
+    BOOST_REQUIRE(MineBlock());
+    CBlockIndex* pindexCoinBase = pindexBest;
+    CBlock block;
+    BOOST_REQUIRE(block.ReadFromDisk(pindexCoinBase));
+    CTransaction txCoinBase = block.vtx[0];
+    CTxIndex txindex;
+    BOOST_REQUIRE(CTxDB("r").ReadTxIndex(txCoinBase.GetHash(), txindex));
+    CTransaction tx = SpendOutput(txCoinBase, CENT);
+
+    // Cached and from disk the coinbase can be spent from the same depth
+    for (;;)
+    {
+        int nDepth = pindexBest->nHeight - pindexCoinBase->nHeight;
+        prevoutcache.Add(txCoinBase, txindex.pos, pindexCoinBase->nHeight);
+        uint64 nHits = GetPrevOutHits();
+        int64 nFees;
+        bool fCached = ConnectPoolInputs(tx, nFees);
+        BOOST_CHECK_EQUAL(GetPrevOutHits(), nHits + 1);
+        ClearPrevOutCache();
+        bool fDisk = ConnectPoolInputs(tx, nFees);
+        BOOST_CHECK_MESSAGE(fCached == fDisk, strprintf("depth %d", nDepth));
+        BOOST_CHECK_MESSAGE(fCached == (nDepth >= COINBASE_MATURITY), strprintf("depth %d", nDepth));
+        if (nDepth > COINBASE_MATURITY)
+            break;
+        BOOST_REQUIRE(MineBlock());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(prevoutcache_evict)
+{
+    uint64 nEntries, nBytes, nMaxBytes, nHits, nMisses;
+    prevoutcache.GetStats(nEntries, nBytes, nMaxBytes, nHits, nMisses);
+    uint64 nMaxBytesSave = nMaxBytes;
+    CDiskTxPos pos(1, 1, 1);
+
+    // Transactions with identical outputs, one output costs nBytesOne
+    CTransaction tx1, tx10, tx2;
+    tx1.vin.resize(1);
+    tx1.vout.resize(1);
+    tx1.vout[0].nValue = COIN;
+    tx1.vout[0].scriptPubKey << OP_DUP << OP_HASH160 << uint160(1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    tx10 = tx1;
+    tx10.vout.resize(10, tx1.vout[0]);
+    tx2 = tx1;
+    tx2.nLockTime = 1;
+
+    prevoutcache.SetMaxBytes(0);
+    prevoutcache.SetMaxBytes(nMaxBytesSave);
+    prevoutcache.Add(tx1, pos, 1);
+    prevoutcache.GetStats(nEntries, nBytes, nMaxBytes, nHits, nMisses);
+    BOOST_REQUIRE_EQUAL(nEntries, 1U);
+    uint64 nBytesOne = nBytes;
+
+    // Room for three, as -prevoutcachesize sets it, the oldest go
+    prevoutcache.SetMaxBytes(3 * nBytesOne);
+    prevoutcache.Add(tx10, pos, 1);
+    prevoutcache.GetStats(nEntries, nBytes, nMaxBytes, nHits, nMisses);
+    BOOST_CHECK_EQUAL(nEntries, 3U);
+    BOOST_CHECK(nBytes <= 3 * nBytesOne);
+
+    CTxOut txout;
+    int nHeight;
+    bool fCoinBase;
+    BOOST_CHECK(!prevoutcache.Get(COutPoint(tx1.GetHash(), 0), pos, txout, nHeight, fCoinBase));
+    BOOST_CHECK(!prevoutcache.Get(COutPoint(tx10.GetHash(), 6), pos, txout, nHeight, fCoinBase));
+    BOOST_CHECK(prevoutcache.Get(COutPoint(tx10.GetHash(), 8), pos, txout, nHeight, fCoinBase));
+    BOOST_CHECK(prevoutcache.Get(COutPoint(tx10.GetHash(), 7), pos, txout, nHeight, fCoinBase));
+    BOOST_CHECK(prevoutcache.Get(COutPoint(tx10.GetHash(), 9), pos, txout, nHeight, fCoinBase));
+
+    // Reading one makes it recent, the least recently read goes next
+    prevoutcache.Add(tx2, pos, 1);
+    BOOST_CHECK(!prevoutcache.Get(COutPoint(tx10.GetHash(), 8), pos, txout, nHeight, fCoinBase));
+    BOOST_CHECK(prevoutcache.Get(COutPoint(tx10.GetHash(), 7), pos, txout, nHeight, fCoinBase));
+    BOOST_CHECK(prevoutcache.Get(COutPoint(tx10.GetHash(), 9), pos, txout, nHeight, fCoinBase));
+    BOOST_CHECK(prevoutcache.Get(COutPoint(tx2.GetHash(), 0), pos, txout, nHeight, fCoinBase));
+
+    prevoutcache.SetMaxBytes(0);
+    prevoutcache.SetMaxBytes(nMaxBytesSave);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,210 @@
+//
+// getwork: every call is different work, and a solution to any of it
+// comes back as a block on the best chain
+//
+#include "../json/json_spirit_utils.h"
+
+using namespace json_spirit;
+
+Value getwork(const Array& params, bool fHelp);
+Value getblocktemplate(const Array& params, bool fHelp);
+Value submitblock(const Array& params, bool fHelp);
+bool IsWorkTemplateStale();
+unsigned int GetWorkTemplatesBuilt();
+bool IsNewWorkSince(unsigned int nTemplatesBuilt);
+
+BOOST_AUTO_TEST_SUITE(rpc_tests)
+
+static uint256 WorkMerkleRoot(const string& strData)
+{
+    vector<unsigned char> vch = ParseHex(strData);
+    SwapWords(vch);
+    uint256 hashMerkleRoot;
+    memcpy(&hashMerkleRoot, &vch[36], 32);
+    return hashMerkleRoot;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_getwork)
+{
+    // getwork wants a peer, a node that never connects will do
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(), true);
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.push_back(pnode);
+
+    // Same template, different extra nonces
+    string strData1 = find_value(getwork(Array(), false).get_obj(), "data").get_str();
+    string strData2 = find_value(getwork(Array(), false).get_obj(), "data").get_str();
+    BOOST_CHECK(WorkMerkleRoot(strData1) != WorkMerkleRoot(strData2));
+
+    // The older work is still good
+    int nHeight = nBestHeight;
+    Array params;
+    params.push_back(SolveWork(strData1));
+    BOOST_CHECK(getwork(params, false).get_bool());
+    BOOST_CHECK_EQUAL(nBestHeight, nHeight + 1);
+
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    delete pnode;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_getwork_old_template)
+{
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(), true);
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.push_back(pnode);
+
+    string strData1 = find_value(getwork(Array(), false).get_obj(), "data").get_str();
+
+    // The memory pool changed a while ago, the next work is from a new
+    // template built on the same best block
+    nTransactionsUpdated++;
+    SetMockTime(GetTime() + 61);
+    BOOST_CHECK(IsWorkTemplateStale());
+    string strData2 = find_value(getwork(Array(), false).get_obj(), "data").get_str();
+    BOOST_CHECK(!IsWorkTemplateStale());
+    BOOST_CHECK(WorkMerkleRoot(strData1) != WorkMerkleRoot(strData2));
+
+    // Work from the first template is rebuilt with its own extra nonce
+    int nHeight = nBestHeight;
+    Array params;
+    params.push_back(SolveWork(strData1));
+    BOOST_CHECK(getwork(params, false).get_bool());
+    BOOST_CHECK_EQUAL(nBestHeight, nHeight + 1);
+    SetMockTime(0);
+
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    delete pnode;
+}
+
+// A long poll (getwork on /LP) waits on IsNewWorkSince the template that
+// was current when it came in
+BOOST_AUTO_TEST_CASE(rpc_getwork_longpoll)
+{
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(), true);
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.push_back(pnode);
+
+    getwork(Array(), false);
+    unsigned int nTemplatesBuilt = GetWorkTemplatesBuilt();
+    BOOST_CHECK(!IsNewWorkSince(nTemplatesBuilt));
+    getwork(Array(), false);
+    BOOST_CHECK(!IsNewWorkSince(nTemplatesBuilt));
+
+    // A new block, and another caller rebuilds the template before the
+    // long poll looks.  The template isn't stale any more, but the poll
+    // still has to wake.
+    BOOST_REQUIRE(MineBlock());
+    BOOST_CHECK(IsNewWorkSince(nTemplatesBuilt));
+    getwork(Array(), false);
+    BOOST_CHECK(!IsWorkTemplateStale());
+    BOOST_CHECK(IsNewWorkSince(nTemplatesBuilt));
+
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    delete pnode;
+}
+
+// Block from a getblocktemplate result, paying coinbasevalue + nExtra to a
+// new key, solved
+static CBlock BlockFromTemplate(const Object& tmpl, int64 nExtra)
+{
+    CBlock block;
+    block.nVersion = find_value(tmpl, "version").get_int();
+    block.hashPrevBlock.SetHex(find_value(tmpl, "previousblockhash").get_str());
+    block.nBits = strtoul(find_value(tmpl, "bits").get_str().c_str(), NULL, 16);
+    block.nTime = find_value(tmpl, "curtime").get_int64();
+    block.nNonce = 0;
+
+    block.vtx.resize(1);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.vtx[0].vin[0].scriptSig = CScript() << block.nBits << CBigNum(find_value(tmpl, "height").get_int());
+    block.vtx[0].vout.resize(1);
+    block.vtx[0].vout[0].nValue = find_value(tmpl, "coinbasevalue").get_int64() + nExtra;
+    block.vtx[0].vout[0].scriptPubKey << GenerateNewKey() << OP_CHECKSIG;
+
+    foreach(const Value& entry, find_value(tmpl, "transactions").get_array())
+    {
+        CDataStream ssTx(ParseHex(find_value(entry.get_obj(), "data").get_str()), SER_NETWORK);
+        CTransaction tx;
+        ssTx >> tx;
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    SolveBlock(block);
+    return block;
+}
+
+// submitblock's error code, 0 if it returned
+static int SubmitBlockError(const CBlock& block)
+{
+    CDataStream ssBlock(SER_NETWORK);
+    ssBlock << block;
+    Array params;
+    params.push_back(HexStr(ssBlock.begin(), ssBlock.end()));
+    try
+    {
+        BOOST_CHECK(submitblock(params, false).get_bool());
+    }
+    catch (Object& objError)
+    {
+        return find_value(objError, "code").get_int();
+    }
+    return 0;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_getblocktemplate_submitblock)
+{
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(), true);
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.push_back(pnode);
+
+    // A memory pool transaction for the template to carry
+    BOOST_REQUIRE(MineBlock());
+    CBlockIndex* pindexCoinBase = pindexBest;
+    for (int i = 0; i < COINBASE_MATURITY; i++)
+        BOOST_REQUIRE(MineBlock());
+    CBlock blockCoinBase;
+    BOOST_REQUIRE(blockCoinBase.ReadFromDisk(pindexCoinBase));
+    CTransaction txPrev = blockCoinBase.vtx[0];
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = txPrev.vout[0].nValue - CENT;
+    tx.vout[0].scriptPubKey << GenerateNewKey() << OP_CHECKSIG;
+    BOOST_REQUIRE(SignSignature(txPrev, tx, 0));
+    BOOST_REQUIRE(tx.AcceptToMemoryPool());
+
+    // Assembled from the template it's the next block, fee included
+    Object tmpl = getblocktemplate(Array(), false).get_obj();
+    BOOST_CHECK_EQUAL(find_value(tmpl, "height").get_int(), nBestHeight + 1);
+    CBlock block = BlockFromTemplate(tmpl, 0);
+    bool fFound = false;
+    foreach(const CTransaction& txBlock, block.vtx)
+        fFound |= (txBlock.GetHash() == tx.GetHash());
+    BOOST_CHECK(fFound);
+    int nHeight = nBestHeight;
+    BOOST_CHECK_EQUAL(SubmitBlockError(block), 0);
+    BOOST_CHECK_EQUAL(nBestHeight, nHeight + 1);
+    BOOST_CHECK(hashBestChain == block.GetHash());
+
+    // Again it's stale
+    BOOST_CHECK_EQUAL(SubmitBlockError(block), -26);
+    BOOST_CHECK_EQUAL(nBestHeight, nHeight + 1);
+
+    // A coinbase claiming more than it may is rejected
+    tmpl = getblocktemplate(Array(), false).get_obj();
+    CBlock blockBad = BlockFromTemplate(tmpl, 1);
+    BOOST_CHECK_EQUAL(SubmitBlockError(blockBad), -25);
+    BOOST_CHECK_EQUAL(nBestHeight, nHeight + 1);
+    BOOST_CHECK(hashBestChain == block.GetHash());
+
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    delete pnode;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,215 @@
+//
+// Script evaluation, its numbers, and the signature cache behind OP_CHECKSIG
+//
+
+BOOST_AUTO_TEST_SUITE(script_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_split)
+{
+    // A bare OP_CHECKSIG output, the spender pushes both signature and pubkey
+    CKey key;
+    key.MakeNewKey();
+    CScript scriptPubKey;
+    scriptPubKey << OP_CHECKSIG;
+
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = Hash(scriptPubKey.begin(), scriptPubKey.end());
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(1);
+    tx.vout[0].nValue = COIN;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+
+    vector<unsigned char> vchSig;
+    BOOST_REQUIRE(key.Sign(SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL), vchSig));
+    vchSig.push_back(SIGHASH_ALL);
+    vector<unsigned char> vchPubKey = key.GetPubKey();
+    tx.vin[0].scriptSig << vchSig << vchPubKey;
+    BOOST_CHECK(VerifyScript(tx.vin[0].scriptSig, scriptPubKey, tx, 0, 0));
+
+    // The same bytes with one byte of the pubkey moved over to the signature.
+    // The sighash doesn't cover the scriptSig, so it is the same.
+    vector<unsigned char> vchBytes(vchSig.begin(), vchSig.end() - 1);
+    vchBytes.insert(vchBytes.end(), vchPubKey.begin(), vchPubKey.end());
+    unsigned int nSplit = vchSig.size();
+    vector<unsigned char> vchSig2(vchBytes.begin(), vchBytes.begin() + nSplit);
+    vchSig2.push_back(SIGHASH_ALL);
+    vector<unsigned char> vchPubKey2(vchBytes.begin() + nSplit, vchBytes.end());
+
+    CTransaction tx2(tx);
+    tx2.vin[0].scriptSig = CScript() << vchSig2 << vchPubKey2;
+    BOOST_CHECK(tx2.GetHash() != tx.GetHash());
+    BOOST_CHECK(SignatureHash(scriptPubKey, tx2, 0, SIGHASH_ALL) == SignatureHash(scriptPubKey, tx, 0, SIGHASH_ALL));
+
+    // It must miss the cache and fail, as it would on a node that never saw tx
+    uint64 nEntries, nHits, nMisses;
+    GetSigCacheStats(nEntries, nHits, nMisses);
+    BOOST_CHECK(!VerifyScript(tx2.vin[0].scriptSig, scriptPubKey, tx2, 0, 0));
+    uint64 nHits2;
+    GetSigCacheStats(nEntries, nHits2, nMisses);
+    BOOST_CHECK_EQUAL(nHits2, nHits);
+
+    // The original still hits
+    BOOST_CHECK(VerifyScript(tx.vin[0].scriptSig, scriptPubKey, tx, 0, 0));
+    GetSigCacheStats(nEntries, nHits2, nMisses);
+    BOOST_CHECK_EQUAL(nHits2, nHits + 1);
+}
+
+
+//
+// Numeric opcodes against the CBigNum arithmetic they replaced
+//
+
+// Operand as CastToBigNum read it, throws past 4 bytes like the original
+static CBigNum RefNum(const vector<unsigned char>& vch)
+{
+    if (vch.size() > 4)
+        throw runtime_error("RefNum() : overflow");
+    return CBigNum(CBigNum(vch).getvch());
+}
+
+// Result of the opcode the old way, false if it threw
+static bool RefUnary(opcodetype opcode, const vector<unsigned char>& vch, vector<unsigned char>& vchRet)
+{
+    CBigNum bn;
+    try { bn = RefNum(vch); } catch (...) { return false; }
+    switch (opcode)
+    {
+    case OP_1ADD:       bn += CBigNum(1); break;
+    case OP_1SUB:       bn -= CBigNum(1); break;
+    case OP_NEGATE:     bn = -bn; break;
+    case OP_ABS:        if (bn < CBigNum(0)) bn = -bn; break;
+    case OP_NOT:        bn = (bn == CBigNum(0)); break;
+    case OP_0NOTEQUAL:  bn = (bn != CBigNum(0)); break;
+    default:            BOOST_FAIL("RefUnary() : opcode");
+    }
+    vchRet = bn.getvch();
+    return true;
+}
+
+static bool RefBinary(opcodetype opcode, const vector<unsigned char>& vch1, const vector<unsigned char>& vch2, vector<unsigned char>& vchRet)
+{
+    CBigNum bn1, bn2, bn;
+    try { bn1 = RefNum(vch1); bn2 = RefNum(vch2); } catch (...) { return false; }
+    CBigNum bnZero(0);
+    switch (opcode)
+    {
+    case OP_ADD:                bn = bn1 + bn2; break;
+    case OP_SUB:                bn = bn1 - bn2; break;
+    case OP_BOOLAND:            bn = (bn1 != bnZero && bn2 != bnZero); break;
+    case OP_BOOLOR:             bn = (bn1 != bnZero || bn2 != bnZero); break;
+    case OP_NUMEQUAL:           bn = (bn1 == bn2); break;
+    case OP_NUMNOTEQUAL:        bn = (bn1 != bn2); break;
+    case OP_LESSTHAN:           bn = (bn1 < bn2); break;
+    case OP_GREATERTHAN:        bn = (bn1 > bn2); break;
+    case OP_LESSTHANOREQUAL:    bn = (bn1 <= bn2); break;
+    case OP_GREATERTHANOREQUAL: bn = (bn1 >= bn2); break;
+    case OP_MIN:                bn = (bn1 < bn2 ? bn1 : bn2); break;
+    case OP_MAX:                bn = (bn1 > bn2 ? bn1 : bn2); break;
+    default:                    BOOST_FAIL("RefBinary() : opcode");
+    }
+    vchRet = bn.getvch();
+    return true;
+}
+
+static bool RunScript(const CScript& scriptSig, const CScript& scriptPubKey)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    return VerifyScript(scriptSig, scriptPubKey, tx, 0, 0);
+}
+
+// Zero, negative zero, non-minimal encodings, the 4 byte limit and past it
+static vector<vector<unsigned char> > NumOperands()
+{
+    const char* pszOperands[] =
+    {
+        "", "00", "80", "0080", "0000", "000080", "00000080",
+        "01", "81", "0100", "0180", "7f", "ff", "8000", "8080", "ff00",
+        "ffff", "ffff00", "ffff7f", "ffffff", "ffffff7f", "ffffffff", "00000001",
+        "0000000000", "0100000000", "ffffffff7f", "0000000080",
+    };
+    vector<vector<unsigned char> > vRet;
+    for (unsigned int i = 0; i < sizeof(pszOperands) / sizeof(pszOperands[0]); i++)
+        vRet.push_back(ParseHex(pszOperands[i]));
+    return vRet;
+}
+
+BOOST_AUTO_TEST_CASE(script_num_unary)
+{
+    opcodetype opcodes[] = { OP_1ADD, OP_1SUB, OP_NEGATE, OP_ABS, OP_NOT, OP_0NOTEQUAL };
+    vector<vector<unsigned char> > vOperands = NumOperands();
+    for (unsigned int i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++)
+    {
+        foreach(const vector<unsigned char>& vch, vOperands)
+        {
+            // Same bytes as the old result, and failing where it threw
+            vector<unsigned char> vchExpected;
+            bool fExpected = RefUnary(opcodes[i], vch, vchExpected);
+            CScript scriptSig;
+            scriptSig << vch;
+            CScript scriptPubKey;
+            scriptPubKey << opcodes[i] << vchExpected << OP_EQUAL;
+            BOOST_CHECK_MESSAGE(RunScript(scriptSig, scriptPubKey) == fExpected,
+                                strprintf("%s %s", GetOpName(opcodes[i]), HexStr(vch).c_str()));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(script_num_binary)
+{
+    opcodetype opcodes[] = { OP_ADD, OP_SUB, OP_BOOLAND, OP_BOOLOR, OP_NUMEQUAL, OP_NUMNOTEQUAL,
+                             OP_LESSTHAN, OP_GREATERTHAN, OP_LESSTHANOREQUAL, OP_GREATERTHANOREQUAL,
+                             OP_MIN, OP_MAX };
+    vector<vector<unsigned char> > vOperands = NumOperands();
+    for (unsigned int i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++)
+    {
+        foreach(const vector<unsigned char>& vch1, vOperands)
+        {
+            foreach(const vector<unsigned char>& vch2, vOperands)
+            {
+                vector<unsigned char> vchExpected;
+                bool fExpected = RefBinary(opcodes[i], vch1, vch2, vchExpected);
+                CScript scriptSig;
+                scriptSig << vch1 << vch2;
+                CScript scriptPubKey;
+                scriptPubKey << opcodes[i] << vchExpected << OP_EQUAL;
+                BOOST_CHECK_MESSAGE(RunScript(scriptSig, scriptPubKey) == fExpected,
+                                    strprintf("%s %s %s", GetOpName(opcodes[i]), HexStr(vch1).c_str(), HexStr(vch2).c_str()));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(script_num_overflow)
+{
+    // Sums past 4 bytes come out in 5, as CBigNum had them
+    vector<unsigned char> vchMax = ParseHex("ffffff7f");
+    vector<unsigned char> vchMin = ParseHex("ffffffff");
+    CScript scriptSig;
+    scriptSig << vchMax << vchMax;
+    BOOST_CHECK(RunScript(scriptSig, CScript() << OP_ADD << ParseHex("feffffff00") << OP_EQUAL));
+    scriptSig = CScript() << vchMin << vchMax;
+    BOOST_CHECK(RunScript(scriptSig, CScript() << OP_SUB << ParseHex("feffffff80") << OP_EQUAL));
+    scriptSig = CScript() << vchMax;
+    BOOST_CHECK(RunScript(scriptSig, CScript() << OP_1ADD << ParseHex("0000008000") << OP_EQUAL));
+
+    // and can still be compared, hashed and sized, but not used as a number
+    scriptSig = CScript() << vchMax << vchMax;
+    BOOST_CHECK(RunScript(scriptSig, CScript() << OP_ADD << OP_SIZE << 5 << OP_EQUALVERIFY << OP_HASH160 << OP_SIZE << 20 << OP_EQUAL));
+    BOOST_CHECK(!RunScript(scriptSig, CScript() << OP_ADD << OP_1SUB << vchMax << OP_EQUAL));
+    BOOST_CHECK(!RunScript(scriptSig, CScript() << OP_ADD << OP_0 << OP_ADD << OP_DROP << OP_1));
+    BOOST_CHECK(!RunScript(scriptSig, CScript() << OP_ADD << OP_NOT));
+
+    // Negative zero is false to the numeric ops as well as to IF
+    scriptSig = CScript() << ParseHex("80");
+    BOOST_CHECK(RunScript(scriptSig, CScript() << OP_NOT));
+    BOOST_CHECK(!RunScript(scriptSig, CScript() << OP_1 << OP_BOOLAND));
+    BOOST_CHECK(RunScript(scriptSig, CScript() << OP_1 << OP_BOOLOR));
+    BOOST_CHECK(RunScript(scriptSig, CScript() << OP_0 << OP_NUMEQUAL));
+    BOOST_CHECK(RunScript(scriptSig, CScript() << OP_NOT << OP_1 << OP_EQUAL));
+    BOOST_CHECK(!RunScript(scriptSig, CScript() << OP_IF << OP_1 << OP_ELSE << OP_0 << OP_ENDIF));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
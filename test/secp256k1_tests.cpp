@@ -0,0 +1,147 @@
+//
+// secp256k1.cpp against OpenSSL on random keys, hashes and signatures,
+// valid and damaged.  Whatever secp256k1.cpp decides must match OpenSSL.
+//
+#ifdef USE_SECP256K1
+
+BOOST_AUTO_TEST_SUITE(secp256k1_tests)
+
+static int OpenSSLVerify(const vector<unsigned char>& vchPubKey, const uint256& hash, const vector<unsigned char>& vchSig)
+{
+    EC_KEY* pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    const unsigned char* pbegin = &vchPubKey[0];
+    if (!o2i_ECPublicKey(&pkey, &pbegin, vchPubKey.size()))
+    {
+        EC_KEY_free(pkey);
+        return -1;
+    }
+    int nRet = ECDSA_verify(0, (unsigned char*)&hash, sizeof(hash), &vchSig[0], vchSig.size(), pkey);
+    EC_KEY_free(pkey);
+    return (nRet == 1 ? 1 : 0);
+}
+
+static vector<unsigned char> CompressPubKey(const vector<unsigned char>& vchPubKey)
+{
+    EC_KEY* pkey = EC_KEY_new_by_curve_name(NID_secp256k1);
+    const unsigned char* pbegin = &vchPubKey[0];
+    BOOST_REQUIRE(o2i_ECPublicKey(&pkey, &pbegin, vchPubKey.size()));
+    EC_KEY_set_conv_form(pkey, POINT_CONVERSION_COMPRESSED);
+    vector<unsigned char> vchRet(i2o_ECPublicKey(pkey, NULL), 0);
+    unsigned char* pch = &vchRet[0];
+    i2o_ECPublicKey(pkey, &pch);
+    EC_KEY_free(pkey);
+    return vchRet;
+}
+
+// Minimal DER INTEGER of a big endian number
+static vector<unsigned char> DERInteger(vector<unsigned char> vch)
+{
+    while (vch.size() > 1 && vch[0] == 0 && !(vch[1] & 0x80))
+        vch.erase(vch.begin());
+    if (vch[0] & 0x80)
+        vch.insert(vch.begin(), 0);
+    vch.insert(vch.begin(), vch.size());
+    vch.insert(vch.begin(), 0x02);
+    return vch;
+}
+
+static vector<unsigned char> RandomSignature()
+{
+    vector<unsigned char> r(32), s(32);
+    RAND_bytes(&r[0], 32);
+    RAND_bytes(&s[0], 32);
+    if (GetRand(4) == 0)
+        memset(&r[0], 0xff, 8);  // at or above the group order
+    if (GetRand(4) == 0)
+        memset(&s[0], 0, 31);    // short encoding
+    r = DERInteger(r);
+    s = DERInteger(s);
+    vector<unsigned char> vchSig;
+    vchSig.push_back(0x30);
+    vchSig.push_back(r.size() + s.size());
+    vchSig.insert(vchSig.end(), r.begin(), r.end());
+    vchSig.insert(vchSig.end(), s.begin(), s.end());
+    return vchSig;
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_openssl_crosscheck)
+{
+    int nNative = 0;
+    for (int n = 0; n < 400; n++)
+    {
+        CKey key;
+        key.MakeNewKey();
+        vector<unsigned char> vchPubKey = key.GetPubKey();
+        if (n % 2)
+            vchPubKey = CompressPubKey(vchPubKey);
+
+        uint256 hash;
+        RAND_bytes((unsigned char*)&hash, sizeof(hash));
+        if (n % 7 == 0)
+            hash = 0;
+        if (n % 11 == 0)
+            memset(&hash, 0xff, sizeof(hash));  // above the group order
+        vector<unsigned char> vchSigGood;
+        BOOST_REQUIRE(key.Sign(hash, vchSigGood));
+
+        for (int nCase = 0; nCase < 5; nCase++)
+        {
+            vector<unsigned char> vchSig = vchSigGood;
+            uint256 hashCheck = hash;
+            if (nCase == 1)
+                hashCheck ^= uint256(1) << GetRand(256);
+            else if (nCase == 2)
+                vchSig[GetRand(vchSig.size())] ^= 1 << GetRand(8);
+            else if (nCase == 3)
+                vchSig = RandomSignature();
+            else if (nCase == 4)
+                vchSig.push_back(0);
+
+            int nOpenSSL = OpenSSLVerify(vchPubKey, hashCheck, vchSig);
+            int nRet = Secp256k1Verify(vchPubKey, hashCheck, vchSig);
+            if (nCase == 0)
+                BOOST_CHECK_EQUAL(nRet, 1);
+            if (nRet >= 0)
+            {
+                nNative++;
+                BOOST_CHECK_EQUAL(nRet, nOpenSSL);
+            }
+
+            CKey keyCheck;
+            BOOST_REQUIRE(keyCheck.SetPubKey(vchPubKey));
+            BOOST_CHECK_EQUAL(keyCheck.Verify(hashCheck, vchSig), nOpenSSL == 1);
+        }
+    }
+
+    // Most cases must be decided natively, not all passed to OpenSSL
+    BOOST_CHECK(nNative > 400 * 3);
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_cached_pubkey)
+{
+    CKey key;
+    key.MakeNewKey();
+    uint256 hash = 12345;
+    vector<unsigned char> vchSig;
+    BOOST_REQUIRE(key.Sign(hash, vchSig));
+
+    // The decoded pubkey follows the key through copies and SetPrivKey
+    CKey keyCopy(key);
+    BOOST_CHECK(keyCopy.Verify(hash, vchSig));
+    CKey keyAssigned;
+    keyAssigned = key;
+    BOOST_CHECK(keyAssigned.Verify(hash, vchSig));
+    CKey keyPriv;
+    BOOST_REQUIRE(keyPriv.SetPrivKey(key.GetPrivKey()));
+    BOOST_CHECK(keyPriv.Verify(hash, vchSig));
+
+    CKey keyOther;
+    keyOther.MakeNewKey();
+    BOOST_CHECK(!keyOther.Verify(hash, vchSig));
+    keyOther = key;
+    BOOST_CHECK(keyOther.Verify(hash, vchSig));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
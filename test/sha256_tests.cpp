@@ -0,0 +1,51 @@
+//
+// SHA256D64 against Hash() on each message, for every count up to a few
+// full passes of the widest kernel, so full, partial and single message
+// runs all get checked on whatever this CPU picks.  Every mining kernel
+// this CPU can run against the genesis block, as SelectScanHash checks
+// them at startup.
+//
+#ifdef FOURWAYSSE2
+
+BOOST_AUTO_TEST_SUITE(sha256_tests)
+
+BOOST_AUTO_TEST_CASE(sha256d64_matches_hash)
+{
+    vector<unsigned char> vchIn(64 * 20);
+    RAND_bytes(&vchIn[0], vchIn.size());
+    for (unsigned int nBlocks = 0; nBlocks <= 20; nBlocks++)
+    {
+        // One more than asked for, it has to stay untouched
+        vector<uint256> vOut(nBlocks + 1);
+        SHA256D64((unsigned char*)&vOut[0], &vchIn[0], nBlocks);
+        for (unsigned int i = 0; i < nBlocks; i++)
+            BOOST_CHECK_MESSAGE(vOut[i] == Hash(&vchIn[64 * i], &vchIn[64 * i] + 64),
+                                strprintf("nBlocks=%u i=%u", nBlocks, i));
+        BOOST_CHECK(vOut[nBlocks] == 0);
+    }
+}
+
+// Finds a nonce, just not the right one
+static unsigned int ScanHash_Broken(char* pmidstate, char* pdata, char* phash1, char* phash, unsigned int& nHashesDone)
+{
+    return ++*(unsigned int*)(pdata + 12);
+}
+
+BOOST_AUTO_TEST_CASE(scanhash_kernels)
+{
+    BOOST_CHECK(TestScanHash(ScanHash_CryptoPP));
+    if (Detect128BitSSE2())
+    {
+        BOOST_CHECK(TestScanHash(ScanHash_4WaySSE2Ref));
+        BOOST_CHECK(TestScanHash(ScanHash_4WaySSE2));
+    }
+    if (DetectAVX2())
+        BOOST_CHECK(TestScanHash(ScanHash_8WayAVX2));
+    if (DetectSHANI())
+        BOOST_CHECK(TestScanHash(ScanHash_SHANI));
+    BOOST_CHECK(!TestScanHash(ScanHash_Broken));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+#endif
@@ -0,0 +1,98 @@
+//
+// SignatureHash, with and without a CSignatureHashCache, against the
+// copy-and-serialize version it replaced, for every hash type on every
+// input of a transaction with more inputs than outputs
+//
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+// SignatureHash as it was: blank a copy of the transaction and serialize it
+static uint256 SignatureHashCopy(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType)
+{
+    if (nIn >= txTo.vin.size())
+        return 1;
+    CTransaction txTmp(txTo);
+
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+        txTmp.vin[i].scriptSig = CScript();
+    txTmp.vin[nIn].scriptSig = scriptCode;
+
+    if ((nHashType & 0x1f) == SIGHASH_NONE)
+    {
+        txTmp.vout.clear();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+    else if ((nHashType & 0x1f) == SIGHASH_SINGLE)
+    {
+        unsigned int nOut = nIn;
+        if (nOut >= txTmp.vout.size())
+            return 1;
+        txTmp.vout.resize(nOut+1);
+        for (unsigned int i = 0; i < nOut; i++)
+            txTmp.vout[i].SetNull();
+        for (unsigned int i = 0; i < txTmp.vin.size(); i++)
+            if (i != nIn)
+                txTmp.vin[i].nSequence = 0;
+    }
+
+    if (nHashType & SIGHASH_ANYONECANPAY)
+    {
+        txTmp.vin[0] = txTmp.vin[nIn];
+        txTmp.vin.resize(1);
+    }
+
+    CDataStream ss(SER_GETHASH);
+    ss.reserve(10000);
+    ss << txTmp << nHashType;
+    return Hash(ss.begin(), ss.end());
+}
+
+BOOST_AUTO_TEST_CASE(sighash_matches_copy)
+{
+    CTransaction tx;
+    tx.nVersion = 1;
+    tx.nLockTime = 12345;
+    tx.vin.resize(5);
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        tx.vin[i].prevout.hash = Hash(BEGIN(i), END(i));
+        tx.vin[i].prevout.n = i * 3;
+        tx.vin[i].scriptSig << vector<unsigned char>(i * 30 + 1, 0x42);
+        tx.vin[i].nSequence = i * 1000;
+    }
+    // Fewer outputs than inputs, so SIGHASH_SINGLE runs out of them
+    tx.vout.resize(3);
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        tx.vout[i].nValue = (i + 1) * CENT;
+        tx.vout[i].scriptPubKey << OP_DUP << OP_HASH160 << Hash160(vector<unsigned char>(1, i)) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    CSignatureHashCache cache(tx);
+
+    // The code separator is dropped by both
+    CScript scriptCode;
+    scriptCode << OP_DUP << OP_CODESEPARATOR << OP_HASH160 << Hash160(vector<unsigned char>(20, 7)) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+    int nHashTypes[] = { 0, SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE, 4, 0x1f, 0x41 };
+    for (unsigned int nIn = 0; nIn <= tx.vin.size(); nIn++)
+    {
+        for (unsigned int i = 0; i < sizeof(nHashTypes) / sizeof(nHashTypes[0]); i++)
+        {
+            for (int nAnyoneCanPay = 0; nAnyoneCanPay <= SIGHASH_ANYONECANPAY; nAnyoneCanPay += SIGHASH_ANYONECANPAY)
+            {
+                int nHashType = nHashTypes[i] | nAnyoneCanPay;
+                uint256 hashCopy = SignatureHashCopy(scriptCode, tx, nIn, nHashType);
+                BOOST_CHECK_MESSAGE(SignatureHash(scriptCode, tx, nIn, nHashType) == hashCopy,
+                                    strprintf("nIn=%u nHashType=0x%x", nIn, nHashType));
+                BOOST_CHECK_MESSAGE(SignatureHash(scriptCode, tx, nIn, nHashType, &cache) == hashCopy,
+                                    strprintf("nIn=%u nHashType=0x%x, cached", nIn, nHashType));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,198 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Distributed under the MIT/X11 software license, see the accompanying
+// file license.txt or http://www.opensource.org/licenses/mit-license.php.
+
+//
+// Unit tests, make -f makefile.unix test_bitcoin && ./test_bitcoin
+//
+#define BOOST_TEST_MODULE Bitcoin Test Suite
+#include <boost/test/unit_test.hpp>
+
+#include "../headers.h"
+
+
+// Search nonces until the block meets its own target
+static void SolveBlock(CBlock& block)
+{
+    uint256 hashTarget = CBigNum().SetCompact(block.nBits).getuint256();
+    while (block.GetHash() > hashTarget)
+        block.nNonce++;
+}
+
+
+//
+// Hooks for a private test chain.  Everything goes to the standard hooks,
+// except there's no lock-in and the genesis block has the easiest target,
+// so a block takes a couple of hashes to mine.
+//
+class CTestHooks : public CHooks
+{
+public:
+    CHooks* pbase;
+    int nAuxPowStartHeight;
+    int nAuxPowChainID;
+
+    CTestHooks(CHooks* pbaseIn)
+    {
+        pbase = pbaseIn;
+        nAuxPowStartHeight = pbase->AuxPowStartHeight();
+        nAuxPowChainID = pbase->AuxPowChainID();
+    }
+
+    bool IsStandard(const CScript& scriptPubKey) { return pbase->IsStandard(scriptPubKey); }
+    void AddToWallet(CWalletTx& tx) { pbase->AddToWallet(tx); }
+    bool CheckTransaction(const CTransaction& tx) { return pbase->CheckTransaction(tx); }
+    bool ConnectInputs(CTxDB& txdb, const CTransaction& tx, vector<CTransaction>& vTxPrev, vector<CTxIndex>& vTxindex,
+                       CBlockIndex* pindexBlock, CDiskTxPos& txPos, bool fBlock, bool fMiner)
+    {
+        return pbase->ConnectInputs(txdb, tx, vTxPrev, vTxindex, pindexBlock, txPos, fBlock, fMiner);
+    }
+    bool IsHeightDependent(const CTransaction& tx) { return pbase->IsHeightDependent(tx); }
+    bool DisconnectInputs(CTxDB& txdb, const CTransaction& tx, CBlockIndex* pindexBlock)
+    {
+        return pbase->DisconnectInputs(txdb, tx, pindexBlock);
+    }
+    bool ConnectBlock(CBlock& block, CTxDB& txdb, CBlockIndex* pindex) { return pbase->ConnectBlock(block, txdb, pindex); }
+    bool DisconnectBlock(CBlock& block, CTxDB& txdb, CBlockIndex* pindex) { return pbase->DisconnectBlock(block, txdb, pindex); }
+    bool ExtractAddress(const CScript& script, string& address) { return pbase->ExtractAddress(script, address); }
+    bool Lockin(int nHeight, uint256 hash) { return true; }
+    int LockinHeight() { return 0; }
+    string IrcPrefix() { return pbase->IrcPrefix(); }
+    int AuxPowStartHeight() { return nAuxPowStartHeight; }
+    int AuxPowChainID() { return nAuxPowChainID; }
+    void MessageStart(char* pchMessageStart) { pbase->MessageStart(pchMessageStart); }
+
+    bool GenesisBlock(CBlock& block)
+    {
+        block.nTime = GetAdjustedTime();
+        block.nBits = bnProofOfWorkLimit.GetCompact();
+        block.nNonce = 0;
+        SolveBlock(block);
+        hashGenesisBlock = block.GetHash();
+        return true;
+    }
+};
+
+static CTestHooks* ptesthooks = NULL;
+
+
+//
+// Every test runs on one chain and wallet in a temporary data directory
+//
+struct CTestingSetup
+{
+    boost::filesystem::path pathTemp;
+
+    CTestingSetup()
+    {
+        pathTemp = boost::filesystem::temp_directory_path() / strprintf("test_bitcoin_%"PRI64d"_%d", GetTime(), (int)GetRand(100000));
+        boost::filesystem::create_directories(pathTemp);
+        strlcpy(pszSetDataDir, pathTemp.string().c_str(), sizeof(pszSetDataDir));
+
+        ptesthooks = new CTestHooks(InitHook());
+        hooks = ptesthooks;
+        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 1);
+        bool fFirstRun;
+        if (!LoadAddresses() || !LoadBlockIndex() || !LoadWallet(fFirstRun))
+            throw runtime_error("CTestingSetup() : loading the test chain failed");
+    }
+
+    ~CTestingSetup()
+    {
+        fShutdown = true;
+        DBFlush(true);
+        boost::filesystem::remove_all(pathTemp);
+    }
+};
+
+BOOST_GLOBAL_FIXTURE(CTestingSetup);
+
+
+// Mine a block on the best chain with the memory pool's transactions
+static bool MineBlock(uint256* phashRet=NULL)
+{
+    CReserveKey reservekey;
+    auto_ptr<CBlock> pblock(CreateNewBlock(reservekey));
+    if (!pblock.get())
+        return false;
+    static unsigned int nExtraNonce;
+    pblock->vtx[0].vin[0].scriptSig = CScript() << pblock->nBits << CBigNum(++nExtraNonce);
+    pblock->vtx[0].InvalidateHash();
+    pblock->hashMerkleRoot = pblock->BuildMerkleTree();
+    SolveBlock(*pblock);
+    if (!ProcessBlock(NULL, pblock.get()))
+        return false;
+    reservekey.KeepKey();
+    if (phashRet)
+        *phashRet = pblock->GetHash();
+    return true;
+}
+
+// Block on top of pindexPrev holding vtx, which needn't be in the pool
+static CBlock BuildBlock(CBlockIndex* pindexPrev, const vector<CTransaction>& vtx)
+{
+    static unsigned int nExtraNonce;
+    CBlock block;
+    block.vtx.resize(1);
+    block.vtx[0].vin.resize(1);
+    block.vtx[0].vin[0].prevout.SetNull();
+    block.vtx[0].vin[0].scriptSig = CScript() << pindexPrev->nBits << CBigNum(++nExtraNonce) << 0;
+    block.vtx[0].vout.resize(1);
+    block.vtx[0].vout[0].nValue = CENT;
+    block.vtx[0].vout[0].scriptPubKey << GenerateNewKey() << OP_CHECKSIG;
+    block.vtx.insert(block.vtx.end(), vtx.begin(), vtx.end());
+    block.hashPrevBlock = pindexPrev->GetBlockHash();
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    block.nTime = max(pindexPrev->GetMedianTimePast()+1, GetAdjustedTime());
+    block.nBits = pindexPrev->nBits;
+    block.nNonce = 0;
+    SolveBlock(block);
+    return block;
+}
+
+// getwork data is the header with each 4 byte word byte swapped
+static void SwapWords(vector<unsigned char>& vch)
+{
+    for (unsigned int i = 0; i + 4 <= vch.size(); i += 4)
+        reverse(vch.begin() + i, vch.begin() + i + 4);
+}
+
+// Search nonces the way an external miner would, return the data to submit
+static string SolveWork(const string& strData)
+{
+    vector<unsigned char> vch = ParseHex(strData);
+    BOOST_REQUIRE_EQUAL(vch.size(), 128U);
+    SwapWords(vch);
+    CBlock block;
+    memcpy(&block.nVersion, &vch[0], 4);
+    memcpy(&block.hashPrevBlock, &vch[4], 32);
+    memcpy(&block.hashMerkleRoot, &vch[36], 32);
+    memcpy(&block.nTime, &vch[68], 4);
+    memcpy(&block.nBits, &vch[72], 4);
+    memcpy(&block.nNonce, &vch[76], 4);
+    SolveBlock(block);
+    memcpy(&vch[76], &block.nNonce, 4);
+    SwapWords(vch);
+    return HexStr(vch.begin(), vch.end());
+}
+
+
+#include "secp256k1_tests.cpp"
+#include "sighash_tests.cpp"
+#include "script_tests.cpp"
+#include "hashcache_tests.cpp"
+#include "hashmap_tests.cpp"
+#include "sha256_tests.cpp"
+#include "miner_tests.cpp"
+#include "mempool_tests.cpp"
+#include "prevoutcache_tests.cpp"
+#include "rpc_tests.cpp"
+#include "workserver_tests.cpp"
+#include "auxpow_tests.cpp"
+
+
+// Symbols from init.cpp, which isn't linked in
+void Shutdown(void* parg)
+{
+    exit(0);
+}
@@ -0,0 +1,154 @@
+//
+// Work server: a miner authorizes and subscribes on one connection, is
+// pushed new work when the best block changes, and submits a solution
+//
+#include "../json/json_spirit_reader_template.h"
+#include "../json/json_spirit_writer_template.h"
+#include "../json/json_spirit_utils.h"
+
+using namespace json_spirit;
+
+void ThreadWorkServer(void* parg);
+
+BOOST_AUTO_TEST_SUITE(workserver_tests)
+
+static SOCKET WorkConnect(unsigned short nPort)
+{
+    struct sockaddr_in sockaddr;
+    memset(&sockaddr, 0, sizeof(sockaddr));
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sockaddr.sin_port = htons(nPort);
+
+    // The server thread may not be listening yet
+    for (int i = 0; i < 100; i++)
+    {
+        SOCKET hSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (hSocket == INVALID_SOCKET)
+            return INVALID_SOCKET;
+        if (connect(hSocket, (struct sockaddr*)&sockaddr, sizeof(sockaddr)) != SOCKET_ERROR)
+            return hSocket;
+        closesocket(hSocket);
+        Sleep(50);
+    }
+    return INVALID_SOCKET;
+}
+
+static void WorkSend(SOCKET hSocket, const string& strMethod, const Array& params, int nID)
+{
+    Object request;
+    request.push_back(Pair("id", nID));
+    request.push_back(Pair("method", strMethod));
+    request.push_back(Pair("params", params));
+    string strRequest = write_string(Value(request), false) + "\n";
+    BOOST_REQUIRE_EQUAL((int)send(hSocket, strRequest.data(), strRequest.size(), MSG_NOSIGNAL), (int)strRequest.size());
+}
+
+// Next line from the server, waits up to 10 seconds
+static Object WorkRead(SOCKET hSocket, string& strRecv)
+{
+    int64 nStart = GetTimeMillis();
+    string::size_type nEnd;
+    while ((nEnd = strRecv.find('\n')) == string::npos)
+    {
+        BOOST_REQUIRE(GetTimeMillis() - nStart < 10000);
+        struct timeval timeout;
+        timeout.tv_sec  = 0;
+        timeout.tv_usec = 100000;
+        fd_set fdsetRecv;
+        FD_ZERO(&fdsetRecv);
+        FD_SET(hSocket, &fdsetRecv);
+        if (select(hSocket + 1, &fdsetRecv, NULL, NULL, &timeout) <= 0)
+            continue;
+        char pchBuf[0x10000];
+        int nBytes = recv(hSocket, pchBuf, sizeof(pchBuf), 0);
+        BOOST_REQUIRE(nBytes > 0);
+        strRecv.append(pchBuf, nBytes);
+    }
+    string strLine = strRecv.substr(0, nEnd);
+    strRecv.erase(0, nEnd + 1);
+    Value valLine;
+    BOOST_REQUIRE(read_string(strLine, valLine) && valLine.type() == obj_type);
+    return valLine.get_obj();
+}
+
+// Skips notifies until the reply to request nID
+static Value WorkReply(SOCKET hSocket, string& strRecv, int nID)
+{
+    for (;;)
+    {
+        Object reply = WorkRead(hSocket, strRecv);
+        if (find_value(reply, "id").type() == null_type)
+            continue;
+        BOOST_REQUIRE_EQUAL(find_value(reply, "id").get_int(), nID);
+        return find_value(reply, "result");
+    }
+}
+
+BOOST_AUTO_TEST_CASE(workserver_subscribe_submit)
+{
+    // Work wants a peer, a node that never connects will do
+    CNode* pnode = new CNode(INVALID_SOCKET, CAddress(), true);
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.push_back(pnode);
+
+    unsigned short nPort = 20000 + GetRandInt(10000);
+    mapArgs["-rpcuser"] = "user";
+    mapArgs["-rpcpassword"] = "password";
+    mapArgs["-workport"] = strprintf("%d", nPort);
+    CreateThread(ThreadWorkServer, NULL);
+
+    SOCKET hSocket = WorkConnect(nPort);
+    BOOST_REQUIRE(hSocket != INVALID_SOCKET);
+    string strRecv;
+
+    // Nothing but authorize before authorizing
+    WorkSend(hSocket, "subscribe", Array(), 1);
+    Object reply = WorkRead(hSocket, strRecv);
+    BOOST_CHECK(find_value(reply, "result").type() == null_type);
+    BOOST_CHECK(find_value(reply, "error").type() == obj_type);
+
+    Array params;
+    params.push_back("user");
+    params.push_back("password");
+    WorkSend(hSocket, "authorize", params, 2);
+    BOOST_CHECK(WorkReply(hSocket, strRecv, 2).get_bool());
+
+    WorkSend(hSocket, "subscribe", Array(), 3);
+    Value work = WorkReply(hSocket, strRecv, 3);
+    BOOST_REQUIRE(work.type() == obj_type);
+    BOOST_CHECK_EQUAL(find_value(work.get_obj(), "data").get_str().size(), 256U);
+
+    // A new best block is pushed as new work
+    CRITICAL_BLOCK(cs_main)
+        BOOST_REQUIRE(MineBlock());
+    Object notify;
+    do
+        notify = WorkRead(hSocket, strRecv);
+    while (find_value(notify, "method").type() != str_type ||
+           find_value(notify, "params").get_array().size() != 2 ||
+           !find_value(notify, "params").get_array()[1].get_bool());
+    BOOST_CHECK_EQUAL(find_value(notify, "method").get_str(), "notify");
+    string strData = find_value(find_value(notify, "params").get_array()[0].get_obj(), "data").get_str();
+
+    // Its solution becomes the next block, the stale one from before doesn't
+    int nHeight = nBestHeight;
+    params.clear();
+    params.push_back(SolveWork(strData));
+    WorkSend(hSocket, "submit", params, 4);
+    BOOST_CHECK(WorkReply(hSocket, strRecv, 4).get_bool());
+    BOOST_CHECK_EQUAL(nBestHeight, nHeight + 1);
+
+    params.clear();
+    params.push_back(SolveWork(find_value(work.get_obj(), "data").get_str()));
+    WorkSend(hSocket, "submit", params, 5);
+    BOOST_CHECK(!WorkReply(hSocket, strRecv, 5).get_bool());
+    BOOST_CHECK_EQUAL(nBestHeight, nHeight + 1);
+
+    closesocket(hSocket);
+    CRITICAL_BLOCK(cs_vNodes)
+        vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
+    delete pnode;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -182,6 +182,7 @@ void ShrinkDebugFile();
 int GetRandInt(int nMax);
 uint64 GetRand(uint64 nMax);
 int64 GetTime();
+void SetMockTime(int64 nMockTimeIn);
 int64 GetAdjustedTime();
 void AddTimeData(unsigned int ip, int64 nTime);
 
@@ -531,16 +532,66 @@ inline uint256 Hash(const T1 p1begin, const T1 p1end,
     return hash2;
 }
 
+#ifdef FOURWAYSSE2
+// Double SHA-256 of nBlocks 64 byte messages at once, in sha256d64.cpp
+void SHA256D64(unsigned char* pout, const unsigned char* pin, unsigned int nBlocks);
+#endif
+
+//
+// Stream that feeds serialized data straight into SHA-256, so hashing an
+// object doesn't need a buffer to serialize it into first.  GetHash()
+// gives the same double SHA-256 as Hash() over the serialized bytes.
+//
+class CHashWriter
+{
+public:
+    SHA256_CTX ctx;
+    int nType;
+    int nVersion;
+
+    CHashWriter(int nTypeIn, int nVersionIn)
+    {
+        SHA256_Init(&ctx);
+        nType = nTypeIn;
+        nVersion = nVersionIn;
+    }
+
+    CHashWriter(const SHA256_CTX& ctxIn, int nTypeIn, int nVersionIn)
+    {
+        ctx = ctxIn;
+        nType = nTypeIn;
+        nVersion = nVersionIn;
+    }
+
+    CHashWriter& write(const char* pch, int nSize)
+    {
+        SHA256_Update(&ctx, pch, nSize);
+        return (*this);
+    }
+
+    template<typename T>
+    CHashWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+    uint256 GetHash()
+    {
+        uint256 hash1;
+        SHA256_Final((unsigned char*)&hash1, &ctx);
+        uint256 hash2;
+        SHA256((unsigned char*)&hash1, sizeof(hash1), (unsigned char*)&hash2);
+        return hash2;
+    }
+};
+
 template<typename T>
 uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=VERSION)
 {
-    // Most of the time is spent allocating and deallocating CDataStream's
-    // buffer.  If this ever needs to be optimized further, make a CStaticStream
-    // class with its buffer on the stack.
-    CDataStream ss(nType, nVersion);
-    ss.reserve(10000);
+    CHashWriter ss(nType, nVersion);
     ss << obj;
-    return Hash(ss.begin(), ss.end());
+    return ss.GetHash();
 }
 
 inline uint160 Hash160(const vector<unsigned char>& vch)